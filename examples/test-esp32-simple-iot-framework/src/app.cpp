@@ -11,6 +11,23 @@ const int        event_timeout_duration = 10*60;
 
 RTC_NOINIT_ATTR int transmit_count;
 
+#ifdef CONFIG_IOT_EVENT_CAPTURE
+  // A short pulse may be over by the time the state machine looks at the
+  // input: the captured rising edge is kept until then.
+  RTC_NOINIT_ATTR bool rising_edge;
+
+  static void event_handler(const EventCapture::Event & event, uint32_t latency_us)
+  {
+    if (event.level == 1) rising_edge = true;
+  }
+#elif defined(CONFIG_IOT_RUN_LOOP)
+  // Wake up the run loop on every input change.
+  static void gpio_isr(void * arg)
+  {
+    iot.notify_from_isr(IoT::APP_EVENT);
+  }
+#endif
+
 static IoT::UserResult iot_handler(IoT::State state)
 {
   IoT::UserResult result = IoT::UserResult::COMPLETED;
@@ -19,6 +36,11 @@ static IoT::UserResult iot_handler(IoT::State state)
 
   switch (state) {
     case IoT::State::STARTUP: {
+      #ifdef CONFIG_IOT_EVENT_CAPTURE
+        // The interrupt also wakes up the run loop, and the pin the device.
+        rising_edge = false;
+        event_capture.add_pin(gpio);
+      #else
         gpio_config_t io_conf = {};
         
         io_conf.mode         = GPIO_MODE_INPUT;
@@ -26,13 +48,30 @@ static IoT::UserResult iot_handler(IoT::State state)
         io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
         io_conf.pull_up_en   = GPIO_PULLUP_DISABLE;
 
+        #ifdef CONFIG_IOT_RUN_LOOP
+          io_conf.intr_type  = GPIO_INTR_ANYEDGE;
+        #endif
+
         gpio_config(&io_conf);
 
+        #ifdef CONFIG_IOT_RUN_LOOP
+          gpio_install_isr_service(0);
+          gpio_isr_handler_add(gpio, gpio_isr, nullptr);
+        #endif
+      #endif
+
         result = IoT::UserResult::COMPLETED;
       }
       break;
 
     case IoT::State::WAIT_FOR_EVENT:
+      #ifdef CONFIG_IOT_EVENT_CAPTURE
+        if (rising_edge) {
+          rising_edge = false;
+          result = IoT::UserResult::NEW_EVENT;
+          break;
+        }
+      #endif
       if (gpio_get_level(gpio) == 1) {
         result = IoT::UserResult::NEW_EVENT;
       }
@@ -78,7 +117,12 @@ static IoT::UserResult iot_handler(IoT::State state)
       break;
   }
 
-  esp_sleep_enable_ext0_wakeup(gpio, level);
+  // With the event capture, the pin wake up is set by the framework.
+  #ifdef CONFIG_IOT_EVENT_CAPTURE
+    (void) level;
+  #else
+    esp_sleep_enable_ext0_wakeup(gpio, level);
+  #endif
 
   return result;
 }
@@ -95,6 +139,10 @@ esp_err_t App::init()
     return ESP_FAIL;
   }
 
+  #ifdef CONFIG_IOT_EVENT_CAPTURE
+    iot.set_event_handler(&event_handler);
+  #endif
+
   if (xTaskCreate(task, "main_task", 4*4096, nullptr, 5, &task_handle) != pdPASS) {
     ESP_LOGE(TAG, "Unable to create main_task.");
     return ESP_FAIL;
@@ -15,10 +15,14 @@ class Battery
 
     static constexpr const gpio_num_t     VOLTAGE_ENABLE = GPIO_NUM_17;
     static constexpr const adc1_channel_t ADC            = ADC1_CHANNEL_0;
+
+    double voltage_level;
     
   public:
     esp_err_t                   init();
     double        read_voltage_level();
+    esp_err_t                 sample();
+    inline double  get_voltage_level() { return voltage_level; }
     esp_err_t prepare_for_deep_sleep();
 };
 
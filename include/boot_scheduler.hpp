@@ -0,0 +1,46 @@
+#pragma once
+
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+/// Boot Sequence Scheduler
+///
+/// The initialization steps are declared with the event group bits they
+/// require and the bits they provide once completed. Every step runs in its
+/// own task, started as soon as its requirements are met, such that the
+/// independent steps (e.g. battery sampling, application sensor warm-up) run
+/// concurrently, on both cores, with the radio bring-up.
+///
+/// A failing step aborts the same way ESP_ERROR_CHECK() does. The caller
+/// waits on the provided bits, usually bounded by the wake deadline.
+
+class BootScheduler
+{
+  public:
+    typedef esp_err_t StepHandler();
+
+    struct Step {
+      const char  * name;
+      StepHandler * handler;
+      EventBits_t   requires;   ///< Bits to be set before the step is started
+      EventBits_t   provides;   ///< Bits set once the step is completed
+      BaseType_t    core;       ///< Core to run on, or tskNO_AFFINITY
+    };
+
+  private:
+    static constexpr char const * TAG = "Boot Scheduler";
+
+    static constexpr const uint32_t STACK_SIZE = 4096;
+
+    static EventGroupHandle_t events;
+
+    static void step_task(void * param);
+
+  public:
+    /// Start the **count** **steps**, completion being reported in **event_group**.
+    /// **steps** must remain valid until all steps are completed. Returns the
+    /// bits that will be set once all steps are completed through **all_bits**.
+    static esp_err_t start(EventGroupHandle_t event_group, const Step * steps, int count, EventBits_t & all_bits);
+};
@@ -5,10 +5,6 @@
 #include <esp_err.h>
 #include <esp_now.h>
 
-#if defined(CONFIG_IOT_ENABLE_UDP) && defined(CONFIG_IOT_ENABLE_ESP_NOW)
-  #error "You must define only one of CONFIG_IOT_ENABLE_UDP or CONFIG_IOT_ENABLE_ESP_NOW"
-#endif
-
 #if !defined(CONFIG_IOT_ENABLE_UDP) && !defined(CONFIG_IOT_ENABLE_ESP_NOW)
   #error "You must define one of CONFIG_IOT_ENABLE_UDP or CONFIG_IOT_ENABLE_ESP_NOW"
 #endif
@@ -16,6 +12,11 @@
 typedef uint8_t MacAddr[6];
 typedef char    MacAddrStr[18];
 
+// Number of bytes reserved in front of every payload given to a transport
+// send() method. The transport prepends its headers (CRC, ...) in this space,
+// such that the payload can be sent without being copied.
+constexpr const int FRAME_HEADROOM = 8;
+
 // Define the log level for all classes
 // One of (ESP_LOG_<suffix>: NONE, ERROR, WARN, INFO, DEBUG, VERBOSE
 //
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cinttypes>
+#include <esp_err.h>
+
+#include "spsc_ring.hpp"
+
+/// Downlink Commands
+///
+/// With CONFIG_IOT_DOWNLINK, the gateway can send commands to the device,
+/// through ESP-NOW (from a known gateway MAC address) or UDP (from the
+/// gateway address, to the port the device sends from). A command frame is
+/// laid out as an uplink frame, with a marker in front of the command:
+///
+///     +-----------+--------+------------------------+
+///     | crc (u16) | marker | command (1..247 bytes) |
+///     +-----------+--------+------------------------+
+///
+/// The CRC (esp_crc16_le(), little-endian) covers the marker and the command.
+/// The command content is application defined. Commands are not
+/// acknowledged: the gateway is expected to send them again until it sees
+/// their effect in the uplink messages.
+///
+/// A sleepy device can only be reached while awake: after an uplink, it keeps
+/// listening for CONFIG_IOT_DOWNLINK_WINDOW msec before going to deep sleep.
+///
+/// The receive callbacks validate the frames and queue the commands in a
+/// lock-free ring, drained by **IoT::process()** in the application task.
+
+constexpr const uint8_t DOWNLINK_MARKER      = 0xDC;
+constexpr const int     DOWNLINK_HEADER_SIZE = 3;    // crc + marker
+constexpr const int     DOWNLINK_MAX_SIZE    = 247;  // Fits an ESP-NOW frame (250 bytes)
+constexpr const int     DOWNLINK_FRAME_SIZE  = DOWNLINK_HEADER_SIZE + DOWNLINK_MAX_SIZE;
+constexpr const int     DOWNLINK_RING_SIZE   = 4;
+
+struct DownlinkCmd {
+  uint8_t len;
+  uint8_t data[DOWNLINK_MAX_SIZE];
+};
+
+typedef SPSCRing<DownlinkCmd, DOWNLINK_RING_SIZE> DownlinkRing;
+
+/// Application defined command handler, see **IoT::set_command_handler()**.
+typedef void DownlinkHandler(const uint8_t * cmd, int len);
+
+/// Returns true if **frame** is a valid frame (length, CRC) starting with
+/// **marker**. Also used for the OTA frames (see ota.hpp).
+extern bool downlink_check(const uint8_t * frame, int len, uint8_t marker);
+
+/// Producer side: validate a received **frame** and queue its command.
+/// Returns ESP_ERR_INVALID_SIZE or ESP_ERR_INVALID_CRC if the frame is not a
+/// valid command frame, ESP_ERR_NO_MEM if the ring is full.
+extern esp_err_t downlink_push(DownlinkRing & ring, const uint8_t * frame, int len);
+
+/// Consumer side: give every queued command to **handler** (dropped if
+/// nullptr). Returns the number of commands processed.
+extern int downlink_dispatch(DownlinkRing & ring, DownlinkHandler * handler);
@@ -8,34 +8,142 @@
 #include "global.hpp"
 #undef __ESP_NOW__
 
+#include <atomic>
 #include <freertos/FreeRTOS.h>
 #include <esp_now.h>
 
+#ifdef CONFIG_IOT_DOWNLINK
+  #include "downlink.hpp"
+#endif
+
+#ifdef CONFIG_IOT_ESPNOW_LINK_ADAPT
+  #include "link_adapt.hpp"
+#endif
+
+/// ESP-NOW Transport
+///
+/// Frames are sent asynchronously: up to CONFIG_IOT_ESPNOW_SEND_WINDOW frames
+/// can be waiting for their send callback at any time. ESP-NOW calls the send
+/// callback in the order the frames were sent, so the callback associates
+/// every result with the oldest outstanding frame of the window, identified
+/// by a frame sequence number. The caller only blocks when the window is full,
+/// or when **flush()** is called (before deep sleep).
+///
+/// Every outstanding frame is kept in its window slot, such that frames that
+/// were not received by the gateway can be put in the store-and-forward buffer.
+/// The caller can build a frame directly in the next free slot (see
+/// **get_send_buffer()**), in which case it is sent without any copy.
+///
+/// Gateway Peer Set
+///
+/// Up to NVSMgr::MAX_GATEWAYS gateways heard during discovery are kept, with
+/// an EWMA of their send success rate (updated by every send callback) and of
+/// their RSSI (updated by scans and probes). The table is kept in RTC memory
+/// and saved in NVS only when a gateway is found or the gateway in use
+/// changes. Frames are sent to the best ranked gateway. After
+/// CONFIG_IOT_ESPNOW_FAILOVER_THRESHOLD consecutive failures, the next best
+/// one is used, without any scan. Once all of them have failed in a row, a
+/// full discovery is done at the next wake up.
+///
+/// With CONFIG_IOT_ESPNOW_LINK_ADAPT, every gateway also has its own PHY rate
+/// and TX power, adapted to its send results (see link_adapt.hpp).
+///
+/// Downlink Commands
+///
+/// With CONFIG_IOT_DOWNLINK, the receive callback accepts command frames (see
+/// downlink.hpp) from the gateways of the peer set only, and queues them in
+/// a lock-free ring, the Wifi task being the single producer. Every queued
+/// command sets the IoT::DOWNLINK_READY bit. OTA frames are given to the Ota
+/// class (see ota.hpp).
+
 class ESPNow
 {
   public:
+    static constexpr const int WINDOW_SIZE = CONFIG_IOT_ESPNOW_SEND_WINDOW;
+
     struct SendEvent {
       esp_err_t status;
-      MacAddr mac_addr;
+      MacAddr   mac_addr;
+      uint32_t  seq;
     };
 
   private:
     static constexpr char const * TAG = "ESPNow Class";
+    static constexpr const int    SEND_TIMEOUT_MS  = 200;
+    static constexpr const int    MAX_CHANNEL      = 13;
+    static constexpr const int    SCAN_MAX_RECORDS = 16;
+    static constexpr const int    SCAN_SLICE_MS    = 20;  // Discovery scan slice, one probe request each
+    static constexpr const int    ACK_RATE_WEIGHT  = 8;   // EWMA alpha = 1/8
+    static constexpr const int    RSSI_WEIGHT      = 4;   // EWMA alpha = 1/4
+    static constexpr const int    RSSI_RANK_FACTOR = 2;   // 1 dB is worth 2/255 of success rate
+    static constexpr const int    RANK_HYSTERESIS  = 32;
+    static constexpr const int    SEARCH_BACKOFF   = 10;  // Seconds, gateway search backoff base
+
+    struct Frame {
+      uint32_t seq;
+      int      len;                                         // Payload length
+      uint8_t  data[FRAME_HEADROOM + ESP_NOW_MAX_DATA_LEN]; // Headroom + payload
+
+      inline uint8_t *   payload() { return &data[FRAME_HEADROOM]; }
+    };
 
-    static bool          abort;
-    static QueueHandle_t send_queue_handle;
-    static SendEvent     send_event;
+    static bool                  abort;
+    static QueueHandle_t         send_queue_handle;
+    static Frame                 window[WINDOW_SIZE];
+    static std::atomic<uint32_t> sent_count;     // Frames given to esp_now_send()
+    static std::atomic<uint32_t> callback_count; // Send callbacks received
+    static uint32_t              done_count;     // Send events processed
     static void send_handler(const uint8_t * mac_addr, esp_now_send_status_t status);
 
+    #ifdef CONFIG_IOT_DOWNLINK
+      static DownlinkRing downlink_ring;
+      static void recv_handler(const uint8_t * mac_addr, const uint8_t * data, int len);
+    #endif
+
     MacAddr ap_mac_addr;
+    uint8_t channel;
+
+    #ifdef CONFIG_IOT_ESPNOW_LINK_ADAPT
+      LinkAdapt link;
+    #endif
+
+    int             rank(const NVSMgr::Gateway & gw);
+    static int find_gateway(const uint8_t * mac_addr);
+    int     best_gateway(int exclude = -1);
+    void     add_gateway(const uint8_t * mac_addr, uint8_t ch, int8_t rssi);
+    esp_err_t use_gateway(int index, bool add_peer);
+    void  update_gateway(const uint8_t * mac_addr, bool success);
+    void   save_gateways(bool persist);
 
     esp_err_t search_ap();
+    int       get_scan_channels(uint8_t * channels);
+    esp_err_t scan_channel(uint8_t ch);
+    #ifdef CONFIG_IOT_ESPNOW_FAST_RECONNECT
+      esp_err_t probe_ap(const NVSMgr::Gateway & gw);
+    #endif
+    esp_err_t wait_send_event(TickType_t timeout);
+    esp_err_t  wait_free_slot();
+    void     resync_callbacks();
+    void           send_failed(Frame & frame);
 
   public:
     esp_err_t                          init();
-    esp_err_t                          send(const uint8_t * data, int len);
+    uint8_t *               get_send_buffer();
+    esp_err_t                          send(uint8_t * data, int len);
+    esp_err_t                         flush();
     QueueHandle_t     get_send_queue_handle() { return send_queue_handle; }
+    inline int              get_outstanding() { return sent_count - done_count; }
     void             prepare_for_deep_sleep();
+
+    #ifdef CONFIG_IOT_ESPNOW_LINK_ADAPT
+      inline const LinkAdapt::Counters & get_link_counters() { return link.get_counters(); }
+    #endif
+
+    #ifdef CONFIG_IOT_DOWNLINK
+      void             wait_downlink(int timeout_ms);
+      inline bool        has_command() { return !downlink_ring.is_empty(); }
+      inline int    process_commands(DownlinkHandler * handler) { return downlink_dispatch(downlink_ring, handler); }
+    #endif
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "config.hpp"
+
+#ifdef CONFIG_IOT_EVENT_CAPTURE
+
+#include <freertos/FreeRTOS.h>
+#include <driver/gpio.h>
+
+#include "spsc_ring.hpp"
+
+/// Interrupt Driven Event Capture
+///
+/// The edges of the input pins registered with **add_pin()** are captured by
+/// a GPIO interrupt, timestamped and queued in RTC memory: the events not yet
+/// delivered survive deep sleep. **process()** gives them, in order, to the
+/// application event handler (see IoT::set_event_handler()) before running
+/// the state machines.
+///
+/// Timestamps: the events are queued with the esp_timer time, converted to
+/// the system time when delivered. An event captured before the system time
+/// is set (SNTP) is delivered with the time set.
+///
+/// Debouncing: an edge is only queued if the pin level differs from the last
+/// level queued for that pin, and CONFIG_IOT_EVENT_DEBOUNCE msec after the
+/// previous edge queued for it. A level reached at the end of a bounce
+/// without any edge left is queued when the events are delivered.
+///
+/// Deep sleep: before going to sleep, the RTC capable pins at low level wake
+/// the device up when any of them goes high (ext1). A single RTC capable pin
+/// at high level wakes it up when it goes low (ext0, overriding any ext0
+/// wake up configured by the application). On wake up, the pins whose level
+/// changed during sleep are queued with the wake up time, that of the boot.
+/// The pull up or down of the pins is kept during sleep, the RTC peripherals
+/// being left powered on.
+///
+/// The delivery latency, from the capture time to the call of the handler,
+/// is accounted (see **get_stats()**). The pins and the queue are kept in RTC
+/// memory until the next reset: the pins are to be added once, after reset.
+
+class EventCapture
+{
+  public:
+    static constexpr const int MAX_PINS   = 8;
+    static constexpr const int QUEUE_SIZE = CONFIG_IOT_EVENT_QUEUE_SIZE;
+
+    struct Event {
+      int64_t time;       ///< Capture time, usec since the epoch (system time),
+                          ///< the esp_timer time while queued
+      uint8_t pin;
+      uint8_t level;      ///< Level after the edge
+      bool    wake_up;    ///< Captured on deep sleep wake up
+    };
+
+    struct Stats {        // Since the last reset
+      uint32_t count;     ///< Events delivered
+      uint32_t dropped;   ///< Events lost, the queue being full
+      uint32_t max_latency_us;
+      uint64_t total_latency_us;
+    };
+
+    /// Application defined event handler, called by **IoT::process()** in the
+    /// application task for every event captured, in order.
+    /// @param[in] event The event, valid during the call only.
+    /// @param[in] latency_us Time since its capture.
+    typedef void Handler(const Event & event, uint32_t latency_us);
+
+    struct PinState {
+      int8_t  pin;        // GPIO number
+      uint8_t level;      // Last level queued
+      uint8_t pull;       // gpio_pull_mode_t, applied on every arming
+    };
+
+    struct State {
+      uint32_t magic;
+      int      pin_count;
+      PinState pins[MAX_PINS];
+      Stats    stats;
+      int64_t  time_base;  // System time minus esp_timer time before deep sleep, usec
+    };
+
+  private:
+    static constexpr char const * TAG = "Event Capture";
+
+    static constexpr uint32_t CAPTURE_MAGIC = 0x45564E32; // EVN2
+    static constexpr int64_t  DEBOUNCE_US   = (int64_t) CONFIG_IOT_EVENT_DEBOUNCE * 1000;
+
+    static int64_t      last_edge[MAX_PINS];      // esp_timer time of the last edge queued
+    static portMUX_TYPE mux;                      // Producers: the ISR and the level check
+    static bool         isr_installed;
+
+    static void              isr(void * arg);
+    static void            queue(int index, uint8_t level, int64_t time, bool wake_up);
+    static int64_t  system_time_base();
+
+    esp_err_t        arm_pin(int index);
+    void         check_levels(bool wake_up);
+
+  public:
+    esp_err_t             init();
+
+    /// Capture the edges of **pin**, an input with the **pull** mode, set
+    /// again on every wake up.
+    esp_err_t          add_pin(gpio_num_t pin, gpio_pull_mode_t pull = GPIO_FLOATING);
+
+    /// Deliver the events queued so far to **handler**. Returns the number of
+    /// events delivered.
+    int                deliver(Handler * handler);
+
+    void prepare_for_deep_sleep();
+
+    const Stats &        get_stats();
+};
+
+#endif
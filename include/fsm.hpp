@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+/// Table Driven Finite State Machine
+///
+/// The states are single bit values, such that a set of states (e.g. the
+/// states of several machines) is a bit mask, and the results returned by
+/// the state handlers are small integers starting at 1. The transition of
+/// every (state, result) pair is an entry of a table built at compile time,
+/// looked up without any branch on the state or the result:
+///
+/// - **next**: the next state, or 0 for the return state, to come back from
+///   a state interrupting the normal flow;
+/// - **next_return**: the next return state, or 0 to keep it unchanged;
+/// - **flags**: application defined, e.g. a condition that may override the
+///   next state.
+///
+/// A result out of range uses the first column. **is_valid()** being
+/// constexpr, a table naming an unknown state is rejected by a static_assert.
+///
+/// The class is free of any ESP-IDF dependency.
+
+template <class State, size_t STATES, size_t RESULTS>
+class FsmTable
+{
+  public:
+    struct Transition {
+      State   next;         ///< Next state, 0 for the return state
+      State   next_return;  ///< Next return state, 0 to keep it unchanged
+      uint8_t flags;        ///< Application defined
+    };
+
+    Transition transitions[STATES][RESULTS];
+
+    static constexpr int index(State state) { return __builtin_ctz((unsigned) (uint8_t) state); }
+
+    /// True if **state** is a single bit state of the table.
+    static constexpr bool is_state(State state) {
+      return ((uint8_t) state != 0) &&
+             (((uint8_t) state & ((uint8_t) state - 1)) == 0) &&
+             (index(state) < (int) STATES);
+    }
+
+    constexpr const Transition & at(State state, int result) const {
+      return transitions[index(state)][((result >= 1) && (result <= (int) RESULTS)) ? (result - 1) : 0];
+    }
+
+    constexpr bool is_valid() const {
+      for (size_t s = 0; s < STATES; s++) {
+        for (size_t r = 0; r < RESULTS; r++) {
+          const Transition & t = transitions[s][r];
+          if (((uint8_t) t.next        != 0) && !is_state(t.next))        return false;
+          if (((uint8_t) t.next_return != 0) && !is_state(t.next_return)) return false;
+        }
+      }
+      return true;
+    }
+};
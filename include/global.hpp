@@ -5,19 +5,32 @@
 #include "wifi.hpp"
 #include "nvs_mgr.hpp"
 #include "iot.hpp"
+#include "wake_scheduler.hpp"
 
 #ifdef CONFIG_IOT_BATTERY_LEVEL
   #include "battery.hpp"
 #endif
 
+#ifdef CONFIG_IOT_MSG_STORE
+  #include "msg_store.hpp"
+#endif
+
 #ifdef CONFIG_IOT_ENABLE_UDP
-  #include "udp_sender.hpp"
+  #include "udp.hpp"
 #endif
 
 #ifdef CONFIG_IOT_ENABLE_ESP_NOW
   #include "esp_now.hpp"
 #endif
 
+#ifdef CONFIG_IOT_OTA
+  #include "ota.hpp"
+#endif
+
+#ifdef CONFIG_IOT_EVENT_CAPTURE
+  #include "event_capture.hpp"
+#endif
+
 #ifndef __GLOBAL__
   extern CFG cfg;
   extern Config config;
@@ -31,6 +44,9 @@
   #ifndef __NVS_MGR__
     extern NVSMgr nvs_mgr;
   #endif
+  #ifndef __WAKE_SCHEDULER__
+    extern WakeScheduler wake_scheduler;
+  #endif
 
   #ifdef CONFIG_IOT_ENABLE_UDP
     #ifndef __UDP__
@@ -44,11 +60,29 @@
     #endif
   #endif
 
+  #ifdef CONFIG_IOT_MSG_STORE
+    #ifndef __MSG_STORE__
+      extern MsgStore msg_store;
+    #endif
+  #endif
+
   #ifdef CONFIG_IOT_ENABLE_ESP_NOW
     #ifndef __ESP_NOW__
       extern ESPNow esp_now;
     #endif
   #endif
+
+  #ifdef CONFIG_IOT_OTA
+    #ifndef __OTA__
+      extern Ota ota;
+    #endif
+  #endif
+
+  #ifdef CONFIG_IOT_EVENT_CAPTURE
+    #ifndef __EVENT_CAPTURE__
+      extern EventCapture event_capture;
+    #endif
+  #endif
 #endif
 
 extern uint32_t sequence_number;
@@ -1,8 +1,19 @@
 #pragma once
 
 #include <esp_sleep.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
 
 #include "config.hpp"
+#include "boot_scheduler.hpp"
+
+#ifdef CONFIG_IOT_DOWNLINK
+  #include "downlink.hpp"
+#endif
+
+#ifdef CONFIG_IOT_EVENT_CAPTURE
+  #include "event_capture.hpp"
+#endif
 
 #define __IOT__
 #include "global.hpp"
@@ -41,6 +52,14 @@ class IoT
     /// END_EVENT --> WAIT_FOR_EVENT : COMPLETED
     /// END_EVENT --> END_EVENT : NOT_COMPLETED
     /// @enduml
+    ///
+    /// The transitions are resolved through a table built at compile time
+    /// (see fsm.hpp and src/iot.cpp). Up to CONFIG_IOT_FSM_MACHINES machines,
+    /// each with its own handler and state kept in RTC memory, can run side by
+    /// side (see **init()**), e.g. one per sensor. The STARTUP and WATCHDOG
+    /// messages are sent once for all of them, only one machine goes through
+    /// the WATCHDOG state, and the device goes to deep sleep only when none
+    /// of them is in the PROCESS_EVENT, END_EVENT or WATCHDOG state.
     enum State : int8_t {
       STARTUP        =  1, ///< The device has just been reset
       WAIT_FOR_EVENT =  2, ///< Wait for an event to occur
@@ -63,6 +82,14 @@ class IoT
       RETRY,         ///< From WAIT_END_EVENT, go back to PROCESS_EVENT
     };
 
+    /// Message classes, used to route messages when both UDP and ESP-NOW are
+    /// enabled (see transport.hpp). With a single transport, all messages go
+    /// through it.
+    enum class MsgClass : uint8_t {
+      NORMAL,        ///< Periodic and bulk data: UDP
+      ALARM          ///< Low latency events: ESP-NOW, never batched
+    };
+
     enum RestartReason : uint8_t {
       RESET,
       DEEP_SLEEP_AWAKE
@@ -73,6 +100,51 @@ class IoT
       OTHER
     };
 
+    /// State of one machine, kept in RTC memory.
+    struct Machine {
+      State state;
+      State return_state;
+    };
+
+    static constexpr const int MAX_MACHINES = CONFIG_IOT_FSM_MACHINES;
+
+    /// Readiness bits of the event group returned by **get_ready_events()**.
+    /// They are set as the boot sequence progresses, and cleared when the
+    /// corresponding resource is lost. The last ones are the run loop events
+    /// (see **notify()**).
+    enum ReadyBit : EventBits_t {
+      WIFI_READY       = BIT0, ///< Wifi started (ESP-NOW) or connected with an IP address (UDP)
+      TRANSPORT_READY  = BIT1, ///< UDP socket created or ESP-NOW gateway found
+      NVS_READY        = BIT2, ///< NVS flash initialized
+      EVENT_LOOP_READY = BIT3, ///< Default event loop created
+      WIFI_STARTED     = BIT4, ///< Wifi initialized and started, association in progress
+      BATTERY_READY    = BIT5, ///< Battery voltage level sampled
+      APP_READY        = BIT6, ///< Application warm-up handler completed
+      DOWNLINK_READY   = BIT7, ///< Downlink command queued (ESP-NOW), cleared when processed
+      APP_EVENT        = BIT8, ///< Application event (e.g. GPIO interrupt), cleared by the run loop
+      SEND_DONE        = BIT9  ///< ESP-NOW send status received, cleared by the run loop
+    };
+
+    #ifdef CONFIG_IOT_RUN_LOOP
+      /// Sources waking up the run loop, see **get_wake_stats()**.
+      enum class WakeSource : uint8_t { APP, DOWNLINK, SEND, TIMER, COUNT };
+
+      /// Latency, from the notification (the expiry for TIMER) to the return
+      /// of the run loop wait.
+      struct WakeStats {
+        uint32_t count;
+        uint32_t max_us;
+        uint64_t total_us;
+      };
+    #endif
+
+    /// Application defined warm-up function (e.g. sensor power up and first
+    /// reading). To be supplied as an optional parameter to the IoT::init()
+    /// function. It is run concurrently with the Wifi bring-up and must not
+    /// send messages.
+    /// @return ESP_OK, any other value aborts.
+    typedef BootScheduler::StepHandler WarmUpHandler;
+
     /// Application defined process handling function. To be supplied as a parameter
     /// to the IOT::init() function.
     /// @param[in] _state The current state of the Finite State Machine.
@@ -80,11 +152,42 @@ class IoT
 
     typedef UserResult ProcessHandler(State state);
 
+    #ifdef CONFIG_IOT_DOWNLINK
+      /// Application defined command handler, called by **process()** in the
+      /// application task for every command received from the gateway (see
+      /// downlink.hpp). To be supplied with **set_command_handler()**.
+      /// @param[in] cmd The command content, valid during the call only.
+      /// @param[in] len The command length, between 1 and DOWNLINK_MAX_SIZE.
+      typedef DownlinkHandler CommandHandler;
+    #endif
+
+    #ifdef CONFIG_IOT_EVENT_CAPTURE
+      /// Application defined handler of the captured input events (see
+      /// event_capture.hpp), called by **process()** in the application task,
+      /// in order, before the process handlers. To be supplied with
+      /// **set_event_handler()**.
+      typedef EventCapture::Handler EventHandler;
+    #endif
+
+    #ifdef CONFIG_IOT_ENABLE_UDP
+      static constexpr const int MAX_PKT_SIZE = 1450;
+    #else
+      static constexpr const int MAX_PKT_SIZE = 248;
+    #endif
+
+    #ifdef CONFIG_IOT_MSG_FRAGMENTATION
+      static constexpr const int MAX_MSG_SIZE = CONFIG_IOT_MSG_MAX_SIZE;
+    #else
+      static constexpr const int MAX_MSG_SIZE = MAX_PKT_SIZE;
+    #endif
+
   private:
     static constexpr char const * TAG = "IoT Class";
 
-    QueueHandle_t send_queue_handle;
-    ProcessHandler * process_handler;
+    static constexpr const int RETRY_CAP_FACTOR = 8; // Wake retry backoff cap, in CONFIG_IOT_WAKE_RETRY_DELAY
+
+    ProcessHandler * process_handlers[MAX_MACHINES];
+    int              machine_count;
 
     RestartReason      restart_reason;
     esp_sleep_source_t deep_sleep_wakeup_reason;
@@ -92,29 +195,109 @@ class IoT
     /// @brief Deep Sleep Duration bypass
     ///
     /// The **deep_sleep_duration** variable is used to bypass the default 
-    /// deep sleep duration that is based on the need to send a watchdog
-    /// message every 24 hours.
+    /// deep sleep duration, that lasts until the earliest deadline of the
+    /// wake scheduler (the watchdog transmission, the application deadlines,
+    /// see wake_scheduler.hpp).
     ///
     /// The values can be:
     ///
     /// -1 : Deep Sleep is disabled
-    ///  0 : Use the default duration for the watchdog transmission
-    /// >0 : Deep sleep for the number of seconds identified
+    ///  0 : Deep sleep until the earliest deadline
+    /// >0 : Deep sleep for the number of seconds identified, or until the
+    ///      earliest deadline if sooner
     ///
     /// Every time the process method is run, the deep_sleep_duration
     /// is resetted to its default value of 0.
     ///
     int32_t          deep_sleep_duration;
 
-    State check_if_24_hours_time(State the_state);
+    EventGroupHandle_t ready_events;
+    int64_t            deadline;       // End of the wake time budget, in usec since boot
+
+    void        deadline_expired(const char * step);
+
+    #ifdef CONFIG_IOT_RUN_LOOP
+      bool                 light_sleep;    // Automatic light sleep configured
+      volatile int64_t     notify_time[(int) WakeSource::COUNT];
+      WakeStats            wake_stats[(int) WakeSource::COUNT];
+
+      void         enable_light_sleep();
+      void                 wait_event();
+      void          account_wake(WakeSource source, int64_t since, int64_t now);
+    #endif
+
+    esp_err_t           init_machines(ProcessHandler * const * handlers, int count, WarmUpHandler * warm_up);
+    uint8_t                get_states();
+    uint8_t         get_return_states();
+    esp_err_t               transmit(uint8_t * data, int len, MsgClass msg_class = MsgClass::NORMAL);
+    uint8_t *        get_send_buffer(MsgClass msg_class = MsgClass::NORMAL);
+    bool               store_pending();
+    void                 send_packet(uint8_t * data, int len, bool pending, MsgClass msg_class = MsgClass::NORMAL);
+    void                  send_frame(uint8_t * data, int len, MsgClass msg_class = MsgClass::NORMAL);
+    int             get_max_pkt_size(MsgClass msg_class = MsgClass::NORMAL);
+    int                   encode_msg(uint8_t * buff, int max_len, const char * msg_type, const char * other_field, bool & truncated);
+
+    #ifdef CONFIG_IOT_MSG_BATCHING
+      void              batch_header();
+      bool                 batch_msg(const char * msg_type, const char * other_field);
+      void               flush_batch();
+    #endif
+
+    #ifdef CONFIG_IOT_MSG_STORE
+      bool                    forwarding;
+      esp_err_t  forward_stored_msgs();
+    #endif
+
+    #ifdef CONFIG_IOT_EVENT_CAPTURE
+      EventHandler *       event_handler;
+    #endif
+
+    #ifdef CONFIG_IOT_DOWNLINK
+      CommandHandler *   command_handler;
+      bool                   uplink_sent;
+      int           process_commands();
+      void            receive_window();
+    #endif
 
   public:
-    esp_err_t                      init(ProcessHandler * handler);
+    esp_err_t                      init(ProcessHandler * handler, WarmUpHandler * warm_up = nullptr);
+
+    /// Run one state machine per handler, **N** up to MAX_MACHINES. The
+    /// handlers are called in order by **process()**.
+    template <int N>
+    esp_err_t                      init(ProcessHandler * const (&handlers)[N], WarmUpHandler * warm_up = nullptr) {
+      static_assert((N >= 1) && (N <= MAX_MACHINES), "The number of state machines must be between 1 and CONFIG_IOT_FSM_MACHINES.");
+      return init_machines(handlers, N, warm_up);
+    }
+
+    State                     get_state(int machine = 0);
     void                        process();
     void                       send_msg(const char * msg_type, const char * other_field = nullptr);
+    void                       send_msg(MsgClass msg_class, const char * msg_type, const char * other_field = nullptr);
+    esp_err_t                     flush();
+    esp_err_t                wait_ready(EventBits_t bits);
+    int32_t       get_remaining_time_ms();
+    inline EventGroupHandle_t get_ready_events() { return ready_events; }
+    void                    send_failed(const uint8_t * data, int len);
     inline void set_deep_sleep_duration(int32_t seconds) { deep_sleep_duration = seconds; }
     inline void   increment_error_count() { error_count += 1; }
     inline bool               was_reset() { return restart_reason == RestartReason::RESET; }
     inline bool  was_deep_sleep_timeout() { return deep_sleep_wakeup_reason == ESP_SLEEP_WAKEUP_TIMER; }
     esp_err_t    prepare_for_deep_sleep();
+
+    void                         notify(EventBits_t bits);
+    /// In IRAM, callable from an ISR registered with ESP_INTR_FLAG_IRAM.
+    void                notify_from_isr(EventBits_t bits);
+
+    #ifdef CONFIG_IOT_RUN_LOOP
+      inline const WakeStats & get_wake_stats(WakeSource source) { return wake_stats[(int) source]; }
+    #endif
+
+    #ifdef CONFIG_IOT_DOWNLINK
+      inline void set_command_handler(CommandHandler * handler) { command_handler = handler; }
+    #endif
+
+    #ifdef CONFIG_IOT_EVENT_CAPTURE
+      inline void   set_event_handler(EventHandler * handler) { event_handler = handler; }
+    #endif
 };
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "config.hpp"
+
+#ifdef CONFIG_IOT_ESPNOW_LINK_ADAPT
+
+#include <esp_wifi.h>
+
+#include "nvs_mgr.hpp"
+
+/// ESP-NOW Link Adaptation
+///
+/// Every gateway of the peer set has its own operating point: a PHY rate and a
+/// maximum TX power, kept in its NVSMgr::Gateway entry (RTC memory, and NVS
+/// when the peer set is saved). The operating point of the gateway in use is
+/// programmed when it is selected.
+///
+/// The operating point moves on a ladder, from the most robust to the most
+/// efficient one, driven by the send results of the gateway in use (Adaptive
+/// Auto Rate Fallback):
+///
+/// - After DOWN_THRESHOLD consecutive failures, the TX power is raised one
+///   level, or the rate is lowered once the TX power is at its maximum.
+/// - After a run of successes, the rate is raised one step, or the TX power
+///   lowered one level once the rate is at its maximum. The next frame is a
+///   probe: if it fails, the step is reverted at once and the run of successes
+///   required for the next attempt is doubled (up to UP_MAX_THRESHOLD).
+///
+/// A step up is only attempted if the gateway RSSI, less the TX power
+/// reduction, stays above the sensitivity of the rate plus
+/// CONFIG_IOT_ESPNOW_LINK_MARGIN dB. A new gateway starts at full TX power
+/// with the fastest rate allowed by its RSSI.
+///
+/// The Long Range rates are only used with CONFIG_IOT_ESPNOW_ENABLE_LONG_RANGE.
+/// Along with UDP, the TX power is left untouched: the Wifi connection shares
+/// it.
+///
+/// The send results are accounted in the application task (see
+/// ESPNow::update_gateway()), not in the Wifi task send callback: the Wifi
+/// configuration functions are not called from it. The counters and the run
+/// of successes are kept in RTC memory across deep sleep, such that devices
+/// sending a few frames per wake up adapt too.
+
+class LinkAdapt
+{
+  public:
+    struct Counters {             // Since the last reset
+      uint32_t sent;
+      uint32_t failed;
+      uint32_t rate_up;
+      uint32_t rate_down;
+      uint32_t power_up;
+      uint32_t power_down;
+      uint32_t probes_failed;
+    };
+
+    enum class Step : uint8_t { NONE, RATE_UP, POWER_DOWN };
+
+    struct State {
+      uint32_t magic;
+      MacAddr  mac_addr;            // Gateway the run of successes belongs to
+      uint8_t  successes;
+      uint8_t  failures;
+      uint8_t  up_threshold;
+      Step     probe;               // Step being probed, NONE if none
+      uint8_t  skip;                // Results of frames sent before the last step, to be ignored
+      Counters counters;
+    };
+
+  private:
+    static constexpr char const * TAG = "LinkAdapt Class";
+
+    static constexpr uint32_t  LINK_MAGIC       = 0x4C4E4B31; // LNK1
+    static constexpr const int DOWN_THRESHOLD   = 2;
+    static constexpr const int UP_MIN_THRESHOLD = 10;
+    static constexpr const int UP_MAX_THRESHOLD = 160;
+
+    int              min_rate();
+    bool              can_use(const NVSMgr::Gateway & gw, int rate, int power);
+    Step              step_up(NVSMgr::Gateway & gw);
+    bool            step_down(NVSMgr::Gateway & gw);
+    void               revert(NVSMgr::Gateway & gw, Step step);
+
+  public:
+    esp_err_t          init();
+    void               seed(NVSMgr::Gateway & gw);
+    esp_err_t         apply(NVSMgr::Gateway & gw);
+    bool             update(NVSMgr::Gateway & gw, bool success, int outstanding);
+
+    const Counters & get_counters();
+};
+
+#endif
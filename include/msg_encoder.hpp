@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+/// Message Encoder
+///
+/// Builds the text frame sent to the gateway without any format string
+/// parsing. Every field kind has its own specialised writer, selected at
+/// compile time by overloading, and keys are string literals whose length
+/// is a template parameter. This replaces the single large **snprintf**
+/// call previously used by IoT::send_msg(), avoiding the varargs handling
+/// and the double to string conversion of the C library (and the large
+/// stack frame that comes with it).
+///
+/// The output is always null terminated. When the buffer is too small,
+/// the output is truncated and **is_truncated()** returns true.
+
+class MsgEncoder
+{
+  private:
+    char * const buff;
+    const size_t size;   // Buffer capacity, including the null terminating char
+    size_t       len;
+    bool         truncated;
+
+    void append(const char * str, size_t count);
+
+  public:
+    MsgEncoder(char * buffer, size_t capacity) : buff(buffer), size(capacity), len(0), truncated(false) {
+      if (size > 0) buff[0] = 0;
+    }
+
+    template<size_t N>
+    inline MsgEncoder &  lit(const char (&str)[N]) { append(str, N - 1); return *this; }
+
+    MsgEncoder &         str(const char * str);
+    MsgEncoder &         u32(uint32_t value);
+    MsgEncoder &         i32(int32_t value);
+    MsgEncoder &      fixed2(double value);
+
+    /// Fields are written as `,key:value`.
+    template<size_t N>
+    inline MsgEncoder & field(const char (&key)[N], const char * value) { return lit(",").lit(key).lit(":").str(value); }
+    template<size_t N>
+    inline MsgEncoder & field(const char (&key)[N], uint32_t value)     { return lit(",").lit(key).lit(":").u32(value); }
+    template<size_t N>
+    inline MsgEncoder & field(const char (&key)[N], int32_t value)      { return lit(",").lit(key).lit(":").i32(value); }
+    template<size_t N>
+    inline MsgEncoder & field(const char (&key)[N], double value)       { return lit(",").lit(key).lit(":").fixed2(value); }
+
+    /// Quoted fields are written as `,key:"value"`.
+    template<size_t N>
+    inline MsgEncoder & qfield(const char (&key)[N], const char * value) { return lit(",").lit(key).lit(":\"").str(value).lit("\""); }
+
+    inline const char *      get_data() { return buff; }
+    inline size_t          get_length() { return len; }
+    inline bool          is_truncated() { return truncated; }
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+/// Message Fragmentation
+///
+/// Messages larger than the transport maximum packet size are split into
+/// fragments, each one starting with the following header (little-endian):
+///
+///     +--------+--------+-------+-------+-----------+---------+
+///     | marker | msg_id | index | count | total_len | msg_crc |
+///     |  (u8)  |  (u16) |  (u8) |  (u8) |   (u16)   |  (u16)  |
+///     +--------+--------+-------+-------+-----------+---------+
+///
+/// All fragments but the last one carry the same number of bytes, equal to
+/// ceil(total_len / count), such that the receiver can place any fragment
+/// without having received the others. The CRC is computed over the complete
+/// reassembled message with **frag_crc16()**.
+///
+/// Both classes are free of any ESP-IDF dependency such that they can be
+/// used as is on the gateway side.
+
+constexpr const uint8_t FRAG_FRAME_MARKER = 0xF5;
+
+struct FragHeader {
+  uint8_t  marker;
+  uint16_t msg_id;
+  uint8_t  index;
+  uint8_t  count;
+  uint16_t total_len;
+  uint16_t msg_crc;
+} __attribute__((packed));
+
+constexpr const int FRAG_MAX_COUNT = 255;
+
+/// CRC-16/CCITT (reflected, polynomial 0x8408, initial value 0xFFFF).
+extern uint16_t frag_crc16(const uint8_t * data, size_t len);
+
+class Fragmenter
+{
+  private:
+    const uint8_t * msg;
+    uint16_t        msg_len;
+    uint16_t        msg_id;
+    uint16_t        msg_crc;
+    uint16_t        chunk_size;
+    uint8_t         count;
+    uint8_t         index;
+
+  public:
+    /// **max_frame_size** is the maximum size of a fragment, header included.
+    Fragmenter(const uint8_t * data, int len, int max_frame_size, uint16_t id);
+
+    /// Build the next fragment in **frame**. Returns its length, or 0 when
+    /// all fragments have been built.
+    int                 next(uint8_t * frame);
+
+    inline bool     is_valid() { return count > 0; }
+    inline int     get_count() { return count; }
+};
+
+class FragReassembler
+{
+  public:
+    enum class Result : uint8_t {
+      INCOMPLETE, ///< Fragment accepted, some fragments still missing
+      COMPLETE,   ///< Message complete and CRC verified, see get_data()
+      DUPLICATE,  ///< Fragment already received
+      INVALID,    ///< Not a fragment or inconsistent header
+      CRC_ERROR   ///< All fragments received but the message CRC is wrong
+    };
+
+  private:
+    uint8_t * const buff;
+    const size_t    size;
+
+    bool            active;
+    uint16_t        msg_id;
+    uint16_t        total_len;
+    uint16_t        msg_crc;
+    uint16_t        chunk_size;
+    uint8_t         count;
+    uint8_t         received_count;
+    uint8_t         received[(FRAG_MAX_COUNT + 7) / 8];
+
+    uint32_t        abandoned_count;
+
+  public:
+    FragReassembler(uint8_t * buffer, size_t capacity);
+
+    /// Add a received fragment (header included). A fragment belonging to a
+    /// new message abandons the message being reassembled, if any.
+    Result               add(const uint8_t * frame, size_t len);
+    void               reset() { active = false; }
+
+    inline const uint8_t *    get_data() { return buff; }
+    inline size_t           get_length() { return total_len; }
+    inline uint32_t  get_abandoned_count() { return abandoned_count; }
+};
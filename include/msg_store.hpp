@@ -0,0 +1,72 @@
+#pragma once
+
+#include "config.hpp"
+
+#ifdef CONFIG_IOT_MSG_STORE
+
+/// Store-and-Forward Message Store
+///
+/// Ring buffer located in RTC slow memory, keeping the messages that could
+/// not be delivered to the gateway across deep sleep cycles. Messages are
+/// forwarded in order at the next opportunity. The memory used is bounded
+/// by CONFIG_IOT_MSG_STORE_SIZE: when a new message doesn't fit, the oldest
+/// ones are evicted.
+///
+/// Every record is protected by a CRC16, as is the ring header. A corrupted
+/// header (e.g. power loss) empties the store. The messages survive a
+/// software reset, the counters don't.
+
+class MsgStore
+{
+  public:
+    static constexpr const int SIZE = CONFIG_IOT_MSG_STORE_SIZE;
+
+    struct Header {
+      uint32_t magic;
+      uint16_t head;             // Offset of the oldest record
+      uint16_t used;             // Number of bytes used, records headers included
+      uint16_t count;            // Number of records in the store
+      uint32_t stored_count;     // Counters since the last reset (see init())
+      uint32_t forwarded_count;
+      uint32_t evicted_count;
+      uint16_t crc;
+    } __attribute__((packed));
+
+  private:
+    static constexpr char const * TAG   = "MsgStore Class";
+    static constexpr uint32_t     MAGIC = 0x4D534731; // MSG1
+
+    struct RecordHeader {
+      uint16_t len;
+      uint16_t crc;
+    } __attribute__((packed));
+
+    void         clear();
+    void         update_crc();
+    void         read(uint16_t offset, void * data, int len);
+    void         write(uint16_t offset, const void * data, int len);
+    void         drop_oldest();
+
+  public:
+    /// **reset**: first boot after a reset, the counters are cleared.
+    esp_err_t    init(bool reset);
+
+    /// Add a message at the end of the store, evicting the oldest ones if required.
+    esp_err_t    push(const uint8_t * data, int len);
+
+    /// Retrieve the oldest message without removing it from the store. Returns
+    /// its length, 0 if the store is empty or -1 if the record is corrupted (the
+    /// store is then emptied) or longer than **max_len** (the record is then
+    /// evicted).
+    int          peek(uint8_t * data, int max_len);
+
+    /// Remove the oldest message, once it has been forwarded.
+    void         pop();
+
+    bool                       is_empty();
+    int                       get_count();
+    uint32_t        get_evicted_count();
+    uint32_t      get_forwarded_count();
+};
+
+#endif
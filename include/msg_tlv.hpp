@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+/// Binary (TLV) Message Format
+///
+/// Alternative to the text frame built with MsgEncoder, selected with
+/// CONFIG_IOT_MSG_FORMAT_BINARY. The frame starts with the TLV_FRAME_MARKER
+/// byte (text frames always start with the printable topic name), followed
+/// by a sequence of fields:
+///
+///     +-----------+--------------+-------------------+
+///     | key (u8)  | length (u8)  | value (length)    |
+///     +-----------+--------------+-------------------+
+///
+/// Unsigned integers are sent little-endian using the minimum number of
+/// bytes (1 to 4), signed 8 bits values in one byte. Strings are sent
+/// without their null terminating character. Unknown keys must be skipped
+/// by the decoder, using the length byte. When a field doesn't fit in the
+/// buffer, the encoder stops there: a truncated frame ends with complete
+/// fields and **is_truncated()** returns true.
+///
+/// Batches (CONFIG_IOT_MSG_BATCHING): the frame carries the fields common to
+/// all messages once (TLV_TOPIC, TLV_NAME, TLV_DUR, TLV_MAC, TLV_ERR,
+/// TLV_RSSI, TLV_ST, TLV_RST, TLV_HEAP, and TLV_VBAT, TLV_DROP, TLV_IP when
+/// enabled), followed by one TLV_REC field per message. The value of a
+/// TLV_REC field is a nested sequence of fields, without the frame marker:
+///
+///     B1 <common fields> 10 <len> [03 <len> type] [04 <len> seq] [0C <len> other]
+///                        10 <len> [03 <len> type] [04 <len> seq] ...
+///
+/// The record fields are decoded with TLVDecoder(value, length, false).
+///
+/// Both classes are free of any ESP-IDF dependency such that they can be
+/// used as is on the gateway side.
+
+constexpr const uint8_t TLV_FRAME_MARKER = 0xB1;
+
+enum TLVKey : uint8_t {
+  TLV_TOPIC = 1, ///< string : MQTT topic name
+  TLV_NAME,      ///< string : device name
+  TLV_TYPE,      ///< string : message type
+  TLV_SEQ,       ///< uint   : message sequence number
+  TLV_DUR,       ///< uint   : last awake duration in milliseconds
+  TLV_MAC,       ///< 6 bytes: device MAC address
+  TLV_ERR,       ///< uint   : error count
+  TLV_RSSI,      ///< int8   : gateway RSSI
+  TLV_ST,        ///< uint   : FSM state
+  TLV_RST,       ///< uint   : FSM return state
+  TLV_HEAP,      ///< uint   : free heap size
+  TLV_OTHER,     ///< string : application supplied field, as "key:value"
+  TLV_VBAT,      ///< uint   : battery voltage in hundredths of volts
+  TLV_IP,        ///< 4 bytes: device IPv4 address, network order
+  TLV_DROP,      ///< uint   : messages evicted from the store-and-forward buffer
+  TLV_REC        ///< TLV    : one message record of a batch (TLV_TYPE, TLV_SEQ, TLV_OTHER)
+};
+
+class TLVEncoder
+{
+  private:
+    uint8_t * const buff;
+    const size_t    size;
+    size_t          len;
+    bool            truncated;
+
+  public:
+    /// The frame marker is not written when **marker** is false, for
+    /// nested fields (TLV_REC) or when appending to an existing frame.
+    TLVEncoder(uint8_t * buffer, size_t capacity, bool marker = true);
+
+    TLVEncoder &      bytes(TLVKey key, const void * data, size_t length);
+    TLVEncoder &        str(TLVKey key, const char * str);
+    TLVEncoder &        u32(TLVKey key, uint32_t value);
+    TLVEncoder &         i8(TLVKey key, int8_t value);
+
+    inline const uint8_t * get_data() { return buff; }
+    inline size_t        get_length() { return len; }
+    inline bool        is_truncated() { return truncated; }
+};
+
+class TLVDecoder
+{
+  public:
+    struct Field {
+      TLVKey          key;
+      uint8_t         length;
+      const uint8_t * value;
+
+      uint32_t          as_uint() const;
+      int8_t            as_int8() const { return (int8_t) value[0]; }
+    };
+
+  private:
+    const uint8_t * data;
+    size_t          len;
+    size_t          pos;
+    bool            valid;
+
+  public:
+    /// Without **marker**, **frame** is a nested sequence of fields (the
+    /// value of a TLV_REC field), not starting with the frame marker.
+    TLVDecoder(const uint8_t * frame, size_t length, bool marker = true);
+
+    /// Retrieve the next field of the frame. Returns false at the end of
+    /// the frame or if the frame is malformed (see **is_valid()**).
+    bool             next(Field & field);
+
+    inline bool  is_valid() { return valid; }
+};
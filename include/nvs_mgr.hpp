@@ -7,10 +7,22 @@
 class NVSMgr
 {
   public:
+    static constexpr const int MAX_GATEWAYS = 4;
+
+    struct Gateway {
+      MacAddr mac_addr;
+      uint8_t channel;           // Channel on which the gateway was found
+      int8_t  rssi;              // EWMA of the RSSI measured by scans and probes
+      uint8_t ack_rate;          // EWMA of the send success rate, 255 = 100%
+      uint8_t rate;              // Link adaptation operating point: PHY rate
+      uint8_t tx_power;          // and TX power level (see link_adapt.hpp)
+    } __attribute__((packed));
+
     struct NVSData {
-      MacAddr gateway_mac_addr;
-      int8_t  rssi;
-    };
+      Gateway gateways[MAX_GATEWAYS];
+      uint8_t count;
+      uint8_t current;           // Gateway in use
+    } __attribute__((packed));
 
   private:
     static constexpr char const * TAG            = "NVSMgr Class";
@@ -26,6 +38,10 @@ class NVSMgr
     esp_err_t get_nvs_data();
     esp_err_t set_nvs_data(NVSData * data);
 
+    /// Other blobs, kept in the same namespace under their own **key**.
+    esp_err_t     get_blob(const char * key, void * data, size_t len);
+    esp_err_t     set_blob(const char * key, const void * data, size_t len);
+
     inline const NVSData *     get_data() { return &nvs_data; }
     inline bool           is_data_valid() { return data_is_valid; }
 };
\ No newline at end of file
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "config.hpp"
+
+#ifdef CONFIG_IOT_OTA
+
+#define __OTA__
+#include "global.hpp"
+#undef __OTA__
+
+#include <esp_partition.h>
+
+#include "downlink.hpp"
+
+/// Firmware Update over ESP-NOW
+///
+/// The gateway streams the new firmware image in chunks, written to the
+/// inactive OTA partition as they arrive, in any order, without buffering
+/// the image in RAM. The frames use the downlink frame layout (see
+/// downlink.hpp) with the OTA_MARKER marker, followed by a frame type:
+///
+///     BEGIN: | crc | marker | 0x01 | image_size (u32) | chunk_size (u16) | sha256 (32) |
+///     DATA:  | crc | marker | 0x02 | index (u16) | chunk data                           |
+///     ABORT: | crc | marker | 0x03 |
+///
+/// All chunks but the last one are chunk_size bytes long. The chunk size is
+/// a multiple of 16 (flash encryption), up to MAX_CHUNK_SIZE. The device
+/// answers with a status frame, sent as an uplink payload (the transport adds
+/// its CRC in front of it):
+///
+///     | marker | 0x80 | status (u8) | image_id (4) | base (u16) | bitmap (u32) | received (u16) |
+///
+/// where image_id is the first 4 bytes of the image SHA-256, base the index of
+/// the first missing chunk and bit i of bitmap is set if chunk base + i has
+/// been received.
+///
+/// Windowed transfer: the gateway sends the missing chunks of the window
+/// [base, base + CONFIG_IOT_OTA_WINDOW) and waits for a status. The device
+/// sends one once a window worth of chunks has been received, or ACK_DELAY_MS
+/// after the last chunk received. The gateway sends again the chunks not
+/// marked in the bitmap (selective repeat), and sends the window again if no
+/// status is received in time.
+///
+/// Resume: the reception bitmap is kept in RTC memory, and saved in NVS when
+/// the transfer starts and before deep sleep. When a transfer is pending,
+/// the device sends a status after its uplink messages and listens for
+/// CONFIG_IOT_OTA_IDLE_TIMEOUT msec: the gateway continues from base. A BEGIN
+/// frame for the same image resumes the transfer, any other image restarts
+/// it.
+///
+/// Once all the chunks are received, the SHA-256 of the partition content is
+/// verified before it is set as the boot partition and the device restarts.
+/// With the bootloader rollback enabled, the new firmware is marked valid
+/// once it has delivered messages to the gateway (see **confirm_image()**).
+///
+/// tools/ota_sender.py implements the gateway side of the protocol and
+/// simulates transfers over a lossy link.
+
+constexpr const uint8_t OTA_MARKER = 0xA5;
+
+class Ota
+{
+  public:
+    static constexpr const int MAX_CHUNK_SIZE = 240; // Multiple of 16, fits a downlink frame with its header
+    static constexpr const int MAX_CHUNKS     = 8192;
+
+    enum class FrameType : uint8_t {
+      BEGIN  = 0x01,
+      DATA   = 0x02,
+      ABORT  = 0x03,
+      STATUS = 0x80
+    };
+
+    enum class Status : uint8_t {
+      RECEIVING,   ///< Transfer in progress
+      COMPLETE,    ///< Image verified, the device restarts on it
+      HASH_ERROR,  ///< SHA-256 mismatch, the transfer is to be restarted
+      REJECTED,    ///< Invalid BEGIN parameters or image too large
+      FLASH_ERROR, ///< Unable to erase, write or activate the partition
+      IDLE         ///< No transfer in progress
+    };
+
+    struct State {
+      uint32_t magic;
+      uint8_t  sha256[32];
+      uint32_t partition_addr;     // Partition being written
+      uint32_t image_size;
+      uint16_t chunk_size;
+      uint16_t chunk_count;
+      uint16_t received_count;
+      uint16_t base;               // First missing chunk
+      uint8_t  bitmap[MAX_CHUNKS / 8];
+    };
+
+    struct StatusFrame {
+      uint8_t  marker;
+      uint8_t  type;
+      uint8_t  status;
+      uint8_t  image_id[4];
+      uint16_t base;
+      uint32_t bitmap;
+      uint16_t received;
+    } __attribute__((packed));
+
+  private:
+    static constexpr char const * TAG = "OTA Class";
+
+    static constexpr uint32_t     OTA_MAGIC    = 0x4F544131; // OTA1
+    static constexpr const int    RING_SIZE    = 16;
+    static constexpr const int    ACK_DELAY_MS = 50;
+    static constexpr char const * NVS_KEY      = "OTA";
+
+    static SPSCRing<DownlinkCmd, RING_SIZE> ring;
+
+    const esp_partition_t * partition;
+    int                     since_status; // Chunks received since the last status
+    bool                    dirty;        // State not yet saved in NVS
+
+    bool            is_received(int index);
+    void                 begin(const uint8_t * body, int len);
+    void            write_chunk(const uint8_t * body, int len);
+    void                 finish();
+    esp_err_t            verify();
+    void                  reset();
+    void            send_status(Status status, const uint8_t * image_id = nullptr);
+    void                   save(bool persist);
+    void                 handle(const uint8_t * body, int len);
+
+  public:
+    esp_err_t              init();
+    esp_err_t              push(const uint8_t * frame, int len);
+    void                    run();
+    void          confirm_image();
+    void prepare_for_deep_sleep();
+
+    inline bool      has_frames() { return !ring.is_empty(); }
+    bool              is_active();
+};
+
+#endif
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+
+/// Lock-free Single Producer / Single Consumer Ring
+///
+/// One task (or callback) produces, another one consumes, without any lock:
+/// the producer only writes **head**, the consumer only writes **tail**. The
+/// release store of an index publishes the slot content to the other side.
+///
+/// Items are built and read in place: the producer fills the slot returned by
+/// **reserve()** and publishes it with **commit()**, the consumer reads the
+/// slot returned by **front()** and frees it with **pop()**.
+///
+/// The class is free of any ESP-IDF dependency.
+
+template <class T, size_t N>
+class SPSCRing
+{
+  static_assert((N > 0) && ((N & (N - 1)) == 0), "The SPSCRing size must be a power of 2.");
+
+  private:
+    T                     items[N];
+    std::atomic<uint32_t> head;  // Next slot to be written, producer side
+    std::atomic<uint32_t> tail;  // Next slot to be read, consumer side
+
+  public:
+    SPSCRing() : head(0), tail(0) {}
+
+    /// Leaves the indexes as they are, for a ring kept in RTC memory across
+    /// deep sleep: to be checked with **is_valid()**, or reset with
+    /// **clear()**.
+    struct NoInit {};
+    explicit SPSCRing(NoInit) {}
+
+    /// To be called while neither side is active.
+    inline void clear() { head.store(0); tail.store(0); }
+
+    inline bool is_valid() const { return (head.load() - tail.load()) <= N; }
+
+    // ----- Producer side -----
+
+    /// Returns the next free slot, or nullptr if the ring is full.
+    inline T * reserve() {
+      uint32_t h = head.load(std::memory_order_relaxed);
+      return ((h - tail.load(std::memory_order_acquire)) < N) ? &items[h & (N - 1)] : nullptr;
+    }
+
+    /// Publish the slot returned by the last **reserve()**.
+    inline void commit() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    inline bool push(const T & item) {
+      T * slot = reserve();
+      if (slot == nullptr) return false;
+      *slot = item;
+      commit();
+      return true;
+    }
+
+    // ----- Consumer side -----
+
+    /// Returns the oldest item, or nullptr if the ring is empty.
+    inline T * front() {
+      uint32_t t = tail.load(std::memory_order_relaxed);
+      return (t != head.load(std::memory_order_acquire)) ? &items[t & (N - 1)] : nullptr;
+    }
+
+    /// The item **i** places after the oldest one, or nullptr.
+    inline T * peek(uint32_t i) {
+      uint32_t t = tail.load(std::memory_order_relaxed);
+      return (i < (head.load(std::memory_order_acquire) - t)) ? &items[(t + i) & (N - 1)] : nullptr;
+    }
+
+    /// Free the slot returned by **front()**.
+    inline void pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    inline bool is_empty() const {
+      return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+    }
+
+    inline uint32_t size() const {
+      return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <algorithm>
+#include <esp_timer.h>
+
+#include "config.hpp"
+#include "global.hpp"
+
+/// Transport Policies
+///
+/// The transport used by the IoT class is selected at compile time. Every
+/// policy is a class with static inline members only, so a single transport
+/// build calls UDP or ESPNow directly, without any virtual dispatch:
+///
+///     static esp_err_t                 init();
+///     static esp_err_t                 send(IoT::MsgClass msg_class, uint8_t * data, int len);
+///     static esp_err_t                flush();
+///     static uint8_t *      get_send_buffer(IoT::MsgClass msg_class);
+///     static int           get_max_pkt_size(IoT::MsgClass msg_class);
+///     static void    prepare_for_deep_sleep();
+///
+/// and, with CONFIG_IOT_DOWNLINK (see downlink.hpp):
+///
+///     static bool               has_command();
+///     static void             wait_downlink(int timeout_ms);
+///     static int           process_commands(DownlinkHandler * handler);
+///
+/// When both protocols are enabled, DualTransport routes the messages by
+/// class: ALARM messages to its second policy (ESP-NOW, low latency), NORMAL
+/// ones to its first (UDP, large packets and delivery verification). If one
+/// of them cannot be initialized, all messages go through the other one. With
+/// CONFIG_IOT_TRANSPORT_FALLBACK, a packet that cannot be sent on its route
+/// is sent through the other one. ESP-NOW delivery failures known only
+/// later, in the send callback, are not retried: the message goes to the
+/// store-and-forward buffer, which is forwarded through the NORMAL route.
+/// Commands are received on both routes.
+
+#ifdef CONFIG_IOT_ENABLE_UDP
+  class UDPTransport
+  {
+    public:
+      static constexpr const int MAX_PKT_SIZE = UDP::MAX_PKT_SIZE;
+
+      static inline esp_err_t                   init() { return udp.init(); }
+      static inline esp_err_t                  flush() { return ESP_OK; }
+      static inline void      prepare_for_deep_sleep() { udp.prepare_for_deep_sleep(); }
+
+      static inline esp_err_t send(IoT::MsgClass msg_class, uint8_t * data, int len) {
+        return udp.send(data, len);
+      }
+
+      static inline uint8_t * get_send_buffer(IoT::MsgClass msg_class) {
+        return udp.get_send_buffer();
+      }
+
+      static inline int get_max_pkt_size(IoT::MsgClass msg_class) {
+        return std::min((int) cfg.udp.max_pkt_size, MAX_PKT_SIZE);
+      }
+
+      #ifdef CONFIG_IOT_DOWNLINK
+        static inline bool                   has_command() { return udp.has_command(); }
+        static inline void wait_downlink(int timeout_ms) { udp.wait_downlink(timeout_ms); }
+
+        static inline int process_commands(DownlinkHandler * handler) {
+          return udp.process_commands(handler);
+        }
+      #endif
+  };
+#endif
+
+#ifdef CONFIG_IOT_ENABLE_ESP_NOW
+  class ESPNowTransport
+  {
+    public:
+      static constexpr const int MAX_PKT_SIZE = 248;
+
+    private:
+      // When the send window is stalled, the packet is built in a spare buffer.
+      // Its transmission will fail and the packet will be given to send_failed().
+      static inline uint8_t spare[FRAME_HEADROOM + MAX_PKT_SIZE + 1];
+
+    public:
+      static inline esp_err_t                   init() { return esp_now.init(); }
+      static inline esp_err_t                  flush() { return esp_now.flush(); }
+      static inline void      prepare_for_deep_sleep() { esp_now.prepare_for_deep_sleep(); }
+
+      static inline esp_err_t send(IoT::MsgClass msg_class, uint8_t * data, int len) {
+        return esp_now.send(data, len);
+      }
+
+      static inline uint8_t * get_send_buffer(IoT::MsgClass msg_class) {
+        uint8_t * buff = esp_now.get_send_buffer();
+        return (buff != nullptr) ? buff : &spare[FRAME_HEADROOM];
+      }
+
+      static inline int get_max_pkt_size(IoT::MsgClass msg_class) {
+        return std::min((int) cfg.esp_now.max_pkt_size, MAX_PKT_SIZE);
+      }
+
+      #ifdef CONFIG_IOT_DOWNLINK
+        static inline bool                   has_command() { return esp_now.has_command(); }
+        static inline void wait_downlink(int timeout_ms) { esp_now.wait_downlink(timeout_ms); }
+
+        static inline int process_commands(DownlinkHandler * handler) {
+          return esp_now.process_commands(handler);
+        }
+      #endif
+  };
+#endif
+
+template <class NormalRoute, class AlarmRoute>
+class DualTransport
+{
+  private:
+    static constexpr char const * TAG = "Transport";
+
+    #ifdef CONFIG_IOT_DOWNLINK
+      static constexpr const int DOWNLINK_POLL_MS = 10;
+    #endif
+
+    static inline bool normal_ready = false;
+    static inline bool  alarm_ready = false;
+
+    static inline bool is_alarm_route(IoT::MsgClass msg_class) {
+      return alarm_ready && ((msg_class == IoT::MsgClass::ALARM) || !normal_ready);
+    }
+
+  public:
+    static constexpr const int MAX_PKT_SIZE = std::max(NormalRoute::MAX_PKT_SIZE, AlarmRoute::MAX_PKT_SIZE);
+
+    static esp_err_t init() {
+      if (!(normal_ready = (NormalRoute::init() == ESP_OK))) ESP_LOGW(TAG, "NORMAL route unavailable.");
+      if (!(alarm_ready  = (AlarmRoute::init()  == ESP_OK))) ESP_LOGW(TAG, "ALARM route unavailable.");
+
+      return (normal_ready || alarm_ready) ? ESP_OK : ESP_FAIL;
+    }
+
+    static esp_err_t send(IoT::MsgClass msg_class, uint8_t * data, int len) {
+      bool      alarm  = is_alarm_route(msg_class);
+      esp_err_t status = alarm ? AlarmRoute::send(msg_class, data, len) : NormalRoute::send(msg_class, data, len);
+
+      #ifdef CONFIG_IOT_TRANSPORT_FALLBACK
+        if (status != ESP_OK) {
+          if (alarm) {
+            if (normal_ready && (len <= NormalRoute::get_max_pkt_size(msg_class))) {
+              ESP_LOGW(TAG, "Fallback to the NORMAL route.");
+              status = NormalRoute::send(msg_class, data, len);
+            }
+          }
+          else if (alarm_ready && (len <= AlarmRoute::get_max_pkt_size(msg_class))) {
+            ESP_LOGW(TAG, "Fallback to the ALARM route.");
+            status = AlarmRoute::send(msg_class, data, len);
+          }
+        }
+      #endif
+
+      return status;
+    }
+
+    static esp_err_t flush() {
+      esp_err_t status = normal_ready ? NormalRoute::flush() : ESP_OK;
+      return (!alarm_ready || (AlarmRoute::flush() == ESP_OK)) ? status : ESP_FAIL;
+    }
+
+    static uint8_t * get_send_buffer(IoT::MsgClass msg_class) {
+      return is_alarm_route(msg_class) ? AlarmRoute::get_send_buffer(msg_class) : NormalRoute::get_send_buffer(msg_class);
+    }
+
+    static int get_max_pkt_size(IoT::MsgClass msg_class) {
+      return is_alarm_route(msg_class) ? AlarmRoute::get_max_pkt_size(msg_class) : NormalRoute::get_max_pkt_size(msg_class);
+    }
+
+    static void prepare_for_deep_sleep() {
+      // A route whose init() failed has nothing to release.
+      if (normal_ready) NormalRoute::prepare_for_deep_sleep();
+      if (alarm_ready)  AlarmRoute::prepare_for_deep_sleep();
+    }
+
+    #ifdef CONFIG_IOT_DOWNLINK
+      static bool has_command() {
+        return NormalRoute::has_command() || AlarmRoute::has_command();
+      }
+
+      // A route may only be able to wait on its own input (e.g. the UDP
+      // socket): with both routes ready, they are polled in turn.
+      static void wait_downlink(int timeout_ms) {
+        if (!alarm_ready)  return NormalRoute::wait_downlink(timeout_ms);
+        if (!normal_ready) return AlarmRoute::wait_downlink(timeout_ms);
+
+        int64_t deadline = esp_timer_get_time() + (int64_t) timeout_ms * 1000;
+        int     remaining;
+
+        while (!has_command() && ((remaining = (deadline - esp_timer_get_time()) / 1000) > 0)) {
+          NormalRoute::wait_downlink(std::min(remaining, DOWNLINK_POLL_MS));
+          AlarmRoute::wait_downlink(0);
+        }
+      }
+
+      static int process_commands(DownlinkHandler * handler) {
+        return NormalRoute::process_commands(handler) + AlarmRoute::process_commands(handler);
+      }
+    #endif
+};
+
+#if defined(CONFIG_IOT_ENABLE_UDP) && defined(CONFIG_IOT_ENABLE_ESP_NOW)
+  typedef DualTransport<UDPTransport, ESPNowTransport> Transport;
+#elif defined(CONFIG_IOT_ENABLE_UDP)
+  typedef UDPTransport Transport;
+#else
+  typedef ESPNowTransport Transport;
+#endif
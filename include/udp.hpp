@@ -10,17 +10,140 @@
 
 #include <lwip/sockets.h>
 
+#ifdef CONFIG_IOT_DOWNLINK
+  #include "downlink.hpp"
+#endif
+
+/// UDP Delivery Verification
+///
+/// When CONFIG_IOT_UDP_ACK is enabled, every frame is preceded by a 16 bits
+/// sequence number (little-endian), in front of the CRC:
+///
+///     +-----------+-----------+-------------------+
+///     | seq (u16) | crc (u16) | payload           |
+///     +-----------+-----------+-------------------+
+///
+/// The gateway acknowledges a frame by sending back its first 4 bytes (seq
+/// and crc) to the source address and port. A frame that is not acknowledged
+/// within the retransmission timeout (RTO) is sent again, up to
+/// CONFIG_IOT_UDP_ACK_RETRIES times, doubling the RTO each time. The gateway
+/// must acknowledge again, but otherwise ignore, a frame with the same
+/// sequence number as the last one received from a device.
+///
+/// The RTO is computed from the measured round-trip times as described in
+/// RFC 6298, and bounded by CONFIG_IOT_UDP_ACK_MIN_RTO and
+/// CONFIG_IOT_UDP_ACK_MAX_RTO. Following Karn's algorithm, the round-trip time
+/// of retransmitted frames is not measured. The estimator is kept in RTC
+/// memory across deep sleep cycles.
+
+/// Gateway Address Cache
+///
+/// The addresses of the gateway are resolved once and kept in RTC memory
+/// with all the addresses returned by the DNS, such that the following wake
+/// up cycles don't wait on the DNS. They are resolved again when
+/// CONFIG_IOT_UDP_DNS_CACHE_TTL seconds have elapsed, or once all of them have
+/// failed. After CONFIG_IOT_UDP_FAILOVER_THRESHOLD consecutive send failures
+/// (frames not acknowledged with CONFIG_IOT_UDP_ACK), the next address is used.
+/// Without CONFIG_IOT_UDP_ACK, only the errors returned by the socket are
+/// failures: a gateway that doesn't answer is not detected.
+///
+/// When the name cannot be resolved, there is no address: frames are not
+/// sent (ESP_ERR_INVALID_STATE) and the name is resolved again, at most every
+/// RESOLVE_RETRY_INTERVAL seconds.
+
+/// Downlink Commands
+///
+/// With CONFIG_IOT_DOWNLINK, command frames (see downlink.hpp) are received
+/// on the socket used to send, from the gateway address only. There is no
+/// receive task: the socket is read while waiting for an ack and during the
+/// receive window (see **wait_downlink()**), in the application task.
+
 class UDP
 {
+  public:
+    static constexpr const int MAX_PKT_SIZE = 1450;
+    static constexpr const int MAX_ADDRS    = 4;
+
+    struct DNSCache {
+      uint32_t magic;
+      uint16_t name_crc;         // CRC of the gateway name the addresses belong to
+      uint8_t  count;            // Number of addresses, 0 if not resolved
+      uint8_t  current;          // Address in use
+      uint8_t  failures;         // Consecutive send failures on the current address
+      uint8_t  failed_count;     // Addresses that failed since the resolution
+      time_t   resolved_time;
+      uint32_t addrs[MAX_ADDRS]; // Network byte order
+    };
+
+    #ifdef CONFIG_IOT_UDP_ACK
+      struct AckState {
+        uint32_t magic;
+        uint16_t seq;              // Sequence number of the next frame
+        int32_t  srtt;             // Smoothed round-trip time in usec, 0 if not measured yet
+        int32_t  rttvar;           // Round-trip time variation in usec
+        uint32_t retransmit_count; // Counters since the last reset
+        uint32_t lost_count;
+      };
+    #endif
+
   private:
     static constexpr char const * TAG = "UDP Class";
 
     int                sock;
-    struct sockaddr_in dest_addr;
+    struct sockaddr_in dest_addr;  // INADDR_ANY when the gateway name is not resolved
+    int64_t            resolve_time; // Last failed resolution (esp_timer time)
+
+    static uint8_t     frame[FRAME_HEADROOM + MAX_PKT_SIZE + 1]; // + 1 for the text encoder null character
+    static DNSCache    dns_cache;
+
+    static constexpr uint32_t   DNS_MAGIC       = 0x444E5331; // DNS1
+    static constexpr const int  RESOLVE_RETRY_INTERVAL = 10;  // Seconds
+
+    esp_err_t             send_pkt(const uint8_t * pkt, int len);
+    esp_err_t              resolve(uint16_t name_crc);
+    bool             cache_is_valid(uint16_t name_crc);
+    bool                route_ready();
+    void                  send_done(esp_err_t status);
+    inline void      set_dest_addr() { dest_addr.sin_addr.s_addr = dns_cache.addrs[dns_cache.current]; }
+
+    #if defined(CONFIG_IOT_UDP_ACK) || defined(CONFIG_IOT_DOWNLINK)
+      int                   recv_pkt(uint8_t * buff, int size, int64_t deadline);
+    #endif
+
+    #ifdef CONFIG_IOT_DOWNLINK
+      static DownlinkRing downlink_ring;
+    #endif
+
+    #ifdef CONFIG_IOT_UDP_ACK
+      static constexpr uint32_t   ACK_MAGIC       = 0x41434B31; // ACK1
+      static constexpr const int  ACK_HEADER_SIZE = 2;
+      static constexpr const int  ACK_SIZE        = 4;          // seq + crc
+
+      esp_err_t          send_with_ack(uint8_t * pkt, int len);
+      esp_err_t               wait_ack(const uint8_t * expected, int timeout_ms);
+      void                  update_rtt(int32_t rtt);
+    #endif
 
   public:
     esp_err_t                   init();
-    esp_err_t                   send(const uint8_t * data, int len);
+    esp_err_t                   send(uint8_t * data, int len);
+
+    #ifdef CONFIG_IOT_UDP_ACK
+      /// Returns the current retransmission timeout in milliseconds.
+      int                   get_rto_ms();
+      uint32_t  get_retransmit_count();
+      uint32_t        get_lost_count();
+    #endif
+
+    #ifdef CONFIG_IOT_DOWNLINK
+      void             wait_downlink(int timeout_ms);
+      inline bool        has_command() { return !downlink_ring.is_empty(); }
+      inline int    process_commands(DownlinkHandler * handler) { return downlink_dispatch(downlink_ring, handler); }
+    #endif
+
+    /// Returns a buffer, preceded by FRAME_HEADROOM bytes, into which a frame
+    /// can be built before being sent.
+    inline uint8_t * get_send_buffer() { return &frame[FRAME_HEADROOM]; }
     void      prepare_for_deep_sleep();
 };
 
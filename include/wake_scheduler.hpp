@@ -0,0 +1,103 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <ctime>
+
+/// Wake Scheduler
+///
+/// Named deadlines, kept in RTC memory across deep sleep in a min-heap
+/// ordered by expiry time. The framework sleeps until the earliest of them
+/// and, on wake up, collects all the deadlines expired by then, along with
+/// the ones expiring within CONFIG_IOT_WAKE_COALESCE seconds: close deadlines
+/// are served by a single wake up instead of one each.
+///
+/// A deadline is identified by a small integer, such that the set of deadlines
+/// fired by a wake up is a bit mask (see **get_fired()**). The framework uses:
+///
+/// - WATCHDOG_ID: periodic, every watchdog_interval seconds;
+/// - RETRY_ID: backoff after a failed wake up (deadline expired, gateway not
+///   found).
+///
+/// The application ids, from APP_ID, are free for the application to use,
+/// e.g. one per sensor sampling period. A periodic deadline is re-armed from
+/// its expiry time, not from the time it was collected: it keeps its phase,
+/// and a deadline collected early through coalescing doesn't drift.
+///
+/// Scheduling an id already in use replaces its deadline.
+///
+/// Fleet behavior: devices reset at the same time (e.g. after a power
+/// failure) would otherwise transmit together at every period. The periodic
+/// deadlines are shifted by **slot_offset()**, derived from the device MAC
+/// address, and the retries wait for **backoff()**, a decorrelated jittered
+/// delay. tools/collision_sim.py shows the effect on the gateway collisions.
+
+class WakeScheduler
+{
+  public:
+    static constexpr const uint8_t WATCHDOG_ID   = 0;
+    static constexpr const uint8_t RETRY_ID      = 1;
+    static constexpr const uint8_t APP_ID        = 2;
+    static constexpr const uint8_t MAX_ID        = 31;
+    static constexpr const int     MAX_DEADLINES = CONFIG_IOT_WAKE_MAX_DEADLINES;
+    static constexpr const int     NAME_SIZE     = 11;
+
+    struct Deadline {
+      time_t   time;              ///< Expiry time
+      uint32_t period;            ///< Seconds, 0 for a one-shot deadline
+      uint8_t  id;
+      char     name[NAME_SIZE];   ///< For the log only
+    };
+
+    struct State {
+      uint32_t magic;
+      int      count;
+      Deadline heap[MAX_DEADLINES];
+    };
+
+  private:
+    static constexpr char const * TAG = "Wake Scheduler";
+
+    static constexpr uint32_t WAKE_MAGIC = 0x57414B31; // WAK1
+
+    uint32_t fired;
+
+    int            find(uint8_t id);
+    void        sift_up(int i);
+    void      sift_down(int i);
+    void         remove(int i);
+    void           seal();
+
+  public:
+    /// Clear the deadlines after a reset, or if the RTC memory copy is
+    /// corrupted. Returns true if the deadlines have been cleared: the
+    /// framework then schedules its own again.
+    bool             init(bool reset);
+
+    /// Schedule the deadline **id** in **delay** seconds, repeated every
+    /// **period** seconds if not 0.
+    esp_err_t    schedule(uint8_t id, const char * name, uint32_t delay, uint32_t period = 0);
+    esp_err_t      cancel(uint8_t id);
+
+    /// Fire the deadlines expiring by now, plus the coalescing tolerance, and
+    /// re-arm the periodic ones. Returns the mask of the fired deadline ids.
+    uint32_t      collect();
+
+    /// Time of the earliest deadline, 0 if there is none.
+    time_t      next_wake();
+
+    /// Offset in [0, **period**) seconds, from a hash of the device MAC
+    /// address and **id**: the first delay of a periodic deadline spreads
+    /// the devices of a fleet over the period.
+    static uint32_t slot_offset(uint8_t id, uint32_t period);
+
+    /// Decorrelated jittered backoff: a random delay between **base** and
+    /// three times the **last** one, up to **cap**, in msec: the wake up
+    /// times don't fall on the same second. **last** is updated, and is to
+    /// be kept at 0 by the caller until a failure.
+    static uint32_t     backoff(uint32_t & last, uint32_t base, uint32_t cap);
+
+    inline bool    is_scheduled(uint8_t id) { return find(id) >= 0; }
+    inline uint32_t   get_fired() { return fired; }
+    inline bool       has_fired(uint8_t id) { return (id <= MAX_ID) && ((fired & (1UL << id)) != 0); }
+};
@@ -4,6 +4,7 @@
 #include <mutex>
 #include <esp_wifi.h>
 #include <esp_event.h>
+#include <esp_netif.h>
 
 #include "config.hpp"
 
@@ -25,6 +26,22 @@ class Wifi
         DISCONNECTED,
         ERROR
       };
+
+      #ifdef CONFIG_IOT_WIFI_FAST_REJOIN
+        /// Kept in RTC memory to rejoin the network after deep sleep without
+        /// scanning for the AP nor waiting for DHCP.
+        struct RejoinData {
+          uint32_t magic;
+          uint8_t  bssid[6];
+          uint8_t  channel;
+          uint32_t ip;
+          uint32_t netmask;
+          uint32_t gw;
+          uint32_t dns;
+          time_t   lease_time;     // When the address was obtained through DHCP
+          uint16_t crc;
+        } __attribute__((packed));
+      #endif
     #endif
 
   private:
@@ -48,8 +65,22 @@ class Wifi
 
       static esp_err_t  connect(void);
 
+      static esp_netif_t * netif;
+      static int64_t       start_time;      // Per-phase timings, in usec since boot
+      static int64_t       associated_time;
+
       wifi_init_config_t wifi_init_cfg;
       wifi_config_t      wifi_sta_cfg;
+
+      #ifdef CONFIG_IOT_WIFI_FAST_REJOIN
+        static constexpr uint32_t REJOIN_MAGIC = 0x524A4E31; // RJN1
+
+        static bool        fast_rejoin;
+
+        static bool    rejoin_data_valid();
+        static void     save_rejoin_data();
+        static void  cancel_fast_rejoin(Wifi * wifi);
+      #endif
     #endif
 
   public:
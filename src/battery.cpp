@@ -13,6 +13,19 @@ esp_err_t Battery::init()
   gpio_set_direction(VOLTAGE_ENABLE, GPIO_MODE_OUTPUT);
   gpio_set_level(VOLTAGE_ENABLE, 0);
 
+  voltage_level = 0.0;
+
+  return ESP_OK;
+}
+
+/// Read the voltage level once per wake up cycle. The value is kept for the
+/// messages sent during the cycle, see **get_voltage_level()**.
+esp_err_t Battery::sample()
+{
+  voltage_level = read_voltage_level();
+
+  ESP_LOGD(TAG, "Battery voltage level: %4.2f", voltage_level);
+
   return ESP_OK;
 }
 
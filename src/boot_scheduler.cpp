@@ -0,0 +1,54 @@
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "boot_scheduler.hpp"
+#include "global.hpp"
+
+EventGroupHandle_t BootScheduler::events = nullptr;
+
+void BootScheduler::step_task(void * param)
+{
+  const Step * step = (const Step *) param;
+
+  if (step->requires != 0) {
+    xEventGroupWaitBits(events, step->requires, pdFALSE, pdTRUE, portMAX_DELAY);
+  }
+
+  int64_t   start  = esp_timer_get_time();
+  esp_err_t result = step->handler();
+
+  if (result != ESP_OK) {
+    ESP_LOGE(TAG, "Step %s failed: %s", step->name, esp_err_to_name(result));
+    ESP_ERROR_CHECK(result);
+  }
+
+  ESP_LOGD(TAG, "Step %s completed at %d msec, in %d msec, on core %d.",
+           step->name,
+           (int)(esp_timer_get_time() / 1000),
+           (int)((esp_timer_get_time() - start) / 1000),
+           xPortGetCoreID());
+
+  xEventGroupSetBits(events, step->provides);
+
+  vTaskDelete(nullptr);
+}
+
+esp_err_t BootScheduler::start(EventGroupHandle_t event_group, const Step * steps, int count, EventBits_t & all_bits)
+{
+  esp_log_level_set(TAG, cfg.log_level);
+
+  events   = event_group;
+  all_bits = 0;
+
+  for (int i = 0; i < count; i++) {
+    if (xTaskCreatePinnedToCore(step_task, steps[i].name, STACK_SIZE, (void *) &steps[i],
+                                uxTaskPriorityGet(nullptr), nullptr, steps[i].core) != pdPASS) {
+      ESP_LOGE(TAG, "Unable to create the %s step task.", steps[i].name);
+      return ESP_ERR_NO_MEM;
+    }
+
+    all_bits |= steps[i].provides;
+  }
+
+  return ESP_OK;
+}
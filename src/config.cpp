@@ -166,7 +166,7 @@ esp_err_t Config::retrieve_cfg()
     #ifdef CONFIG_IOT_ENABLE_UDP
       cfg.udp.port            = get_val(                        "udp", "port",            CONFIG_IOT_UDP_PORT,         1, 65535);
       cfg.udp.max_pkt_size    = get_val(                        "udp", "max_pkt_size",    CONFIG_IOT_UDP_MAX_PKT_SIZE, 2,  1450);
-                                get_str(cfg.udp.gateway_address "udp", "gateway_address", CONFIG_IOT_GATEWAY_ADDRESS ,      128);
+                                get_str(cfg.udp.gateway_address, "udp", "gateway_address", CONFIG_IOT_GATEWAY_ADDRESS ,      128);
                                 get_str(cfg.udp.wifi_ssid,      "udp", "wifi_ssid",       CONFIG_IOT_WIFI_UDP_STA_SSID,      32);
                                 get_str(cfg.udp.wifi_psw,       "udp", "wifi_psw",        CONFIG_IOT_WIFI_UDP_STA_PASS,      32);
     #endif
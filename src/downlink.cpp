@@ -0,0 +1,63 @@
+#include "config.hpp"
+
+#ifdef CONFIG_IOT_DOWNLINK
+
+#include <cstring>
+#include <esp_crc.h>
+#include <esp_log.h>
+
+#include "downlink.hpp"
+
+static constexpr char const * TAG = "Downlink";
+
+bool downlink_check(const uint8_t * frame, int len, uint8_t marker)
+{
+  uint16_t crc;
+
+  if ((len <= DOWNLINK_HEADER_SIZE) || (len > DOWNLINK_FRAME_SIZE) || (frame[2] != marker)) return false;
+
+  memcpy(&crc, frame, 2);
+
+  return esp_crc16_le(UINT16_MAX, &frame[2], len - 2) == crc;
+}
+
+// Called from the Wifi task (ESP-NOW) or the application task (UDP), the
+// only producer of **ring**.
+esp_err_t downlink_push(DownlinkRing & ring, const uint8_t * frame, int len)
+{
+  if ((len <= DOWNLINK_HEADER_SIZE) || (len > DOWNLINK_FRAME_SIZE)) return ESP_ERR_INVALID_SIZE;
+
+  if (!downlink_check(frame, len, DOWNLINK_MARKER)) {
+    ESP_LOGD(TAG, "Invalid frame of %d bytes ignored.", len);
+    return ESP_ERR_INVALID_CRC;
+  }
+
+  DownlinkCmd * cmd = ring.reserve();
+
+  if (cmd == nullptr) {
+    ESP_LOGW(TAG, "Command queue is full, command is lost.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  cmd->len = len - DOWNLINK_HEADER_SIZE;
+  memcpy(cmd->data, &frame[DOWNLINK_HEADER_SIZE], cmd->len);
+  ring.commit();
+
+  return ESP_OK;
+}
+
+int downlink_dispatch(DownlinkRing & ring, DownlinkHandler * handler)
+{
+  DownlinkCmd * cmd;
+  int           count = 0;
+
+  while ((cmd = ring.front()) != nullptr) {
+    if (handler != nullptr) handler(cmd->data, cmd->len);
+    ring.pop();
+    count++;
+  }
+
+  return count;
+}
+
+#endif
\ No newline at end of file
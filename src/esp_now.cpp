@@ -4,11 +4,13 @@
 
 #ifdef CONFIG_IOT_ENABLE_ESP_NOW
 
+#include <algorithm>
 #include <cstring>
-#include <cmath>
+#include <cstdlib>
 #include <esp_crc.h>
 #include <esp_wifi.h>
 #include <esp_system.h>
+#include <esp_timer.h>
 #include <assert.h>
 
 #include "utils.hpp"
@@ -21,10 +23,25 @@
 
 RTC_NOINIT_ATTR bool     ap_failed;
 RTC_NOINIT_ATTR uint32_t gateway_access_error_count;
-
-bool              ESPNow::abort             = false;
-QueueHandle_t     ESPNow::send_queue_handle = nullptr;
-ESPNow::SendEvent ESPNow::send_event;
+RTC_NOINIT_ATTR uint32_t gateway_backoff;            // Last search backoff (msec), 0 once a gateway is found
+
+// Gateway peer set. The RTC memory copy is the most recent one, NVS is only
+// written when the set or the gateway in use changes.
+RTC_NOINIT_ATTR NVSMgr::NVSData gateways;
+RTC_NOINIT_ATTR uint16_t        gateways_crc;
+RTC_NOINIT_ATTR uint8_t         failure_count;   // Consecutive failures of the gateway in use
+RTC_NOINIT_ATTR uint8_t         failed_count;    // Gateways that failed in a row
+
+bool                  ESPNow::abort             = false;
+QueueHandle_t         ESPNow::send_queue_handle = nullptr;
+ESPNow::Frame         ESPNow::window[WINDOW_SIZE];
+std::atomic<uint32_t> ESPNow::sent_count        = 0;
+std::atomic<uint32_t> ESPNow::callback_count    = 0;
+uint32_t              ESPNow::done_count        = 0;
+
+#ifdef CONFIG_IOT_DOWNLINK
+  DownlinkRing        ESPNow::downlink_ring;
+#endif
 
 esp_err_t ESPNow::init()
 {
@@ -32,68 +49,284 @@ esp_err_t ESPNow::init()
 
   esp_log_level_set(TAG, cfg.log_level);
 
-  send_queue_handle = xQueueCreate(5, sizeof(send_event));
+  send_queue_handle = xQueueCreate(WINDOW_SIZE + 1, sizeof(SendEvent));
   if (send_queue_handle == nullptr) {
     ESP_LOGE(TAG, "Unable to create send queue.");
     return ESP_FAIL;
   }
 
-  // Retrieve AP info from nvs and check reset type
-
-  nvs_mgr.get_nvs_data();
-
   if (iot.was_reset()) {
     gateway_access_error_count = 0;
+    gateway_backoff = 0;
     ap_failed = false;
   }
 
-  if (!(nvs_mgr.is_data_valid() && !ap_failed && !iot.was_reset())) {
-    ESP_ERROR_CHECK(search_ap());
-    NVSMgr::NVSData nvs_data;
-    memcpy(&nvs_data.gateway_mac_addr, &ap_mac_addr, 6);
-    nvs_data.rssi = wifi.get_rssi();
-    ESP_ERROR_CHECK(nvs_mgr.set_nvs_data(&nvs_data));
+  #ifdef CONFIG_IOT_ESPNOW_LINK_ADAPT
+    link.init();
+  #endif
+
+  // Retrieve the gateway peer set from RTC memory, or from nvs after a reset
+
+  bool valid = !iot.was_reset() &&
+               (gateways_crc == esp_crc16_le(UINT16_MAX, (const uint8_t *) &gateways, sizeof(gateways)));
+
+  if (!valid) {
+    failure_count = 0;
+    failed_count  = 0;
+    if (nvs_mgr.get_nvs_data() == ESP_OK) {
+      memcpy(&gateways, nvs_mgr.get_data(), sizeof(gateways));
+    }
+    else {
+      memset(&gateways, 0, sizeof(gateways));
+    }
+  }
+
+  valid = (gateways.count > 0) && (gateways.count <= NVSMgr::MAX_GATEWAYS) && (gateways.current < gateways.count);
+  if (!valid) memset(&gateways, 0, sizeof(gateways));
+
+  int index = gateways.current;
+
+  if (!(valid && !ap_failed && !iot.was_reset())) {
+    int64_t start = esp_timer_get_time();
+
+    #ifdef CONFIG_IOT_ESPNOW_FAST_RECONNECT
+      // The gateway in use last time is probed first. The full scan is only
+      // required if it doesn't answer.
+      if (!(valid && (probe_ap(gateways.gateways[gateways.current]) == ESP_OK))) {
+        if (search_ap() != ESP_OK) return ESP_FAIL;
+      }
+    #else
+      if (search_ap() != ESP_OK) return ESP_FAIL;
+    #endif
+
+    ESP_LOGI(TAG, "Gateway found in %d msec.", (int)((esp_timer_get_time() - start) / 1000));
+
+    index = best_gateway();
+    save_gateways(true);
   }
   else {
-    wifi.set_rssi(nvs_mgr.get_data()->rssi);
-    memcpy(&ap_mac_addr, nvs_mgr.get_data()->gateway_mac_addr, 6);
+    // Switch to a better ranked gateway only if the difference is significant,
+    // to avoid alternating between two similar ones.
+    int best = best_gateway();
+    if (rank(gateways.gateways[best]) > (rank(gateways.gateways[index]) + RANK_HYSTERESIS)) index = best;
   }
 
   static_assert(sizeof(CONFIG_IOT_ESPNOW_PMK) == 17, "The Exerciser's PMK must be 16 characters long.");
 
-  ESP_ERROR_CHECK(esp_now_init());
-  ESP_ERROR_CHECK(esp_now_register_send_cb(send_handler));
-  ESP_ERROR_CHECK(status = esp_now_set_pmk((const uint8_t *) cfg.esp_now.primary_master_key));
+  // Errors are returned to the caller: with the dual transport, the other
+  // route can still be used.
+  if ((status = esp_now_init()) == ESP_OK) {
+    status = esp_now_register_send_cb(send_handler);
+    #ifdef CONFIG_IOT_DOWNLINK
+      if (status == ESP_OK) status = esp_now_register_recv_cb(recv_handler);
+    #endif
+    if (status == ESP_OK) status = esp_now_set_pmk((const uint8_t *) cfg.esp_now.primary_master_key);
+    if (status == ESP_OK) status = use_gateway(index, true);
+
+    if (status != ESP_OK) prepare_for_deep_sleep();
+  }
 
-  esp_now_peer_info_t peer;
-  memset(&peer, 0, sizeof(esp_now_peer_info_t));
+  if (status != ESP_OK) {
+    ESP_LOGE(TAG, "ESP-NOW initialization failed: %s.", esp_err_to_name(status));
+    vQueueDelete(send_queue_handle);
+    send_queue_handle = nullptr;
+  }
 
-  memcpy(peer.peer_addr, ap_mac_addr, 6);
+  return status;
+}
 
-  peer.channel   = cfg.esp_now.channel;
-  peer.ifidx     = (wifi_interface_t) ESP_IF_WIFI_STA;
+// Gateways are ranked on their send success rate first, their RSSI second.
+int ESPNow::rank(const NVSMgr::Gateway & gw)
+{
+  return gw.ack_rate + RSSI_RANK_FACTOR * (gw.rssi + 100);
+}
 
-  if (cfg.esp_now.encryption_enabled) {
-    static_assert(sizeof(CONFIG_IOT_ESPNOW_LMK) == 17, "The Exerciser's LMK must be 16 characters long.");
+int ESPNow::find_gateway(const uint8_t * mac_addr)
+{
+  for (int i = 0; i < gateways.count; i++) {
+    if (memcmp(gateways.gateways[i].mac_addr, mac_addr, sizeof(MacAddr)) == 0) return i;
+  }
 
-    peer.encrypt   = true;
-    memcpy(peer.lmk, cfg.esp_now.local_master_key, ESP_NOW_KEY_LEN);
+  return -1;
+}
+
+int ESPNow::best_gateway(int exclude)
+{
+  int best = -1;
+
+  for (int i = 0; i < gateways.count; i++) {
+    if ((i != exclude) && ((best < 0) || (rank(gateways.gateways[i]) > rank(gateways.gateways[best])))) best = i;
+  }
+
+  return best;
+}
+
+// Add a gateway heard by a scan or a probe to the peer set, or update its RSSI
+// if already known. When the set is full, the worst ranked gateway is replaced
+// if the new one would rank better.
+void ESPNow::add_gateway(const uint8_t * mac_addr, uint8_t ch, int8_t rssi)
+{
+  int index = find_gateway(mac_addr);
+
+  if (index >= 0) {
+    NVSMgr::Gateway & gw = gateways.gateways[index];
+    gw.rssi    = gw.rssi + (rssi - gw.rssi) / RSSI_WEIGHT;
+    gw.channel = ch;
+    return;
+  }
+
+  NVSMgr::Gateway gw;
+  memcpy(gw.mac_addr, mac_addr, sizeof(MacAddr));
+  gw.channel  = ch;
+  gw.rssi     = rssi;
+  gw.ack_rate = 255;
+
+  #ifdef CONFIG_IOT_ESPNOW_LINK_ADAPT
+    link.seed(gw);
+  #endif
+
+  if (gateways.count < NVSMgr::MAX_GATEWAYS) {
+    index = gateways.count++;
   }
   else {
-    peer.encrypt   = false;
+    index = 0;
+    for (int i = 1; i < gateways.count; i++) {
+      if (rank(gateways.gateways[i]) < rank(gateways.gateways[index])) index = i;
+    }
+    if (rank(gateways.gateways[index]) >= rank(gw)) return;
   }
 
-  ESP_LOGD(TAG, "AP Peer MAC address: " MACSTR, MAC2STR(peer.peer_addr));
+  gateways.gateways[index] = gw;
+}
+
+// Select the gateway to which frames are sent. When **add_peer** is true,
+// ESP-NOW is already initialized: the gateway is added as a peer (if not
+// already known) and the radio is moved to its channel. Previous peers are
+// kept such that the send callbacks of outstanding frames are still received.
+esp_err_t ESPNow::use_gateway(int index, bool add_peer)
+{
+  esp_err_t         status = ESP_OK;
+  NVSMgr::Gateway & gw     = gateways.gateways[index];
+
+  memcpy(&ap_mac_addr, gw.mac_addr, sizeof(MacAddr));
+  channel = gw.channel;
+  wifi.set_rssi(gw.rssi);
+
+  if (add_peer) {
+    if (!esp_now_is_peer_exist(ap_mac_addr)) {
+      esp_now_peer_info_t peer;
+      memset(&peer, 0, sizeof(esp_now_peer_info_t));
+
+      memcpy(peer.peer_addr, ap_mac_addr, 6);
+
+      peer.channel   = channel;
+      peer.ifidx     = (wifi_interface_t) ESP_IF_WIFI_STA;
 
-  ESP_ERROR_CHECK(status = esp_now_add_peer(&peer));
-  ESP_ERROR_CHECK(esp_wifi_set_channel(cfg.esp_now.channel, WIFI_SECOND_CHAN_NONE));
+      if (cfg.esp_now.encryption_enabled) {
+        static_assert(sizeof(CONFIG_IOT_ESPNOW_LMK) == 17, "The Exerciser's LMK must be 16 characters long.");
+
+        peer.encrypt   = true;
+        memcpy(peer.lmk, cfg.esp_now.local_master_key, ESP_NOW_KEY_LEN);
+      }
+      else {
+        peer.encrypt   = false;
+      }
+
+      ESP_LOGD(TAG, "AP Peer MAC address: " MACSTR, MAC2STR(peer.peer_addr));
+
+      #ifdef CONFIG_IOT_ENABLE_UDP
+        peer.channel = 0; // The Wifi connection owns the radio channel
+      #endif
+
+      if ((status = esp_now_add_peer(&peer)) != ESP_OK) return status;
+    }
+
+    #ifndef CONFIG_IOT_ENABLE_UDP
+      status = esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+    #endif
+
+    #ifdef CONFIG_IOT_ESPNOW_LINK_ADAPT
+      if (status == ESP_OK) status = link.apply(gw);
+    #endif
+  }
+
+  if (index != gateways.current) {
+    ESP_LOGI(TAG, "Gateway " MACSTR " in use (%d of %d), channel %d, success rate %d%%, RSSI %d.",
+             MAC2STR(ap_mac_addr), index + 1, gateways.count, channel, gw.ack_rate * 100 / 255, gw.rssi);
+    gateways.current = index;
+    failure_count    = 0;
+    save_gateways(true);
+  }
+  else {
+    save_gateways(false);
+  }
 
   return status;
 }
 
+// Account for the result of a frame sent to **mac_addr** (nullptr if unknown:
+// the gateway in use). After CONFIG_IOT_ESPNOW_FAILOVER_THRESHOLD consecutive
+// failures, the next best gateway is used. The results of the gateway in use
+// also drive its link adaptation.
+void ESPNow::update_gateway(const uint8_t * mac_addr, bool success)
+{
+  int index = (mac_addr != nullptr) ? find_gateway(mac_addr) : gateways.current;
+  if (index < 0) return;
+
+  NVSMgr::Gateway & gw = gateways.gateways[index];
+  gw.ack_rate = gw.ack_rate + ((success ? 255 : 0) - gw.ack_rate) / ACK_RATE_WEIGHT;
+
+  if (index == gateways.current) {
+    #ifdef CONFIG_IOT_ESPNOW_LINK_ADAPT
+      link.update(gw, success, get_outstanding());
+    #endif
+
+    if (success) {
+      failure_count = 0;
+      failed_count  = 0;
+    }
+    else if (++failure_count >= CONFIG_IOT_ESPNOW_FAILOVER_THRESHOLD) {
+      int next = best_gateway(index);
+
+      if ((++failed_count >= gateways.count) || (next < 0)) {
+        ESP_LOGW(TAG, "All the gateways failed. Discovery to be done at next wake up.");
+        failure_count = 0;
+        failed_count  = 0;
+        ap_failed     = true;
+      }
+      else {
+        ESP_LOGW(TAG, "%d consecutive failures. Gateway failover.", failure_count);
+        use_gateway(next, true);
+        return;
+      }
+    }
+  }
+
+  save_gateways(false);
+}
+
+// The RTC memory copy is protected by a CRC. NVS is written only when
+// **persist** is true, to limit flash wear.
+void ESPNow::save_gateways(bool persist)
+{
+  gateways_crc = esp_crc16_le(UINT16_MAX, (const uint8_t *) &gateways, sizeof(gateways));
+
+  if (persist && (nvs_mgr.set_nvs_data(&gateways) != ESP_OK)) {
+    ESP_LOGW(TAG, "Unable to save the gateway peer set in nvs.");
+  }
+}
+
+// Called from the Wifi task. Callbacks are received in the order the frames
+// were sent, so the callback count is the sequence number of the frame
+// (realigned after a lost callback, see **resync_callbacks()**).
+
 void ESPNow::send_handler(const uint8_t * mac_addr, esp_now_send_status_t status)
 {
-  ESP_LOGD(TAG, "Send Event for " MACSTR ": %s.", MAC2STR(mac_addr), status == ESP_NOW_SEND_SUCCESS ? "OK" : "FAILED");
+  SendEvent send_event;
+
+  send_event.seq = callback_count.fetch_add(1);
+
+  ESP_LOGD(TAG, "Send Event for frame %u " MACSTR ": %s.", send_event.seq, MAC2STR(mac_addr), status == ESP_NOW_SEND_SUCCESS ? "OK" : "FAILED");
 
   if (send_queue_handle != nullptr) {
     memcpy(send_event.mac_addr, mac_addr, 6);
@@ -102,78 +335,297 @@ void ESPNow::send_handler(const uint8_t * mac_addr, esp_now_send_status_t status
       ESP_LOGW(TAG, "Message Queue is full, message is lost.");
     }
   }
+
+  iot.notify(IoT::SEND_DONE);
+}
+
+#ifdef CONFIG_IOT_DOWNLINK
+  // Called from the Wifi task. Frames from unknown senders are ignored. The
+  // peer set is only read here: a gateway being replaced at the same time
+  // can at worst cause one frame to be wrongly accepted or ignored.
+  void ESPNow::recv_handler(const uint8_t * mac_addr, const uint8_t * data, int len)
+  {
+    if (find_gateway(mac_addr) < 0) {
+      ESP_LOGD(TAG, "Frame from unknown sender " MACSTR " ignored.", MAC2STR(mac_addr));
+      return;
+    }
+
+    #ifdef CONFIG_IOT_OTA
+      if ((len > 2) && (data[2] == OTA_MARKER)) {
+        if (ota.push(data, len) == ESP_OK) iot.notify(IoT::DOWNLINK_READY);
+        return;
+      }
+    #endif
+
+    if (downlink_push(downlink_ring, data, len) == ESP_OK) iot.notify(IoT::DOWNLINK_READY);
+  }
+
+  /// Wait for a command for up to **timeout_ms**. Returns at once if one is
+  /// already queued.
+  void ESPNow::wait_downlink(int timeout_ms)
+  {
+    if (has_command()) return;
+
+    xEventGroupWaitBits(iot.get_ready_events(), IoT::DOWNLINK_READY, pdFALSE, pdFALSE, pdMS_TO_TICKS(timeout_ms));
+  }
+#endif
+
+void ESPNow::send_failed(Frame & frame)
+{
+  iot.send_failed(frame.payload(), frame.len);
+}
+
+// Process the result of the oldest outstanding frame. If no result is received
+// before the timeout, the frame is considered lost, and the callback tags are
+// moved past it (see **resync_callbacks()**).
+
+esp_err_t ESPNow::wait_send_event(TickType_t timeout)
+{
+  SendEvent evt;
+
+  if (xQueueReceive(send_queue_handle, &evt, timeout) != pdTRUE) {
+    ESP_LOGE(TAG, "No answer after frame %u sent.", done_count);
+    send_failed(window[done_count % WINDOW_SIZE]);
+    done_count++;
+    resync_callbacks();
+    update_gateway(nullptr, false);
+    return ESP_ERR_TIMEOUT;
+  }
+
+  if ((int32_t)(evt.seq - done_count) < 0) {
+    ESP_LOGW(TAG, "Late send event for frame %u ignored.", evt.seq);
+    return ESP_OK;
+  }
+
+  // The results come in order: this is the one of the oldest outstanding
+  // frame, even when a late callback made the tag run ahead.
+  uint32_t seq = done_count++;
+
+  update_gateway(evt.mac_addr, evt.status == ESP_OK);
+
+  if (evt.status != ESP_OK) {
+    ESP_LOGE(TAG, "Frame %u not received by the gateway.", seq);
+    send_failed(window[seq % WINDOW_SIZE]);
+    return ESP_FAIL;
+  }
+
+  ESP_LOGD(TAG, "Frame %u transmitted.", seq);
+  return ESP_OK;
+}
+
+// Align the send callback tags on the oldest outstanding frame. The send
+// callback carries no frame id: without this, once a frame timed out, the
+// results of the next ones would be tagged with the sequence of the frame
+// before them, and ignored as late. With no frame outstanding, the send
+// events still queued are late ones: dropped.
+void ESPNow::resync_callbacks()
+{
+  if (done_count == sent_count) {
+    SendEvent evt;
+
+    while ((send_queue_handle != nullptr) && (xQueueReceive(send_queue_handle, &evt, 0) == pdTRUE)) {
+      ESP_LOGW(TAG, "Late send event ignored.");
+    }
+
+    callback_count = done_count;
+    return;
+  }
+
+  uint32_t count = callback_count;
+
+  // A callback may be counted meanwhile.
+  while (((int32_t)(count - done_count) < 0) && !callback_count.compare_exchange_weak(count, done_count)) {}
 }
 
-esp_err_t ESPNow::send(const uint8_t * data, int len)
+// Wait for a free slot in the window. A slot is reused only when the
+// send callback of the frame it contains has been received.
+esp_err_t ESPNow::wait_free_slot()
+{
+  // Signed: a late callback can make the callback count run ahead.
+  while (((sent_count - done_count) >= WINDOW_SIZE) || ((int32_t)(sent_count - callback_count) >= WINDOW_SIZE)) {
+    if ((wait_send_event(pdMS_TO_TICKS(SEND_TIMEOUT_MS)) == ESP_ERR_TIMEOUT) &&
+        ((int32_t)(sent_count - callback_count) >= WINDOW_SIZE)) {
+      ESP_LOGE(TAG, "Send window is stalled.");
+      return ESP_FAIL;
+    }
+  }
+
+  return ESP_OK;
+}
+
+/// Returns the payload area of the next free slot of the window, or nullptr
+/// if the window is stalled. A frame built there is sent without being copied.
+/// FRAME_HEADROOM bytes are available in front of it.
+uint8_t * ESPNow::get_send_buffer()
+{
+  if (wait_free_slot() != ESP_OK) return nullptr;
+
+  return window[sent_count % WINDOW_SIZE].payload();
+}
+
+/// Send a frame. The frame is copied in the next window slot only if it was
+/// not built in the buffer returned by **get_send_buffer()**.
+esp_err_t ESPNow::send(uint8_t * data, int len)
 {
   esp_err_t status;
-  static struct PKT {
-    uint16_t crc;
-    char data[0];
-  } __attribute__((packed)) * pkt;
 
   if (len > cfg.esp_now.max_pkt_size) {
     ESP_LOGE(TAG, "Cannot send data of length %d, too long. Max is %d.", len, cfg.esp_now.max_pkt_size);
-    status = ESP_FAIL;
+    return ESP_FAIL;
+  }
+
+  if (wait_free_slot() != ESP_OK) return ESP_FAIL;
+
+  if (done_count == sent_count) resync_callbacks();
+
+  uint32_t seq   = sent_count;
+  Frame &  frame = window[seq % WINDOW_SIZE];
+
+  if (data != frame.payload()) memcpy(frame.payload(), data, len);
+
+  frame.seq = seq;
+  frame.len = len;
+
+  uint8_t * pkt = frame.payload() - 2;
+  uint16_t  crc = esp_crc16_le(UINT16_MAX, frame.payload(), len);
+  memcpy(pkt, &crc, 2);
+
+  status = esp_now_send(ap_mac_addr, pkt, len + 2);
+
+  if (status != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to send ESP-NOW packet: %s.", esp_err_to_name(status));
+    uint8_t primary_channel;
+    wifi_second_chan_t secondary_channel;
+    esp_wifi_get_channel(&primary_channel, &secondary_channel);
+    ESP_LOGE(TAG, "Wifi channels: %d %d.", primary_channel, secondary_channel);
   }
   else {
-    pkt = (PKT *) malloc(len + 2);
-    if (pkt == nullptr) {
-      ESP_LOGE(TAG, "Unable to allocate memory for PKT struct.");
-      return ESP_FAIL;
-    }
-    memcpy(pkt->data, data, len);
-    pkt->crc = esp_crc16_le(UINT16_MAX, (uint8_t *)(pkt->data), len);
-    status = esp_now_send(ap_mac_addr, (const uint8_t *) pkt, len+2);
-    free(pkt);
-    
-    if (status != ESP_OK) {
-      ESP_LOGE(TAG, "Unable to send ESP-NOW packet: %s.", esp_err_to_name(status));
-      uint8_t primary_channel;
-      wifi_second_chan_t secondary_channel;
-      esp_wifi_get_channel(&primary_channel, &secondary_channel);
-      ESP_LOGE(TAG, "Wifi channels: %d %d.", primary_channel, secondary_channel);
+    if (sent_count++ == 0) {
+      ESP_LOGI(TAG, "First packet sent %d msec after boot.", (int)(esp_timer_get_time() / 1000));
     }
   }
 
   return status;
 }
 
-esp_err_t ESPNow::search_ap()
+/// Wait for the result of all outstanding frames. Returns ESP_OK if all
+/// of them were received by the gateway.
+esp_err_t ESPNow::flush()
 {
-  wifi_scan_config_t config;
-  wifi_ap_record_t * ap_records;
-  uint16_t count;
+  esp_err_t status = ESP_OK;
 
-  ESP_LOGD(TAG, "Scanning AP list to find SSID starting with [%s]...", cfg.esp_now.gateway_ssid_prefix);
+  while (done_count != sent_count) {
+    if (wait_send_event(pdMS_TO_TICKS(SEND_TIMEOUT_MS)) != ESP_OK) status = ESP_FAIL;
+  }
+
+  return status;
+}
+
+// Build the list of channels to scan, in order. By default, the channel on which
+// the gateway was found last time (or the configured one) comes first, followed
+// by its neighbours: c, c-1, c+1, c-2, c+2, ...
+int ESPNow::get_scan_channels(uint8_t * channels)
+{
+  int count = 0;
+
+  #ifdef CONFIG_IOT_ENABLE_UDP
+    // Along with UDP, the radio stays on the channel of the Wifi router.
+    uint8_t            primary;
+    wifi_second_chan_t secondary;
+
+    if (esp_wifi_get_channel(&primary, &secondary) == ESP_OK) {
+      channels[count++] = primary;
+      return count;
+    }
+  #endif
+
+  if (CONFIG_IOT_ESPNOW_SCAN_CHANNELS[0] != 0) {
+    const char * str = CONFIG_IOT_ESPNOW_SCAN_CHANNELS;
+    char       * end;
+
+    while ((*str != 0) && (count < MAX_CHANNEL)) {
+      long ch = strtol(str, &end, 10);
+      if (end == str) { str++; continue; }
+      if ((ch >= 1) && (ch <= MAX_CHANNEL)) channels[count++] = ch;
+      str = end;
+    }
+
+    if (count > 0) return count;
+    ESP_LOGW(TAG, "No valid channel in [%s]. Default order used.", CONFIG_IOT_ESPNOW_SCAN_CHANNELS);
+  }
+
+  int first = (gateways.count > 0) ? gateways.gateways[gateways.current].channel : cfg.esp_now.channel;
+  if ((first < 1) || (first > MAX_CHANNEL)) first = 1;
+
+  channels[count++] = first;
+  for (int dist = 1; count < MAX_CHANNEL; dist++) {
+    if ((first - dist) >= 1)           channels[count++] = first - dist;
+    if ((first + dist) <= MAX_CHANNEL) channels[count++] = first + dist;
+  }
+
+  return count;
+}
+
+// Scan a single channel, in slices of SCAN_SLICE_MS up to
+// CONFIG_IOT_ESPNOW_SCAN_TIME: each slice sends a probe request, and the scan
+// ends with the first slice a gateway answers. The gateways answering the
+// same probe request are all heard in that slice, and added to the peer set
+// with their RSSI for the ranking.
+esp_err_t ESPNow::scan_channel(uint8_t ch)
+{
+  static wifi_ap_record_t ap_records[SCAN_MAX_RECORDS];
+
+  wifi_scan_config_t config;
 
   memset(&config, 0, sizeof(wifi_scan_config_t));
-  config.channel   = cfg.esp_now.channel;
+  config.channel   = ch;
   config.scan_type = WIFI_SCAN_TYPE_ACTIVE;
 
-  ESP_ERROR_CHECK(esp_wifi_scan_start(&config, true));
-  ESP_ERROR_CHECK(esp_wifi_scan_get_ap_num(&count));
+  int len   = strlen(cfg.esp_now.gateway_ssid_prefix);
+  int found = 0;
 
-  ESP_LOGD(TAG, "Number of SSID found: %d", count);
-  
-  ap_records = (wifi_ap_record_t *) malloc(sizeof(wifi_ap_record_t) * count);
-  if (ap_records == nullptr) {
-    ESP_LOGE(TAG, "Unable to allocate memory for ap_records.");
-    return ESP_FAIL;
+  for (int elapsed = 0; (found == 0) && (elapsed < CONFIG_IOT_ESPNOW_SCAN_TIME); elapsed += SCAN_SLICE_MS) {
+    uint16_t count = SCAN_MAX_RECORDS;
+
+    config.scan_time.active.max = std::min(SCAN_SLICE_MS, CONFIG_IOT_ESPNOW_SCAN_TIME - elapsed);
+
+    if ((esp_wifi_scan_start(&config, true) != ESP_OK) ||
+        (esp_wifi_scan_get_ap_records(&count, ap_records) != ESP_OK)) {
+      ESP_LOGE(TAG, "Unable to scan channel %d.", ch);
+      return ESP_FAIL;
+    }
+
+    ESP_LOGD(TAG, "Channel %d: %d SSID found.", ch, count);
+
+    for (int i = 0; i < count; i++) {
+      ESP_LOGD(TAG, "SSID -> %s (%d) ...", ap_records[i].ssid, ap_records[i].rssi);
+      if (strncmp((const char *) ap_records[i].ssid, cfg.esp_now.gateway_ssid_prefix, len) == 0) {
+        ESP_LOGD(TAG, "Found AP SSID %s:" MACSTR " on channel %d.", ap_records[i].ssid, MAC2STR(ap_records[i].bssid), ch);
+        add_gateway(ap_records[i].bssid, ch, ap_records[i].rssi);
+        found++;
+      }
+    }
   }
 
-  ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&count, ap_records));
+  return (found > 0) ? ESP_OK : ESP_FAIL;
+}
+
+// Gateway discovery. The channels are scanned one at a time, stopping at the
+// first one on which a gateway is heard.
+esp_err_t ESPNow::search_ap()
+{
+  uint8_t channels[MAX_CHANNEL];
+  int     count = get_scan_channels(channels);
 
-  int len = strlen(cfg.esp_now.gateway_ssid_prefix);
+  ESP_LOGD(TAG, "Scanning %d channel(s) to find SSID starting with [%s]...", count, cfg.esp_now.gateway_ssid_prefix);
 
   for (int i = 0; i < count; i++) {
-    ESP_LOGD(TAG, "SSID -> %s ...", ap_records[i].ssid);
-    if (strncmp((const char *) ap_records[i].ssid, cfg.esp_now.gateway_ssid_prefix, len) == 0) {
-      memcpy(&ap_mac_addr, ap_records[i].bssid, sizeof(MacAddr)); 
-      wifi.set_rssi(ap_records[i].rssi);
-      ESP_LOGD(TAG, "Found AP SSID %s:" MACSTR, ap_records[i].ssid, MAC2STR(ap_mac_addr));
+    if (scan_channel(channels[i]) == ESP_OK) {
       ap_failed = false;
       gateway_access_error_count = 0;
+      gateway_backoff = 0;
+      failure_count = 0;
+      failed_count  = 0;
       return ESP_OK;
     }
   }
@@ -181,19 +633,68 @@ esp_err_t ESPNow::search_ap()
   gateway_access_error_count++;
   iot.increment_error_count();
   ap_failed = true;
-  int wait_time = pow(gateway_access_error_count, 4) * 10;
-  if (wait_time > 86400) wait_time = 86400; // Don't wait for more than one day.
-  ESP_LOGE(TAG, "Unable to find Gateway Access Point. Waiting for %d seconds...", wait_time);
 
-  iot.prepare_for_deep_sleep();
-  esp_deep_sleep(wait_time * 1e6);
+  #ifdef CONFIG_IOT_ENABLE_UDP
+    // UDP remains available: no deep sleep, the ALARM route goes through UDP.
+    ESP_LOGE(TAG, "Unable to find Gateway Access Point on the Wifi router channel.");
+  #else
+    // Decorrelated jitter: a fleet losing its gateway at the same time
+    // doesn't search for it again all together. Don't wait for more than one day.
+    uint32_t wait_time = WakeScheduler::backoff(gateway_backoff, SEARCH_BACKOFF * 1000, 86400 * 1000);
+    ESP_LOGE(TAG, "Unable to find Gateway Access Point. Waiting for %u msec...", wait_time);
+
+    wake_scheduler.schedule(WakeScheduler::RETRY_ID, "gateway", (wait_time + 999) / 1000);
+    iot.prepare_for_deep_sleep();
+    esp_deep_sleep(((uint64_t) wait_time) * 1000);
+  #endif
 
   return ESP_FAIL;
 }
 
+#ifdef CONFIG_IOT_ESPNOW_FAST_RECONNECT
+  // Directed probe of the gateway found last time: a scan limited to its BSSID
+  // and channel, with a short dwell time. No deep sleep on failure: the caller
+  // falls back to the full scan.
+  esp_err_t ESPNow::probe_ap(const NVSMgr::Gateway & gw)
+  {
+    wifi_scan_config_t config;
+    wifi_ap_record_t   record;
+    uint16_t           count = 1;
+
+    ESP_LOGD(TAG, "Probing gateway " MACSTR " on channel %d...", MAC2STR(gw.mac_addr), gw.channel);
+
+    memset(&config, 0, sizeof(wifi_scan_config_t));
+    config.bssid                = (uint8_t *) gw.mac_addr;
+    config.channel              = gw.channel;
+    config.scan_type            = WIFI_SCAN_TYPE_ACTIVE;
+    config.scan_time.active.min = CONFIG_IOT_ESPNOW_PROBE_TIME;
+    config.scan_time.active.max = CONFIG_IOT_ESPNOW_PROBE_TIME;
+
+    if ((esp_wifi_scan_start(&config, true) != ESP_OK) ||
+        (esp_wifi_scan_get_ap_records(&count, &record) != ESP_OK) ||
+        (count == 0) ||
+        (strncmp((const char *) record.ssid, cfg.esp_now.gateway_ssid_prefix, strlen(cfg.esp_now.gateway_ssid_prefix)) != 0)) {
+      ESP_LOGW(TAG, "Gateway did not answer the probe. Full scan required.");
+      return ESP_FAIL;
+    }
+
+    add_gateway(record.bssid, gw.channel, record.rssi);
+    ap_failed                  = false;
+    gateway_access_error_count = 0;
+    gateway_backoff            = 0;
+
+    ESP_LOGD(TAG, "Gateway answered the probe, RSSI: %d.", record.rssi);
+
+    return ESP_OK;
+  }
+#endif
+
 void ESPNow::prepare_for_deep_sleep()
 {
   esp_now_unregister_send_cb();
+  #ifdef CONFIG_IOT_DOWNLINK
+    esp_now_unregister_recv_cb();
+  #endif
   esp_now_deinit();
 }
 
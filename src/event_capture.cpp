@@ -0,0 +1,265 @@
+#include "config.hpp"
+
+#ifdef CONFIG_IOT_EVENT_CAPTURE
+
+#include <cstring>
+#include <algorithm>
+#include <sys/time.h>
+#include <esp_timer.h>
+#include <esp_sleep.h>
+#include <driver/rtc_io.h>
+
+#include "event_capture.hpp"
+
+#define __EVENT_CAPTURE__
+#include "global.hpp"
+#undef __EVENT_CAPTURE__
+
+// Pins and event queue. The queue indexes are checked on wake up: they are
+// updated by the ISR, no CRC can cover them.
+RTC_NOINIT_ATTR static EventCapture::State capture_state;
+RTC_NOINIT_ATTR static SPSCRing<EventCapture::Event, EventCapture::QUEUE_SIZE>
+                  event_ring{ SPSCRing<EventCapture::Event, EventCapture::QUEUE_SIZE>::NoInit() };
+
+int64_t      EventCapture::last_edge[MAX_PINS];
+portMUX_TYPE EventCapture::mux           = portMUX_INITIALIZER_UNLOCKED;
+bool         EventCapture::isr_installed = false;
+
+esp_err_t EventCapture::init()
+{
+  esp_log_level_set(TAG, cfg.log_level);
+
+  memset(last_edge, 0, sizeof(last_edge));
+
+  if (iot.was_reset() || (capture_state.magic != CAPTURE_MAGIC) ||
+      (capture_state.pin_count < 0) || (capture_state.pin_count > MAX_PINS) || !event_ring.is_valid()) {
+    if (!iot.was_reset()) ESP_LOGW(TAG, "Event queue lost.");
+    memset(&capture_state, 0, sizeof(State));
+    capture_state.magic = CAPTURE_MAGIC;
+    event_ring.clear();
+    return ESP_OK;
+  }
+
+  // The events queued before deep sleep are timed with the esp_timer of the
+  // previous boot: moved to that of this one, before any new event.
+  int64_t shift = capture_state.time_base - system_time_base();
+  Event * event;
+
+  for (uint32_t i = 0; (event = event_ring.peek(i)) != nullptr; i++) event->time += shift;
+
+  for (int i = 0; i < capture_state.pin_count; i++) {
+    if (arm_pin(i) != ESP_OK) return ESP_FAIL;
+  }
+
+  // The pins that woke the device up, and those that changed during sleep.
+  check_levels(true);
+
+  return ESP_OK;
+}
+
+// System time minus esp_timer time, usec. Changes when the system time is
+// set (SNTP).
+int64_t EventCapture::system_time_base()
+{
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+
+  return ((int64_t) tv.tv_sec * 1000000) + tv.tv_usec - esp_timer_get_time();
+}
+
+// Input with an interrupt on both edges, and the pull mode given to
+// add_pin(). A pin used as a deep sleep wake up source is left as an RTC IO:
+// it is given back to the GPIO matrix first.
+esp_err_t EventCapture::arm_pin(int index)
+{
+  gpio_num_t       pin  = (gpio_num_t) capture_state.pins[index].pin;
+  gpio_pull_mode_t pull = (gpio_pull_mode_t) capture_state.pins[index].pull;
+  esp_err_t        status;
+
+  if (rtc_gpio_is_valid_gpio(pin)) rtc_gpio_deinit(pin);
+
+  gpio_config_t io_conf = {};
+
+  io_conf.mode         = GPIO_MODE_INPUT;
+  io_conf.pin_bit_mask = 1ULL << pin;
+  io_conf.pull_down_en = ((pull == GPIO_PULLDOWN_ONLY) || (pull == GPIO_PULLUP_PULLDOWN)) ?
+                           GPIO_PULLDOWN_ENABLE : GPIO_PULLDOWN_DISABLE;
+  io_conf.pull_up_en   = ((pull == GPIO_PULLUP_ONLY)   || (pull == GPIO_PULLUP_PULLDOWN)) ?
+                           GPIO_PULLUP_ENABLE   : GPIO_PULLUP_DISABLE;
+  io_conf.intr_type    = GPIO_INTR_ANYEDGE;
+
+  if ((status = gpio_config(&io_conf)) != ESP_OK) return status;
+
+  if (!isr_installed) {
+    status = gpio_install_isr_service(0);
+    // Already installed by the application.
+    if ((status != ESP_OK) && (status != ESP_ERR_INVALID_STATE)) return status;
+    isr_installed = true;
+  }
+
+  if ((status = gpio_isr_handler_add(pin, isr, (void *)(intptr_t) index)) != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to add the interrupt handler of GPIO %d: %s.", pin, esp_err_to_name(status));
+  }
+
+  return status;
+}
+
+esp_err_t EventCapture::add_pin(gpio_num_t pin, gpio_pull_mode_t pull)
+{
+  for (int i = 0; i < capture_state.pin_count; i++) {
+    if (capture_state.pins[i].pin == pin) return ESP_OK;
+  }
+
+  if (capture_state.pin_count >= MAX_PINS) return ESP_ERR_NO_MEM;
+
+  int index = capture_state.pin_count;
+
+  capture_state.pins[index].pin   = pin;
+  capture_state.pins[index].pull  = pull;
+  capture_state.pins[index].level = gpio_get_level(pin);
+
+  esp_err_t status = arm_pin(index);
+
+  if (status == ESP_OK) {
+    // Taken into account once the pin is ready, the ISR may run at once.
+    capture_state.pins[index].level = gpio_get_level(pin);
+    capture_state.pin_count++;
+  }
+
+  return status;
+}
+
+// Called from the ISR and the application task, under the mux.
+void EventCapture::queue(int index, uint8_t level, int64_t time, bool wake_up)
+{
+  Event * event = event_ring.reserve();
+
+  capture_state.pins[index].level = level;
+
+  if (event == nullptr) {
+    capture_state.stats.dropped++;
+    return;
+  }
+
+  event->time    = time;
+  event->pin     = capture_state.pins[index].pin;
+  event->level   = level;
+  event->wake_up = wake_up;
+  event_ring.commit();
+}
+
+void EventCapture::isr(void * arg)
+{
+  int     index = (int)(intptr_t) arg;
+  int64_t now   = esp_timer_get_time();
+
+  if (index >= capture_state.pin_count) return;
+
+  uint8_t level = gpio_get_level((gpio_num_t) capture_state.pins[index].pin);
+
+  portENTER_CRITICAL_ISR(&mux);
+  if ((level != capture_state.pins[index].level) && ((now - last_edge[index]) >= DEBOUNCE_US)) {
+    last_edge[index] = now;
+    queue(index, level, now, false);
+  }
+  portEXIT_CRITICAL_ISR(&mux);
+
+  #ifdef CONFIG_IOT_RUN_LOOP
+    iot.notify_from_isr(IoT::APP_EVENT);
+  #endif
+}
+
+// Queue the levels not yet reported: changes during deep sleep, or the end
+// of a bounce. On wake up, the event time is the boot time.
+void EventCapture::check_levels(bool wake_up)
+{
+  int64_t now = esp_timer_get_time();
+
+  for (int i = 0; i < capture_state.pin_count; i++) {
+    uint8_t level = gpio_get_level((gpio_num_t) capture_state.pins[i].pin);
+
+    portENTER_CRITICAL(&mux);
+    if ((level != capture_state.pins[i].level) && (wake_up || ((now - last_edge[i]) >= DEBOUNCE_US))) {
+      last_edge[i] = now;
+      queue(i, level, wake_up ? 0 : now, wake_up);
+    }
+    portEXIT_CRITICAL(&mux);
+  }
+}
+
+int EventCapture::deliver(Handler * handler)
+{
+  if (handler == nullptr) return 0;
+
+  check_levels(false);
+
+  int     count = 0;
+  int64_t base  = system_time_base();
+  Event * event;
+
+  while ((event = event_ring.front()) != nullptr) {
+    Stats &  stats   = capture_state.stats;
+    uint32_t latency = (uint32_t) std::max(esp_timer_get_time() - event->time, (int64_t) 0);
+    Event    e       = *event;
+
+    e.time += base;
+
+    stats.count++;
+    stats.total_latency_us += latency;
+    stats.max_latency_us    = std::max(stats.max_latency_us, latency);
+
+    ESP_LOGD(TAG, "GPIO %d %s%s, latency %u usec.", event->pin, event->level ? "high" : "low",
+             event->wake_up ? " (wake up)" : "", latency);
+
+    handler(e, latency);
+    event_ring.pop();
+    count++;
+  }
+
+  return count;
+}
+
+void EventCapture::prepare_for_deep_sleep()
+{
+  uint64_t   low_mask  = 0;
+  gpio_num_t high_pin  = GPIO_NUM_NC;
+  int        high_pins = 0;
+  bool       pulls     = false;
+
+  capture_state.time_base = system_time_base();
+
+  for (int i = 0; i < capture_state.pin_count; i++) {
+    gpio_num_t pin = (gpio_num_t) capture_state.pins[i].pin;
+
+    if (!rtc_gpio_is_valid_gpio(pin)) continue;
+
+    pulls |= capture_state.pins[i].pull != GPIO_FLOATING;
+
+    if (gpio_get_level(pin) == 0) {
+      low_mask |= 1ULL << pin;
+    }
+    else {
+      high_pin = pin;
+      high_pins++;
+    }
+  }
+
+  // The pulls of the RTC IOs are off with the RTC peripherals.
+  if (pulls) esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+
+  if (low_mask != 0) esp_sleep_enable_ext1_wakeup(low_mask, ESP_EXT1_WAKEUP_ANY_HIGH);
+
+  if (high_pins == 1) {
+    esp_sleep_enable_ext0_wakeup(high_pin, 0);
+  }
+  else if (high_pins > 1) {
+    ESP_LOGW(TAG, "%d pins at high level: their falling edges won't wake the device up.", high_pins);
+  }
+}
+
+const EventCapture::Stats & EventCapture::get_stats()
+{
+  return capture_state.stats;
+}
+
+#endif
@@ -5,15 +5,20 @@
 
 RTC_NOINIT_ATTR CFG cfg;
 
-Config config;
-IoT    iot;
-Wifi   wifi;
-NVSMgr nvs_mgr;
+Config        config;
+IoT           iot;
+Wifi          wifi;
+NVSMgr        nvs_mgr;
+WakeScheduler wake_scheduler;
 
 #ifdef CONFIG_IOT_BATTERY_LEVEL
   Battery battery;
 #endif
 
+#ifdef CONFIG_IOT_MSG_STORE
+  MsgStore msg_store;
+#endif
+
 #ifdef CONFIG_IOT_ENABLE_UDP
   UDP udp;
 #endif
@@ -22,4 +27,12 @@ NVSMgr nvs_mgr;
   ESPNow esp_now;
 #endif
 
+#ifdef CONFIG_IOT_OTA
+  Ota ota;
+#endif
+
+#ifdef CONFIG_IOT_EVENT_CAPTURE
+  EventCapture event_capture;
+#endif
+
 RTC_NOINIT_ATTR uint32_t sequence_number;
@@ -1,7 +1,21 @@
 #include <time.h>
+#include <cstring>
+#include <algorithm>
 #include <esp_timer.h>
+#include <esp_attr.h>
 
 #include "iot.hpp"
+#include "transport.hpp"
+#include "msg_encoder.hpp"
+#include "msg_tlv.hpp"
+#include "msg_frag.hpp"
+#include "fsm.hpp"
+
+#ifdef CONFIG_IOT_RUN_LOOP
+  #include <esp_pm.h>
+  #include <esp_wifi.h>
+  #include <soc/rtc.h>
+#endif
 
 #if CONFIG_IOT_ESPNOW_ENABLE_LONG_RANGE
   #pragma message "----> INFO: IOT WIFI LONG RANGE ENABLED <----"
@@ -15,25 +29,129 @@
   #pragma message "----> INFO: IOT BATTERY LEVEL DISABLED <----"
 #endif
 
-RTC_NOINIT_ATTR IoT::State state;
-RTC_NOINIT_ATTR IoT::State return_state;
-RTC_NOINIT_ATTR time_t     next_watchdog_time;
+RTC_NOINIT_ATTR IoT::Machine machines[IoT::MAX_MACHINES];
+RTC_NOINIT_ATTR bool       watchdog_pending;
+RTC_NOINIT_ATTR uint32_t   retry_delay;        // Last wake retry backoff (msec), 0 once a boot succeeded
 RTC_NOINIT_ATTR uint32_t   error_count;
 RTC_NOINIT_ATTR uint32_t   send_seq_nbr;
 RTC_NOINIT_ATTR uint32_t   last_duration;
 
-esp_err_t IoT::init(ProcessHandler * handler)
+#ifdef CONFIG_IOT_MSG_FRAGMENTATION
+  RTC_NOINIT_ATTR uint16_t frag_msg_id;
+#endif
+
+// State machine transitions, see the IoT::State diagram. One row per state,
+// in bit order, one column per user result: COMPLETED, NOT_COMPLETED,
+// ABORTED, NEW_EVENT, RETRY. CHECK_WATCHDOG: the WATCHDOG state comes first
+// when the watchdog message is due.
+typedef FsmTable<IoT::State, 6, 5> IoTFsm;
+
+static constexpr IoT::State RETURN_STATE   = (IoT::State) 0;  // Back to the return state
+static constexpr IoT::State UNCHANGED      = (IoT::State) 0;  // Return state unchanged
+static constexpr uint8_t    CHECK_WATCHDOG = 1;
+
+static constexpr IoTFsm iot_fsm = {{
+  { // STARTUP
+    { IoT::WAIT_FOR_EVENT, IoT::WAIT_FOR_EVENT, 0              },
+    { IoT::STARTUP,        UNCHANGED,           0              },
+    { IoT::WAIT_FOR_EVENT, IoT::WAIT_FOR_EVENT, 0              },
+    { IoT::WAIT_FOR_EVENT, IoT::WAIT_FOR_EVENT, 0              },
+    { IoT::WAIT_FOR_EVENT, IoT::WAIT_FOR_EVENT, 0              } },
+  { // WAIT_FOR_EVENT
+    { IoT::WAIT_FOR_EVENT, IoT::WAIT_FOR_EVENT, CHECK_WATCHDOG },
+    { IoT::WAIT_FOR_EVENT, IoT::WAIT_FOR_EVENT, CHECK_WATCHDOG },
+    { IoT::WAIT_FOR_EVENT, IoT::WAIT_FOR_EVENT, CHECK_WATCHDOG },
+    { IoT::PROCESS_EVENT,  IoT::PROCESS_EVENT,  0              },
+    { IoT::WAIT_FOR_EVENT, IoT::WAIT_FOR_EVENT, CHECK_WATCHDOG } },
+  { // PROCESS_EVENT
+    { IoT::WAIT_END_EVENT, IoT::WAIT_END_EVENT, 0              },
+    { IoT::PROCESS_EVENT,  IoT::PROCESS_EVENT,  CHECK_WATCHDOG },
+    { IoT::WAIT_FOR_EVENT, IoT::WAIT_FOR_EVENT, 0              },
+    { IoT::WAIT_END_EVENT, IoT::WAIT_END_EVENT, 0              },
+    { IoT::WAIT_END_EVENT, IoT::WAIT_END_EVENT, 0              } },
+  { // WAIT_END_EVENT
+    { IoT::END_EVENT,      IoT::END_EVENT,      0              },
+    { IoT::WAIT_END_EVENT, IoT::WAIT_END_EVENT, CHECK_WATCHDOG },
+    { IoT::END_EVENT,      IoT::END_EVENT,      0              },
+    { IoT::END_EVENT,      IoT::END_EVENT,      0              },
+    { IoT::PROCESS_EVENT,  IoT::PROCESS_EVENT,  0              } },
+  { // END_EVENT
+    { IoT::WAIT_FOR_EVENT, IoT::WAIT_FOR_EVENT, 0              },
+    { IoT::END_EVENT,      UNCHANGED,           0              },
+    { IoT::WAIT_FOR_EVENT, IoT::WAIT_FOR_EVENT, 0              },
+    { IoT::WAIT_FOR_EVENT, IoT::WAIT_FOR_EVENT, 0              },
+    { IoT::WAIT_FOR_EVENT, IoT::WAIT_FOR_EVENT, 0              } },
+  { // WATCHDOG
+    { RETURN_STATE,        UNCHANGED,           0              },
+    { RETURN_STATE,        UNCHANGED,           0              },
+    { RETURN_STATE,        UNCHANGED,           0              },
+    { RETURN_STATE,        UNCHANGED,           0              },
+    { RETURN_STATE,        UNCHANGED,           0              } }
+}};
+
+static_assert(iot_fsm.is_valid(),                    "The IoT state machine table names an unknown state.");
+static_assert(IoTFsm::index(IoT::WATCHDOG)  == 5,    "The IoT states must be the bits 0 to 5.");
+static_assert(iot_fsm.at(IoT::PROCESS_EVENT, IoT::ABORTED).next == IoT::WAIT_FOR_EVENT, "Unexpected table layout.");
+
+static IoT::WarmUpHandler * warm_up_handler = nullptr;
+
+/// Boot steps run concurrently once the configuration is retrieved. The
+/// Wifi association being the long pole, everything not needed to start it
+/// is done in parallel: battery sampling and the application warm-up run on
+/// the application core while the Wifi stack works on the other one.
+static const BootScheduler::Step boot_steps[] = {
+  { "boot_nvs",     [] { return nvs_mgr.init(); },
+    0,                                      IoT::NVS_READY,        tskNO_AFFINITY },
+  { "boot_evt_loop", [] { return esp_event_loop_create_default(); },
+    0,                                      IoT::EVENT_LOOP_READY, tskNO_AFFINITY },
+  { "boot_wifi",    [] { return wifi.init(); },
+    IoT::NVS_READY | IoT::EVENT_LOOP_READY, IoT::WIFI_STARTED,     tskNO_AFFINITY },
+  #ifdef CONFIG_IOT_BATTERY_LEVEL
+    { "boot_battery", [] { battery.init(); return battery.sample(); },
+      0,                                    IoT::BATTERY_READY,    portNUM_PROCESSORS - 1 },
+  #endif
+  { "boot_app",     [] { return (warm_up_handler != nullptr) ? warm_up_handler() : ESP_OK; },
+    0,                                      IoT::APP_READY,        portNUM_PROCESSORS - 1 },
+};
+
+esp_err_t IoT::init(ProcessHandler * handler, WarmUpHandler * warm_up)
 {
-  process_handler           = handler;
+  return init_machines(&handler, 1, warm_up);
+}
+
+esp_err_t IoT::init_machines(ProcessHandler * const * handlers, int count, WarmUpHandler * warm_up)
+{
+  for (int i = 0; i < count; i++) process_handlers[i] = handlers[i];
+
+  machine_count             = count;
+  warm_up_handler           = warm_up;
   deep_sleep_duration       = 0;
+  deadline                  = (CONFIG_IOT_WAKE_DEADLINE > 0) ?
+                                esp_timer_get_time() + (int64_t) CONFIG_IOT_WAKE_DEADLINE * 1000 : INT64_MAX;
+
+  if ((ready_events = xEventGroupCreate()) == nullptr) return ESP_FAIL;
+
+  #ifdef CONFIG_IOT_MSG_STORE
+    forwarding              = false;
+  #endif
+  #ifdef CONFIG_IOT_DOWNLINK
+    uplink_sent             = false;
+  #endif
+  #ifdef CONFIG_IOT_EVENT_CAPTURE
+    event_handler           = nullptr;
+  #endif
+  #ifdef CONFIG_IOT_RUN_LOOP
+    light_sleep             = false;
+    memset((void *) notify_time, 0, sizeof(notify_time));
+    memset(wake_stats, 0, sizeof(wake_stats));
+  #endif
   esp_reset_reason_t reason = esp_reset_reason();
 
   if (reason != ESP_RST_DEEPSLEEP) {
     if (config.init(true) != ESP_OK) return ESP_FAIL;
     restart_reason       = RestartReason::RESET;
-    time_t now           = time(&now);
-    state = return_state = STARTUP;
-    next_watchdog_time   = now + cfg.watchdog_interval;
+    for (auto & m : machines) m.state = m.return_state = STARTUP;
+    retry_delay          = 0;
     error_count          = 0;
     send_seq_nbr         = 0;
     last_duration        = 0;
@@ -42,219 +160,893 @@ esp_err_t IoT::init(ProcessHandler * handler)
     if (config.init(false) != ESP_OK) return ESP_FAIL;
     restart_reason = RestartReason::DEEP_SLEEP_AWAKE;
     deep_sleep_wakeup_reason = esp_sleep_get_wakeup_cause();
+
+    for (auto & m : machines) {
+      if (!IoTFsm::is_state(m.state) || !IoTFsm::is_state(m.return_state)) m.state = m.return_state = STARTUP;
+    }
   }
 
   esp_log_level_set(TAG, cfg.log_level);
 
-  ESP_ERROR_CHECK(nvs_mgr.init());
-  ESP_ERROR_CHECK(esp_event_loop_create_default());
-  ESP_ERROR_CHECK(wifi.init());
+  if (wake_scheduler.init(was_reset())) {
+    uint32_t interval = cfg.watchdog_interval;
 
-  #ifdef CONFIG_IOT_BATTERY_LEVEL
-    battery.init();
+    watchdog_pending = false;
+    wake_scheduler.schedule(WakeScheduler::WATCHDOG_ID, "watchdog",
+                            interval + WakeScheduler::slot_offset(WakeScheduler::WATCHDOG_ID, interval), interval);
+  }
+
+  #ifdef CONFIG_IOT_EVENT_CAPTURE
+    // Before the boot steps: the levels that woke the device up are read first.
+    if (event_capture.init() != ESP_OK) return ESP_FAIL;
   #endif
 
-  #ifdef CONFIG_IOT_ENABLE_UDP
-    wifi.show_state();
+  #ifdef CONFIG_IOT_MSG_STORE
+    // Messages waiting in the store survive a software reset, its counters
+    // don't. The CRC check will take care of the RTC memory content after a
+    // power on.
+    msg_store.init(was_reset());
+  #endif
 
-    Wifi::State state = wifi.get_state();
-    while (!((state == Wifi::State::CONNECTED) || (state == Wifi::State::ERROR)) || (state == Wifi::State::WAITING_FOR_IP)) {
-      vTaskDelay(pdMS_TO_TICKS(500));
-      state = wifi.get_state();
-    }
+  EventBits_t boot_bits;
+  if (BootScheduler::start(ready_events, boot_steps, sizeof(boot_steps) / sizeof(boot_steps[0]), boot_bits) != ESP_OK) {
+    return ESP_FAIL;
+  }
 
-    if (state == Wifi::State::ERROR) return ESP_FAIL;
-  #endif
+  if (wait_ready(WIFI_READY) != ESP_OK) deadline_expired("the Wifi connection");
 
   #ifdef CONFIG_IOT_ENABLE_UDP
-    // UDP initialization
-    ESP_ERROR_CHECK(udp.init());
+    wifi.show_state();
   #endif
 
-  #ifdef CONFIG_IOT_ENABLE_ESP_NOW
-    // EspNow initialization
-    ESP_ERROR_CHECK(esp_now.init());
-    send_queue_handle = esp_now.get_send_queue_handle();
+  int wifi_ready_time = (int)(esp_timer_get_time() / 1000);
+
+  ESP_ERROR_CHECK(Transport::init());
+
+  #ifdef CONFIG_IOT_OTA
+    ota.init();
   #endif
 
+  if (wait_ready(boot_bits) != ESP_OK) deadline_expired("the boot steps");
+
+  retry_delay = 0;
+
+  xEventGroupSetBits(ready_events, TRANSPORT_READY);
+
+  ESP_LOGI(TAG, "Boot sequence completed in %d msec (Wifi ready at %d msec).",
+           (int)(esp_timer_get_time() / 1000), wifi_ready_time);
+
   return ESP_OK;
 }
 
+/// Returns the time left in the wake time budget (CONFIG_IOT_WAKE_DEADLINE),
+/// or INT32_MAX if there is no budget.
+int32_t IoT::get_remaining_time_ms()
+{
+  if (deadline == INT64_MAX) return INT32_MAX;
+
+  int64_t remaining = (deadline - esp_timer_get_time()) / 1000;
+
+  return (remaining > 0) ? remaining : 0;
+}
+
+/// Wait for all the readiness **bits** (see ReadyBit) to be set, at the latest
+/// until the end of the wake time budget. Returns ESP_ERR_TIMEOUT if the
+/// deadline expired.
+esp_err_t IoT::wait_ready(EventBits_t bits)
+{
+  int32_t    remaining = get_remaining_time_ms();
+  TickType_t timeout   = (remaining == INT32_MAX) ? portMAX_DELAY : pdMS_TO_TICKS(remaining);
+
+  EventBits_t result = xEventGroupWaitBits(ready_events, bits, pdFALSE, pdTRUE, timeout);
+
+  return ((result & bits) == bits) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+/// The boot sequence could not be completed in time. The failure is counted
+/// and the device goes straight to deep sleep, for a jittered delay growing
+/// with the consecutive failures. The transports are not yet
+/// initialized: only the Wifi is stopped. The retry deadline reports the
+/// wake up as a retry (see WakeScheduler::has_fired()).
+void IoT::deadline_expired(const char * step)
+{
+  uint32_t delay = WakeScheduler::backoff(retry_delay, CONFIG_IOT_WAKE_RETRY_DELAY * 1000,
+                                          std::min(CONFIG_IOT_WAKE_RETRY_DELAY * RETRY_CAP_FACTOR, 86400) * 1000);
+
+  ESP_LOGE(TAG, "Wake deadline of %d msec expired waiting for %s. Deep sleep for %u msec.",
+           CONFIG_IOT_WAKE_DEADLINE, step, delay);
+
+  error_count++;
+  wake_scheduler.schedule(WakeScheduler::RETRY_ID, "retry", (delay + 999) / 1000);
+
+  wifi.prepare_for_deep_sleep();
+  last_duration = (int)(esp_timer_get_time() / 1000);
+  esp_deep_sleep(((uint64_t) delay) * 1000);
+}
+
 esp_err_t IoT::prepare_for_deep_sleep()
 {
+  flush();
+
   #ifdef CONFIG_IOT_BATTERY_LEVEL
     battery.prepare_for_deep_sleep();
   #endif
   
-  #ifdef CONFIG_IOT_ENABLE_UDP
-    udp.prepare_for_deep_sleep();
+  #ifdef CONFIG_IOT_OTA
+    ota.prepare_for_deep_sleep();
   #endif
 
-  #ifdef CONFIG_IOT_ENABLE_ESP_NOW
-    esp_now.prepare_for_deep_sleep();
+  #ifdef CONFIG_IOT_EVENT_CAPTURE
+    event_capture.prepare_for_deep_sleep();
   #endif
 
+  Transport::prepare_for_deep_sleep();
+
   wifi.prepare_for_deep_sleep();
 
   return ESP_OK;
 }
 
-IoT::State IoT::check_if_24_hours_time(State the_state)
+#ifdef CONFIG_IOT_RUN_LOOP
+  static constexpr const EventBits_t RUN_LOOP_BITS = IoT::APP_EVENT | IoT::DOWNLINK_READY | IoT::SEND_DONE;
+
+  #if defined(CONFIG_IOT_DOWNLINK) && defined(CONFIG_IOT_ENABLE_UDP)
+    // The UDP socket can't be waited on along with the event group: it is
+    // read every beacon interval, when the modem sleep wakes the radio up.
+    static constexpr const int64_t UDP_POLL_MS = 100;
+  #endif
+
+  // Read by stamp(), from an ISR: in DRAM, the flash cache may be disabled.
+  static const DRAM_ATTR struct {
+    EventBits_t     bit;
+    IoT::WakeSource source;
+  } wake_sources[] = {
+    { IoT::APP_EVENT,      IoT::WakeSource::APP      },
+    { IoT::DOWNLINK_READY, IoT::WakeSource::DOWNLINK },
+    { IoT::SEND_DONE,      IoT::WakeSource::SEND     }
+  };
+
+  static const char * const wake_source_names[] = { "application", "downlink", "send status", "timer" };
+
+  // Callable from an ISR, flash cache disabled or not: in IRAM, as is
+  // esp_timer_get_time().
+  static void IRAM_ATTR stamp(volatile int64_t * notify_time, EventBits_t bits)
+  {
+    int64_t now = esp_timer_get_time();
+
+    for (auto & s : wake_sources) {
+      if (bits & s.bit) notify_time[(int) s.source] = now;
+    }
+  }
+#endif
+
+/// Signal run loop events (see ReadyBit): APP_EVENT for the application,
+/// e.g. from a timer callback, DOWNLINK_READY and SEND_DONE for the
+/// transports. Not to be called from an ISR, see **notify_from_isr()**.
+void IoT::notify(EventBits_t bits)
 {
-  time_t now;
+  #ifdef CONFIG_IOT_RUN_LOOP
+    stamp(notify_time, bits);
+  #endif
 
-  time(&now);
-  if (now > next_watchdog_time) return State::WATCHDOG;
-  return the_state;
+  xEventGroupSetBits(ready_events, bits);
 }
 
-/// Send a message to the gateway. May not return if the message cannot
-/// be sent (gateway is dead for any reason). The underneath protocol
-/// (udp or esp_now) will start a deep_sleep if not able to send the message.
-/// At next boot, the current state will be done again to try to send again
-/// something if there is still something to be sent.
-void IoT::send_msg(const char * msg_type, const char * other_field)
+/// Same as **notify()**, from an ISR (e.g. a GPIO interrupt). The bits are
+/// set by the FreeRTOS timer task. In IRAM with the data it reads, such that
+/// it can be called from an ISR registered with ESP_INTR_FLAG_IRAM, run while
+/// the flash cache is disabled.
+void IRAM_ATTR IoT::notify_from_isr(EventBits_t bits)
 {
-  static char pkt[248];
+  BaseType_t woken = pdFALSE;
+
+  #ifdef CONFIG_IOT_RUN_LOOP
+    stamp(notify_time, bits);
+  #endif
+
+  if ((xEventGroupSetBitsFromISR(ready_events, bits, &woken) == pdPASS) && (woken == pdTRUE)) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+#ifdef CONFIG_IOT_RUN_LOOP
+  /// Configure the automatic light sleep, entered by the idle task when no
+  /// task is ready to run. The Wifi association is kept through the modem
+  /// sleep. With ESP-NOW only, the radio stays on to receive the gateway
+  /// frames: the CPU frequency is still lowered between events.
+  void IoT::enable_light_sleep()
+  {
+    light_sleep = true;
+
+    #if defined(CONFIG_PM_ENABLE) && defined(CONFIG_FREERTOS_USE_TICKLESS_IDLE)
+      #ifdef CONFIG_IOT_ENABLE_UDP
+        esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+      #endif
+
+      esp_pm_config_esp32_t pm_config = {
+        .max_freq_mhz       = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz       = (int) rtc_clk_xtal_freq_get(),
+        .light_sleep_enable = true
+      };
+
+      esp_err_t status = esp_pm_configure(&pm_config);
+
+      if (status == ESP_OK) {
+        ESP_LOGI(TAG, "Automatic light sleep enabled.");
+      }
+      else {
+        ESP_LOGW(TAG, "Unable to enable the automatic light sleep: %s.", esp_err_to_name(status));
+      }
+    #else
+      ESP_LOGW(TAG, "Automatic light sleep requires CONFIG_PM_ENABLE and CONFIG_FREERTOS_USE_TICKLESS_IDLE.");
+    #endif
+  }
+
+  void IoT::account_wake(WakeSource source, int64_t since, int64_t now)
+  {
+    WakeStats & stats   = wake_stats[(int) source];
+    uint32_t    latency = (uint32_t) std::max(now - since, (int64_t) 0);
+
+    stats.count++;
+    stats.total_us += latency;
+    stats.max_us    = std::max(stats.max_us, latency);
+
+    ESP_LOGD(TAG, "Run loop wake up: %s, latency %u usec.", wake_source_names[(int) source], latency);
+  }
+
+  /// Run loop wait. With deep sleep disabled, **process()** blocks until
+  /// the next event instead of returning at once: an application event, a
+  /// downlink command, an ESP-NOW send status or the next wake scheduler
+  /// deadline. The wait lasts CONFIG_IOT_RUN_LOOP_MAX_IDLE msec at most,
+  /// for the process handlers polling their inputs. The wake up latency is
+  /// accounted per source (see **get_wake_stats()**).
+  void IoT::wait_event()
+  {
+    if (!light_sleep) enable_light_sleep();
+
+    int64_t timeout_ms = CONFIG_IOT_RUN_LOOP_MAX_IDLE;
+    bool    timer      = false;
+    time_t  wake       = wake_scheduler.next_wake();
+    time_t  now_s;
+
+    if (wake != 0) {
+      int64_t until_wake = ((int64_t)(wake - time(&now_s))) * 1000;
+      if (until_wake <= timeout_ms) {
+        timeout_ms = std::max(until_wake, (int64_t) 0);
+        timer      = true;
+      }
+    }
+
+    int64_t     end = esp_timer_get_time() + (timeout_ms * 1000);
+    int64_t     now;
+    EventBits_t bits;
+
+    for (;;) {
+      int64_t wait_ms = std::max((end - esp_timer_get_time()) / 1000, (int64_t) 0);
+
+      #if defined(CONFIG_IOT_DOWNLINK) && defined(CONFIG_IOT_ENABLE_UDP)
+        wait_ms = std::min(wait_ms, UDP_POLL_MS);
+      #endif
+
+      bits = xEventGroupWaitBits(ready_events, RUN_LOOP_BITS, pdFALSE, pdFALSE, pdMS_TO_TICKS(wait_ms)) & RUN_LOOP_BITS;
+
+      #if defined(CONFIG_IOT_DOWNLINK) && defined(CONFIG_IOT_ENABLE_UDP)
+        if (bits == 0) {
+          Transport::wait_downlink(0);
+          if (Transport::has_command()) {
+            notify(DOWNLINK_READY);
+            bits = DOWNLINK_READY;
+          }
+        }
+      #endif
+
+      now = esp_timer_get_time();
+      if ((bits != 0) || (now >= end)) break;
+    }
+
+    // DOWNLINK_READY is cleared once the commands are processed.
+    xEventGroupClearBits(ready_events, APP_EVENT | SEND_DONE);
+
+    for (auto & s : wake_sources) {
+      if (bits & s.bit) account_wake(s.source, notify_time[(int) s.source], now);
+    }
+
+    if ((bits == 0) && timer) account_wake(WakeSource::TIMER, end, now);
+  }
+#endif
+
+IoT::State IoT::get_state(int machine)
+{
+  return ((machine >= 0) && (machine < machine_count)) ? machines[machine].state : STARTUP;
+}
+
+// The states of all the machines, as a bit mask. Sent in the messages "st"
+// field, the "rst" field being the mask of their return states.
+uint8_t IoT::get_states()
+{
+  uint8_t states = 0;
+
+  for (int i = 0; i < machine_count; i++) states |= machines[i].state;
+
+  return states;
+}
+
+uint8_t IoT::get_return_states()
+{
+  uint8_t states = 0;
+
+  for (int i = 0; i < machine_count; i++) states |= machines[i].return_state;
+
+  return states;
+}
+
+/// Transmit a frame through the protocol selected for its class (see
+/// transport.hpp). With ESP-NOW, the frame is queued in the send window and
+/// the delivery result will be known later (see **flush()**). Frames that
+/// cannot be delivered are given to **send_failed()**.
+esp_err_t IoT::transmit(uint8_t * data, int len, MsgClass msg_class)
+{
+  esp_err_t status = Transport::send(msg_class, data, len);
+
+  if (status != ESP_OK) send_failed(data, len);
+
+  #ifdef CONFIG_IOT_DOWNLINK
+    if (status == ESP_OK) uplink_sent = true;
+  #endif
+
+  return status;
+}
+
+/// Wait for the delivery result of all the frames transmitted so far.
+esp_err_t IoT::flush()
+{
+  #ifdef CONFIG_IOT_MSG_BATCHING
+    flush_batch();
+  #endif
+
+  return Transport::flush();
+}
+
+/// Called by the transport when a frame could not be delivered to the gateway.
+void IoT::send_failed(const uint8_t * data, int len)
+{
+  #ifdef CONFIG_IOT_OTA
+    // OTA status frames are superseded by the next one: not stored.
+    if ((len > 0) && (data[0] == OTA_MARKER)) return;
+  #endif
+
+  error_count++;
+
+  #ifdef CONFIG_IOT_MSG_STORE
+    // While forwarding, the frame is still at the head of the store.
+    if (!forwarding) msg_store.push(data, len);
+  #endif
+}
+
+#ifdef CONFIG_IOT_MSG_STORE
+  /// Forward the stored messages, oldest first. Every message is removed
+  /// from the store only once delivered. Stops at the first transmission
+  /// failure, leaving the remaining ones in the store.
+  esp_err_t IoT::forward_stored_msgs()
+  {
+    esp_err_t status = ESP_OK;
+    uint8_t * pkt;
+    int len;
+
+    flush();
+    forwarding = true;
+
+    // Every message is read directly in the transport send buffer.
+    while ((len = msg_store.peek(pkt = get_send_buffer(), MAX_PKT_SIZE)) != 0) {
+      if (len > 0) {
+        if ((transmit(pkt, len) != ESP_OK) || (flush() != ESP_OK)) {
+          status = ESP_FAIL;
+          break;
+        }
+        msg_store.pop();
+      }
+    }
+
+    forwarding = false;
+
+    if (status == ESP_OK) ESP_LOGI(TAG, "All stored messages forwarded.");
+
+    return status;
+  }
+#endif
+
+#ifdef CONFIG_IOT_DOWNLINK
+  // Returns true if a command or an OTA frame is waiting.
+  static bool downlink_received()
+  {
+    #ifdef CONFIG_IOT_OTA
+      if (ota.has_frames()) return true;
+    #endif
+
+    return Transport::has_command();
+  }
+
+  /// Give the commands received so far to the application command handler.
+  int IoT::process_commands()
+  {
+    // Cleared before draining: a command queued meanwhile sets it again.
+    xEventGroupClearBits(ready_events, DOWNLINK_READY);
+
+    int count = Transport::process_commands(command_handler);
+
+    if (count > 0) ESP_LOGI(TAG, "%d downlink command(s) processed.", count);
+
+    return count;
+  }
+
+  /// Receive window. The gateway can only reach a sleepy device while it is
+  /// awake: when something was sent during this wake cycle, the device keeps
+  /// listening for CONFIG_IOT_DOWNLINK_WINDOW msec before going to deep
+  /// sleep. The window closes as soon as a command is received. A firmware
+  /// transfer (see ota.hpp) keeps the device awake until it goes idle.
+  void IoT::receive_window()
+  {
+    if (!uplink_sent) return;
+
+    uplink_sent = false;
+
+    #ifdef CONFIG_IOT_OTA
+      if (flush() == ESP_OK) ota.confirm_image();
+    #else
+      flush();
+    #endif
+
+    int64_t end = esp_timer_get_time() + (int64_t) CONFIG_IOT_DOWNLINK_WINDOW * 1000;
+    int     remaining;
+
+    while (!downlink_received() && ((remaining = (end - esp_timer_get_time()) / 1000) > 0)) {
+      Transport::wait_downlink(remaining);
+    }
+
+    #ifdef CONFIG_IOT_OTA
+      ota.run();
+    #endif
+
+    process_commands();
+  }
+#endif
+
+int IoT::get_max_pkt_size(MsgClass msg_class)
+{
+  return std::min(Transport::get_max_pkt_size(msg_class), MAX_PKT_SIZE);
+}
+
+/// Returns the buffer in which the next packet is to be built, preceded by
+/// FRAME_HEADROOM bytes for the transport headers. A packet built there is
+/// transmitted without any copy. The buffer holds at least MAX_PKT_SIZE + 1
+/// bytes.
+uint8_t * IoT::get_send_buffer(MsgClass msg_class)
+{
+  static_assert(Transport::MAX_PKT_SIZE <= MAX_PKT_SIZE, "IoT::MAX_PKT_SIZE too small for the transport.");
+
+  return Transport::get_send_buffer(msg_class);
+}
+
+/// Returns true if new packets must go to the store-and-forward buffer. The
+/// stored messages are forwarded first to keep them in order. If this is not
+/// possible, the new messages join them in the store.
+///
+/// Must be called before **get_send_buffer()**, as forwarding uses the
+/// transport send buffers.
+bool IoT::store_pending()
+{
+  #ifdef CONFIG_IOT_MSG_STORE
+    return !msg_store.is_empty() && (forward_stored_msgs() != ESP_OK);
+  #else
+    return false;
+  #endif
+}
+
+/// Send a packet, or keep it in the store-and-forward buffer if **pending**
+/// (see **store_pending()**). **data** must be preceded by FRAME_HEADROOM bytes.
+void IoT::send_packet(uint8_t * data, int len, bool pending, MsgClass msg_class)
+{
+  #ifdef CONFIG_IOT_MSG_STORE
+    if (pending) {
+      msg_store.push(data, len);
+      return;
+    }
+  #endif
+
+  transmit(data, len, msg_class);
+}
+
+/// Send a complete frame, split in fragments if larger than the transport
+/// maximum packet size (see msg_frag.hpp). **data** must be preceded by
+/// FRAME_HEADROOM bytes and must not be a transport send buffer.
+void IoT::send_frame(uint8_t * data, int len, MsgClass msg_class)
+{
+  #ifdef CONFIG_IOT_MSG_FRAGMENTATION
+    if (len > get_max_pkt_size(msg_class)) {
+      Fragmenter fragmenter(data, len, get_max_pkt_size(msg_class), frag_msg_id++);
+
+      if (!fragmenter.is_valid()) {
+        ESP_LOGE(TAG, "Unable to fragment a message of %d bytes.", len);
+        error_count++;
+        return;
+      }
+
+      ESP_LOGD(TAG, "Sending a message of %d bytes in %d fragments.", len, fragmenter.get_count());
+
+      // Fragments are built directly in the transport send buffer.
+      for (int i = 0; i < fragmenter.get_count(); i++) {
+        bool      pending = store_pending();
+        uint8_t * frag    = get_send_buffer(msg_class);
+
+        send_packet(frag, fragmenter.next(frag), pending, msg_class);
+      }
+
+      return;
+    }
+  #endif
+
+  send_packet(data, len, store_pending(), msg_class);
+}
+
+#ifdef CONFIG_IOT_MSG_BATCHING
+  /// Message Batching
+  ///
+  /// The messages sent during a process() cycle are aggregated in a single
+  /// frame. The fields common to all messages are sent once at the beginning of
+  /// the frame, followed by the length-prefixed records:
+  ///
+  /// - Text format:   topic;{name:...,dur:...,...,recs:[<len>{type:...,seq:...,...}<len>{...}]}
+  ///                  where <len> is the record length in decimal.
+  /// - Binary format: the header fields followed by TLV_REC fields, each containing
+  ///                  the TLV_TYPE, TLV_SEQ and TLV_OTHER fields of one message.
+  ///
+  /// The frame is transmitted at the end of the process() cycle, before deep sleep,
+  /// or when the next record would exceed the transport maximum packet size.
+
+  static uint8_t   batch_buff[FRAME_HEADROOM + IoT::MAX_PKT_SIZE];
+  static uint8_t * batch       = &batch_buff[FRAME_HEADROOM];
+  static int       batch_len   = 0;
+  static int       batch_count = 0;
+
+  #ifdef CONFIG_IOT_MSG_FORMAT_BINARY
+    static constexpr const int BATCH_TRAILER_SIZE = 0;
+  #else
+    static constexpr const int BATCH_TRAILER_SIZE = 2; // "]}"
+  #endif
+
+  void IoT::batch_header()
+  {
+    int max_len = get_max_pkt_size() - BATCH_TRAILER_SIZE;
+
+    #ifdef CONFIG_IOT_MSG_FORMAT_BINARY
+      TLVEncoder enc(batch, max_len);
+
+      enc.str(TLV_TOPIC, cfg.topic_name)
+         .str(TLV_NAME,  cfg.device_name)
+         .u32(TLV_DUR,   last_duration)
+         .bytes(TLV_MAC, wifi.get_mac(), sizeof(MacAddr))
+         .u32(TLV_ERR,   error_count)
+         .i8(TLV_RSSI,   wifi.get_rssi())
+         .u32(TLV_ST,    get_states())
+         .u32(TLV_RST,   get_return_states())
+         .u32(TLV_HEAP,  esp_get_free_heap_size());
+
+      #ifdef CONFIG_IOT_BATTERY_LEVEL
+        enc.u32(TLV_VBAT, (uint32_t)(battery.get_voltage_level() * 100.0 + 0.5));
+      #endif
+      #ifdef CONFIG_IOT_MSG_STORE
+        enc.u32(TLV_DROP, msg_store.get_evicted_count());
+      #endif
+      #ifdef CONFIG_IOT_ENABLE_UDP
+        uint32_t ip = wifi.get_ip();
+        enc.bytes(TLV_IP, &ip, sizeof(ip));
+      #endif
+    #else
+      MsgEncoder enc((char *) batch, max_len + 1);
+
+      enc.str(cfg.topic_name)
+         .lit(";{name:").str(cfg.device_name)
+         .field("dur",   (uint32_t) last_duration)
+         .qfield("mac",  wifi.get_mac_cstr())
+         .field("err",   (uint32_t) error_count)
+         .field("rssi",  (int32_t) wifi.get_rssi())
+         .field("st",    (int32_t) get_states())
+         .field("rst",   (int32_t) get_return_states())
+         .field("heap",  (uint32_t) esp_get_free_heap_size());
+
+      #ifdef CONFIG_IOT_BATTERY_LEVEL
+        enc.field("vbat", battery.get_voltage_level());
+      #endif
+      #ifdef CONFIG_IOT_MSG_STORE
+        enc.field("drop", (uint32_t) msg_store.get_evicted_count());
+      #endif
+      #ifdef CONFIG_IOT_ENABLE_UDP
+        enc.qfield("ip",  wifi.get_ip_cstr());
+      #endif
+
+      enc.lit(",recs:[");
+    #endif
+
+    batch_len = enc.get_length();
+  }
+
+  /// Add a message to the current batch. Returns false if the message is too
+  /// large to be part of a batch: it must then be sent alone.
+  bool IoT::batch_msg(const char * msg_type, const char * other_field)
+  {
+    static uint8_t rec[MAX_PKT_SIZE];
+    int rec_len, needed;
+    int max_len = get_max_pkt_size() - BATCH_TRAILER_SIZE;
+
+    #ifdef CONFIG_IOT_MSG_FORMAT_BINARY
+      TLVEncoder enc(rec, sizeof(rec), false);
+
+      enc.str(TLV_TYPE, msg_type)
+         .u32(TLV_SEQ,  send_seq_nbr);
+
+      if (other_field != nullptr) enc.str(TLV_OTHER, other_field);
+
+      rec_len = enc.get_length();
+      needed  = 2 + rec_len;
+
+      // The record length must fit in the TLV_REC length byte.
+      if (enc.is_truncated() || (rec_len > UINT8_MAX)) needed = max_len + 1;
+    #else
+      MsgEncoder enc((char *) rec, sizeof(rec));
+
+      enc.lit("{type:").str(msg_type)
+         .field("seq", (uint32_t) send_seq_nbr);
+
+      if (other_field != nullptr) enc.lit(",").str(other_field);
+
+      enc.lit("}");
+
+      rec_len = enc.get_length();
+      needed  = rec_len + ((rec_len >= 1000) ? 4 : (rec_len >= 100) ? 3 : (rec_len >= 10) ? 2 : 1);
+
+      if (enc.is_truncated()) needed = max_len + 1;
+    #endif
+
+    // A message that doesn't fit is sent alone, after the current batch.
+    if ((batch_count > 0) && ((batch_len + needed) > max_len)) flush_batch();
+    if (batch_count == 0) batch_header();
+
+    if ((batch_len + needed) > max_len) return false;
+
+    #ifdef CONFIG_IOT_MSG_FORMAT_BINARY
+      TLVEncoder app(&batch[batch_len], max_len - batch_len, false);
+      app.bytes(TLV_REC, rec, rec_len);
+    #else
+      MsgEncoder app((char *) &batch[batch_len], max_len - batch_len + 1);
+      app.u32(rec_len).str((const char *) rec);
+    #endif
+
+    batch_len   += app.get_length();
+    batch_count += 1;
+
+    return true;
+  }
+
+  void IoT::flush_batch()
+  {
+    if (batch_count == 0) return;
+
+    #ifndef CONFIG_IOT_MSG_FORMAT_BINARY
+      memcpy(&batch[batch_len], "]}", BATCH_TRAILER_SIZE);
+      batch_len += BATCH_TRAILER_SIZE;
+    #endif
+
+    ESP_LOGD(TAG, "Sending a batch of %d message(s), %d bytes.", batch_count, batch_len);
+
+    send_frame(batch, batch_len);
+
+    batch_len   = 0;
+    batch_count = 0;
+  }
+#endif
+
+/// Encode a message in **buff**, that must be able to hold **max_len** + 1
+/// bytes. Returns the length of the encoded message. **truncated** is set if
+/// the message doesn't fit.
+int IoT::encode_msg(uint8_t * buff, int max_len, const char * msg_type, const char * other_field, bool & truncated)
+{
+  #ifdef CONFIG_IOT_MSG_FORMAT_BINARY
+    TLVEncoder enc(buff, max_len);
+
+    enc.str(TLV_TOPIC, cfg.topic_name)
+       .str(TLV_NAME,  cfg.device_name)
+       .str(TLV_TYPE,  msg_type)
+       .u32(TLV_SEQ,   send_seq_nbr)
+       .u32(TLV_DUR,   last_duration)
+       .bytes(TLV_MAC, wifi.get_mac(), sizeof(MacAddr))
+       .u32(TLV_ERR,   error_count)
+       .i8(TLV_RSSI,   wifi.get_rssi())
+       .u32(TLV_ST,    get_states())
+       .u32(TLV_RST,   get_return_states())
+       .u32(TLV_HEAP,  esp_get_free_heap_size());
+
+    if (other_field != nullptr) enc.str(TLV_OTHER, other_field);
 
-  snprintf(pkt, 247,
-    "%s;{name:%s,type:%s,seq:%d,dur:%d,mac:\"%s\",err:%d,rssi:%d,st:%d,rst:%d,heap:%d%s%s"
     #ifdef CONFIG_IOT_BATTERY_LEVEL
-      ",vbat:%4.2f"
+      enc.u32(TLV_VBAT, (uint32_t)(battery.get_voltage_level() * 100.0 + 0.5));
+    #endif
+    #ifdef CONFIG_IOT_MSG_STORE
+      enc.u32(TLV_DROP, msg_store.get_evicted_count());
     #endif
     #ifdef CONFIG_IOT_ENABLE_UDP
-      ",ip:\"%s\""
+      uint32_t ip = wifi.get_ip();
+      enc.bytes(TLV_IP, &ip, sizeof(ip));
     #endif
-    "}",
-    cfg.topic_name,
-    cfg.device_name,
-    msg_type,
-    send_seq_nbr,
-    last_duration,
-    wifi.get_mac_cstr(),
-    error_count,
-    wifi.get_rssi(),
-    state, return_state,
-    esp_get_free_heap_size(),
-    other_field == nullptr ? "" : ",",
-    other_field == nullptr ? "" : other_field
+  #else
+    MsgEncoder enc((char *) buff, max_len + 1);
+
+    enc.str(cfg.topic_name)
+       .lit(";{name:").str(cfg.device_name)
+       .field("type",  msg_type)
+       .field("seq",   (uint32_t) send_seq_nbr)
+       .field("dur",   (uint32_t) last_duration)
+       .qfield("mac",  wifi.get_mac_cstr())
+       .field("err",   (uint32_t) error_count)
+       .field("rssi",  (int32_t) wifi.get_rssi())
+       .field("st",    (int32_t) get_states())
+       .field("rst",   (int32_t) get_return_states())
+       .field("heap",  (uint32_t) esp_get_free_heap_size());
+
+    if (other_field != nullptr) enc.lit(",").str(other_field);
+
     #ifdef CONFIG_IOT_BATTERY_LEVEL
-      , battery.read_voltage_level()
+      enc.field("vbat", battery.get_voltage_level());
+    #endif
+    #ifdef CONFIG_IOT_MSG_STORE
+      enc.field("drop", (uint32_t) msg_store.get_evicted_count());
     #endif
     #ifdef CONFIG_IOT_ENABLE_UDP
-      , wifi.get_ip_cstr()
+      enc.qfield("ip",  wifi.get_ip_cstr());
     #endif
-  );
 
-  #ifdef CONFIG_IOT_ENABLE_UDP
-    udp.send((uint8_t *) pkt, strlen(pkt));
+    enc.lit("}");
   #endif
-  #ifdef CONFIG_IOT_ENABLE_ESP_NOW
-    esp_now.send((uint8_t *) pkt, strlen(pkt));
-    ESPNow::SendEvent evt;
-    if (send_queue_handle != nullptr) {
-      if (xQueueReceive(send_queue_handle, &evt, pdMS_TO_TICKS(200)) != pdTRUE) {
-        ESP_LOGE(TAG, "No answer after packet sent.");
-        error_count++;
-      }
-      else {
-        if (evt.status == ESP_OK) {
-          ESP_LOGD(TAG, "Packet transmitted:");
-        }
-      }
+
+
+  truncated = enc.is_truncated();
+
+  return enc.get_length();
+}
+
+/// Send a message to the gateway. May not return if the message cannot
+/// be sent (gateway is dead for any reason). The underneath protocol
+/// (udp or esp_now) will start a deep_sleep if not able to send the message.
+/// At next boot, the current state will be done again to try to send again
+/// something if there is still something to be sent.
+///
+/// The message is encoded directly in the transport send buffer. It is copied
+/// only if it must be fragmented.
+void IoT::send_msg(const char * msg_type, const char * other_field)
+{
+  send_msg(MsgClass::NORMAL, msg_type, other_field);
+}
+
+/// Send a message of the given class. ALARM messages are never batched and,
+/// when both UDP and ESP-NOW are enabled, are sent through ESP-NOW.
+void IoT::send_msg(MsgClass msg_class, const char * msg_type, const char * other_field)
+{
+  #ifdef CONFIG_IOT_MSG_BATCHING
+    if ((msg_class == MsgClass::NORMAL) && batch_msg(msg_type, other_field)) {
+      send_seq_nbr++;
+      return;
+    }
+  #endif
+
+  bool      truncated;
+  bool      pending = store_pending();
+  uint8_t * pkt     = get_send_buffer(msg_class);
+  int       len     = encode_msg(pkt, get_max_pkt_size(msg_class), msg_type, other_field, truncated);
+
+  #ifdef CONFIG_IOT_MSG_FRAGMENTATION
+    if (truncated) {
+      static uint8_t msg[FRAME_HEADROOM + MAX_MSG_SIZE + 1];
+
+      len = encode_msg(&msg[FRAME_HEADROOM], MAX_MSG_SIZE, msg_type, other_field, truncated);
+
+      if (truncated) ESP_LOGW(TAG, "Message truncated to %d bytes.", len);
+
+      send_frame(&msg[FRAME_HEADROOM], len, msg_class);
+      send_seq_nbr++;
+      return;
     }
   #endif
 
+  if (truncated) ESP_LOGW(TAG, "Message truncated to %d bytes.", len);
+
+  send_packet(pkt, len, pending, msg_class);
+
   send_seq_nbr++;
 }
 
 void IoT::process()
 {
-  UserResult user_result = UserResult::COMPLETED;
-  if (process_handler != nullptr) user_result = process_handler(state);
-  
-  State new_state = state;
-  State new_return_state = return_state;
-
-  switch (state) {
-    case State::STARTUP:
-      send_msg("STARTUP");
-      if (user_result != NOT_COMPLETED) {
-        new_state        = WAIT_FOR_EVENT;
-        new_return_state = WAIT_FOR_EVENT;
-      }
-      break;
+  if (wake_scheduler.collect() & (1UL << WakeScheduler::WATCHDOG_ID)) watchdog_pending = true;
 
-    case State::WATCHDOG: {
-        send_msg("WATCHDOG");
-        time_t now;
-        next_watchdog_time = time(&now) + cfg.watchdog_interval;
-        new_state = new_return_state;
-      }
-      break;
+  #ifdef CONFIG_IOT_DOWNLINK
+    #ifdef CONFIG_IOT_OTA
+      // Always on: there is no receive window, the transfer runs as soon as
+      // its frames arrive (wait_event() returns on DOWNLINK_READY).
+      if ((deep_sleep_duration < 0) && ota.has_frames()) ota.run();
+    #endif
 
-    case State::WAIT_FOR_EVENT:
-      if (user_result == NEW_EVENT) {
-        new_state        = PROCESS_EVENT;
-        new_return_state = PROCESS_EVENT;
-      }
-      else {
-        new_return_state = WAIT_FOR_EVENT;
-        new_state        = check_if_24_hours_time(WAIT_FOR_EVENT);
-      }
-      break;
+    process_commands();
+  #endif
 
-    case State::PROCESS_EVENT:
-     if (user_result == ABORTED) {
-        new_state = new_return_state = WAIT_FOR_EVENT;
-      }
-      else if (user_result != NOT_COMPLETED) {
-        new_state = new_return_state = WAIT_END_EVENT;
-      }
-      else {
-        new_return_state = PROCESS_EVENT;
-        new_state        = check_if_24_hours_time(PROCESS_EVENT);
-      }
-       break;
+  #ifdef CONFIG_IOT_EVENT_CAPTURE
+    event_capture.deliver(event_handler);
+  #endif
 
-    case State::WAIT_END_EVENT:
-      if (user_result == RETRY) {
-        new_state = new_return_state = PROCESS_EVENT;
-      }
-      else if (user_result != NOT_COMPLETED) {
-        new_state = new_return_state = END_EVENT;
-      }
-      else {
-        new_return_state = WAIT_END_EVENT;
-        new_state        = check_if_24_hours_time(WAIT_END_EVENT);
-      }
-      break;
+  UserResult results[MAX_MACHINES];
 
-    case State::END_EVENT:
-      if (user_result != NOT_COMPLETED) {
-        new_state = new_return_state = WAIT_FOR_EVENT;
-      }
-      break;
+  for (int i = 0; i < machine_count; i++) {
+    results[i] = (process_handlers[i] != nullptr) ? process_handlers[i](machines[i].state) : UserResult::COMPLETED;
   }
 
-  state        = new_state;
-  return_state = new_return_state;
+  uint8_t states = get_states();
+
+  if (states & STARTUP) send_msg("STARTUP");
+
+  if (states & WATCHDOG) {
+    send_msg("WATCHDOG");
+    watchdog_pending = false;
+  }
+
+  bool watchdog_due = watchdog_pending;
+
+  for (int i = 0; i < machine_count; i++) {
+    Machine &                    m = machines[i];
+    const IoTFsm::Transition &   t = iot_fsm.at(m.state, results[i]);
+    State                     back = m.return_state;
+
+    m.state        = (t.next        != 0) ? t.next        : back;
+    m.return_state = (t.next_return != 0) ? t.next_return : back;
+
+    // A single machine goes through the WATCHDOG state.
+    if ((t.flags & CHECK_WATCHDOG) && watchdog_due) {
+      m.state      = WATCHDOG;
+      watchdog_due = false;
+    }
+  }
+
+  #ifdef CONFIG_IOT_MSG_BATCHING
+    flush_batch();
+  #endif
+
+  #ifdef CONFIG_IOT_MSG_STORE
+    if (!msg_store.is_empty()) forward_stored_msgs();
+  #endif
+
+  if ((get_states() & (PROCESS_EVENT|END_EVENT|WATCHDOG)) == 0) {
+    #ifdef CONFIG_IOT_DOWNLINK
+      // Before the deep sleep decision: a command may change its duration.
+      if (deep_sleep_duration >= 0) receive_window();
+    #endif
 
-  if ((state & (PROCESS_EVENT|END_EVENT|WATCHDOG)) == 0) {
     if (deep_sleep_duration >= 0) {
-      if (deep_sleep_duration == 0) {
-        time_t now = time(&now);
-        if ((next_watchdog_time - now) > 0) {
-          prepare_for_deep_sleep();
-          last_duration = (int)(esp_timer_get_time() / 1000);
-          esp_deep_sleep(((uint64_t)(next_watchdog_time - now)) * 1e6);
-        }
+      // Wake up for the earliest deadline, or earlier as asked by the application.
+      time_t now  = time(&now);
+      time_t wake = wake_scheduler.next_wake();
+
+      if ((deep_sleep_duration > 0) && ((wake == 0) || ((now + deep_sleep_duration) < wake))) {
+        wake = now + deep_sleep_duration;
       }
-      else {
+
+      // A pending watchdog is to be sent first, unless the application asked
+      // for a wake up: it will be sent then.
+      if ((wake > now) && (!watchdog_pending || (deep_sleep_duration > 0))) {
         prepare_for_deep_sleep();
         last_duration = (int)(esp_timer_get_time() / 1000);
-        esp_deep_sleep(((uint64_t) deep_sleep_duration) * 1e6);
+        esp_deep_sleep(((uint64_t)(wake - now)) * 1e6);
       }
     }
+
+    #ifdef CONFIG_IOT_RUN_LOOP
+      if ((deep_sleep_duration < 0) && !watchdog_pending) wait_event();
+    #endif
   }
 }
\ No newline at end of file
@@ -0,0 +1,215 @@
+#include "config.hpp"
+
+#ifdef CONFIG_IOT_ESPNOW_LINK_ADAPT
+
+#include <cstring>
+#include <algorithm>
+#include <esp_wifi.h>
+
+#include "link_adapt.hpp"
+#include "global.hpp"
+
+// Rate ladder, from the most robust to the most efficient one. The 5.5 and
+// 11 Mbps DSSS rates are left out: the 6 and 12 Mbps OFDM rates are as
+// sensitive and shorter on air. The sensitivities are those of the ESP32
+// datasheet, rounded down.
+static const struct {
+  wifi_phy_rate_t rate;
+  int8_t          sensitivity;  // dBm
+  const char *    name;
+} rates[] = {
+  { WIFI_PHY_RATE_LORA_250K, -102, "LR 250K" },
+  { WIFI_PHY_RATE_LORA_500K,  -99, "LR 500K" },
+  { WIFI_PHY_RATE_1M_L,       -97, "1M"      },
+  { WIFI_PHY_RATE_6M,         -92, "6M"      },
+  { WIFI_PHY_RATE_12M,        -89, "12M"     },
+  { WIFI_PHY_RATE_24M,        -84, "24M"     }
+};
+
+static constexpr const int RATE_COUNT   = sizeof(rates) / sizeof(rates[0]);
+static constexpr const int DEFAULT_RATE = 2;  // 1 Mbps, the ESP-NOW default
+
+// TX power levels accepted by esp_wifi_set_max_tx_power(), in 0.25 dBm unit,
+// from the highest one.
+static const int8_t power_levels[] = { 84, 80, 72, 66, 60, 56, 52, 44, 34, 28, 20, 8 };
+
+#ifdef CONFIG_IOT_ENABLE_UDP
+  static constexpr const int POWER_COUNT = 1;  // Shared with the Wifi connection
+#else
+  static constexpr const int POWER_COUNT = sizeof(power_levels) / sizeof(power_levels[0]);
+#endif
+
+RTC_NOINIT_ATTR static LinkAdapt::State link_state;
+
+esp_err_t LinkAdapt::init()
+{
+  esp_log_level_set(TAG, cfg.log_level);
+
+  if (iot.was_reset() || (link_state.magic != LINK_MAGIC) ||
+      (link_state.up_threshold < UP_MIN_THRESHOLD) || (link_state.up_threshold > UP_MAX_THRESHOLD)) {
+    memset(&link_state, 0, sizeof(State));
+    link_state.magic        = LINK_MAGIC;
+    link_state.up_threshold = UP_MIN_THRESHOLD;
+  }
+
+  return ESP_OK;
+}
+
+int LinkAdapt::min_rate()
+{
+  return cfg.esp_now.enable_long_range ? 0 : DEFAULT_RATE;
+}
+
+// The gateway RSSI is measured at full TX power (by the gateway, assuming a
+// symmetric link): every level of TX power reduction is taken out of it.
+bool LinkAdapt::can_use(const NVSMgr::Gateway & gw, int rate, int power)
+{
+  int rssi = gw.rssi - ((power_levels[0] - power_levels[power]) / 4);
+
+  return rssi >= (rates[rate].sensitivity + CONFIG_IOT_ESPNOW_LINK_MARGIN);
+}
+
+/// Initial operating point of a new gateway: full TX power and the fastest
+/// rate its RSSI allows.
+void LinkAdapt::seed(NVSMgr::Gateway & gw)
+{
+  gw.tx_power = 0;
+  gw.rate     = min_rate();
+
+  while (((gw.rate + 1) < RATE_COUNT) && can_use(gw, gw.rate + 1, 0)) gw.rate++;
+}
+
+/// Program the operating point of the gateway in use. The run of successes
+/// starts again when the gateway changes.
+esp_err_t LinkAdapt::apply(NVSMgr::Gateway & gw)
+{
+  esp_err_t status;
+
+  if ((gw.rate < min_rate()) || (gw.rate >= RATE_COUNT) || (gw.tx_power >= POWER_COUNT)) seed(gw);
+
+  if (memcmp(link_state.mac_addr, gw.mac_addr, sizeof(MacAddr)) != 0) {
+    memcpy(link_state.mac_addr, gw.mac_addr, sizeof(MacAddr));
+    link_state.successes    = 0;
+    link_state.failures     = 0;
+    link_state.up_threshold = UP_MIN_THRESHOLD;
+    link_state.probe        = Step::NONE;
+    link_state.skip         = 0;
+  }
+
+  if ((status = esp_wifi_config_espnow_rate(WIFI_IF_STA, rates[gw.rate].rate)) != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to set the ESP-NOW rate to %s: %s.", rates[gw.rate].name, esp_err_to_name(status));
+    return status;
+  }
+
+  #ifndef CONFIG_IOT_ENABLE_UDP
+    if ((status = esp_wifi_set_max_tx_power(power_levels[gw.tx_power])) != ESP_OK) {
+      ESP_LOGE(TAG, "Unable to set the TX power: %s.", esp_err_to_name(status));
+      return status;
+    }
+  #endif
+
+  ESP_LOGD(TAG, "Rate %s, TX power %d dBm, RSSI %d.", rates[gw.rate].name, power_levels[gw.tx_power] / 4, gw.rssi);
+
+  return ESP_OK;
+}
+
+// A faster rate first: shorter frames save more energy than a lower TX power.
+LinkAdapt::Step LinkAdapt::step_up(NVSMgr::Gateway & gw)
+{
+  if (((gw.rate + 1) < RATE_COUNT) && can_use(gw, gw.rate + 1, gw.tx_power)) {
+    gw.rate++;
+    link_state.counters.rate_up++;
+    return Step::RATE_UP;
+  }
+
+  if (((gw.tx_power + 1) < POWER_COUNT) && can_use(gw, gw.rate, gw.tx_power + 1)) {
+    gw.tx_power++;
+    link_state.counters.power_down++;
+    return Step::POWER_DOWN;
+  }
+
+  return Step::NONE;
+}
+
+// A higher TX power first: it doesn't cost any airtime.
+bool LinkAdapt::step_down(NVSMgr::Gateway & gw)
+{
+  if (gw.tx_power > 0) {
+    gw.tx_power--;
+    link_state.counters.power_up++;
+    return true;
+  }
+
+  if (gw.rate > min_rate()) {
+    gw.rate--;
+    link_state.counters.rate_down++;
+    return true;
+  }
+
+  return false;
+}
+
+void LinkAdapt::revert(NVSMgr::Gateway & gw, Step step)
+{
+  if      (step == Step::RATE_UP)    gw.rate--;
+  else if (step == Step::POWER_DOWN) gw.tx_power--;
+}
+
+/// Account for the result of a frame sent to the gateway in use.
+/// **outstanding** frames, sent at the current operating point, are still
+/// waiting for their result. Returns true if the operating point changed.
+bool LinkAdapt::update(NVSMgr::Gateway & gw, bool success, int outstanding)
+{
+  bool changed = false;
+
+  link_state.counters.sent++;
+  if (!success) link_state.counters.failed++;
+
+  if (link_state.skip > 0) {
+    link_state.skip--;
+    return false;
+  }
+
+  if (success) {
+    link_state.failures = 0;
+    link_state.probe    = Step::NONE;
+
+    if (++link_state.successes >= link_state.up_threshold) {
+      link_state.successes = 0;
+      link_state.probe     = step_up(gw);
+      changed              = (link_state.probe != Step::NONE);
+    }
+  }
+  else {
+    link_state.successes = 0;
+
+    if (link_state.probe != Step::NONE) {
+      revert(gw, link_state.probe);
+      link_state.counters.probes_failed++;
+      link_state.probe        = Step::NONE;
+      link_state.failures     = 0;
+      link_state.up_threshold = std::min(link_state.up_threshold * 2, UP_MAX_THRESHOLD);
+      changed                 = true;
+    }
+    else if (++link_state.failures >= DOWN_THRESHOLD) {
+      link_state.failures     = 0;
+      link_state.up_threshold = UP_MIN_THRESHOLD;
+      changed                 = step_down(gw);
+    }
+  }
+
+  if (changed) {
+    ESP_LOGI(TAG, "Operating point: rate %s, TX power %d dBm.", rates[gw.rate].name, power_levels[gw.tx_power] / 4);
+    link_state.skip = std::min(outstanding, 255);
+    apply(gw);
+  }
+
+  return changed;
+}
+
+const LinkAdapt::Counters & LinkAdapt::get_counters()
+{
+  return link_state.counters;
+}
+
+#endif
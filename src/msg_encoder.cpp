@@ -0,0 +1,101 @@
+#include <cstring>
+
+#include "msg_encoder.hpp"
+
+void MsgEncoder::append(const char * str, size_t count)
+{
+  if ((len + count) >= size) {
+    truncated = true;
+    count = (size > (len + 1)) ? size - len - 1 : 0;
+  }
+
+  memcpy(&buff[len], str, count);
+  len += count;
+  buff[len] = 0;
+}
+
+MsgEncoder & MsgEncoder::str(const char * str)
+{
+  append(str, strlen(str));
+  return *this;
+}
+
+MsgEncoder & MsgEncoder::u32(uint32_t value)
+{
+  char   digits[10];
+  size_t pos = sizeof(digits);
+
+  do {
+    digits[--pos] = '0' + (value % 10);
+    value /= 10;
+  } while (value != 0);
+
+  append(&digits[pos], sizeof(digits) - pos);
+  return *this;
+}
+
+MsgEncoder & MsgEncoder::i32(int32_t value)
+{
+  if (value < 0) {
+    lit("-");
+    return u32(-(uint32_t) value);
+  }
+
+  return u32((uint32_t) value);
+}
+
+// Same output as printf's "%4.2f": the exact binary value is rounded to 2
+// decimals, ties to even (3.295 is stored as 3.29499..., giving "3.29").
+// The hundredths are computed from the mantissa and exponent bits, without
+// any floating point operation. Values saturate at 42949672.95.
+
+MsgEncoder & MsgEncoder::fixed2(double value)
+{
+  if (value < 0.0) {
+    lit("-");
+    value = -value;
+  }
+
+  uint32_t hundredths;
+
+  if (!(value < 42949672.95)) {   // NaN included
+    hundredths = UINT32_MAX;
+  }
+  else {
+    // value = mant * 2^-shift exactly, with shift >= 26 in this range. The
+    // product mant * 100 fits in 60 bits.
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    int      exp    = (int)((bits >> 52) & 0x7FF);
+    uint64_t mant   = bits & ((1ULL << 52) - 1);
+
+    if (exp == 0) exp = 1; else mant |= 1ULL << 52;
+
+    int      shift  = 1075 - exp;
+    uint64_t scaled = mant * 100;
+
+    if (shift >= 64) {
+      hundredths = 0;             // scaled < 2^60 < half
+    }
+    else {
+      uint64_t half = 1ULL << (shift - 1);
+      uint64_t rem  = scaled & ((half << 1) - 1);
+
+      hundredths = (uint32_t)(scaled >> shift);
+      if ((rem > half) || ((rem == half) && (hundredths & 1))) hundredths++;
+    }
+  }
+
+  char decimals[3] = {
+    (char)('0' + ((hundredths / 10) % 10)),
+    (char)('0' + (hundredths % 10)),
+    0
+  };
+
+  u32(hundredths / 100);
+  lit(".");
+  append(decimals, 2);
+
+  return *this;
+}
@@ -0,0 +1,110 @@
+#include <cstring>
+
+#include "msg_frag.hpp"
+
+uint16_t frag_crc16(const uint8_t * data, size_t len)
+{
+  uint16_t crc = 0xFFFF;
+
+  while (len--) {
+    crc ^= *data++;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : (crc >> 1);
+    }
+  }
+
+  return crc;
+}
+
+Fragmenter::Fragmenter(const uint8_t * data, int len, int max_frame_size, uint16_t id) :
+  msg(data), msg_len(len), msg_id(id), count(0), index(0)
+{
+  int max_chunk = max_frame_size - (int) sizeof(FragHeader);
+
+  if ((max_chunk <= 0) || (len <= 0) || (len > UINT16_MAX)) return;
+
+  int frag_count = (len + max_chunk - 1) / max_chunk;
+  if (frag_count > FRAG_MAX_COUNT) return;
+
+  count      = frag_count;
+  chunk_size = (len + count - 1) / count;
+  msg_crc    = frag_crc16(data, len);
+}
+
+int Fragmenter::next(uint8_t * frame)
+{
+  if (index >= count) return 0;
+
+  int offset = index * chunk_size;
+  int len    = (msg_len - offset) < chunk_size ? (msg_len - offset) : chunk_size;
+
+  FragHeader hdr = {
+    .marker    = FRAG_FRAME_MARKER,
+    .msg_id    = msg_id,
+    .index     = index,
+    .count     = count,
+    .total_len = msg_len,
+    .msg_crc   = msg_crc
+  };
+
+  memcpy(frame, &hdr, sizeof(FragHeader));
+  memcpy(&frame[sizeof(FragHeader)], &msg[offset], len);
+
+  index += 1;
+
+  return sizeof(FragHeader) + len;
+}
+
+FragReassembler::FragReassembler(uint8_t * buffer, size_t capacity) :
+  buff(buffer), size(capacity), active(false), abandoned_count(0)
+{
+}
+
+FragReassembler::Result FragReassembler::add(const uint8_t * frame, size_t len)
+{
+  FragHeader hdr;
+
+  if (len <= sizeof(FragHeader)) return Result::INVALID;
+
+  memcpy(&hdr, frame, sizeof(FragHeader));
+
+  if ((hdr.marker != FRAG_FRAME_MARKER) ||
+      (hdr.count == 0) ||
+      (hdr.index >= hdr.count) ||
+      (hdr.total_len > size) ||
+      (hdr.total_len < hdr.count)) {
+    return Result::INVALID;
+  }
+
+  if (!active || (hdr.msg_id != msg_id) || (hdr.total_len != total_len) || (hdr.count != count)) {
+    if (active) abandoned_count += 1;
+
+    active         = true;
+    msg_id         = hdr.msg_id;
+    total_len      = hdr.total_len;
+    msg_crc        = hdr.msg_crc;
+    count          = hdr.count;
+    chunk_size     = (total_len + count - 1) / count;
+    received_count = 0;
+    memset(received, 0, sizeof(received));
+  }
+
+  size_t offset   = hdr.index * chunk_size;
+  if (offset >= total_len) return Result::INVALID;
+
+  size_t expected = ((total_len - offset) < chunk_size) ? (total_len - offset) : chunk_size;
+
+  if ((len - sizeof(FragHeader)) != expected) return Result::INVALID;
+
+  if (received[hdr.index >> 3] & (1 << (hdr.index & 7))) return Result::DUPLICATE;
+
+  memcpy(&buff[offset], &frame[sizeof(FragHeader)], expected);
+  received[hdr.index >> 3] |= (1 << (hdr.index & 7));
+  received_count += 1;
+
+  if (received_count < count) return Result::INCOMPLETE;
+
+  active = false;
+
+  return (frag_crc16(buff, total_len) == msg_crc) ? Result::COMPLETE : Result::CRC_ERROR;
+}
@@ -0,0 +1,171 @@
+#include "config.hpp"
+
+#ifdef CONFIG_IOT_MSG_STORE
+
+#include <cstring>
+#include <algorithm>
+#include <esp_crc.h>
+#include <esp_attr.h>
+
+#include "msg_store.hpp"
+
+#define __MSG_STORE__
+#include "global.hpp"
+#undef __MSG_STORE__
+
+RTC_NOINIT_ATTR MsgStore::Header store_hdr;
+RTC_NOINIT_ATTR uint8_t          store_data[MsgStore::SIZE];
+
+esp_err_t MsgStore::init(bool reset)
+{
+  esp_log_level_set(TAG, cfg.log_level);
+
+  uint16_t crc = esp_crc16_le(UINT16_MAX, (const uint8_t *) &store_hdr, sizeof(Header) - 2);
+
+  if ((store_hdr.magic != MAGIC) || (crc != store_hdr.crc) || (store_hdr.used > SIZE) || (store_hdr.head >= SIZE)) {
+    // Expected after a power on.
+    if (!reset) ESP_LOGW(TAG, "Store header is corrupted. Emptied.");
+    clear();
+    return ESP_OK;
+  }
+
+  if (reset) {
+    store_hdr.stored_count    = 0;
+    store_hdr.forwarded_count = 0;
+    store_hdr.evicted_count   = 0;
+    update_crc();
+  }
+
+  if (store_hdr.count > 0) {
+    ESP_LOGI(TAG, "%d message(s) waiting to be forwarded.", store_hdr.count);
+  }
+
+  return ESP_OK;
+}
+
+void MsgStore::clear()
+{
+  memset(&store_hdr, 0, sizeof(Header));
+  store_hdr.magic = MAGIC;
+  update_crc();
+}
+
+void MsgStore::update_crc()
+{
+  store_hdr.crc = esp_crc16_le(UINT16_MAX, (const uint8_t *) &store_hdr, sizeof(Header) - 2);
+}
+
+void MsgStore::read(uint16_t offset, void * data, int len)
+{
+  int first = std::min(len, SIZE - offset);
+
+  memcpy(data, &store_data[offset], first);
+  if (first < len) memcpy(((uint8_t *) data) + first, store_data, len - first);
+}
+
+void MsgStore::write(uint16_t offset, const void * data, int len)
+{
+  int first = std::min(len, SIZE - offset);
+
+  memcpy(&store_data[offset], data, first);
+  if (first < len) memcpy(store_data, ((const uint8_t *) data) + first, len - first);
+}
+
+void MsgStore::drop_oldest()
+{
+  RecordHeader rec;
+
+  read(store_hdr.head, &rec, sizeof(RecordHeader));
+
+  int rec_size = sizeof(RecordHeader) + rec.len;
+
+  if (rec_size > store_hdr.used) {
+    ESP_LOGE(TAG, "Corrupted record header. Store emptied.");
+    clear();
+    return;
+  }
+
+  store_hdr.head   = (store_hdr.head + rec_size) % SIZE;
+  store_hdr.used  -= rec_size;
+  store_hdr.count -= 1;
+}
+
+esp_err_t MsgStore::push(const uint8_t * data, int len)
+{
+  int rec_size = sizeof(RecordHeader) + len;
+
+  if (rec_size > SIZE) {
+    ESP_LOGE(TAG, "Message of length %d cannot fit in the store.", len);
+    return ESP_FAIL;
+  }
+
+  while ((SIZE - store_hdr.used) < rec_size) {
+    drop_oldest();
+    store_hdr.evicted_count += 1;
+    ESP_LOGW(TAG, "Store is full. Oldest message evicted.");
+  }
+
+  RecordHeader rec = { .len = (uint16_t) len, .crc = esp_crc16_le(UINT16_MAX, data, len) };
+  uint16_t tail    = (store_hdr.head + store_hdr.used) % SIZE;
+
+  write(tail, &rec, sizeof(RecordHeader));
+  write((tail + sizeof(RecordHeader)) % SIZE, data, len);
+
+  store_hdr.used         += rec_size;
+  store_hdr.count        += 1;
+  store_hdr.stored_count += 1;
+  update_crc();
+
+  ESP_LOGD(TAG, "Message stored. %d message(s) waiting.", store_hdr.count);
+
+  return ESP_OK;
+}
+
+int MsgStore::peek(uint8_t * data, int max_len)
+{
+  if (store_hdr.count == 0) return 0;
+
+  RecordHeader rec;
+
+  read(store_hdr.head, &rec, sizeof(RecordHeader));
+
+  if ((int)(sizeof(RecordHeader) + rec.len) > store_hdr.used) {
+    ESP_LOGE(TAG, "Corrupted record header. Store emptied.");
+    clear();
+    return -1;
+  }
+
+  if (rec.len > max_len) {
+    ESP_LOGE(TAG, "Message of length %d larger than %d. Evicted.", rec.len, max_len);
+    drop_oldest();
+    store_hdr.evicted_count += 1;
+    update_crc();
+    return -1;
+  }
+
+  read((store_hdr.head + sizeof(RecordHeader)) % SIZE, data, rec.len);
+
+  if (esp_crc16_le(UINT16_MAX, data, rec.len) != rec.crc) {
+    ESP_LOGE(TAG, "Corrupted record. Store emptied.");
+    clear();
+    return -1;
+  }
+
+  return rec.len;
+}
+
+void MsgStore::pop()
+{
+  if (store_hdr.count == 0) return;
+
+  drop_oldest();
+  store_hdr.forwarded_count += 1;
+  update_crc();
+}
+
+bool     MsgStore::is_empty()            { return store_hdr.count == 0;     }
+int      MsgStore::get_count()           { return store_hdr.count;          }
+uint32_t MsgStore::get_evicted_count()   { return store_hdr.evicted_count;  }
+uint32_t MsgStore::get_forwarded_count() { return store_hdr.forwarded_count; }
+
+#endif
@@ -0,0 +1,91 @@
+#include <cstring>
+
+#include "msg_tlv.hpp"
+
+TLVEncoder::TLVEncoder(uint8_t * buffer, size_t capacity, bool marker) :
+  buff(buffer), size(capacity), len(0), truncated(false)
+{
+  if (marker) {
+    if (size > 0) buff[len++] = TLV_FRAME_MARKER;
+    else truncated = true;
+  }
+}
+
+TLVEncoder & TLVEncoder::bytes(TLVKey key, const void * data, size_t length)
+{
+  // A field is never split. Once a field doesn't fit, it is dropped along
+  // with all the following ones: a truncated frame is a prefix of the
+  // complete one, never missing a field in the middle.
+
+  if (truncated) return *this;
+
+  if ((length > UINT8_MAX) || ((len + 2 + length) > size)) {
+    truncated = true;
+  }
+  else {
+    buff[len++] = key;
+    buff[len++] = (uint8_t) length;
+    memcpy(&buff[len], data, length);
+    len += length;
+  }
+
+  return *this;
+}
+
+TLVEncoder & TLVEncoder::str(TLVKey key, const char * str)
+{
+  return bytes(key, str, strlen(str));
+}
+
+TLVEncoder & TLVEncoder::u32(TLVKey key, uint32_t value)
+{
+  uint8_t le[4];
+  size_t  count = 0;
+
+  do {
+    le[count++] = value & 0xFF;
+    value >>= 8;
+  } while (value != 0);
+
+  return bytes(key, le, count);
+}
+
+TLVEncoder & TLVEncoder::i8(TLVKey key, int8_t value)
+{
+  return bytes(key, &value, 1);
+}
+
+uint32_t TLVDecoder::Field::as_uint() const
+{
+  uint32_t result = 0;
+
+  for (int i = (length > 4 ? 4 : length) - 1; i >= 0; i--) {
+    result = (result << 8) | value[i];
+  }
+
+  return result;
+}
+
+TLVDecoder::TLVDecoder(const uint8_t * frame, size_t length, bool marker) :
+  data(frame), len(length), pos(marker ? 1 : 0)
+{
+  valid = !marker || ((len > 0) && (data[0] == TLV_FRAME_MARKER));
+}
+
+bool TLVDecoder::next(Field & field)
+{
+  if (!valid || (pos >= len)) return false;
+
+  if ((pos + 2) > len || (pos + 2 + data[pos + 1]) > len) {
+    valid = false;
+    return false;
+  }
+
+  field.key    = (TLVKey) data[pos];
+  field.length = data[pos + 1];
+  field.value  = &data[pos + 2];
+
+  pos += 2 + field.length;
+
+  return true;
+}
@@ -41,3 +41,30 @@ esp_err_t NVSMgr::set_nvs_data(NVSData * data)
 
   return status;
 }
+
+/// Returns ESP_FAIL if the blob doesn't exist or is not **len** bytes long.
+esp_err_t NVSMgr::get_blob(const char * key, void * data, size_t len)
+{
+  esp_err_t status;
+
+  if ((status = nvs_open(NAMESPACE, NVS_READONLY, &nvs_handle)) == ESP_OK) {
+    size_t size = len;
+    status = nvs_get_blob(nvs_handle, key, data, &size);
+    if ((status == ESP_OK) && (size != len)) status = ESP_FAIL;
+    nvs_close(nvs_handle);
+  }
+
+  return status;
+}
+
+esp_err_t NVSMgr::set_blob(const char * key, const void * data, size_t len)
+{
+  esp_err_t status;
+
+  if ((status = nvs_open(NAMESPACE, NVS_READWRITE, &nvs_handle)) == ESP_OK) {
+    if ((status = nvs_set_blob(nvs_handle, key, data, len)) == ESP_OK) status = nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+  }
+
+  return status;
+}
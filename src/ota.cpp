@@ -0,0 +1,392 @@
+#include "config.hpp"
+
+#ifdef CONFIG_IOT_OTA
+
+#include <cstring>
+#include <algorithm>
+#include <esp_crc.h>
+#include <esp_timer.h>
+#include <esp_ota_ops.h>
+#include <esp_system.h>
+#include <mbedtls/sha256.h>
+
+#include "ota.hpp"
+
+#define __OTA__
+#include "global.hpp"
+#undef __OTA__
+
+// Transfer state. The RTC memory copy is the most recent one, NVS is only
+// written when a transfer starts or ends, and before deep sleep.
+RTC_NOINIT_ATTR static Ota::State ota_state;
+RTC_NOINIT_ATTR static uint16_t   ota_state_crc;
+
+SPSCRing<DownlinkCmd, Ota::RING_SIZE> Ota::ring;
+
+esp_err_t Ota::init()
+{
+  static_assert(CONFIG_IOT_OTA_WINDOW <= RING_SIZE, "The OTA window must not exceed the OTA frame ring size.");
+  static_assert(CONFIG_IOT_OTA_WINDOW <= 32,        "The OTA window must fit the status bitmap.");
+
+  esp_log_level_set(TAG, cfg.log_level);
+
+  partition    = esp_ota_get_next_update_partition(nullptr);
+  since_status = 0;
+  dirty        = false;
+
+  bool valid = !iot.was_reset() &&
+               (ota_state_crc == esp_crc16_le(UINT16_MAX, (const uint8_t *) &ota_state, sizeof(State)));
+
+  if (!valid && (nvs_mgr.get_blob(NVS_KEY, &ota_state, sizeof(State)) != ESP_OK)) ota_state.magic = 0;
+
+  if (is_active()) {
+    if ((partition == nullptr) ||
+        (ota_state.partition_addr != partition->address) ||
+        (ota_state.chunk_count    == 0) ||
+        (ota_state.chunk_count    >  MAX_CHUNKS) ||
+        (ota_state.received_count >= ota_state.chunk_count)) {
+      ESP_LOGW(TAG, "Pending transfer state is inconsistent. Discarded.");
+      reset();
+    }
+    else {
+      ESP_LOGI(TAG, "Transfer pending: %d of %d chunks received.", ota_state.received_count, ota_state.chunk_count);
+    }
+  }
+
+  save(dirty);
+
+  return ESP_OK;
+}
+
+bool Ota::is_active()
+{
+  return ota_state.magic == OTA_MAGIC;
+}
+
+bool Ota::is_received(int index)
+{
+  return ota_state.bitmap[index >> 3] & (1 << (index & 7));
+}
+
+void Ota::reset()
+{
+  memset(&ota_state, 0, sizeof(State));
+  dirty = true;
+}
+
+// The RTC memory copy is protected by a CRC. NVS is written only when
+// **persist** is true, to limit flash wear.
+void Ota::save(bool persist)
+{
+  ota_state_crc = esp_crc16_le(UINT16_MAX, (const uint8_t *) &ota_state, sizeof(State));
+
+  if (persist) {
+    if (nvs_mgr.set_blob(NVS_KEY, &ota_state, sizeof(State)) != ESP_OK) {
+      ESP_LOGW(TAG, "Unable to save the transfer state in nvs.");
+    }
+    dirty = false;
+  }
+}
+
+/// Called from the Wifi task. Queue a valid OTA frame for **run()**. A frame
+/// lost because the ring is full is reported missing by the next status.
+esp_err_t Ota::push(const uint8_t * frame, int len)
+{
+  if (!downlink_check(frame, len, OTA_MARKER)) return ESP_ERR_INVALID_CRC;
+
+  DownlinkCmd * body = ring.reserve();
+  if (body == nullptr) return ESP_ERR_NO_MEM;
+
+  body->len = len - DOWNLINK_HEADER_SIZE;
+  memcpy(body->data, &frame[DOWNLINK_HEADER_SIZE], body->len);
+  ring.commit();
+
+  return ESP_OK;
+}
+
+// The status frame is sent directly through ESP-NOW: it is neither batched
+// nor stored when not delivered (see IoT::send_failed()), the next one
+// superseding it.
+void Ota::send_status(Status status, const uint8_t * image_id)
+{
+  uint8_t * buff = esp_now.get_send_buffer();
+  if (buff == nullptr) return;
+
+  StatusFrame frame;
+  memset(&frame, 0, sizeof(StatusFrame));
+
+  frame.marker = OTA_MARKER;
+  frame.type   = (uint8_t) FrameType::STATUS;
+  frame.status = (uint8_t) status;
+
+  if (is_active()) {
+    frame.base     = ota_state.base;
+    frame.received = ota_state.received_count;
+    for (int i = 0; (i < 32) && ((ota_state.base + i) < ota_state.chunk_count); i++) {
+      if (is_received(ota_state.base + i)) frame.bitmap |= (1UL << i);
+    }
+    if (image_id == nullptr) image_id = ota_state.sha256;
+  }
+
+  if (image_id != nullptr) memcpy(frame.image_id, image_id, sizeof(frame.image_id));
+
+  memcpy(buff, &frame, sizeof(StatusFrame));
+  esp_now.send(buff, sizeof(StatusFrame));
+
+  since_status = 0;
+}
+
+void Ota::begin(const uint8_t * body, int len)
+{
+  uint32_t        image_size;
+  uint16_t        chunk_size;
+  const uint8_t * sha256 = &body[7];
+
+  if (len != (1 + 4 + 2 + 32)) {
+    ESP_LOGE(TAG, "Malformed BEGIN frame of %d bytes.", len);
+    send_status(Status::REJECTED);
+    return;
+  }
+
+  memcpy(&image_size, &body[1], 4);
+  memcpy(&chunk_size, &body[5], 2);
+
+  if (is_active() &&
+      (ota_state.image_size == image_size) &&
+      (ota_state.chunk_size == chunk_size) &&
+      (memcmp(ota_state.sha256, sha256, 32) == 0)) {
+    ESP_LOGI(TAG, "Transfer resumed at chunk %d, %d of %d received.",
+             ota_state.base, ota_state.received_count, ota_state.chunk_count);
+    send_status(Status::RECEIVING);
+    return;
+  }
+
+  uint32_t chunk_count = (chunk_size > 0) ? ((image_size + chunk_size - 1) / chunk_size) : 0;
+
+  if ((partition   == nullptr) ||
+      (chunk_size  == 0) ||
+      (chunk_size  >  MAX_CHUNK_SIZE) ||
+      ((chunk_size %  16) != 0) ||
+      (image_size  == 0) ||
+      (image_size  >  partition->size) ||
+      (chunk_count >  MAX_CHUNKS)) {
+    ESP_LOGE(TAG, "Transfer of %u bytes in chunks of %u bytes rejected.", image_size, chunk_size);
+    send_status(Status::REJECTED, sha256);
+    return;
+  }
+
+  reset();
+
+  ESP_LOGI(TAG, "New transfer: %u bytes in %u chunks to partition %s.", image_size, chunk_count, partition->label);
+
+  // The flash is erased once per transfer, such that the chunks can then be
+  // written in any order. A resumed transfer (above) is not erased again: the
+  // chunks already written are kept.
+  if (esp_partition_erase_range(partition, 0, (image_size + 4095) & ~4095) != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to erase partition %s.", partition->label);
+    send_status(Status::FLASH_ERROR, sha256);
+    save(true);
+    return;
+  }
+
+  ota_state.magic          = OTA_MAGIC;
+  ota_state.partition_addr = partition->address;
+  ota_state.image_size     = image_size;
+  ota_state.chunk_size     = chunk_size;
+  ota_state.chunk_count    = chunk_count;
+  memcpy(ota_state.sha256, sha256, 32);
+
+  save(true);
+
+  send_status(Status::RECEIVING);
+}
+
+void Ota::write_chunk(const uint8_t * body, int len)
+{
+  uint16_t index;
+
+  if (len < 4) return;
+
+  since_status++;
+
+  if (!is_active()) return;
+
+  memcpy(&index, &body[1], 2);
+
+  if (index >= ota_state.chunk_count) return;
+
+  uint32_t offset = (uint32_t) index * ota_state.chunk_size;
+  int      size   = std::min((uint32_t) ota_state.chunk_size, ota_state.image_size - offset);
+
+  if ((len - 3) != size) {
+    ESP_LOGD(TAG, "Chunk %d of wrong size %d ignored.", index, len - 3);
+    return;
+  }
+
+  if (is_received(index)) return;
+
+  if (esp_partition_write(partition, offset, &body[3], size) != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to write chunk %d in partition %s.", index, partition->label);
+    send_status(Status::FLASH_ERROR);
+    reset();
+    save(true);
+    return;
+  }
+
+  ota_state.bitmap[index >> 3] |= (1 << (index & 7));
+  ota_state.received_count++;
+  dirty = true;
+
+  while ((ota_state.base < ota_state.chunk_count) && is_received(ota_state.base)) ota_state.base++;
+
+  if (ota_state.received_count == ota_state.chunk_count) finish();
+}
+
+// Compute the SHA-256 of the image as written in the partition.
+esp_err_t Ota::verify()
+{
+  uint8_t                buff[256];
+  uint8_t                sha256[32];
+  mbedtls_sha256_context ctx;
+  esp_err_t              status = ESP_OK;
+
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts(&ctx, 0);
+
+  for (uint32_t offset = 0; offset < ota_state.image_size; offset += sizeof(buff)) {
+    size_t len = std::min((uint32_t) sizeof(buff), ota_state.image_size - offset);
+    if ((status = esp_partition_read(partition, offset, buff, len)) != ESP_OK) break;
+    mbedtls_sha256_update(&ctx, buff, len);
+  }
+
+  mbedtls_sha256_finish(&ctx, sha256);
+  mbedtls_sha256_free(&ctx);
+
+  if (status != ESP_OK) return status;
+
+  return (memcmp(sha256, ota_state.sha256, 32) == 0) ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+// All the chunks are received: verify the image and restart on it.
+void Ota::finish()
+{
+  ESP_LOGI(TAG, "All %d chunks received. Verifying the image...", ota_state.chunk_count);
+
+  if (verify() != ESP_OK) {
+    ESP_LOGE(TAG, "Image SHA-256 mismatch. Transfer to be restarted.");
+    send_status(Status::HASH_ERROR);
+    reset();
+    save(true);
+    return;
+  }
+
+  if (esp_ota_set_boot_partition(partition) != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to set partition %s as the boot partition.", partition->label);
+    send_status(Status::FLASH_ERROR);
+    reset();
+    save(true);
+    return;
+  }
+
+  ESP_LOGI(TAG, "Firmware update completed. Restarting...");
+
+  send_status(Status::COMPLETE);
+  reset();
+  save(true);
+
+  iot.prepare_for_deep_sleep();
+  esp_restart();
+}
+
+void Ota::handle(const uint8_t * body, int len)
+{
+  switch ((FrameType) body[0]) {
+    case FrameType::BEGIN:
+      begin(body, len);
+      break;
+
+    case FrameType::DATA:
+      write_chunk(body, len);
+      break;
+
+    case FrameType::ABORT:
+      if (is_active()) {
+        ESP_LOGW(TAG, "Transfer aborted by the gateway.");
+        reset();
+        save(true);
+      }
+      send_status(Status::IDLE);
+      break;
+
+    default:
+      ESP_LOGD(TAG, "Frame of unknown type 0x%02x ignored.", body[0]);
+      break;
+  }
+}
+
+/// Transfer loop, run in the application task at the end of the receive
+/// window (see IoT::receive_window()). Returns at once if no transfer is in
+/// progress or starting. Otherwise, returns when no OTA frame has been
+/// received for CONFIG_IOT_OTA_IDLE_TIMEOUT msec, or restarts the device once
+/// the new firmware is verified.
+void Ota::run()
+{
+  if (!is_active() && !has_frames()) return;
+
+  EventGroupHandle_t events  = iot.get_ready_events();
+  int64_t            last_rx = esp_timer_get_time();
+
+  // Resume request: the gateway continues from the reported base.
+  if (!has_frames()) send_status(Status::RECEIVING);
+
+  while ((esp_timer_get_time() - last_rx) < ((int64_t) CONFIG_IOT_OTA_IDLE_TIMEOUT * 1000)) {
+    DownlinkCmd * body;
+
+    // Cleared before draining: a frame queued meanwhile sets it again.
+    xEventGroupClearBits(events, IoT::DOWNLINK_READY);
+
+    while ((body = ring.front()) != nullptr) {
+      handle(body->data, body->len);
+      ring.pop();
+      last_rx = esp_timer_get_time();
+    }
+
+    if (!is_active() && (since_status == 0)) break;
+
+    if (since_status >= CONFIG_IOT_OTA_WINDOW) {
+      send_status(is_active() ? Status::RECEIVING : Status::IDLE);
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(events, IoT::DOWNLINK_READY, pdFALSE, pdFALSE, pdMS_TO_TICKS(ACK_DELAY_MS));
+
+    // Nothing received for ACK_DELAY_MS: report the chunks still missing.
+    if (((bits & IoT::DOWNLINK_READY) == 0) && (since_status > 0)) {
+      send_status(is_active() ? Status::RECEIVING : Status::IDLE);
+    }
+  }
+
+  save(dirty);
+}
+
+/// With the bootloader rollback enabled, a new firmware must be confirmed
+/// or it is rolled back at the next restart. It is confirmed once it has
+/// delivered its messages to the gateway.
+void Ota::confirm_image()
+{
+  #ifdef CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE
+    esp_ota_img_states_t img_state;
+
+    if ((esp_ota_get_state_partition(esp_ota_get_running_partition(), &img_state) == ESP_OK) &&
+        (img_state == ESP_OTA_IMG_PENDING_VERIFY)) {
+      ESP_LOGI(TAG, "New firmware confirmed.");
+      esp_ota_mark_app_valid_cancel_rollback();
+    }
+  #endif
+}
+
+void Ota::prepare_for_deep_sleep()
+{
+  save(dirty);
+}
+
+#endif
@@ -3,35 +3,47 @@
 #ifdef CONFIG_IOT_ENABLE_UDP
 
 #include <cstring>
+#include <algorithm>
 #include <esp_crc.h>
+#include <esp_timer.h>
+#include <esp_attr.h>
 #include <lwip/dns.h>
 #include <netdb.h>
 
 #include "utils.hpp"
 #include "udp.hpp"
 
+uint8_t UDP::frame[FRAME_HEADROOM + MAX_PKT_SIZE + 1];
+
+RTC_NOINIT_ATTR UDP::DNSCache UDP::dns_cache;
+
+#ifdef CONFIG_IOT_DOWNLINK
+  DownlinkRing UDP::downlink_ring;
+#endif
+
+#ifdef CONFIG_IOT_UDP_ACK
+  RTC_NOINIT_ATTR static UDP::AckState ack_state;
+#endif
+
 esp_err_t UDP::init()
 {
   esp_log_level_set(TAG, cfg.log_level);
 
   esp_err_t status = ESP_OK;
 
-  hostent * h = gethostbyname(cfg.udp.gateway_address);
-  in_addr addr;
+  uint16_t name_crc = esp_crc16_le(UINT16_MAX, (const uint8_t *) cfg.udp.gateway_address, strlen(cfg.udp.gateway_address));
 
-  int i = 0;
-  addr.s_addr = 0;
+  resolve_time = 0;
 
-  while (h->h_addr_list[i] != 0) {
-    addr.s_addr = *(u_long *) h->h_addr_list[i++];
-    ESP_LOGD(TAG, "\tIPv4 Address #%d: %s\n", i, inet_ntoa(addr));
+  if (cache_is_valid(name_crc)) {
+    ESP_LOGD(TAG, "Gateway address #%d of %d taken from the cache.", dns_cache.current + 1, dns_cache.count);
   }
-
-  if (addr.s_addr == 0) {
-    ESP_LOGE(TAG, "Unable to retrieve IP address of %s.", cfg.udp.gateway_address);
+  else if (resolve(name_crc) != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to retrieve IP address of %s. Nothing sent until resolved.", cfg.udp.gateway_address);
+    resolve_time = esp_timer_get_time();
   }
 
-  dest_addr.sin_addr.s_addr = addr.s_addr;
+  set_dest_addr();
   dest_addr.sin_family      = AF_INET;
   dest_addr.sin_port        = htons(cfg.udp.port);
   
@@ -44,40 +56,295 @@ esp_err_t UDP::init()
     status = ESP_FAIL;
   }
 
+  #ifdef CONFIG_IOT_UDP_ACK
+    if ((ack_state.magic != ACK_MAGIC) || (ack_state.srtt < 0) || (ack_state.rttvar < 0)) {
+      memset(&ack_state, 0, sizeof(AckState));
+      ack_state.magic = ACK_MAGIC;
+    }
+  #endif
+
   return status;
 }
 
-esp_err_t UDP::send(const uint8_t * data, int len)
+bool UDP::cache_is_valid(uint16_t name_crc)
 {
-  esp_err_t status = ESP_OK;
+  if ((dns_cache.magic    != DNS_MAGIC) ||
+      (dns_cache.name_crc != name_crc ) ||
+      (dns_cache.count    == 0        ) ||
+      (dns_cache.count    >  MAX_ADDRS) ||
+      (dns_cache.current  >= dns_cache.count)) {
+    return false;
+  }
 
-  static struct PKT {
-    uint16_t crc;
-    char data[0];
-  } __attribute__((packed)) * pkt;
+  time_t now = time(nullptr);
 
+  return (now >= dns_cache.resolved_time) && ((now - dns_cache.resolved_time) < CONFIG_IOT_UDP_DNS_CACHE_TTL);
+}
 
-  if (len > cfg.udp.max_pkt_size) {
-    ESP_LOGE(TAG, "Cannot send data of length %d, too long. Max is %d.", len, cfg.udp.max_pkt_size);
-    status = ESP_FAIL;
+/// Resolve the gateway name and keep all its IPv4 addresses in the cache. On
+/// failure, the cache is left empty, without any address (see route_ready()).
+esp_err_t UDP::resolve(uint16_t name_crc)
+{
+  memset(&dns_cache, 0, sizeof(DNSCache));
+  dns_cache.name_crc = name_crc;
+
+  int64_t   start = esp_timer_get_time();
+  hostent * h     = gethostbyname(cfg.udp.gateway_address);
+
+  if ((h == nullptr) || (h->h_addrtype != AF_INET) || (h->h_addr_list == nullptr)) return ESP_FAIL;
+
+  for (int i = 0; (h->h_addr_list[i] != nullptr) && (dns_cache.count < MAX_ADDRS); i++) {
+    in_addr addr;
+    memcpy(&addr.s_addr, h->h_addr_list[i], sizeof(addr.s_addr));
+    if (addr.s_addr == 0) continue;
+
+    dns_cache.addrs[dns_cache.count++] = addr.s_addr;
+    ESP_LOGD(TAG, "\tIPv4 Address #%d: %s", dns_cache.count, inet_ntoa(addr));
   }
-  else {
-    pkt = (PKT *) malloc(len + 2);
-    if (pkt == nullptr) {
-      ESP_LOGE(TAG, "Unable to allocate memory for PKT struct.");
+
+  if (dns_cache.count == 0) return ESP_FAIL;
+
+  dns_cache.resolved_time = time(nullptr);
+  dns_cache.magic         = DNS_MAGIC;
+
+  ESP_LOGI(TAG, "%s resolved in %d msec, %d address(es).",
+           cfg.udp.gateway_address, (int)((esp_timer_get_time() - start) / 1000), dns_cache.count);
+
+  return ESP_OK;
+}
+
+/// Returns true when the gateway has an address. After a failed resolution,
+/// no address is set: the name is resolved again, at most once every
+/// RESOLVE_RETRY_INTERVAL seconds, until it succeeds.
+bool UDP::route_ready()
+{
+  if (dest_addr.sin_addr.s_addr != INADDR_ANY) return true;
+
+  int64_t now = esp_timer_get_time();
+
+  if ((now - resolve_time) < (int64_t) RESOLVE_RETRY_INTERVAL * 1000000) return false;
+
+  resolve_time = now;
+
+  uint16_t name_crc = esp_crc16_le(UINT16_MAX, (const uint8_t *) cfg.udp.gateway_address, strlen(cfg.udp.gateway_address));
+
+  if (resolve(name_crc) != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to retrieve IP address of %s.", cfg.udp.gateway_address);
+    return false;
+  }
+
+  set_dest_addr();
+
+  return true;
+}
+
+/// Keep track of consecutive send failures on the current address, and move
+/// to the next one when the threshold is reached. Once all the addresses have
+/// failed, the cache is invalidated: the name is resolved again at the next
+/// wake up.
+void UDP::send_done(esp_err_t status)
+{
+  if (dns_cache.magic != DNS_MAGIC) return;
+
+  if (status == ESP_OK) {
+    dns_cache.failures     = 0;
+    dns_cache.failed_count = 0;
+    return;
+  }
+
+  if (++dns_cache.failures < CONFIG_IOT_UDP_FAILOVER_THRESHOLD) return;
+
+  dns_cache.failures = 0;
+
+  if (++dns_cache.failed_count >= dns_cache.count) {
+    ESP_LOGW(TAG, "All the gateway addresses failed. Name to be resolved again.");
+    dns_cache.magic = 0;
+    return;
+  }
+
+  dns_cache.current = (dns_cache.current + 1) % dns_cache.count;
+  set_dest_addr();
+
+  ESP_LOGW(TAG, "Gateway address failover to #%d of %d: %s.",
+           dns_cache.current + 1, dns_cache.count, inet_ntoa(dest_addr.sin_addr));
+}
+
+esp_err_t UDP::send_pkt(const uint8_t * pkt, int len)
+{
+  int err = sendto(sock, pkt, len, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+
+  if (err < 0) {
+      ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
       return ESP_FAIL;
+  }
+
+  return ESP_OK;
+}
+
+#if defined(CONFIG_IOT_UDP_ACK) || defined(CONFIG_IOT_DOWNLINK)
+  // Wait until **deadline** (esp_timer time) for a datagram from the gateway
+  // and copy it in **buff**. Datagrams from any other source are ignored. The
+  // socket is polled at least once. Returns the datagram length, 0 on timeout.
+  int UDP::recv_pkt(uint8_t * buff, int size, int64_t deadline)
+  {
+    int64_t remaining;
+
+    do {
+      remaining = std::max(deadline - esp_timer_get_time(), (int64_t) 0);
+
+      fd_set fds;
+      FD_ZERO(&fds);
+      FD_SET(sock, &fds);
+
+      struct timeval tv = { .tv_sec = (time_t)(remaining / 1000000), .tv_usec = (suseconds_t)(remaining % 1000000) };
+
+      if (select(sock + 1, &fds, nullptr, nullptr, &tv) <= 0) break;
+
+      struct sockaddr_in from;
+      socklen_t          from_len = sizeof(from);
+
+      int len = recvfrom(sock, buff, size, 0, (struct sockaddr *) &from, &from_len);
+
+      if ((len > 0) && (from.sin_addr.s_addr == dest_addr.sin_addr.s_addr)) return len;
+    } while (remaining > 0);
+
+    return 0;
+  }
+#endif
+
+#ifdef CONFIG_IOT_DOWNLINK
+  /// Listen for a command frame for up to **timeout_ms** (0 to only read the
+  /// datagrams already received). Returns as soon as a command is queued.
+  void UDP::wait_downlink(int timeout_ms)
+  {
+    uint8_t pkt[DOWNLINK_FRAME_SIZE];
+    int64_t deadline = esp_timer_get_time() + (int64_t) timeout_ms * 1000;
+    int     len;
+
+    while ((len = recv_pkt(pkt, sizeof(pkt), deadline)) > 0) {
+      if (downlink_push(downlink_ring, pkt, len) == ESP_OK) return;
     }
-    memcpy(pkt->data, data, len);
-    pkt->crc = esp_crc16_le(UINT16_MAX, (const uint8_t *)(pkt->data), len);
-
-    int err = sendto(sock, (const uint8_t *) pkt, len + 2, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-    free(pkt)
-    
-    if (err < 0) {
-        ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-        status = ESP_FAIL;
+  }
+#endif
+
+#ifdef CONFIG_IOT_UDP_ACK
+  int UDP::get_rto_ms()
+  {
+    // No measurement yet: start with the maximum value.
+    if (ack_state.srtt == 0) return CONFIG_IOT_UDP_ACK_MAX_RTO;
+
+    int rto = (ack_state.srtt + std::max(1000, 4 * ack_state.rttvar) + 999) / 1000;
+
+    return std::min(std::max(rto, CONFIG_IOT_UDP_ACK_MIN_RTO), CONFIG_IOT_UDP_ACK_MAX_RTO);
+  }
+
+  // RFC 6298, section 2, with alpha = 1/8 and beta = 1/4.
+  void UDP::update_rtt(int32_t rtt)
+  {
+    if (ack_state.srtt == 0) {
+      ack_state.srtt   = std::max(rtt, 1);
+      ack_state.rttvar = rtt / 2;
     }
     else {
+      ack_state.rttvar = ack_state.rttvar - (ack_state.rttvar / 4) + (abs(ack_state.srtt - rtt) / 4);
+      ack_state.srtt   = std::max(ack_state.srtt - (ack_state.srtt / 8) + (rtt / 8), 1);
+    }
+
+    ESP_LOGD(TAG, "RTT: %d usec, SRTT: %d usec, RTTVAR: %d usec, RTO: %d msec.",
+             rtt, ack_state.srtt, ack_state.rttvar, get_rto_ms());
+  }
+
+  // Wait for the ack of a frame. Acks of previous frames (late or duplicated)
+  // are ignored. Command frames received meanwhile are queued.
+  esp_err_t UDP::wait_ack(const uint8_t * expected, int timeout_ms)
+  {
+    #ifdef CONFIG_IOT_DOWNLINK
+      uint8_t pkt[DOWNLINK_FRAME_SIZE];
+    #else
+      uint8_t pkt[ACK_SIZE];
+    #endif
+    int64_t deadline = esp_timer_get_time() + (int64_t) timeout_ms * 1000;
+    int     len;
+
+    while ((len = recv_pkt(pkt, sizeof(pkt), deadline)) > 0) {
+      if ((len == ACK_SIZE) && (memcmp(pkt, expected, ACK_SIZE) == 0)) return ESP_OK;
+
+      #ifdef CONFIG_IOT_DOWNLINK
+        if (downlink_push(downlink_ring, pkt, len) == ESP_OK) continue;
+      #endif
+
+      ESP_LOGD(TAG, "Unexpected ack ignored.");
+    }
+
+    return ESP_ERR_TIMEOUT;
+  }
+
+  // Send a frame, starting with the ack header, until acknowledged or
+  // the maximum number of retries is reached.
+  esp_err_t UDP::send_with_ack(uint8_t * pkt, int len)
+  {
+    int rto = get_rto_ms();
+
+    for (int attempt = 0; attempt <= CONFIG_IOT_UDP_ACK_RETRIES; attempt++) {
+      if (attempt > 0) {
+        ack_state.retransmit_count++;
+        ESP_LOGW(TAG, "No ack received in %d msec. Retransmission #%d.", rto, attempt);
+        rto = std::min(rto * 2, CONFIG_IOT_UDP_ACK_MAX_RTO);
+      }
+
+      int64_t start = esp_timer_get_time();
+
+      if (send_pkt(pkt, len) != ESP_OK) return ESP_FAIL;
+
+      if (wait_ack(pkt, rto) == ESP_OK) {
+        // Karn's algorithm: the ack of a retransmitted frame is ambiguous.
+        if (attempt == 0) update_rtt((int32_t)(esp_timer_get_time() - start));
+        return ESP_OK;
+      }
+    }
+
+    ack_state.lost_count++;
+    ESP_LOGE(TAG, "Frame not acknowledged after %d retransmission(s).", CONFIG_IOT_UDP_ACK_RETRIES);
+
+    return ESP_FAIL;
+  }
+
+  uint32_t UDP::get_retransmit_count() { return ack_state.retransmit_count; }
+  uint32_t       UDP::get_lost_count() { return ack_state.lost_count;       }
+#endif
+
+/// Send a frame. **data** must be preceded by FRAME_HEADROOM bytes that
+/// will receive the CRC (and the ack header). The frame is sent without any copy.
+esp_err_t UDP::send(uint8_t * data, int len)
+{
+  esp_err_t status = ESP_OK;
+
+  if (len > cfg.udp.max_pkt_size) {
+    ESP_LOGE(TAG, "Cannot send data of length %d, too long. Max is %d.", len, cfg.udp.max_pkt_size);
+    status = ESP_FAIL;
+  }
+  else if (!route_ready()) {
+    ESP_LOGW(TAG, "No gateway address, message not sent.");
+    status = ESP_ERR_INVALID_STATE;
+  }
+  else {
+    uint8_t * pkt = data - 2;
+    uint16_t  crc = esp_crc16_le(UINT16_MAX, data, len);
+    memcpy(pkt, &crc, 2);
+
+    #ifdef CONFIG_IOT_UDP_ACK
+      pkt -= ACK_HEADER_SIZE;
+      memcpy(pkt, &ack_state.seq, ACK_HEADER_SIZE);
+      ack_state.seq++;
+
+      status = send_with_ack(pkt, len + 2 + ACK_HEADER_SIZE);
+    #else
+      status = send_pkt(pkt, len + 2);
+    #endif
+
+    send_done(status);
+
+    if (status == ESP_OK) {
       ESP_LOGD(TAG, "The following message was sent:");
       dump_data(TAG, data, len);
     }
@@ -0,0 +1,197 @@
+#include "config.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <esp_crc.h>
+#include <esp_system.h>
+
+#include "wake_scheduler.hpp"
+
+#define __WAKE_SCHEDULER__
+#include "global.hpp"
+#undef __WAKE_SCHEDULER__
+
+RTC_NOINIT_ATTR static WakeScheduler::State wake_state;
+RTC_NOINIT_ATTR static uint16_t             wake_state_crc;
+
+bool WakeScheduler::init(bool reset)
+{
+  static_assert(MAX_DEADLINES <= (MAX_ID + 1), "Too many deadlines for the fired mask.");
+
+  esp_log_level_set(TAG, cfg.log_level);
+
+  fired = 0;
+
+  bool valid = (wake_state.magic == WAKE_MAGIC) &&
+               (wake_state.count >= 0) && (wake_state.count <= MAX_DEADLINES) &&
+               (wake_state_crc == esp_crc16_le(UINT16_MAX, (const uint8_t *) &wake_state, sizeof(State)));
+
+  if (reset || !valid) {
+    if (!reset) ESP_LOGW(TAG, "Deadlines lost, scheduling them again.");
+    memset(&wake_state, 0, sizeof(State));
+    wake_state.magic = WAKE_MAGIC;
+    seal();
+    return true;
+  }
+
+  return false;
+}
+
+void WakeScheduler::seal()
+{
+  wake_state_crc = esp_crc16_le(UINT16_MAX, (const uint8_t *) &wake_state, sizeof(State));
+}
+
+int WakeScheduler::find(uint8_t id)
+{
+  for (int i = 0; i < wake_state.count; i++) {
+    if (wake_state.heap[i].id == id) return i;
+  }
+  return -1;
+}
+
+void WakeScheduler::sift_up(int i)
+{
+  Deadline * heap = wake_state.heap;
+
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (heap[parent].time <= heap[i].time) break;
+    std::swap(heap[parent], heap[i]);
+    i = parent;
+  }
+}
+
+void WakeScheduler::sift_down(int i)
+{
+  Deadline * heap = wake_state.heap;
+
+  for (;;) {
+    int smallest = i;
+    int left     = (2 * i) + 1;
+    int right    = left + 1;
+
+    if ((left  < wake_state.count) && (heap[left].time  < heap[smallest].time)) smallest = left;
+    if ((right < wake_state.count) && (heap[right].time < heap[smallest].time)) smallest = right;
+    if (smallest == i) break;
+
+    std::swap(heap[smallest], heap[i]);
+    i = smallest;
+  }
+}
+
+void WakeScheduler::remove(int i)
+{
+  wake_state.count--;
+  if (i == wake_state.count) return;
+
+  wake_state.heap[i] = wake_state.heap[wake_state.count];
+  sift_up(i);
+  sift_down(i);
+}
+
+esp_err_t WakeScheduler::schedule(uint8_t id, const char * name, uint32_t delay, uint32_t period)
+{
+  if (id > MAX_ID) return ESP_ERR_INVALID_ARG;
+
+  int i = find(id);
+
+  if (i >= 0) {
+    remove(i);
+  }
+  else if (wake_state.count >= MAX_DEADLINES) {
+    ESP_LOGE(TAG, "No room left to schedule %s.", name);
+    return ESP_ERR_NO_MEM;
+  }
+
+  time_t     now;
+  Deadline & d = wake_state.heap[wake_state.count];
+
+  d.time   = time(&now) + delay;
+  d.period = period;
+  d.id     = id;
+  strncpy(d.name, name, NAME_SIZE - 1);
+  d.name[NAME_SIZE - 1] = 0;
+
+  sift_up(wake_state.count++);
+  seal();
+
+  ESP_LOGD(TAG, "%s scheduled in %u seconds.", name, delay);
+
+  return ESP_OK;
+}
+
+esp_err_t WakeScheduler::cancel(uint8_t id)
+{
+  int i = find(id);
+
+  if (i < 0) return ESP_ERR_NOT_FOUND;
+
+  remove(i);
+  seal();
+
+  return ESP_OK;
+}
+
+uint32_t WakeScheduler::collect()
+{
+  time_t now;
+  time_t limit = time(&now) + CONFIG_IOT_WAKE_COALESCE;
+
+  fired = 0;
+
+  while ((wake_state.count > 0) && (wake_state.heap[0].time <= limit)) {
+    Deadline & d = wake_state.heap[0];
+
+    if (d.time > now) {
+      ESP_LOGI(TAG, "%s fired, %d seconds early.", d.name, (int)(d.time - now));
+    }
+    else {
+      ESP_LOGI(TAG, "%s fired.", d.name);
+    }
+
+    fired |= 1UL << d.id;
+
+    if (d.period > 0) {
+      // Keep the phase. Periods missed while awake or asleep are skipped.
+      d.time += (((limit - d.time) / d.period) + 1) * d.period;
+      sift_down(0);
+    }
+    else {
+      remove(0);
+    }
+  }
+
+  seal();
+
+  return fired;
+}
+
+time_t WakeScheduler::next_wake()
+{
+  return (wake_state.count > 0) ? wake_state.heap[0].time : 0;
+}
+
+// FNV-1a: the MAC addresses of a batch of devices are usually sequential,
+// the hash spreads them anyway. Same as tools/collision_sim.py.
+uint32_t WakeScheduler::slot_offset(uint8_t id, uint32_t period)
+{
+  uint8_t  mac[6];
+  uint32_t hash = 2166136261UL;
+
+  if ((period == 0) || (esp_read_mac(mac, ESP_MAC_WIFI_STA) != ESP_OK)) return 0;
+
+  for (auto b : mac) hash = (hash ^ b) * 16777619UL;
+  hash = (hash ^ id) * 16777619UL;
+
+  return hash % period;
+}
+
+uint32_t WakeScheduler::backoff(uint32_t & last, uint32_t base, uint32_t cap)
+{
+  uint32_t high = std::min(std::max(last, base) * 3, cap);
+
+  last = (high > base) ? (base + (esp_random() % (high - base + 1))) : std::min(base, cap);
+
+  return last;
+}
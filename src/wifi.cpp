@@ -1,4 +1,7 @@
 #include <esp_netif.h>
+#include <esp_timer.h>
+#include <esp_crc.h>
+#include <esp_attr.h>
 
 #include "wifi.hpp"
 
@@ -11,6 +14,15 @@ int8_t        Wifi::rssi                    = 0;
   Wifi::State Wifi::state                   = State::NOT_INITIALIZED;
   uint32_t    Wifi::ip                      = 0;
   char        Wifi::ip_cstr[20]             = "0.0.0.0";
+  esp_netif_t * Wifi::netif                 = nullptr;
+  int64_t     Wifi::start_time              = 0;
+  int64_t     Wifi::associated_time         = 0;
+
+  #ifdef CONFIG_IOT_WIFI_FAST_REJOIN
+    bool      Wifi::fast_rejoin             = false;
+
+    RTC_NOINIT_ATTR static Wifi::RejoinData rejoin;
+  #endif
 #endif
 
 // Wifi Contructor
@@ -51,6 +63,14 @@ Wifi::Wifi(void)
         case WIFI_EVENT_STA_CONNECTED: {
           std::lock_guard<std::mutex> state_guard(mutex);
           state = State::WAITING_FOR_IP;
+          associated_time = esp_timer_get_time();
+
+          #ifdef CONFIG_IOT_WIFI_FAST_REJOIN
+            const wifi_event_sta_connected_t * event = (const wifi_event_sta_connected_t *) event_data;
+            memcpy(rejoin.bssid, event->bssid, sizeof(rejoin.bssid));
+            rejoin.channel = event->channel;
+          #endif
+
           show_state();
           break;
         }
@@ -59,6 +79,13 @@ Wifi::Wifi(void)
           std::lock_guard<std::mutex> state_guard(mutex);
           state = State::DISCONNECTED;
           show_state();
+
+          xEventGroupClearBits(iot.get_ready_events(), IoT::WIFI_READY);
+
+          #ifdef CONFIG_IOT_WIFI_FAST_REJOIN
+            if (fast_rejoin) cancel_fast_rejoin((Wifi *) arg);
+          #endif
+
           connect();
           break;
         }
@@ -103,7 +130,26 @@ Wifi::Wifi(void)
             ESP_LOGE(TAG, "Unable to retrieve IP Address: %s.", esp_err_to_name(status));
           }    
 
+          #ifdef CONFIG_IOT_WIFI_FAST_REJOIN
+            if (!fast_rejoin) save_rejoin_data();
+          #endif
+
+          #ifdef CONFIG_IOT_WIFI_FAST_REJOIN
+            const char * mode = fast_rejoin ? "fast rejoin" : "DHCP";
+          #else
+            const char * mode = "DHCP";
+          #endif
+
+          int64_t now = esp_timer_get_time();
+          ESP_LOGI(TAG, "Wifi ready in %d msec (association: %d msec, IP: %d msec, %s).",
+                   (int)((now - start_time) / 1000),
+                   (int)((associated_time - start_time) / 1000),
+                   (int)((now - associated_time) / 1000),
+                   mode);
+
           show_state();
+
+          xEventGroupSetBits(iot.get_ready_events(), IoT::WIFI_READY);
           break;
         }
 
@@ -113,6 +159,7 @@ Wifi::Wifi(void)
             state = State::WAITING_FOR_IP;
             show_state();
           }
+          xEventGroupClearBits(iot.get_ready_events(), IoT::WIFI_READY);
           break;
         }
 
@@ -190,11 +237,60 @@ Wifi::Wifi(void)
 
     ESP_LOGD(TAG, "State: %s", msg);
   }
+
+  #ifdef CONFIG_IOT_WIFI_FAST_REJOIN
+    bool Wifi::rejoin_data_valid()
+    {
+      time_t now;
+
+      return (rejoin.magic == REJOIN_MAGIC) &&
+             (rejoin.crc   == esp_crc16_le(UINT16_MAX, (const uint8_t *) &rejoin, sizeof(RejoinData) - 2)) &&
+             (time(&now) >= rejoin.lease_time) &&
+             ((now - rejoin.lease_time) < CONFIG_IOT_WIFI_LEASE_REUSE_TIME);
+    }
+
+    // Called when the address has been obtained through DHCP. The BSSID and
+    // channel were retrieved at association time.
+    void Wifi::save_rejoin_data()
+    {
+      esp_netif_ip_info_t  ip_info;
+      esp_netif_dns_info_t dns_info;
+
+      if ((esp_netif_get_ip_info(netif, &ip_info) != ESP_OK) ||
+          (esp_netif_get_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns_info) != ESP_OK)) {
+        rejoin.magic = 0;
+        return;
+      }
+
+      rejoin.magic      = REJOIN_MAGIC;
+      rejoin.ip         = ip_info.ip.addr;
+      rejoin.netmask    = ip_info.netmask.addr;
+      rejoin.gw         = ip_info.gw.addr;
+      rejoin.dns        = dns_info.ip.u_addr.ip4.addr;
+      rejoin.lease_time = time(nullptr);
+      rejoin.crc        = esp_crc16_le(UINT16_MAX, (const uint8_t *) &rejoin, sizeof(RejoinData) - 2);
+    }
+
+    // The AP is not reachable with the cached data: go back to a normal
+    // connection (scan and DHCP).
+    void Wifi::cancel_fast_rejoin(Wifi * wifi)
+    {
+      ESP_LOGW(TAG, "Fast rejoin failed. Back to a full connection.");
+
+      fast_rejoin  = false;
+      rejoin.magic = 0;
+
+      wifi->wifi_sta_cfg.sta.bssid_set = false;
+      wifi->wifi_sta_cfg.sta.channel   = 0;
+      esp_wifi_set_config(WIFI_IF_STA, &wifi->wifi_sta_cfg);
+      esp_netif_dhcpc_start(netif);
+    }
+  #endif
 #endif
 
 esp_err_t Wifi::init()
 {
-  #ifdef CONFIG_IOT_ENABLE_ESP_NOW
+  #ifndef CONFIG_IOT_ENABLE_UDP
 
     wifi_init_config_t init_cfg = WIFI_INIT_CONFIG_DEFAULT();
 
@@ -210,6 +306,8 @@ esp_err_t Wifi::init()
         WIFI_PROTOCOL_11B|WIFI_PROTOCOL_11G|WIFI_PROTOCOL_11N|WIFI_PROTOCOL_LR));
     }
 
+    xEventGroupSetBits(iot.get_ready_events(), IoT::WIFI_READY);
+
     return ESP_OK;
 
   #else // CONFIG_IOT_ENABLE_UDP
@@ -218,15 +316,17 @@ esp_err_t Wifi::init()
 
     std::lock_guard<std::mutex> mutx_guard(mutex);
 
+    start_time = esp_timer_get_time();
+
     ESP_ERROR_CHECK(esp_netif_init());
 
-    if (esp_netif_create_default_wifi_sta() == nullptr) {
+    if ((netif = esp_netif_create_default_wifi_sta()) == nullptr) {
       ESP_LOGE(TAG, "Unable to create default wifi STA.");
       return ESP_FAIL;
     }
 
     ESP_ERROR_CHECK(esp_wifi_init(&wifi_init_cfg));
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, nullptr, nullptr));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, this, nullptr));
     ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, ESP_EVENT_ANY_ID, &ip_event_handler, nullptr, nullptr));
     ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
@@ -237,6 +337,41 @@ esp_err_t Wifi::init()
     wifi_sta_cfg.sta.pmf_cfg.capable    = true;
     wifi_sta_cfg.sta.pmf_cfg.required   = false;
 
+    #ifdef CONFIG_IOT_WIFI_FAST_REJOIN
+      // After deep sleep, connect directly to the last AP (no scan) with the
+      // last address obtained through DHCP (no DHCP exchange). The address is
+      // obtained again through DHCP once CONFIG_IOT_WIFI_LEASE_REUSE_TIME is
+      // expired, or if the AP cannot be reached.
+      fast_rejoin = (esp_reset_reason() == ESP_RST_DEEPSLEEP) && rejoin_data_valid();
+
+      if (fast_rejoin) {
+        esp_netif_ip_info_t  ip_info;
+        esp_netif_dns_info_t dns_info;
+
+        ip_info.ip.addr      = rejoin.ip;
+        ip_info.netmask.addr = rejoin.netmask;
+        ip_info.gw.addr      = rejoin.gw;
+
+        memset(&dns_info, 0, sizeof(dns_info));
+        dns_info.ip.u_addr.ip4.addr = rejoin.dns;
+        dns_info.ip.type            = ESP_IPADDR_TYPE_V4;
+
+        esp_netif_dhcpc_stop(netif);
+        if ((esp_netif_set_ip_info(netif, &ip_info) == ESP_OK) &&
+            (esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns_info) == ESP_OK)) {
+          wifi_sta_cfg.sta.bssid_set = true;
+          memcpy(wifi_sta_cfg.sta.bssid, rejoin.bssid, sizeof(rejoin.bssid));
+          wifi_sta_cfg.sta.channel   = rejoin.channel;
+          ESP_LOGD(TAG, "Fast rejoin of " MACSTR " on channel %d.", MAC2STR(rejoin.bssid), rejoin.channel);
+        }
+        else {
+          ESP_LOGW(TAG, "Unable to set the cached address. Using DHCP.");
+          fast_rejoin = false;
+          esp_netif_dhcpc_start(netif);
+        }
+      }
+    #endif
+
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_sta_cfg));
     ESP_ERROR_CHECK(esp_wifi_start());
     
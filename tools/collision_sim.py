@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+#
+# Gateway collision simulator for a fleet of ESP32 Simple IoT Framework
+# devices, before and after the transmit slotting and jittered backoff (see
+# include/wake_scheduler.hpp).
+#
+# Scenario: a building-wide power failure resets the whole fleet and the
+# gateway at time 0. The gateway is back after --gateway-down seconds. Every
+# device boots, searches for the gateway (one probe frame) and, once found,
+# sends its STARTUP message. A failed search deep sleeps for:
+#
+#   before: pow(failures, 4) * 10 seconds, up to one day;
+#   after:  the decorrelated jittered backoff (WakeScheduler::backoff()).
+#
+# The device then sends a WATCHDOG message every --interval seconds, the
+# first one:
+#
+#   before: --interval seconds after reset;
+#   after:  --interval + WakeScheduler::slot_offset() seconds after reset.
+#
+#     tools/collision_sim.py --devices 1000
+#     tools/collision_sim.py --devices 5000 --interval 86400 --duration 604800
+#
+# Every device RTC clock drifts by up to --drift-ppm, and the time from wake
+# up to transmission varies by --boot-jitter-ms. A frame collides when its
+# airtime overlaps another frame (no carrier sense: the devices are assumed
+# hidden from each other, the worst case). The report (JSON) gives the
+# collision rate of the gateway search probes, of the STARTUP messages and of
+# the WATCHDOG messages, for both behaviors. The first probes, right after
+# power on, collide in both cases: the fleet boots at the same time.
+
+import argparse
+import json
+import random
+import sys
+
+SEARCH_BACKOFF = 10     # ESPNow::SEARCH_BACKOFF
+MAX_BACKOFF    = 86400
+WATCHDOG_ID    = 0      # WakeScheduler::WATCHDOG_ID
+
+
+def fnv1a_slot(mac, id, period):
+  """WakeScheduler::slot_offset()"""
+  if period == 0:
+    return 0
+  h = 2166136261
+  for b in bytes(mac) + bytes([id]):
+    h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+  return h % period
+
+
+def backoff(last, base, cap, rng):
+  """WakeScheduler::backoff(), returns the new last delay (msec)."""
+  high = min(max(last, base) * 3, cap)
+  return base + rng.randrange(high - base + 1) if high > base else min(base, cap)
+
+
+def device_frames(index, after, args, rng):
+  """The (time, kind) of the frames sent by a device."""
+  mac    = (0x24, 0x6F, 0x28, (index >> 16) & 0xFF, (index >> 8) & 0xFF, index & 0xFF)
+  drift  = 1 + rng.uniform(-args.drift_ppm, args.drift_ppm) * 1e-6
+  boot   = args.boot_ms / 1000
+  frames = []
+
+  def wake_time(rtc):
+    return rtc * drift + boot + rng.uniform(0, args.boot_jitter_ms / 1000)
+
+  # Rediscovery. Device RTC time in seconds. The old backoff deep sleeps for
+  # whole seconds, the jittered one for msec.
+  rtc      = 0
+  failures = 0
+  last     = 0
+  while True:
+    t = wake_time(rtc)
+    if t >= args.duration:
+      return frames
+    frames.append((t, "probe"))
+    if t >= args.gateway_down:
+      frames.append((t + args.airtime_ms / 1000, "startup"))
+      break
+    failures += 1
+    if after:
+      last = backoff(last, SEARCH_BACKOFF * 1000, MAX_BACKOFF * 1000, rng)
+      rtc  = t / drift + last / 1000
+    else:
+      rtc  = int(t / drift) + min(failures ** 4 * SEARCH_BACKOFF, MAX_BACKOFF)
+
+  # Periodic watchdog, from the reset time.
+  first = args.interval + (fnv1a_slot(mac, WATCHDOG_ID, args.interval) if after else 0)
+  rtc   = first
+  while True:
+    t = wake_time(rtc)
+    if t >= args.duration:
+      return frames
+    if t > frames[-1][0]:
+      frames.append((t, "watchdog"))
+    rtc += args.interval
+
+
+def collisions(frames, airtime):
+  """Marks the frames overlapping another one. frames: sorted [(time, kind)]."""
+  hit = [False] * len(frames)
+  end = -1.0
+  last = -1
+  for i, (t, _) in enumerate(frames):
+    if t < end:
+      hit[i] = True
+      hit[last] = True
+    if t + airtime >= end:
+      end  = t + airtime
+      last = i
+  return hit
+
+
+def run(after, args):
+  rng    = random.Random(args.seed)
+  frames = []
+  for i in range(args.devices):
+    frames.extend(device_frames(i, after, args, rng))
+  frames.sort()
+
+  hit    = collisions(frames, args.airtime_ms / 1000)
+  result = {}
+  for kind in ("probe", "startup", "watchdog"):
+    total    = sum(1 for f in frames if f[1] == kind)
+    collided = sum(1 for f, h in zip(frames, hit) if h and f[1] == kind)
+    result[kind] = {
+      "frames":         total,
+      "collided":       collided,
+      "collision_rate": round(collided / total, 4) if total else 0.0,
+    }
+
+  startups = [t for t, k in frames if k == "startup"]
+  result["last_startup_s"]    = round(max(startups), 1) if startups else None
+  result["probes_per_device"] = round(sum(1 for f in frames if f[1] == "probe") / args.devices, 2)
+  return result
+
+
+def main():
+  parser = argparse.ArgumentParser(description="Gateway collision simulator for the ESP32 Simple IoT Framework")
+  parser.add_argument("--report",         help="JSON report file (default: stdout)")
+  parser.add_argument("--devices",        type=int,   default=1000)
+  parser.add_argument("--interval",       type=int,   default=3600,  help="watchdog_interval (sec)")
+  parser.add_argument("--duration",       type=float, default=86400, help="simulated time (sec)")
+  parser.add_argument("--gateway-down",   type=float, default=120,   help="gateway back after (sec)")
+  parser.add_argument("--airtime-ms",     type=float, default=2.2,   help="frame airtime (msec)")
+  parser.add_argument("--boot-ms",        type=float, default=250,   help="wake up to transmission (msec)")
+  parser.add_argument("--boot-jitter-ms", type=float, default=50,    help="wake up to transmission variation (msec)")
+  parser.add_argument("--drift-ppm",      type=float, default=100,   help="RTC clock drift, up to (ppm)")
+  parser.add_argument("--seed",           type=int,   default=1)
+  args = parser.parse_args()
+
+  if args.devices < 1 or args.interval < 1:
+    parser.error("devices and interval must be positive")
+
+  report = {
+    "devices":  args.devices,
+    "interval": args.interval,
+    "duration": args.duration,
+    "before":   run(False, args),
+    "after":    run(True,  args),
+  }
+
+  out = json.dumps(report, indent=2)
+  if args.report:
+    with open(args.report, "w") as f:
+      f.write(out + "\n")
+  else:
+    print(out)
+  return 0
+
+
+if __name__ == "__main__":
+  sys.exit(main())
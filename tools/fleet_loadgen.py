@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+#
+# Fleet load generator for the ESP32 Simple IoT Framework gateway.
+#
+# Simulates thousands of devices waking up at a configurable interval and
+# sending the frames IoT::send_msg() would produce (text or TLV payload,
+# optional batching and fragmentation) to a gateway over UDP. Use with
+# tools/gateway_emulator.py:
+#
+#     tools/gateway_emulator.py --report gw.json serve &
+#     tools/fleet_loadgen.py --devices 5000 --interval 60 --duration 600 --speedup 0
+#
+# Time is simulated: --speedup 0 sends as fast as possible, --speedup 1 in
+# real time. --drop removes frames on the device side, such that the
+# sequence gaps detected by the gateway can be verified.
+
+import argparse
+import heapq
+import json
+import random
+import socket
+import sys
+import time
+
+import iot_proto
+
+ESPNOW_MAX_PKT_SIZE = 248
+UDP_MAX_PKT_SIZE    = 1450
+
+
+class Device:
+  """State kept by one simulated device across deep sleep cycles."""
+
+  def __init__(self, index, args, rng):
+    self.rng  = rng
+    self.args = args
+    self.msg  = {
+      "topic": args.topic,
+      "name":  f"dev{index:05d}",
+      "seq":   0,
+      "dur":   0,
+      "mac":   ":".join(f"{b:02x}" for b in (0x24, 0x6f, 0x28, (index >> 16) & 0xFF, (index >> 8) & 0xFF, index & 0xFF)),
+      "err":   0,
+      "rssi":  -40 - index % 50,
+      "st":    1,
+      "rst":   1,
+      "heap":  200000,
+    }
+    if args.other_size:
+      self.msg["other"] = "data:\"" + "x" * max(args.other_size - 7, 0) + "\""
+    self.frag_id = 0
+    self.ack_seq = 0
+
+  def wake(self):
+    """Returns the payloads (already fragmented) sent during one wake up cycle."""
+    msgs = []
+    for i in range(self.args.msgs_per_wake):
+      msg = dict(self.msg, type="EVENT" if i else "WATCHDOG")
+      msgs.append(msg)
+      self.msg["seq"] += 1
+    self.msg["dur"] = self.rng.randint(80, 400)
+
+    encode = iot_proto.encode_tlv if self.args.format == "binary" else iot_proto.encode_text
+    if self.args.batch and len(msgs) > 1:
+      payloads = [iot_proto.encode_batch(msgs, self.args.format == "binary")]
+    else:
+      payloads = [encode(msg) for msg in msgs]
+
+    frames = []
+    for payload in payloads:
+      if len(payload) > self.args.max_pkt_size:
+        frames += iot_proto.fragment(payload, self.args.max_pkt_size, self.frag_id)
+        self.frag_id += 1
+      else:
+        frames.append(payload)
+    return frames
+
+  def frame(self, payload):
+    ack_seq = None
+    if self.args.ack:
+      ack_seq, self.ack_seq = self.ack_seq, self.ack_seq + 1
+    return iot_proto.build_frame(payload, ack_seq)
+
+
+def schedule(args, rng):
+  """Yields (sim_time, device) in wake up order."""
+  devices = [Device(i, args, rng) for i in range(args.devices)]
+  heap = [(rng.uniform(0, args.interval), i) for i in range(args.devices)]
+  heapq.heapify(heap)
+  while heap:
+    t, i = heapq.heappop(heap)
+    if t > args.duration:
+      return
+    yield t, devices[i]
+    jitter = rng.uniform(-args.jitter, args.jitter) * args.interval
+    heapq.heappush(heap, (t + max(args.interval + jitter, 0.001), i))
+
+
+def add_arguments(parser):
+  parser.add_argument("--devices",       type=int,   default=1000)
+  parser.add_argument("--interval",      type=float, default=60.0,  help="mean wake up interval (sec)")
+  parser.add_argument("--jitter",        type=float, default=0.1,   help="wake up interval jitter, fraction of the interval")
+  parser.add_argument("--duration",      type=float, default=600.0, help="simulated duration (sec)")
+  parser.add_argument("--msgs-per-wake", type=int,   default=1)
+  parser.add_argument("--format",        choices=("text", "binary"), default="text")
+  parser.add_argument("--batch",         action="store_true", help="CONFIG_IOT_MSG_BATCHING")
+  parser.add_argument("--ack",           action="store_true", help="CONFIG_IOT_UDP_ACK frame header (acks are not awaited)")
+  parser.add_argument("--max-pkt-size",  type=int,   default=ESPNOW_MAX_PKT_SIZE,
+                      help=f"{ESPNOW_MAX_PKT_SIZE} for ESP-NOW, up to {UDP_MAX_PKT_SIZE} for UDP")
+  parser.add_argument("--other-size",    type=int,   default=0,     help="size of the application field")
+  parser.add_argument("--topic",         default="test")
+  parser.add_argument("--seed",          type=int,   default=1)
+
+
+def main():
+  parser = argparse.ArgumentParser(description="Fleet load generator for the ESP32 Simple IoT Framework")
+  parser.add_argument("--address", default="127.0.0.1")
+  parser.add_argument("--port",    type=int,   default=3333)
+  parser.add_argument("--speedup", type=float, default=0.0, help="simulated time factor, 0 for no pacing")
+  parser.add_argument("--drop",    type=float, default=0.0, help="probability of dropping a frame before sending")
+  parser.add_argument("--report",  help="JSON report file (default: stdout)")
+  add_arguments(parser)
+  args = parser.parse_args()
+
+  rng  = random.Random(args.seed)
+  sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+  sock.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, 1 << 20)
+  dest = (args.address, args.port)
+
+  wakes = frames = dropped = sent_bytes = 0
+  start = time.monotonic()
+
+  for t, device in schedule(args, rng):
+    if args.speedup > 0:
+      delay = start + t / args.speedup - time.monotonic()
+      if delay > 0:
+        time.sleep(delay)
+    wakes += 1
+    for payload in device.wake():
+      frame = device.frame(payload)
+      frames += 1
+      if rng.random() < args.drop:
+        dropped += 1
+        continue
+      sock.sendto(frame, dest)
+      sent_bytes += len(frame)
+
+  elapsed = time.monotonic() - start
+  report = {
+    "tool":       "fleet_loadgen",
+    "parameters": {k: v for k, v in vars(args).items() if k not in ("report",)},
+    "wakes":      wakes,
+    "messages":   wakes * args.msgs_per_wake,
+    "frames":     frames,
+    "dropped":    dropped,
+    "bytes":      sent_bytes,
+    "elapsed":    round(elapsed, 3),
+    "frames_per_sec": round((frames - dropped) / elapsed, 1) if elapsed else None,
+  }
+  out = json.dumps(report, indent=2)
+  if args.report:
+    with open(args.report, "w") as f:
+      f.write(out + "\n")
+  else:
+    print(out)
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+#
+# Host side gateway emulator for the ESP32 Simple IoT Framework.
+#
+# Speaks the frame format produced by UDP::send() and ESPNow::send() (CRC16
+# followed by the IoT::send_msg() payload), carried over UDP for both
+# transports. Every frame is CRC checked, reassembled if fragmented and
+# decoded (text, TLV, batches). The sequence numbers of every device are
+# tracked to report lost and duplicated messages.
+#
+#   serve: receive frames, e.g. from tools/fleet_loadgen.py or from devices
+#          using the UDP transport. The report is written when no frame has
+#          been received for --idle seconds, or on Ctrl-C.
+#   bench: decode frames generated in-process (same options as
+#          fleet_loadgen.py), without any socket, to measure the decoder
+#          throughput alone.
+#
+# The JSON report contains the framework version (library.json) and the
+# parameters used, such that results can be compared across versions.
+# Fragments are reassembled per source address: frames of different devices
+# sharing one address must not interleave fragments.
+
+import argparse
+import json
+import os
+import random
+import socket
+import sys
+import time
+
+import iot_proto
+import fleet_loadgen
+
+REPORT_SCHEMA = 1
+
+
+def framework_version():
+  path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "library.json")
+  try:
+    with open(path) as f:
+      return json.load(f).get("version")
+  except (OSError, ValueError):
+    return None
+
+
+class Gateway:
+
+  def __init__(self, ack=False):
+    self.ack          = ack
+    self.reassemblers = {}
+    self.last_seq     = {}
+    self.stats        = dict(datagrams=0, bytes=0, crc_errors=0, decode_errors=0, fragments=0,
+                             messages=0, seq_gaps=0, duplicates=0, restarts=0, abandoned_fragments=0)
+    self.decode_time  = 0.0
+
+  def process(self, frame, source):
+    start = time.perf_counter()
+    stats = self.stats
+    stats["datagrams"] += 1
+    stats["bytes"]     += len(frame)
+
+    _, payload, ok = iot_proto.parse_frame(frame, self.ack)
+    if not ok:
+      stats["crc_errors"] += 1
+      self.decode_time += time.perf_counter() - start
+      return None
+
+    try:
+      if iot_proto.is_fragment(payload):
+        stats["fragments"] += 1
+        payload = self.reassemblers.setdefault(source, iot_proto.Reassembler()).add(payload)
+      msg = iot_proto.decode_payload(payload) if payload is not None else None
+    except (ValueError, IndexError, UnicodeDecodeError):
+      stats["decode_errors"] += 1
+      msg = None
+
+    if msg is not None:
+      device = msg.get("name") or msg.get("mac")
+      for rec in msg.get("recs", [msg]):
+        self.track(device, rec.get("seq"))
+
+    self.decode_time += time.perf_counter() - start
+    return msg
+
+  def track(self, device, seq):
+    self.stats["messages"] += 1
+    if seq is None:
+      return
+    last = self.last_seq.get(device)
+    if last is not None:
+      if seq > last + 1:
+        self.stats["seq_gaps"] += seq - last - 1
+      elif seq == 0:
+        self.stats["restarts"] += 1
+      elif seq <= last:
+        self.stats["duplicates"] += 1
+        return
+    self.last_seq[device] = seq
+
+  def report(self, mode, parameters, elapsed):
+    self.stats["abandoned_fragments"] = sum(r.abandoned for r in self.reassemblers.values())
+    return {
+      "schema":            REPORT_SCHEMA,
+      "tool":              "gateway_emulator",
+      "mode":              mode,
+      "framework_version": framework_version(),
+      "parameters":        parameters,
+      "devices":           len(self.last_seq),
+      **self.stats,
+      "elapsed":           round(elapsed, 3),
+      "decode_time":       round(self.decode_time, 3),
+      "decode_frames_per_sec": round(self.stats["datagrams"] / self.decode_time, 1) if self.decode_time else None,
+      "decode_mbytes_per_sec": round(self.stats["bytes"] / self.decode_time / 1e6, 3) if self.decode_time else None,
+    }
+
+
+def serve(args):
+  sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+  sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 << 20)
+  sock.bind((args.address, args.port))
+  sock.settimeout(args.idle)
+  gateway = Gateway(args.ack)
+  print(f"Listening on {args.address}:{args.port}", file=sys.stderr)
+
+  start = None
+  try:
+    while True:
+      try:
+        frame, addr = sock.recvfrom(2048)
+      except socket.timeout:
+        if start is not None:
+          break
+        continue
+      if start is None:
+        start = time.monotonic()
+      last = time.monotonic()
+      if args.ack:
+        sock.sendto(frame[:4], addr)
+      msg = gateway.process(frame, addr)
+      if args.verbose and msg is not None:
+        print(f"{addr[0]}:{addr[1]} {msg}")
+  except KeyboardInterrupt:
+    pass
+
+  elapsed = (last - start) if start is not None else 0.0
+  return gateway.report("serve", {"ack": args.ack}, elapsed)
+
+
+def bench(args):
+  rng    = random.Random(args.seed)
+  frames = [device.frame(payload) for _, device in fleet_loadgen.schedule(args, rng) for payload in device.wake()]
+
+  gateway = Gateway(args.ack)
+  start   = time.monotonic()
+  for frame in frames:
+    gateway.process(frame, None)
+  elapsed = time.monotonic() - start
+
+  return gateway.report("bench", {k: v for k, v in vars(args).items() if k not in ("command", "report")}, elapsed)
+
+
+def main():
+  parser = argparse.ArgumentParser(description="Gateway emulator for the ESP32 Simple IoT Framework")
+  parser.add_argument("--report", help="JSON report file (default: stdout)")
+  sub = parser.add_subparsers(dest="command", required=True)
+
+  srv = sub.add_parser("serve", help="receive and decode frames over UDP")
+  srv.add_argument("--address", default="127.0.0.1")
+  srv.add_argument("--port",    type=int,   default=3333)
+  srv.add_argument("--idle",    type=float, default=2.0, help="end of run after this idle time (sec)")
+  srv.add_argument("--ack",     action="store_true", help="frames carry the CONFIG_IOT_UDP_ACK header, acknowledge them")
+  srv.add_argument("--verbose", action="store_true")
+
+  bch = sub.add_parser("bench", help="decode frames generated in-process")
+  fleet_loadgen.add_arguments(bch)
+
+  args   = parser.parse_args()
+  report = serve(args) if args.command == "serve" else bench(args)
+  out    = json.dumps(report, indent=2)
+
+  if args.report:
+    with open(args.report, "w") as f:
+      f.write(out + "\n")
+  else:
+    print(out)
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -0,0 +1,861 @@
+// Host implementation of the ESP-IDF functions called by the framework
+// sources linked in the host tests (see stubs/esp_host.h):
+//
+// - FreeRTOS tasks are threads, event groups are implemented with a
+//   condition variable. The tick is one msec.
+// - The Wifi station (UDP mode) gets its address esp_host_wifi_connect_ms
+//   after esp_wifi_connect(), through the same events as on the device,
+//   delivered by an event loop thread.
+// - ESP-NOW frames are not transmitted: esp_now_send() keeps a copy of them
+//   in esp_host_now_frames, without any allocation. The gateway access point
+//   (esp_host_gateway) is found by the scans of its channel, each scan
+//   lasting its maximum dwell time. The test gives the gateway frames to the
+//   receive callback with esp_host_now_receive().
+// - The OTA partition is a RAM buffer.
+// - esp_deep_sleep() calls esp_host_deep_sleep_hook, that must end the
+//   process.
+// - The GPIO levels are set by the test with esp_host_gpio_set_level(), that
+//   calls the ISR of the pin in the calling thread.
+//
+// See esp_host.hpp for the variables given to the tests.
+
+#include <algorithm>
+#include <cstdarg>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <esp_now.h>
+#include <esp_ota_ops.h>
+#include <esp_sleep.h>
+#include <driver/rtc_io.h>
+#include <nvs_flash.h>
+#include <lwip/sockets.h>
+#include <cJSON.h>
+#include <esp_littlefs.h>
+#include <mbedtls/sha256.h>
+
+#include "esp_host.hpp"
+
+int       esp_host_wifi_connect_ms = 0;
+int       esp_host_nvs_init_ms     = 0;
+int64_t   esp_host_nvs_ready_time  = 0;
+int64_t   esp_host_wifi_init_time  = 0;
+int64_t   esp_host_wifi_ready_time = 0;
+void   (* esp_host_deep_sleep_hook)(uint64_t time_in_us) = nullptr;
+
+HostFrame esp_host_now_frames[HOST_MAX_FRAMES];
+int       esp_host_now_frame_count = 0;
+
+HostGateway esp_host_gateway = { "ESP_GATEWAY_1", { 0x24, 0x0A, 0xC4, 0x01, 0x02, 0x03 }, 6, -60 };
+
+static esp_log_level_t log_level = ESP_LOG_WARN;
+
+static void sleep_ms(int ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// esp_err.h, esp_log.h
+
+const char * esp_err_to_name(esp_err_t code)
+{
+  switch (code) {
+    case ESP_OK:              return "ESP_OK";
+    case ESP_FAIL:            return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:      return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_TIMEOUT:     return "ESP_ERR_TIMEOUT";
+    default:                  return "ESP_ERR";
+  }
+}
+
+void esp_log_level_set(const char * tag, esp_log_level_t level)
+{
+  if (strcmp(tag, "*") == 0) log_level = level;
+}
+
+esp_log_level_t esp_log_level_get(const char * tag)
+{
+  return log_level;
+}
+
+void esp_log_write(esp_log_level_t level, const char * tag, const char * format, ...)
+{
+  if (level > log_level) return;
+
+  va_list args;
+
+  va_start(args, format);
+  printf("%s: ", tag);
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+}
+
+// esp_crc.h, esp_timer.h, esp_random.h, esp_system.h, esp_mac.h
+
+// Same polynomial, bit order and complement as the ROM function.
+uint16_t esp_crc16_le(uint16_t crc, const uint8_t * buf, uint32_t len)
+{
+  crc = ~crc;
+
+  while (len--) {
+    crc ^= *buf++;
+    for (int i = 0; i < 8; i++) crc = (crc & 1) ? ((crc >> 1) ^ 0x8408) : (crc >> 1);
+  }
+
+  return ~crc;
+}
+
+// Time since the process start, as the device counts from boot.
+int64_t esp_timer_get_time()
+{
+  static const auto boot = std::chrono::steady_clock::now();
+
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot).count();
+}
+
+uint32_t esp_random()
+{
+  return ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+}
+
+uint32_t esp_get_free_heap_size()
+{
+  return 123456;
+}
+
+// The cached configuration (cfg) is used, as after a deep sleep.
+esp_reset_reason_t esp_reset_reason()
+{
+  return ESP_RST_DEEPSLEEP;
+}
+
+// The device doesn't come back from esp_restart(): not expected in the tests.
+void esp_restart()
+{
+  fprintf(stderr, "esp_restart() called.\n");
+  abort();
+}
+
+esp_err_t esp_read_mac(uint8_t * mac, esp_mac_type_t type)
+{
+  static const uint8_t MAC[6] = { 0x24, 0x6F, 0x28, 0x0A, 0x1B, 0x2C };
+
+  memcpy(mac, MAC, sizeof(MAC));
+
+  return ESP_OK;
+}
+
+// esp_sleep.h
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause()
+{
+  return ESP_SLEEP_WAKEUP_TIMER;
+}
+
+void esp_deep_sleep(uint64_t time_in_us)
+{
+  if (esp_host_deep_sleep_hook != nullptr) esp_host_deep_sleep_hook(time_in_us);
+
+  fprintf(stderr, "esp_deep_sleep(%llu) without a hook ending the process.\n", (unsigned long long) time_in_us);
+  abort();
+}
+
+esp_sleep_pd_option_t esp_host_rtc_periph_pd = ESP_PD_OPTION_AUTO;
+
+esp_err_t esp_sleep_pd_config(esp_sleep_pd_domain_t domain, esp_sleep_pd_option_t option)
+{
+  if (domain == ESP_PD_DOMAIN_RTC_PERIPH) esp_host_rtc_periph_pd = option;
+
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t pin, int level)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_ext1_wakeup(uint64_t mask, esp_sleep_ext1_wakeup_mode_t mode)
+{
+  return ESP_OK;
+}
+
+// driver/gpio.h, driver/rtc_io.h
+
+HostPin esp_host_pins[GPIO_NUM_MAX];
+
+static bool isr_service = false;
+
+void esp_host_gpio_set_level(gpio_num_t pin, int level)
+{
+  HostPin & p = esp_host_pins[pin];
+
+  if (p.level == level) return;
+
+  p.level = level;
+
+  if ((p.isr != nullptr) && (p.config.intr_type == GPIO_INTR_ANYEDGE)) p.isr(p.isr_arg);
+}
+
+esp_err_t gpio_config(const gpio_config_t * config)
+{
+  for (int pin = 0; pin < GPIO_NUM_MAX; pin++) {
+    if (config->pin_bit_mask & (1ULL << pin)) esp_host_pins[pin].config = *config;
+  }
+
+  return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t pin)
+{
+  return esp_host_pins[pin].level;
+}
+
+esp_err_t gpio_install_isr_service(int flags)
+{
+  if (isr_service) return ESP_ERR_INVALID_STATE;
+
+  isr_service = true;
+
+  return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t isr, void * arg)
+{
+  if (!isr_service) return ESP_ERR_INVALID_STATE;
+
+  esp_host_pins[pin].isr     = isr;
+  esp_host_pins[pin].isr_arg = arg;
+
+  return ESP_OK;
+}
+
+// The ESP32 RTC IOs.
+bool rtc_gpio_is_valid_gpio(gpio_num_t pin)
+{
+  return (pin == 0) || (pin == 2) || (pin == 4) || ((pin >= 12) && (pin <= 15)) ||
+         ((pin >= 25) && (pin <= 27)) || ((pin >= 32) && (pin <= 39));
+}
+
+esp_err_t rtc_gpio_deinit(gpio_num_t pin)
+{
+  return ESP_OK;
+}
+
+// FreeRTOS
+
+struct HostEventGroup {
+  std::mutex              mutex;
+  std::condition_variable changed;
+  EventBits_t             bits = 0;
+};
+
+void vTaskDelay(TickType_t ticks)
+{
+  sleep_ms(ticks);
+}
+
+TickType_t xTaskGetTickCount()
+{
+  return esp_timer_get_time() / 1000;
+}
+
+BaseType_t xTaskCreatePinnedToCore(void (* task)(void *), const char * name, uint32_t stack, void * arg,
+                                   UBaseType_t prio, TaskHandle_t * handle, BaseType_t core)
+{
+  std::thread(task, arg).detach();
+
+  if (handle != nullptr) *handle = nullptr;
+
+  return pdPASS;
+}
+
+// A task deleting itself returns from its function just after.
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+  return 5;
+}
+
+BaseType_t xPortGetCoreID()
+{
+  return 0;
+}
+
+EventGroupHandle_t xEventGroupCreate()
+{
+  return new HostEventGroup;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+  if (group == nullptr) return 0;
+
+  HostEventGroup * g = (HostEventGroup *) group;
+  std::lock_guard<std::mutex> lock(g->mutex);
+
+  g->bits |= bits;
+  g->changed.notify_all();
+
+  return g->bits;
+}
+
+// No timer task on the host: the bits are set at once, by the calling
+// thread standing for the ISR.
+BaseType_t xEventGroupSetBitsFromISR(EventGroupHandle_t group, EventBits_t bits, BaseType_t * woken)
+{
+  if (group == nullptr) return pdFAIL;
+
+  xEventGroupSetBits(group, bits);
+
+  if (woken != nullptr) *woken = pdFALSE;
+
+  return pdPASS;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+  if (group == nullptr) return 0;
+
+  HostEventGroup * g = (HostEventGroup *) group;
+  std::lock_guard<std::mutex> lock(g->mutex);
+  EventBits_t                 before = g->bits;
+
+  g->bits &= ~bits;
+
+  return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+  if (group == nullptr) return 0;
+
+  HostEventGroup * g = (HostEventGroup *) group;
+  std::lock_guard<std::mutex> lock(g->mutex);
+
+  return g->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t wait)
+{
+  HostEventGroup * g = (HostEventGroup *) group;
+  std::unique_lock<std::mutex> lock(g->mutex);
+
+  auto done = [&] { return all ? ((g->bits & bits) == bits) : ((g->bits & bits) != 0); };
+
+  if (wait == portMAX_DELAY) {
+    g->changed.wait(lock, done);
+  }
+  else {
+    g->changed.wait_for(lock, std::chrono::milliseconds(wait), done);
+  }
+
+  EventBits_t result = g->bits;
+
+  if (clear && done()) g->bits &= ~bits;
+
+  return result;
+}
+
+// No send callback on the host: the queue stays empty.
+static int queue;
+
+QueueHandle_t xQueueCreate(int length, int item_size)
+{
+  return &queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void * item, TickType_t wait)
+{
+  return pdFALSE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void * item, TickType_t wait)
+{
+  return pdFALSE;
+}
+
+// esp_event.h: the handlers are called from the event loop thread, one
+// event at a time, as from the default event loop task.
+
+esp_event_base_t WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t IP_EVENT   = "IP_EVENT";
+
+static struct {
+  esp_event_base_t    base;
+  esp_event_handler_t handler;
+  void              * arg;
+} handlers[4];
+
+static std::mutex event_loop;
+
+static void post_event(esp_event_base_t base, int32_t id, void * data)
+{
+  std::lock_guard<std::mutex> lock(event_loop);
+
+  for (auto & h : handlers) {
+    if ((h.handler != nullptr) && (h.base == base)) h.handler(h.arg, base, id, data);
+  }
+}
+
+esp_err_t esp_event_loop_create_default()
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler,
+                                              void * arg, esp_event_handler_instance_t * instance)
+{
+  std::lock_guard<std::mutex> lock(event_loop);
+
+  for (auto & h : handlers) {
+    if (h.handler == nullptr) {
+      h.base    = base;
+      h.handler = handler;
+      h.arg     = arg;
+      return ESP_OK;
+    }
+  }
+
+  return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_event_handler_unregister(esp_event_base_t base, int32_t id, esp_event_handler_t handler)
+{
+  for (auto & h : handlers) {
+    if ((h.base == base) && (h.handler == handler)) h.handler = nullptr;
+  }
+
+  return ESP_OK;
+}
+
+// esp_netif.h, esp_wifi.h
+
+static int netif;
+
+esp_err_t esp_netif_init()
+{
+  return ESP_OK;
+}
+
+esp_netif_t * esp_netif_create_default_wifi_sta()
+{
+  return (esp_netif_t *) &netif;
+}
+
+esp_err_t tcpip_adapter_get_ip_info(tcpip_adapter_if_t tcpip_if, tcpip_adapter_ip_info_t * ip_info)
+{
+  memset(ip_info, 0, sizeof(tcpip_adapter_ip_info_t));
+  ip_info->ip.addr = htonl(INADDR_LOOPBACK);
+
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t * config)
+{
+  esp_host_wifi_init_time = esp_timer_get_time();
+
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t * conf)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_start()
+{
+  std::thread([] { post_event(WIFI_EVENT, WIFI_EVENT_STA_START, nullptr); }).detach();
+
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_stop()
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect()
+{
+  if (esp_host_wifi_connect_ms < 0) return ESP_OK;
+
+  std::thread([] {
+    wifi_event_sta_connected_t connected = {};
+    ip_event_got_ip_t          got_ip    = {};
+
+    sleep_ms(esp_host_wifi_connect_ms / 2);
+    post_event(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &connected);
+
+    sleep_ms(esp_host_wifi_connect_ms - esp_host_wifi_connect_ms / 2);
+    esp_host_wifi_ready_time = esp_timer_get_time();
+    post_event(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_ip);
+  }).detach();
+
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t * ap_info)
+{
+  memset(ap_info, 0, sizeof(wifi_ap_record_t));
+  ap_info->rssi = -60;
+
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_channel(uint8_t * primary, wifi_second_chan_t * second)
+{
+  *primary = 1;
+  *second  = WIFI_SECOND_CHAN_NONE;
+
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_protocol(wifi_interface_t interface, uint8_t protocol)
+{
+  return ESP_OK;
+}
+
+static bool scan_found;
+
+// Blocking scan of one channel, or of all of them (channel 0).
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t * config, bool block)
+{
+  sleep_ms(config->scan_time.active.max);
+
+  scan_found = ((config->channel == 0) || (config->channel == esp_host_gateway.channel)) &&
+               ((config->bssid == nullptr) || (memcmp(config->bssid, esp_host_gateway.bssid, 6) == 0));
+
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t * count, wifi_ap_record_t * records)
+{
+  if (!scan_found || (*count == 0)) {
+    *count = 0;
+    return ESP_OK;
+  }
+
+  memset(records, 0, sizeof(wifi_ap_record_t));
+  strcpy((char *) records->ssid, esp_host_gateway.ssid);
+  memcpy(records->bssid, esp_host_gateway.bssid, 6);
+  records->primary = esp_host_gateway.channel;
+  records->rssi    = esp_host_gateway.rssi;
+
+  *count = 1;
+
+  return ESP_OK;
+}
+
+// esp_now.h
+
+static esp_now_recv_cb_t recv_cb = nullptr;
+
+esp_err_t esp_now_init()
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_now_deinit()
+{
+  return ESP_OK;
+}
+
+// Not called: there is no send status on the host.
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_now_unregister_send_cb()
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb)
+{
+  recv_cb = cb;
+
+  return ESP_OK;
+}
+
+esp_err_t esp_now_unregister_recv_cb()
+{
+  recv_cb = nullptr;
+
+  return ESP_OK;
+}
+
+esp_err_t esp_now_set_pmk(const uint8_t * pmk)
+{
+  return ESP_OK;
+}
+
+void esp_host_now_receive(const uint8_t * mac_addr, const uint8_t * data, int len)
+{
+  if (recv_cb != nullptr) recv_cb(mac_addr, data, len);
+}
+
+esp_err_t esp_now_send(const uint8_t * peer_addr, const uint8_t * data, size_t len)
+{
+  if ((esp_host_now_frame_count >= HOST_MAX_FRAMES) || (len > sizeof(HostFrame::data))) return ESP_FAIL;
+
+  HostFrame & frame = esp_host_now_frames[esp_host_now_frame_count++];
+
+  memcpy(frame.data, data, len);
+  frame.len = len;
+
+  return ESP_OK;
+}
+
+// Reached through the gateway failover, after a send timeout.
+bool esp_now_is_peer_exist(const uint8_t * peer_addr)
+{
+  return false;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t * peer)
+{
+  return ESP_OK;
+}
+
+// esp_partition.h, esp_ota_ops.h
+
+static uint8_t               ota_flash[256 * 1024];
+static const esp_partition_t ota_partition = { 0x110000, sizeof(ota_flash), "ota_1" };
+
+const esp_partition_t * esp_ota_get_next_update_partition(const esp_partition_t * start)
+{
+  return &ota_partition;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t * partition)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t * partition, size_t offset, size_t size)
+{
+  if ((offset + size) > partition->size) return ESP_ERR_INVALID_SIZE;
+
+  memset(&ota_flash[offset], 0xFF, size);
+
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t * partition, size_t offset, const void * src, size_t size)
+{
+  if ((offset + size) > partition->size) return ESP_ERR_INVALID_SIZE;
+
+  memcpy(&ota_flash[offset], src, size);
+
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t * partition, size_t offset, void * dst, size_t size)
+{
+  if ((offset + size) > partition->size) return ESP_ERR_INVALID_SIZE;
+
+  memcpy(dst, &ota_flash[offset], size);
+
+  return ESP_OK;
+}
+
+// mbedtls/sha256.h: SHA-256 only (FIPS 180-4), no SHA-224.
+
+static const uint32_t SHA256_K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t ror(uint32_t x, int n)
+{
+  return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_block(mbedtls_sha256_context * ctx, const uint8_t * block)
+{
+  uint32_t w[64];
+  uint32_t v[8];
+
+  for (int i = 0; i < 16; i++) {
+    w[i] = (block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2],  19) ^ (w[i - 2]  >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  memcpy(v, ctx->state, sizeof(v));
+
+  for (int i = 0; i < 64; i++) {
+    uint32_t t1 = v[7] + (ror(v[4], 6) ^ ror(v[4], 11) ^ ror(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + SHA256_K[i] + w[i];
+    uint32_t t2 = (ror(v[0], 2) ^ ror(v[0], 13) ^ ror(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+
+    memmove(&v[1], &v[0], 7 * sizeof(uint32_t));
+    v[4] += t1;
+    v[0]  = t1 + t2;
+  }
+
+  for (int i = 0; i < 8; i++) ctx->state[i] += v[i];
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context * ctx)
+{
+  memset(ctx, 0, sizeof(mbedtls_sha256_context));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context * ctx)
+{
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context * ctx, int is224)
+{
+  static const uint32_t H0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+  if (is224) return -1;
+
+  memcpy(ctx->state, H0, sizeof(H0));
+  ctx->total = 0;
+
+  return 0;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context * ctx, const unsigned char * input, size_t len)
+{
+  while (len > 0) {
+    size_t used = ctx->total % 64;
+    size_t n    = std::min(len, 64 - used);
+
+    memcpy(&ctx->buffer[used], input, n);
+    ctx->total += n;
+    input      += n;
+    len        -= n;
+
+    if ((ctx->total % 64) == 0) sha256_block(ctx, ctx->buffer);
+  }
+
+  return 0;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context * ctx, unsigned char * output)
+{
+  static const uint8_t pad[64] = { 0x80 };
+
+  uint64_t bits = ctx->total * 8;
+  uint8_t  length[8];
+
+  for (int i = 0; i < 8; i++) length[i] = bits >> (56 - i * 8);
+
+  mbedtls_sha256_update(ctx, pad, ((ctx->total % 64) < 56) ? (56 - ctx->total % 64) : (120 - ctx->total % 64));
+  mbedtls_sha256_update(ctx, length, 8);
+
+  for (int i = 0; i < 8; i++) {
+    output[i * 4]     = ctx->state[i] >> 24;
+    output[i * 4 + 1] = ctx->state[i] >> 16;
+    output[i * 4 + 2] = ctx->state[i] >> 8;
+    output[i * 4 + 3] = ctx->state[i];
+  }
+
+  return 0;
+}
+
+// nvs_flash.h: the flash is initialized in esp_host_nvs_init_ms, and is
+// always empty.
+
+esp_err_t nvs_flash_init()
+{
+  sleep_ms(esp_host_nvs_init_ms);
+  esp_host_nvs_ready_time = esp_timer_get_time();
+
+  return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase()
+{
+  return ESP_OK;
+}
+
+esp_err_t nvs_open(const char * name, nvs_open_mode_t mode, nvs_handle_t * handle)
+{
+  return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char * key, void * value, size_t * length)
+{
+  return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char * key, const void * value, size_t length)
+{
+  return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+  return ESP_ERR_NVS_NOT_FOUND;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+// esp_littlefs.h, cJSON.h: there is no littlefs partition, the tests give
+// the configuration in cfg, with its CRC (as cached in RTC memory).
+
+esp_err_t esp_vfs_littlefs_register(const esp_vfs_littlefs_conf_t * conf)
+{
+  return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_vfs_littlefs_unregister(const char * partition_label)
+{
+  return ESP_OK;
+}
+
+cJSON * cJSON_Parse(const char * value)
+{
+  return nullptr;
+}
+
+cJSON * cJSON_GetObjectItem(const cJSON * object, const char * name)
+{
+  return nullptr;
+}
+
+void cJSON_Delete(cJSON * item)
+{
+}
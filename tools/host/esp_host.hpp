@@ -0,0 +1,63 @@
+#pragma once
+
+// Control and observation of the host implementation of ESP-IDF
+// (esp_host.cpp). Times are esp_timer_get_time() values, 0 until the
+// event happened.
+
+#include <esp_now.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+
+/// Time from esp_wifi_connect() to the IP address, -1 for never (UDP mode).
+extern int     esp_host_wifi_connect_ms;
+/// Duration of nvs_flash_init().
+extern int     esp_host_nvs_init_ms;
+
+extern int64_t esp_host_nvs_ready_time;   ///< End of nvs_flash_init()
+extern int64_t esp_host_wifi_init_time;   ///< Call to esp_wifi_init()
+extern int64_t esp_host_wifi_ready_time;  ///< IP_EVENT_STA_GOT_IP posted
+
+/// Called by esp_deep_sleep(). It must end the process: the device doesn't
+/// come back from esp_deep_sleep().
+extern void (* esp_host_deep_sleep_hook)(uint64_t time_in_us);
+
+struct HostFrame {
+  uint8_t data[ESP_NOW_MAX_DATA_LEN];
+  size_t  len;
+};
+
+constexpr const int HOST_MAX_FRAMES = 16;
+
+/// Frames given to esp_now_send(), in order.
+extern HostFrame esp_host_now_frames[HOST_MAX_FRAMES];
+extern int       esp_host_now_frame_count;
+
+struct HostGateway {
+  const char * ssid;
+  uint8_t      bssid[6];
+  uint8_t      channel;
+  int8_t       rssi;
+};
+
+/// The ESP-NOW gateway access point, found by the scans of its channel.
+extern HostGateway esp_host_gateway;
+
+/// Give the frame **data** from **mac_addr** to the ESP-NOW receive callback,
+/// called by the calling thread.
+void esp_host_now_receive(const uint8_t * mac_addr, const uint8_t * data, int len);
+
+struct HostPin {
+  int           level;    ///< Read by gpio_get_level()
+  gpio_config_t config;   ///< Last given to gpio_config()
+  gpio_isr_t    isr;
+  void *        isr_arg;
+};
+
+extern HostPin esp_host_pins[GPIO_NUM_MAX];
+
+/// Set the level of **pin**. On a change, the ISR of the pin is called by the
+/// calling thread.
+void esp_host_gpio_set_level(gpio_num_t pin, int level);
+
+/// Last option given to esp_sleep_pd_config() for the RTC peripherals.
+extern esp_sleep_pd_option_t esp_host_rtc_periph_pd;
@@ -0,0 +1,21 @@
+#pragma once
+
+// Minimal test support for the host tests: CHECK() reports the failed
+// condition and counts it, TEST_RESULT() prints the summary and gives the
+// process exit status.
+
+#include <cstdio>
+
+static int test_checks   = 0;
+static int test_failures = 0;
+
+#define CHECK(cond) do {                                                   \
+    test_checks++;                                                         \
+    if (!(cond)) {                                                         \
+      printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);      \
+      test_failures++;                                                     \
+    }                                                                      \
+  } while (0)
+
+#define TEST_RESULT(name) (printf("%s: %d checks, %d failure(s)\n", name, test_checks, test_failures), \
+                           (test_failures == 0) ? 0 : 1)
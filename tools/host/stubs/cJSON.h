@@ -0,0 +1,10 @@
+#pragma once
+typedef struct cJSON { int type; double valuedouble; char * valuestring; } cJSON;
+#define cJSON_Number 8
+#define cJSON_String 16
+#define cJSON_Array 32
+cJSON * cJSON_GetObjectItem(const cJSON*, const char*);
+cJSON * cJSON_Parse(const char*);
+void cJSON_Delete(cJSON*);
+int cJSON_GetArraySize(const cJSON*);
+cJSON * cJSON_GetArrayItem(const cJSON*, int);
@@ -0,0 +1,9 @@
+#pragma once
+#include "../esp_host.h"
+typedef enum { ADC1_CHANNEL_0 } adc1_channel_t;
+typedef enum { ADC_UNIT_1 } adc_unit_t;
+typedef enum { ADC_ATTEN_DB_11 } adc_atten_t;
+typedef enum { ADC_WIDTH_BIT_9 } adc_bits_width_t;
+esp_err_t adc1_config_width(adc_bits_width_t);
+esp_err_t adc1_config_channel_atten(adc1_channel_t, adc_atten_t);
+int adc1_get_raw(adc1_channel_t);
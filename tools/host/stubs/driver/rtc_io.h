@@ -0,0 +1,3 @@
+#pragma once
+#include "gpio.h"
+esp_err_t rtc_gpio_deinit(gpio_num_t);
@@ -0,0 +1,7 @@
+#pragma once
+#include "driver/adc.h"
+typedef struct { int x; } esp_adc_cal_characteristics_t;
+typedef enum { ESP_ADC_CAL_VAL_EFUSE_VREF, ESP_ADC_CAL_VAL_EFUSE_TP, ESP_ADC_CAL_VAL_DEFAULT_VREF } esp_adc_cal_value_t;
+#define ESP_ADC_CAL_VAL_DEFAULT_VREF 1100
+esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t, adc_atten_t, adc_bits_width_t, uint32_t, esp_adc_cal_characteristics_t*);
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t, const esp_adc_cal_characteristics_t*);
@@ -0,0 +1,11 @@
+#pragma once
+#include "esp_host.h"
+typedef const char * esp_event_base_t;
+extern esp_event_base_t WIFI_EVENT, IP_EVENT;
+#define ESP_EVENT_ANY_ID -1
+typedef void (*esp_event_handler_t)(void*, esp_event_base_t, int32_t, void*);
+typedef void * esp_event_handler_instance_t;
+esp_err_t esp_event_loop_create_default();
+esp_err_t esp_event_handler_instance_register(esp_event_base_t, int32_t, esp_event_handler_t, void*, esp_event_handler_instance_t*);
+esp_err_t esp_event_handler_register(esp_event_base_t, int32_t, esp_event_handler_t, void*);
+esp_err_t esp_event_handler_unregister(esp_event_base_t, int32_t, esp_event_handler_t);
@@ -0,0 +1,141 @@
+#pragma once
+
+// Host build of the ESP-IDF API used by the framework: types, constants
+// and declarations only. The functions a host test links against are
+// implemented in tools/host/esp_host.cpp; the other ones are declared such
+// that the sources compile, and are dropped at link time with the unused
+// sections (-ffunction-sections -Wl,--gc-sections).
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <cerrno>
+
+#include "sdkconfig.h"
+
+// esp_err.h
+
+typedef int esp_err_t;
+
+#define ESP_OK                          0
+#define ESP_FAIL                       -1
+#define ESP_ERR_NO_MEM                  0x101
+#define ESP_ERR_INVALID_ARG             0x102
+#define ESP_ERR_INVALID_STATE           0x103
+#define ESP_ERR_INVALID_SIZE            0x104
+#define ESP_ERR_NOT_FOUND               0x105
+#define ESP_ERR_TIMEOUT                 0x107
+#define ESP_ERR_INVALID_CRC             0x109
+#define ESP_ERR_NVS_NO_FREE_PAGES       0x1100
+#define ESP_ERR_NVS_NEW_VERSION_FOUND   0x1101
+#define ESP_ERR_NVS_NOT_FOUND           0x1102
+
+#define ESP_ERROR_CHECK(x) do { esp_err_t err_rc_ = (x); if (err_rc_ != ESP_OK) ::abort(); } while (0)
+
+const char * esp_err_to_name(esp_err_t code);
+
+// esp_log.h: the messages are printed up to the level set for all tags
+// with esp_log_level_set("*", ...), ESP_LOG_WARN by default.
+
+typedef enum { ESP_LOG_NONE, ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_DEBUG, ESP_LOG_VERBOSE } esp_log_level_t;
+
+void            esp_log_level_set(const char * tag, esp_log_level_t level);
+esp_log_level_t esp_log_level_get(const char * tag);
+void            esp_log_write(esp_log_level_t level, const char * tag, const char * format, ...)
+                  __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOGE(tag, fmt, ...) esp_log_write(ESP_LOG_ERROR,   tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) esp_log_write(ESP_LOG_WARN,    tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) esp_log_write(ESP_LOG_INFO,    tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) esp_log_write(ESP_LOG_DEBUG,   tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) esp_log_write(ESP_LOG_VERBOSE, tag, fmt, ##__VA_ARGS__)
+
+// esp_attr.h: no RTC or IRAM memory on the host.
+
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+// esp_mac.h, esp_netif.h
+
+#define MACSTR      "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a)  (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+#define IPSTR       "%d.%d.%d.%d"
+#define IP2STR(a)   (int) ((a)->addr & 0xFF), (int) (((a)->addr >> 8) & 0xFF), \
+                    (int) (((a)->addr >> 16) & 0xFF), (int) (((a)->addr >> 24) & 0xFF)
+
+typedef enum { ESP_MAC_WIFI_STA } esp_mac_type_t;
+
+esp_err_t esp_read_mac(uint8_t * mac, esp_mac_type_t type);
+
+// esp_crc.h, esp_random.h, esp_timer.h, esp_system.h
+
+uint16_t esp_crc16_le(uint16_t crc, const uint8_t * buf, uint32_t len);
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t * buf, uint32_t len);
+uint32_t esp_random();
+void     esp_fill_random(void * buf, size_t len);
+int64_t  esp_timer_get_time();
+uint32_t esp_get_free_heap_size();
+
+typedef enum { ESP_RST_UNKNOWN, ESP_RST_POWERON, ESP_RST_SW, ESP_RST_PANIC, ESP_RST_DEEPSLEEP, ESP_RST_BROWNOUT } esp_reset_reason_t;
+
+esp_reset_reason_t esp_reset_reason();
+void               esp_restart();
+
+// FreeRTOS
+
+typedef uint32_t TickType_t;
+typedef int      BaseType_t;
+typedef unsigned UBaseType_t;
+
+#define pdTRUE                1
+#define pdFALSE               0
+#define pdPASS                1
+#define pdFAIL                0
+#define portMAX_DELAY         0xFFFFFFFFu
+#define portTICK_PERIOD_MS    1
+#define pdMS_TO_TICKS(ms)     ((TickType_t) (ms))
+#define portNUM_PROCESSORS    2
+#define tskNO_AFFINITY        0x7FFFFFFF
+
+typedef void *   QueueHandle_t;
+typedef void *   TaskHandle_t;
+typedef void *   xTaskHandle;
+typedef void *   TimerHandle_t;
+typedef void *   SemaphoreHandle_t;
+typedef void *   EventGroupHandle_t;
+typedef uint32_t EventBits_t;
+
+QueueHandle_t xQueueCreate(int length, int item_size);
+void          vQueueDelete(QueueHandle_t queue);
+BaseType_t    xQueueReceive(QueueHandle_t queue, void * item, TickType_t wait);
+BaseType_t    xQueueSend(QueueHandle_t queue, const void * item, TickType_t wait);
+BaseType_t    xQueueSendFromISR(QueueHandle_t queue, const void * item, BaseType_t * woken);
+
+void        vTaskDelay(TickType_t ticks);
+TickType_t  xTaskGetTickCount();
+BaseType_t  xTaskCreate(void (* task)(void *), const char * name, uint32_t stack, void * arg, UBaseType_t prio, TaskHandle_t * handle);
+BaseType_t  xTaskCreatePinnedToCore(void (* task)(void *), const char * name, uint32_t stack, void * arg, UBaseType_t prio, TaskHandle_t * handle, BaseType_t core);
+void        vTaskDelete(TaskHandle_t task);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+BaseType_t  xPortGetCoreID();
+
+EventGroupHandle_t xEventGroupCreate();
+EventBits_t        xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+BaseType_t         xEventGroupSetBitsFromISR(EventGroupHandle_t group, EventBits_t bits, BaseType_t * woken);
+EventBits_t        xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t        xEventGroupGetBits(EventGroupHandle_t group);
+EventBits_t        xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t wait);
+
+typedef struct { int owner; } portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define portENTER_CRITICAL(mux)      (void) (mux)
+#define portEXIT_CRITICAL(mux)       (void) (mux)
+#define portENTER_CRITICAL_ISR(mux)  (void) (mux)
+#define portEXIT_CRITICAL_ISR(mux)   (void) (mux)
+#define portYIELD_FROM_ISR(...)      do {} while (0)
@@ -0,0 +1,5 @@
+#pragma once
+#include "esp_host.h"
+typedef struct { const char * base_path; const char * partition_label; unsigned format_if_mount_failed:1; unsigned dont_mount:1; } esp_vfs_littlefs_conf_t;
+esp_err_t esp_vfs_littlefs_register(const esp_vfs_littlefs_conf_t*);
+esp_err_t esp_vfs_littlefs_unregister(const char*);
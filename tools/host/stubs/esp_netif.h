@@ -0,0 +1,20 @@
+#pragma once
+#include "esp_host.h"
+typedef struct { uint32_t addr; } esp_ip4_addr_t;
+typedef struct { esp_ip4_addr_t ip, netmask, gw; } esp_netif_ip_info_t;
+typedef struct esp_netif_obj esp_netif_t;
+esp_err_t esp_netif_init();
+esp_netif_t * esp_netif_create_default_wifi_sta();
+esp_err_t esp_netif_get_ip_info(esp_netif_t*, esp_netif_ip_info_t*);
+esp_err_t esp_netif_set_ip_info(esp_netif_t*, const esp_netif_ip_info_t*);
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t*);
+esp_err_t esp_netif_dhcpc_start(esp_netif_t*);
+typedef enum { ESP_NETIF_DNS_MAIN } esp_netif_dns_type_t;
+typedef struct { struct { struct { esp_ip4_addr_t ip4; } u_addr; uint8_t type; } ip; } esp_netif_dns_info_t;
+esp_err_t esp_netif_get_dns_info(esp_netif_t*, esp_netif_dns_type_t, esp_netif_dns_info_t*);
+esp_err_t esp_netif_set_dns_info(esp_netif_t*, esp_netif_dns_type_t, esp_netif_dns_info_t*);
+typedef enum { TCPIP_ADAPTER_IF_STA } tcpip_adapter_if_t;
+typedef esp_netif_ip_info_t tcpip_adapter_ip_info_t;
+esp_err_t tcpip_adapter_get_ip_info(tcpip_adapter_if_t, tcpip_adapter_ip_info_t*);
+typedef struct { esp_netif_ip_info_t ip_info; bool ip_changed; esp_netif_t * esp_netif; } ip_event_got_ip_t;
+#define ESP_IPADDR_TYPE_V4 0
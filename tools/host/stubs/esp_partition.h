@@ -0,0 +1,6 @@
+#pragma once
+#include "esp_host.h"
+typedef struct { uint32_t address; uint32_t size; char label[17]; } esp_partition_t;
+esp_err_t esp_partition_read(const esp_partition_t*, size_t, void*, size_t);
+esp_err_t esp_partition_write(const esp_partition_t*, size_t, const void*, size_t);
+esp_err_t esp_partition_erase_range(const esp_partition_t*, size_t, size_t);
@@ -0,0 +1,5 @@
+#pragma once
+#include "esp_err.h"
+#include <stdbool.h>
+typedef struct { int max_freq_mhz; int min_freq_mhz; bool light_sleep_enable; } esp_pm_config_esp32_t;
+esp_err_t esp_pm_configure(const void *);
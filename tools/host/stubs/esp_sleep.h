@@ -0,0 +1,18 @@
+#pragma once
+#include "esp_host.h"
+typedef enum { ESP_SLEEP_WAKEUP_UNDEFINED, ESP_SLEEP_WAKEUP_ALL, ESP_SLEEP_WAKEUP_EXT0, ESP_SLEEP_WAKEUP_EXT1, ESP_SLEEP_WAKEUP_TIMER, ESP_SLEEP_WAKEUP_GPIO } esp_sleep_source_t;
+typedef esp_sleep_source_t esp_sleep_wakeup_cause_t;
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause();
+void esp_deep_sleep(uint64_t) __attribute__((noreturn));
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t);
+esp_err_t esp_light_sleep_start();
+typedef enum { ESP_EXT1_WAKEUP_ALL_LOW, ESP_EXT1_WAKEUP_ANY_HIGH } esp_sleep_ext1_wakeup_mode_t;
+esp_err_t esp_sleep_enable_ext1_wakeup(uint64_t, esp_sleep_ext1_wakeup_mode_t);
+uint64_t esp_sleep_get_ext1_wakeup_status();
+esp_err_t esp_sleep_enable_gpio_wakeup();
+esp_err_t esp_sleep_enable_wifi_wakeup();
+#include "driver/gpio.h"
+esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t, int);
+typedef enum { ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_DOMAIN_RTC_SLOW_MEM, ESP_PD_DOMAIN_RTC_FAST_MEM, ESP_PD_DOMAIN_XTAL, ESP_PD_DOMAIN_MAX } esp_sleep_pd_domain_t;
+typedef enum { ESP_PD_OPTION_OFF, ESP_PD_OPTION_ON, ESP_PD_OPTION_AUTO } esp_sleep_pd_option_t;
+esp_err_t esp_sleep_pd_config(esp_sleep_pd_domain_t, esp_sleep_pd_option_t);
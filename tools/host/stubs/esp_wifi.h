@@ -0,0 +1,49 @@
+#pragma once
+#include "esp_host.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+typedef enum { WIFI_IF_STA=0, WIFI_IF_AP } wifi_interface_t;
+#define ESP_IF_WIFI_STA WIFI_IF_STA
+typedef enum { WIFI_MODE_STA=1 } wifi_mode_t;
+typedef enum { WIFI_STORAGE_RAM } wifi_storage_t;
+typedef enum { WIFI_SECOND_CHAN_NONE } wifi_second_chan_t;
+typedef enum { WIFI_SCAN_TYPE_ACTIVE, WIFI_SCAN_TYPE_PASSIVE } wifi_scan_type_t;
+typedef enum { WIFI_AUTH_OPEN, WIFI_AUTH_WEP_PSK, WIFI_AUTH_WPA_PSK, WIFI_AUTH_WPA2_PSK, WIFI_AUTH_WPA3_PSK } wifi_auth_mode_t;
+typedef enum { WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM } wifi_ps_type_t;
+typedef enum { WIFI_PHY_RATE_1M_L, WIFI_PHY_RATE_2M, WIFI_PHY_RATE_5M_L, WIFI_PHY_RATE_11M_L, WIFI_PHY_RATE_6M, WIFI_PHY_RATE_12M, WIFI_PHY_RATE_24M, WIFI_PHY_RATE_54M, WIFI_PHY_RATE_MCS7_SGI, WIFI_PHY_RATE_LORA_250K, WIFI_PHY_RATE_LORA_500K } wifi_phy_rate_t;
+typedef struct { uint32_t min, max; } wifi_active_scan_time_t;
+typedef struct { wifi_active_scan_time_t active; uint32_t passive; } wifi_scan_time_t;
+typedef struct { uint8_t * ssid; uint8_t * bssid; uint8_t channel; bool show_hidden; wifi_scan_type_t scan_type; wifi_scan_time_t scan_time; } wifi_scan_config_t;
+typedef struct { uint8_t bssid[6]; uint8_t ssid[33]; uint8_t primary; int8_t rssi; wifi_auth_mode_t authmode; } wifi_ap_record_t;
+typedef struct { wifi_auth_mode_t authmode; } wifi_scan_threshold_t;
+typedef struct { bool capable; bool required; } wifi_pmf_config_t;
+typedef struct { uint8_t ssid[32]; uint8_t password[64]; bool bssid_set; uint8_t bssid[6]; uint8_t channel; wifi_scan_threshold_t threshold; wifi_pmf_config_t pmf_cfg; int scan_method; } wifi_sta_config_t;
+typedef union { wifi_sta_config_t sta; } wifi_config_t;
+typedef struct { int x; } wifi_init_config_t;
+#define WIFI_INIT_CONFIG_DEFAULT() wifi_init_config_t{0}
+#define WIFI_PROTOCOL_11B 1
+#define WIFI_PROTOCOL_11G 2
+#define WIFI_PROTOCOL_11N 4
+#define WIFI_PROTOCOL_LR 8
+#define WIFI_FAST_SCAN 0
+typedef enum { WIFI_EVENT_SCAN_DONE, WIFI_EVENT_STA_START, WIFI_EVENT_STA_STOP, WIFI_EVENT_STA_CONNECTED, WIFI_EVENT_STA_DISCONNECTED } wifi_event_t;
+typedef enum { IP_EVENT_STA_GOT_IP, IP_EVENT_STA_LOST_IP } ip_event_t;
+typedef struct { uint8_t ssid[32]; uint8_t ssid_len; uint8_t bssid[6]; uint8_t channel; wifi_auth_mode_t authmode; } wifi_event_sta_connected_t;
+typedef struct { uint8_t ssid[32]; uint8_t ssid_len; uint8_t bssid[6]; uint8_t reason; } wifi_event_sta_disconnected_t;
+esp_err_t esp_wifi_init(const wifi_init_config_t*);
+esp_err_t esp_wifi_set_storage(wifi_storage_t);
+esp_err_t esp_wifi_set_mode(wifi_mode_t);
+esp_err_t esp_wifi_start(); esp_err_t esp_wifi_stop(); esp_err_t esp_wifi_connect(); esp_err_t esp_wifi_disconnect();
+esp_err_t esp_wifi_set_protocol(wifi_interface_t, uint8_t);
+esp_err_t esp_wifi_set_config(wifi_interface_t, wifi_config_t*);
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t*, bool);
+esp_err_t esp_wifi_scan_stop();
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t*);
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t*, wifi_ap_record_t*);
+esp_err_t esp_wifi_set_channel(uint8_t, wifi_second_chan_t);
+esp_err_t esp_wifi_get_channel(uint8_t*, wifi_second_chan_t*);
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t*);
+esp_err_t esp_wifi_set_max_tx_power(int8_t);
+esp_err_t esp_wifi_get_max_tx_power(int8_t*);
+esp_err_t esp_wifi_config_espnow_rate(wifi_interface_t, wifi_phy_rate_t);
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t);
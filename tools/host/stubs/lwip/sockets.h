@@ -0,0 +1,8 @@
+#pragma once
+#include "../esp_host.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <fcntl.h>
@@ -0,0 +1,9 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+typedef struct { uint32_t state[8]; uint64_t total; unsigned char buffer[64]; } mbedtls_sha256_context;
+void mbedtls_sha256_init(mbedtls_sha256_context*);
+void mbedtls_sha256_free(mbedtls_sha256_context*);
+int mbedtls_sha256_starts(mbedtls_sha256_context*, int);
+int mbedtls_sha256_update(mbedtls_sha256_context*, const unsigned char*, size_t);
+int mbedtls_sha256_finish(mbedtls_sha256_context*, unsigned char*);
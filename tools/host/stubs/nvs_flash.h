@@ -0,0 +1,11 @@
+#pragma once
+#include "esp_host.h"
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+esp_err_t nvs_flash_init(); esp_err_t nvs_flash_erase();
+esp_err_t nvs_open(const char*, nvs_open_mode_t, nvs_handle_t*);
+esp_err_t nvs_get_blob(nvs_handle_t, const char*, void*, size_t*);
+esp_err_t nvs_set_blob(nvs_handle_t, const char*, const void*, size_t);
+esp_err_t nvs_commit(nvs_handle_t);
+esp_err_t nvs_erase_key(nvs_handle_t, const char*);
+void nvs_close(nvs_handle_t);
@@ -0,0 +1,71 @@
+#pragma once
+
+// Configuration of the host builds. The transport, message format and
+// optional features are selected by each test target (see the Makefile).
+
+#define CONFIG_IOT_DEVICE_NAME            "dev1"
+#define CONFIG_IOT_TOPIC_NAME             "iot"
+#define CONFIG_IOT_LOG_WARN               1
+#define CONFIG_IOT_WATCHDOG_INTERVAL      86400
+#ifndef CONFIG_IOT_FSM_MACHINES
+  #define CONFIG_IOT_FSM_MACHINES         1
+#endif
+#define CONFIG_IOT_WAKE_MAX_DEADLINES     8
+#define CONFIG_IOT_WAKE_COALESCE          5
+#define CONFIG_IOT_WAKE_DEADLINE          500
+#define CONFIG_IOT_WAKE_RETRY_DELAY       300
+#define CONFIG_IOT_WIFI_STA_WPA2          1
+
+#ifdef CONFIG_IOT_ENABLE_UDP
+  #define CONFIG_IOT_UDP_PORT               3333
+  #define CONFIG_IOT_UDP_MAX_PKT_SIZE       250
+  #define CONFIG_IOT_GATEWAY_ADDRESS        "127.0.0.1"
+  #define CONFIG_IOT_WIFI_UDP_STA_SSID      "ssid"
+  #define CONFIG_IOT_WIFI_UDP_STA_PASS      "password"
+  #define CONFIG_IOT_WIFI_LEASE_REUSE_TIME  3600
+  #define CONFIG_IOT_UDP_DNS_CACHE_TTL      3600
+  #define CONFIG_IOT_UDP_FAILOVER_THRESHOLD 3
+#endif
+
+#ifdef CONFIG_IOT_ENABLE_ESP_NOW
+  #define CONFIG_IOT_ESPNOW_PMK             "pmk1234567890123"
+  #define CONFIG_IOT_ESPNOW_LMK             "lmk1234567890123"
+  #define CONFIG_IOT_GATEWAY_SSID_PREFIX    "ESP_GATEWAY"
+  #define CONFIG_IOT_CHANNEL                1
+  #define CONFIG_IOT_ESPNOW_MAX_PKT_SIZE    248
+  #define CONFIG_IOT_ESPNOW_SEND_WINDOW     8
+  #define CONFIG_IOT_ESPNOW_PROBE_TIME      30
+  #define CONFIG_IOT_ESPNOW_SCAN_CHANNELS   ""
+  #define CONFIG_IOT_ESPNOW_SCAN_TIME       60
+  #define CONFIG_IOT_ESPNOW_FAILOVER_THRESHOLD 3
+#endif
+
+#ifdef CONFIG_IOT_MSG_FRAGMENTATION
+  #define CONFIG_IOT_MSG_MAX_SIZE           1024
+#endif
+
+#ifdef CONFIG_IOT_DOWNLINK
+  #define CONFIG_IOT_DOWNLINK_WINDOW        50
+#endif
+
+#ifdef CONFIG_IOT_OTA
+  #define CONFIG_IOT_OTA_WINDOW             8
+  #define CONFIG_IOT_OTA_IDLE_TIMEOUT       300
+#endif
+
+#ifdef CONFIG_IOT_RUN_LOOP
+  #ifndef CONFIG_IOT_RUN_LOOP_MAX_IDLE
+    #define CONFIG_IOT_RUN_LOOP_MAX_IDLE    1000
+  #endif
+#endif
+
+#ifdef CONFIG_IOT_EVENT_CAPTURE
+  #define CONFIG_IOT_EVENT_QUEUE_SIZE       16
+  #define CONFIG_IOT_EVENT_DEBOUNCE         20
+#endif
+
+#ifdef CONFIG_IOT_MSG_STORE
+  #ifndef CONFIG_IOT_MSG_STORE_SIZE
+    #define CONFIG_IOT_MSG_STORE_SIZE       1024
+  #endif
+#endif
@@ -0,0 +1,3 @@
+#pragma once
+typedef enum { RTC_XTAL_FREQ_AUTO = 0, RTC_XTAL_FREQ_40M = 40 } rtc_xtal_freq_t;
+rtc_xtal_freq_t rtc_clk_xtal_freq_get(void);
@@ -0,0 +1,179 @@
+// Boot sequence of IoT::init() (src/iot.cpp) with the host Wifi emulation
+// (esp_host.cpp): the Wifi readiness is waited for on the IoT event group,
+// bounded by the wake deadline (CONFIG_IOT_WAKE_DEADLINE). When the Wifi
+// doesn't come up in time, the device goes to deep sleep.
+//
+// The boot steps (BootScheduler) are checked to run concurrently.
+//
+// Every case runs in its own process, from the state of a device waking up
+// from deep sleep, the deep sleep ending the process.
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "global.hpp"
+
+#include "esp_host.hpp"
+#include "host_test.hpp"
+
+static IoT::UserResult process(IoT::State state)
+{
+  return IoT::COMPLETED;
+}
+
+// The cached configuration, as retrieved before the deep sleep.
+static void setup_cfg()
+{
+  memset(&cfg, 0, sizeof(CFG));
+
+  cfg.log_level         = ESP_LOG_WARN;
+  cfg.watchdog_interval = CONFIG_IOT_WATCHDOG_INTERVAL;
+  strcpy(cfg.device_name,         CONFIG_IOT_DEVICE_NAME);
+  strcpy(cfg.topic_name,          CONFIG_IOT_TOPIC_NAME);
+  cfg.udp.port         = CONFIG_IOT_UDP_PORT;
+  cfg.udp.max_pkt_size = CONFIG_IOT_UDP_MAX_PKT_SIZE;
+  strcpy(cfg.udp.gateway_address, CONFIG_IOT_GATEWAY_ADDRESS);
+
+  cfg.crc = esp_crc16_le(UINT16_MAX, (const uint8_t *) &cfg, sizeof(CFG) - 2);
+}
+
+// Run **test** in a child process. Returns its number of failed checks.
+static int run(const char * name, void (* test)())
+{
+  pid_t pid = fork();
+
+  if (pid == 0) {
+    setup_cfg();
+    test();
+    printf("  %s: %d checks, %d failure(s)\n", name, test_checks, test_failures);
+    fflush(stdout);
+    _exit(std::min(test_failures, 100));
+  }
+
+  int status = -1;
+
+  waitpid(pid, &status, 0);
+
+  return (WIFEXITED(status)) ? WEXITSTATUS(status) : 100;
+}
+
+static int64_t boot_time;
+
+static int msec(int64_t time)
+{
+  return (int)((time - boot_time) / 1000);
+}
+
+static void not_expected(uint64_t time_in_us)
+{
+  printf("Unexpected deep sleep at %d msec.\n", msec(esp_timer_get_time()));
+  _exit(100);
+}
+
+// The Wifi gets its address after 150 msec: init() returns as soon as it is
+// ready, not at the next polling period.
+static void test_wifi_ready()
+{
+  esp_host_wifi_connect_ms = 150;
+  esp_host_deep_sleep_hook = not_expected;
+  boot_time                = esp_timer_get_time();
+
+  CHECK(iot.init(process) == ESP_OK);
+
+  int64_t end = esp_timer_get_time();
+
+  printf("  Wifi ready at %d msec, init() returned at %d msec.\n", msec(esp_host_wifi_ready_time), msec(end));
+
+  CHECK(esp_host_wifi_ready_time > 0);
+  CHECK(end - esp_host_wifi_ready_time < 50000);
+  CHECK((xEventGroupGetBits(iot.get_ready_events()) & (IoT::WIFI_READY | IoT::TRANSPORT_READY)) ==
+        (IoT::WIFI_READY | IoT::TRANSPORT_READY));
+  CHECK(iot.get_remaining_time_ms() <= CONFIG_IOT_WAKE_DEADLINE - 150);
+  CHECK(error_count == 0);
+}
+
+// The Wifi never gets its address: at the wake deadline, the failure is
+// counted, a retry is scheduled and the device goes to deep sleep.
+static void deadline_deep_sleep(uint64_t time_in_us)
+{
+  int64_t now = esp_timer_get_time();
+
+  printf("  Deep sleep at %d msec, for %llu sec.\n", msec(now), (unsigned long long)(time_in_us / 1000000));
+
+  // The remaining time is waited for in ticks.
+  CHECK(now - boot_time >= (CONFIG_IOT_WAKE_DEADLINE - portTICK_PERIOD_MS) * 1000);
+  CHECK(now - boot_time <  CONFIG_IOT_WAKE_DEADLINE * 1000 + 100000);
+  CHECK(error_count == 1);
+  CHECK(wake_scheduler.is_scheduled(WakeScheduler::RETRY_ID));
+  CHECK(time_in_us >= (uint64_t) CONFIG_IOT_WAKE_RETRY_DELAY * 1000000);
+  CHECK(time_in_us <= (uint64_t) CONFIG_IOT_WAKE_RETRY_DELAY * 3000000);
+
+  printf("  %s: %d checks, %d failure(s)\n", "wifi_never_ready", test_checks, test_failures);
+  fflush(stdout);
+  _exit(std::min(test_failures, 100));
+}
+
+static void test_wifi_never_ready()
+{
+  esp_host_wifi_connect_ms = -1;
+  esp_host_deep_sleep_hook = deadline_deep_sleep;
+  boot_time                = esp_timer_get_time();
+
+  iot.init(process);
+
+  printf("init() returned without deep sleep.\n");
+  CHECK(false);
+}
+
+// NVS initialization (100 msec), Wifi association (250 msec) and application
+// warm-up (200 msec): the Wifi is started as soon as the NVS is ready, the
+// warm-up runs meanwhile. The boot takes the NVS and Wifi time, not the sum.
+
+static const int NVS_MS     = 100;
+static const int CONNECT_MS = 250;
+static const int WARM_UP_MS = 200;
+
+static int64_t warm_up_start, warm_up_end;
+
+static esp_err_t warm_up()
+{
+  warm_up_start = esp_timer_get_time();
+  vTaskDelay(pdMS_TO_TICKS(WARM_UP_MS));
+  warm_up_end   = esp_timer_get_time();
+
+  return ESP_OK;
+}
+
+static void test_concurrent_steps()
+{
+  esp_host_nvs_init_ms     = NVS_MS;
+  esp_host_wifi_connect_ms = CONNECT_MS;
+  esp_host_deep_sleep_hook = not_expected;
+  boot_time                = esp_timer_get_time();
+
+  CHECK(iot.init(process, warm_up) == ESP_OK);
+
+  int64_t end = esp_timer_get_time();
+
+  printf("  NVS ready at %d msec, Wifi init at %d msec, ready at %d msec.\n",
+         msec(esp_host_nvs_ready_time), msec(esp_host_wifi_init_time), msec(esp_host_wifi_ready_time));
+  printf("  Warm-up from %d to %d msec.\n", msec(warm_up_start), msec(warm_up_end));
+  printf("  Boot completed in %d msec, %d msec in sequence.\n", msec(end), NVS_MS + CONNECT_MS + WARM_UP_MS);
+
+  CHECK(esp_host_wifi_init_time >= esp_host_nvs_ready_time);
+  CHECK(warm_up_start < esp_host_nvs_ready_time);
+  CHECK(warm_up_end   < esp_host_wifi_ready_time);
+  CHECK(end >= warm_up_end);
+  CHECK(end - boot_time < (NVS_MS + CONNECT_MS + 50) * 1000);
+  CHECK((xEventGroupGetBits(iot.get_ready_events()) & (IoT::NVS_READY | IoT::APP_READY | IoT::TRANSPORT_READY)) ==
+        (IoT::NVS_READY | IoT::APP_READY | IoT::TRANSPORT_READY));
+}
+
+int main()
+{
+  CHECK(run("wifi_ready",       test_wifi_ready)       == 0);
+  CHECK(run("wifi_never_ready", test_wifi_never_ready) == 0);
+  CHECK(run("concurrent_steps", test_concurrent_steps) == 0);
+
+  return TEST_RESULT("test_boot");
+}
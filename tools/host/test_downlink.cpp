@@ -0,0 +1,193 @@
+// Downlink command path (CONFIG_IOT_DOWNLINK): the lock-free ring
+// (include/spsc_ring.hpp), with a producer and a consumer thread, the frame
+// validation of downlink_push() (src/downlink.cpp), and the UDP receive path
+// of the framework (UDP::wait_downlink()), with a loopback gateway answering
+// an uplink frame with commands.
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "global.hpp"
+#include "downlink.hpp"
+
+#include "host_test.hpp"
+
+// Wrap around and full ring, in a single thread.
+static void test_ring()
+{
+  SPSCRing<uint32_t, 4> ring;
+  uint32_t              next_in = 0, next_out = 0;
+
+  CHECK(ring.is_empty() && ring.is_valid());
+  CHECK(ring.front() == nullptr);
+
+  for (int round = 0; round < 10; round++) {
+    while (ring.push(next_in)) next_in++;
+
+    CHECK(ring.size() == 4);
+    CHECK(ring.reserve() == nullptr);
+
+    // Leave one item in the ring, such that the indexes keep moving.
+    while (ring.size() > 1) {
+      CHECK(*ring.front() == next_out++);
+      ring.pop();
+    }
+  }
+
+  CHECK(ring.is_valid());
+  CHECK(next_in == 31);
+}
+
+// One producer and one consumer thread: every item is received once, in
+// order, without any lock.
+static void test_ring_threads()
+{
+  static SPSCRing<uint32_t, 8> ring;
+  constexpr uint32_t           COUNT = 1000000;
+
+  std::thread producer([] {
+    for (uint32_t i = 0; i < COUNT; i++) {
+      while (!ring.push(i)) std::this_thread::yield();
+    }
+  });
+
+  uint32_t expected = 0, errors = 0;
+
+  while (expected < COUNT) {
+    uint32_t * item = ring.front();
+
+    if (item == nullptr) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    if (*item != expected) errors++;
+    ring.pop();
+    expected++;
+  }
+
+  producer.join();
+
+  CHECK(errors == 0);
+  CHECK(ring.is_empty());
+}
+
+// crc + marker + command
+static std::vector<uint8_t> make_frame(const std::string & cmd, uint8_t marker = DOWNLINK_MARKER)
+{
+  std::vector<uint8_t> frame(DOWNLINK_HEADER_SIZE + cmd.size());
+
+  frame[2] = marker;
+  memcpy(&frame[DOWNLINK_HEADER_SIZE], cmd.data(), cmd.size());
+
+  uint16_t crc = esp_crc16_le(UINT16_MAX, &frame[2], frame.size() - 2);
+  memcpy(&frame[0], &crc, 2);
+
+  return frame;
+}
+
+static std::vector<std::string> commands;
+
+static void handler(const uint8_t * cmd, int len)
+{
+  commands.emplace_back((const char *) cmd, len);
+}
+
+static void test_push()
+{
+  DownlinkRing ring;
+
+  auto ok        = make_frame("reboot");
+  auto corrupted = make_frame("sleep:60");
+  auto marker    = make_frame("sleep:60", DOWNLINK_MARKER + 1);
+  auto longest   = make_frame(std::string(DOWNLINK_MAX_SIZE, 'c'));
+  auto too_long  = make_frame(std::string(DOWNLINK_MAX_SIZE + 1, 'c'));
+
+  corrupted[5] ^= 1;
+
+  CHECK(downlink_push(ring, ok.data(),        ok.size())            == ESP_OK);
+  CHECK(downlink_push(ring, corrupted.data(), corrupted.size())     == ESP_ERR_INVALID_CRC);
+  CHECK(downlink_push(ring, marker.data(),    marker.size())        == ESP_ERR_INVALID_CRC);
+  CHECK(downlink_push(ring, ok.data(),        DOWNLINK_HEADER_SIZE) == ESP_ERR_INVALID_SIZE);
+  CHECK(downlink_push(ring, too_long.data(),  too_long.size())      == ESP_ERR_INVALID_SIZE);
+  CHECK(downlink_push(ring, longest.data(),   longest.size())       == ESP_OK);
+
+  for (int i = 2; i < DOWNLINK_RING_SIZE; i++) {
+    auto frame = make_frame("cmd" + std::to_string(i));
+    CHECK(downlink_push(ring, frame.data(), frame.size()) == ESP_OK);
+  }
+
+  CHECK(downlink_push(ring, ok.data(), ok.size()) == ESP_ERR_NO_MEM);
+
+  commands.clear();
+  CHECK(downlink_dispatch(ring, handler) == DOWNLINK_RING_SIZE);
+  CHECK(commands.size() == DOWNLINK_RING_SIZE);
+  CHECK(commands[0] == "reboot");
+  CHECK(commands[1] == std::string(DOWNLINK_MAX_SIZE, 'c'));
+  CHECK(commands[2] == "cmd2");
+
+  // Without handler, the commands are dropped.
+  CHECK(downlink_push(ring, ok.data(), ok.size()) == ESP_OK);
+  CHECK(downlink_dispatch(ring, nullptr) == 1);
+  CHECK(ring.is_empty());
+}
+
+// The gateway answers the first uplink frame with an invalid and a valid
+// command frame, to the address and port the frame came from.
+static void test_udp()
+{
+  sockaddr_in addr = {};
+  socklen_t   len  = sizeof(addr);
+
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int gw_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+  CHECK(bind(gw_sock, (sockaddr *) &addr, sizeof(addr)) == 0);
+  CHECK(getsockname(gw_sock, (sockaddr *) &addr, &len) == 0);
+
+  cfg.udp.port         = ntohs(addr.sin_port);
+  cfg.udp.max_pkt_size = CONFIG_IOT_UDP_MAX_PKT_SIZE;
+  strcpy(cfg.udp.gateway_address, CONFIG_IOT_GATEWAY_ADDRESS);
+
+  CHECK(udp.init() == ESP_OK);
+  CHECK(!udp.has_command());
+
+  uint8_t * data = udp.get_send_buffer();
+  memcpy(data, "uplink", 6);
+  CHECK(udp.send(data, 6) == ESP_OK);
+
+  uint8_t     buff[1500];
+  sockaddr_in device;
+  len = sizeof(device);
+  CHECK(recvfrom(gw_sock, buff, sizeof(buff), 0, (sockaddr *) &device, &len) == 8);
+
+  auto bad = make_frame("bad");
+  auto cmd = make_frame("led:on");
+  bad[3] ^= 1;
+
+  sendto(gw_sock, bad.data(), bad.size(), 0, (sockaddr *) &device, sizeof(device));
+  sendto(gw_sock, cmd.data(), cmd.size(), 0, (sockaddr *) &device, sizeof(device));
+
+  udp.wait_downlink(500);
+
+  CHECK(udp.has_command());
+
+  commands.clear();
+  CHECK(udp.process_commands(handler) == 1);
+  CHECK((commands.size() == 1) && (commands[0] == "led:on"));
+
+  close(gw_sock);
+}
+
+int main()
+{
+  test_ring();
+  test_ring_threads();
+  test_push();
+  test_udp();
+
+  return TEST_RESULT("test_downlink");
+}
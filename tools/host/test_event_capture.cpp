@@ -0,0 +1,203 @@
+// Event capture (src/event_capture.cpp) with the host GPIO (esp_host.cpp):
+// the pull mode given to add_pin() applied on every arming and kept in deep
+// sleep, and the event times given in the system time of the delivery, the
+// clock being set (SNTP) after the capture, or the esp_timer being restarted
+// by a deep sleep.
+//
+// The system time is given by the test: gettimeofday() is replaced, as the
+// RTC time of the device. Moving the system time against the esp_timer time
+// between prepare_for_deep_sleep() and init() stands for the esp_timer
+// restart of a deep sleep.
+
+#include <thread>
+#include <vector>
+#include <sys/time.h>
+
+#include "global.hpp"
+
+#include "esp_host.hpp"
+#include "host_test.hpp"
+
+static constexpr int64_t SNTP_TIME = 1700000000LL * 1000000;   // usec
+static constexpr int     EDGE_MS   = CONFIG_IOT_EVENT_DEBOUNCE + 10;
+static constexpr int64_t SLACK_US  = 1000;
+
+// System time minus esp_timer time.
+static int64_t clock_base = 0;
+
+extern "C" int gettimeofday(struct timeval * __restrict tv, void * __restrict tz) noexcept
+{
+  int64_t now = esp_timer_get_time() + clock_base;
+
+  tv->tv_sec  = now / 1000000;
+  tv->tv_usec = now % 1000000;
+
+  return 0;
+}
+
+static std::vector<EventCapture::Event> events;
+static std::vector<uint32_t>            latencies;
+
+static void handler(const EventCapture::Event & event, uint32_t latency_us)
+{
+  events.push_back(event);
+  latencies.push_back(latency_us);
+}
+
+static void deliver()
+{
+  events.clear();
+  latencies.clear();
+  event_capture.deliver(handler);
+}
+
+// An edge, after the debounce time of the previous one. Returns its
+// esp_timer time.
+static int64_t edge(gpio_num_t pin, int level)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(EDGE_MS));
+
+  int64_t time = esp_timer_get_time();
+
+  esp_host_gpio_set_level(pin, level);
+
+  return time;
+}
+
+static bool near(int64_t time, int64_t expected)
+{
+  return (time > expected - SLACK_US) && (time < expected + SLACK_US);
+}
+
+static bool pulls(gpio_num_t pin, gpio_pullup_t up, gpio_pulldown_t down)
+{
+  const gpio_config_t & config = esp_host_pins[pin].config;
+
+  return (config.pull_up_en == up) && (config.pull_down_en == down) && (config.intr_type == GPIO_INTR_ANYEDGE);
+}
+
+// The pull modes, set again on wake up, and the RTC peripherals kept on in
+// deep sleep for them.
+static void test_pulls()
+{
+  CHECK(event_capture.add_pin(GPIO_NUM_2) == ESP_OK);
+  CHECK(pulls(GPIO_NUM_2, GPIO_PULLUP_DISABLE, GPIO_PULLDOWN_DISABLE));
+
+  event_capture.prepare_for_deep_sleep();
+  CHECK(esp_host_rtc_periph_pd == ESP_PD_OPTION_AUTO);
+
+  CHECK(event_capture.add_pin(GPIO_NUM_4,  GPIO_PULLUP_ONLY)   == ESP_OK);
+  CHECK(event_capture.add_pin(GPIO_NUM_15, GPIO_PULLDOWN_ONLY) == ESP_OK);
+  CHECK(pulls(GPIO_NUM_4,  GPIO_PULLUP_ENABLE,  GPIO_PULLDOWN_DISABLE));
+  CHECK(pulls(GPIO_NUM_15, GPIO_PULLUP_DISABLE, GPIO_PULLDOWN_ENABLE));
+
+  event_capture.prepare_for_deep_sleep();
+  CHECK(esp_host_rtc_periph_pd == ESP_PD_OPTION_ON);
+
+  // The GPIO configuration is lost in deep sleep.
+  for (auto & p : esp_host_pins) memset(&p.config, 0, sizeof(p.config));
+
+  CHECK(event_capture.init() == ESP_OK);
+  CHECK(pulls(GPIO_NUM_2,  GPIO_PULLUP_DISABLE, GPIO_PULLDOWN_DISABLE));
+  CHECK(pulls(GPIO_NUM_4,  GPIO_PULLUP_ENABLE,  GPIO_PULLDOWN_DISABLE));
+  CHECK(pulls(GPIO_NUM_15, GPIO_PULLUP_DISABLE, GPIO_PULLDOWN_ENABLE));
+}
+
+// An edge captured before the system time is set, delivered after.
+static void test_clock_set()
+{
+  clock_base = 0;
+
+  int64_t captured = edge(GPIO_NUM_4, 1);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(EDGE_MS));
+
+  clock_base = SNTP_TIME;
+
+  deliver();
+
+  CHECK(events.size() == 1);
+
+  if (events.size() == 1) {
+    printf("Clock set: event at %lld usec, latency %u usec.\n", (long long) (events[0].time - SNTP_TIME), latencies[0]);
+
+    CHECK(events[0].pin   == GPIO_NUM_4);
+    CHECK(events[0].level == 1);
+    CHECK(!events[0].wake_up);
+    CHECK(near(events[0].time, SNTP_TIME + captured));
+    CHECK(latencies[0] >= EDGE_MS * 1000);
+  }
+}
+
+// An edge captured before deep sleep, delivered after, and a level changed
+// during sleep: the first one keeps its system time, the second one has the
+// boot time.
+static void test_deep_sleep()
+{
+  int64_t captured = edge(GPIO_NUM_2, 1);
+  int64_t system   = clock_base + captured;
+
+  event_capture.prepare_for_deep_sleep();
+
+  // Asleep for 10 sec: the system time went on, the esp_timer restarts.
+  esp_host_pins[GPIO_NUM_15].level = 1;
+  clock_base += 10000000 + esp_timer_get_time();
+
+  int64_t boot = clock_base;
+
+  CHECK(event_capture.init() == ESP_OK);
+
+  deliver();
+
+  CHECK(events.size() == 2);
+
+  if (events.size() == 2) {
+    CHECK((events[0].pin == GPIO_NUM_2) && !events[0].wake_up);
+    CHECK(near(events[0].time, system));
+    CHECK(latencies[0] >= 10000000);
+
+    CHECK((events[1].pin == GPIO_NUM_15) && events[1].wake_up);
+    CHECK(near(events[1].time, boot));
+  }
+
+  CHECK(event_capture.get_stats().count == 3);
+  CHECK(event_capture.get_stats().dropped == 0);
+}
+
+// The configuration, as cached in RTC memory.
+static void set_config()
+{
+  memset(&cfg, 0, sizeof(CFG));
+
+  cfg.log_level         = ESP_LOG_WARN;
+  cfg.watchdog_interval = CONFIG_IOT_WATCHDOG_INTERVAL;
+  strcpy(cfg.device_name,         CONFIG_IOT_DEVICE_NAME);
+  strcpy(cfg.topic_name,          CONFIG_IOT_TOPIC_NAME);
+  cfg.udp.port         = CONFIG_IOT_UDP_PORT;
+  cfg.udp.max_pkt_size = CONFIG_IOT_UDP_MAX_PKT_SIZE;
+  strcpy(cfg.udp.gateway_address, CONFIG_IOT_GATEWAY_ADDRESS);
+
+  cfg.crc = esp_crc16_le(UINT16_MAX, (const uint8_t *) &cfg, sizeof(CFG) - 2);
+}
+
+static IoT::UserResult process_handler(IoT::State state)
+{
+  return IoT::COMPLETED;
+}
+
+int main()
+{
+  set_config();
+
+  esp_host_wifi_connect_ms = 0;
+
+  // Woken up from deep sleep (esp_reset_reason() on the host), with the event
+  // queue lost: the pins are added again.
+  CHECK(iot.init(process_handler) == ESP_OK);
+
+  test_pulls();
+  test_clock_set();
+  test_deep_sleep();
+
+  return TEST_RESULT("test_event_capture");
+}
@@ -0,0 +1,228 @@
+// State machines of IoT::process() (src/iot.cpp), resolved through the
+// FsmTable (include/fsm.hpp), against the switch statement they replaced,
+// kept here as the reference. Several machines are driven with random user
+// results, the watchdog being due at random times: after every process()
+// call, the state of every machine and the STARTUP and WATCHDOG messages
+// sent to the gateway are checked.
+//
+// With several machines, the STARTUP and WATCHDOG messages are sent once for
+// all of them, and a single machine goes through the WATCHDOG state.
+
+#include <random>
+#include <string>
+
+#include "global.hpp"
+
+#include "esp_host.hpp"
+#include "host_test.hpp"
+
+// Set when the watchdog deadline fires (src/iot.cpp).
+extern bool watchdog_pending;
+
+static constexpr int MACHINES = CONFIG_IOT_FSM_MACHINES;
+static constexpr int STEPS    = 20000;
+
+struct RefMachine {
+  IoT::State state        = IoT::STARTUP;
+  IoT::State return_state = IoT::STARTUP;
+};
+
+// The switch of IoT::process() before the table. check_if_24_hours_time()
+// is **watchdog** (the watchdog is due, and no other machine took it).
+static void reference(RefMachine & m, IoT::UserResult result, bool & watchdog)
+{
+  IoT::State new_state        = m.state;
+  IoT::State new_return_state = m.return_state;
+
+  auto check_if_24_hours_time = [&](IoT::State state) {
+    if (!watchdog) return state;
+    watchdog = false;
+    return IoT::WATCHDOG;
+  };
+
+  switch (m.state) {
+    case IoT::STARTUP:
+      if (result != IoT::NOT_COMPLETED) {
+        new_state        = IoT::WAIT_FOR_EVENT;
+        new_return_state = IoT::WAIT_FOR_EVENT;
+      }
+      break;
+
+    case IoT::WATCHDOG:
+      new_state = new_return_state;
+      break;
+
+    case IoT::WAIT_FOR_EVENT:
+      if (result == IoT::NEW_EVENT) {
+        new_state        = IoT::PROCESS_EVENT;
+        new_return_state = IoT::PROCESS_EVENT;
+      }
+      else {
+        new_return_state = IoT::WAIT_FOR_EVENT;
+        new_state        = check_if_24_hours_time(IoT::WAIT_FOR_EVENT);
+      }
+      break;
+
+    case IoT::PROCESS_EVENT:
+      if (result == IoT::ABORTED) {
+        new_state = new_return_state = IoT::WAIT_FOR_EVENT;
+      }
+      else if (result != IoT::NOT_COMPLETED) {
+        new_state = new_return_state = IoT::WAIT_END_EVENT;
+      }
+      else {
+        new_return_state = IoT::PROCESS_EVENT;
+        new_state        = check_if_24_hours_time(IoT::PROCESS_EVENT);
+      }
+      break;
+
+    case IoT::WAIT_END_EVENT:
+      if (result == IoT::RETRY) {
+        new_state = new_return_state = IoT::PROCESS_EVENT;
+      }
+      else if (result != IoT::NOT_COMPLETED) {
+        new_state = new_return_state = IoT::END_EVENT;
+      }
+      else {
+        new_return_state = IoT::WAIT_END_EVENT;
+        new_state        = check_if_24_hours_time(IoT::WAIT_END_EVENT);
+      }
+      break;
+
+    case IoT::END_EVENT:
+      if (result != IoT::NOT_COMPLETED) {
+        new_state = new_return_state = IoT::WAIT_FOR_EVENT;
+      }
+      break;
+  }
+
+  m.state        = new_state;
+  m.return_state = new_return_state;
+}
+
+static IoT::UserResult results[MACHINES];
+static IoT::State      seen[MACHINES];
+
+template <int I>
+static IoT::UserResult handler(IoT::State state)
+{
+  seen[I] = state;
+  return results[I];
+}
+
+template <int... I>
+static esp_err_t init_machines(std::integer_sequence<int, I...>)
+{
+  static IoT::ProcessHandler * const handlers[] = { handler<I>... };
+  return iot.init(handlers);
+}
+
+static int sink = -1;
+
+// The gateway: a loopback socket receiving the messages.
+static void open_gateway()
+{
+  sockaddr_in addr = {};
+  socklen_t   len  = sizeof(addr);
+
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  sink = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+  CHECK(bind(sink, (sockaddr *) &addr, sizeof(addr)) == 0);
+  CHECK(getsockname(sink, (sockaddr *) &addr, &len) == 0);
+
+  memset(&cfg, 0, sizeof(CFG));
+
+  cfg.log_level         = ESP_LOG_WARN;
+  cfg.watchdog_interval = CONFIG_IOT_WATCHDOG_INTERVAL;
+  strcpy(cfg.device_name,         CONFIG_IOT_DEVICE_NAME);
+  strcpy(cfg.topic_name,          CONFIG_IOT_TOPIC_NAME);
+  cfg.udp.port         = ntohs(addr.sin_port);
+  cfg.udp.max_pkt_size = CONFIG_IOT_UDP_MAX_PKT_SIZE;
+  strcpy(cfg.udp.gateway_address, CONFIG_IOT_GATEWAY_ADDRESS);
+
+  cfg.crc = esp_crc16_le(UINT16_MAX, (const uint8_t *) &cfg, sizeof(CFG) - 2);
+}
+
+// Number of messages of **type** received since the last call.
+static void count_msgs(int & startup, int & watchdog)
+{
+  char buff[1500];
+  int  len;
+
+  startup = watchdog = 0;
+
+  while ((len = recv(sink, buff, sizeof(buff) - 1, MSG_DONTWAIT)) > 0) {
+    std::string msg(buff + 2, len - 2);
+
+    if (msg.find("type:STARTUP")  != std::string::npos) startup++;
+    if (msg.find("type:WATCHDOG") != std::string::npos) watchdog++;
+  }
+}
+
+static void test_machines()
+{
+  std::mt19937 rng(1);
+  RefMachine   ref[MACHINES];
+  int          errors = 0, watchdogs = 0;
+
+  open_gateway();
+
+  esp_host_wifi_connect_ms = 0;
+
+  CHECK(init_machines(std::make_integer_sequence<int, MACHINES>()) == ESP_OK);
+
+  // No deep sleep: process() returns after every step.
+  iot.set_deep_sleep_duration(-1);
+
+  for (int step = 0; step < STEPS; step++) {
+    bool any_startup  = false;
+    bool any_watchdog = false;
+
+    for (int i = 0; i < MACHINES; i++) {
+      // NOT_COMPLETED more often, such that the machines stay in every state.
+      results[i]    = (IoT::UserResult) ((rng() % 3 == 0) ? (uint32_t) IoT::NOT_COMPLETED : 1 + rng() % 5);
+      any_startup  |= ref[i].state == IoT::STARTUP;
+      any_watchdog |= ref[i].state == IoT::WATCHDOG;
+    }
+
+    // The watchdog message being due, as set by the wake scheduler.
+    if (rng() % 50 == 0) watchdog_pending = true;
+
+    bool due = watchdog_pending && !any_watchdog;
+
+    iot.process();
+
+    for (int i = 0; i < MACHINES; i++) {
+      if (seen[i] != ref[i].state) errors++;
+      reference(ref[i], results[i], due);
+      if (iot.get_state(i) != ref[i].state) errors++;
+      if (ref[i].state == IoT::WATCHDOG) watchdogs++;
+    }
+
+    int startup_msgs, watchdog_msgs;
+
+    count_msgs(startup_msgs, watchdog_msgs);
+
+    if (startup_msgs  != (any_startup  ? 1 : 0)) errors++;
+    if (watchdog_msgs != (any_watchdog ? 1 : 0)) errors++;
+
+    if (errors > 0) {
+      printf("Step %d: first difference with the reference.\n", step);
+      break;
+    }
+  }
+
+  printf("%d machines, %d steps, %d watchdog transitions.\n", MACHINES, STEPS, watchdogs);
+
+  CHECK(errors == 0);
+  CHECK(watchdogs > 0);
+}
+
+int main()
+{
+  test_machines();
+
+  return TEST_RESULT("test_fsm");
+}
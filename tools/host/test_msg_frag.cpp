@@ -0,0 +1,216 @@
+// Tests of the message fragmentation (include/msg_frag.hpp): fragments
+// built by Fragmenter and given to FragReassembler in order, out of order,
+// duplicated, with losses and with corrupted content. The fragments are also
+// compared with the ones built by tools/iot_proto.py fragment().
+
+#include <cstring>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "msg_frag.hpp"
+#include "host_test.hpp"
+
+typedef std::vector<uint8_t>  Frame;
+typedef FragReassembler::Result Result;
+
+static std::vector<Frame> fragment(const std::vector<uint8_t> & msg, int max_frame_size, uint16_t id)
+{
+  Fragmenter         fragmenter(msg.data(), msg.size(), max_frame_size, id);
+  std::vector<Frame> frames;
+  uint8_t            frame[1500];
+  int                len;
+
+  while ((len = fragmenter.next(frame)) > 0) frames.emplace_back(frame, frame + len);
+
+  return frames;
+}
+
+static std::vector<uint8_t> message(size_t len, uint32_t seed)
+{
+  std::mt19937         rng(seed);
+  std::vector<uint8_t> msg(len);
+
+  for (auto & b : msg) b = rng();
+
+  return msg;
+}
+
+static bool same(FragReassembler & r, const std::vector<uint8_t> & msg)
+{
+  return (r.get_length() == msg.size()) && (memcmp(r.get_data(), msg.data(), msg.size()) == 0);
+}
+
+// iot_proto.fragment(bytes(range(40)), 25, 7)
+static void test_vector()
+{
+  static const char * VECTOR[] = {
+    "f5070000032800baf7000102030405060708090a0b0c0d",
+    "f5070001032800baf70e0f101112131415161718191a1b",
+    "f5070002032800baf71c1d1e1f2021222324252627"
+  };
+
+  std::vector<uint8_t> msg(40);
+  for (int i = 0; i < 40; i++) msg[i] = i;
+
+  auto frames = fragment(msg, 25, 7);
+
+  CHECK(frames.size() == 3);
+
+  for (size_t i = 0; i < frames.size() && i < 3; i++) {
+    std::string hex;
+    char        digits[3];
+
+    for (auto b : frames[i]) {
+      snprintf(digits, sizeof(digits), "%02x", b);
+      hex += digits;
+    }
+
+    CHECK(hex == VECTOR[i]);
+  }
+}
+
+static void test_sizes()
+{
+  static uint8_t buff[8192];
+
+  for (size_t len : { 1, 239, 240, 241, 1000, 4096, 8192 }) {
+    auto            msg    = message(len, len);
+    auto            frames = fragment(msg, 248, len);
+    FragReassembler reassembler(buff, sizeof(buff));
+
+    CHECK(frames.size() == (len + 238) / 239);
+
+    for (size_t i = 0; i < frames.size(); i++) {
+      CHECK(frames[i].size() <= 248);
+      Result res = reassembler.add(frames[i].data(), frames[i].size());
+      CHECK(res == ((i + 1 < frames.size()) ? Result::INCOMPLETE : Result::COMPLETE));
+    }
+
+    CHECK(same(reassembler, msg));
+  }
+
+  // More than FRAG_MAX_COUNT fragments.
+  auto       msg = message(2000, 1);
+  Fragmenter fragmenter(msg.data(), msg.size(), sizeof(FragHeader) + 7, 1);
+
+  CHECK(!fragmenter.is_valid());
+}
+
+static void test_reordering()
+{
+  static uint8_t buff[4096];
+
+  std::mt19937 rng(3);
+  auto         msg = message(3000, 2);
+
+  for (int round = 0; round < 100; round++) {
+    auto            frames = fragment(msg, 248, round);
+    FragReassembler reassembler(buff, sizeof(buff));
+    int             complete = 0;
+
+    std::shuffle(frames.begin(), frames.end(), rng);
+
+    for (auto & f : frames) {
+      if (reassembler.add(f.data(), f.size()) == Result::COMPLETE) complete++;
+    }
+
+    CHECK(complete == 1);
+    CHECK(same(reassembler, msg));
+  }
+}
+
+static void test_duplicates()
+{
+  static uint8_t buff[4096];
+
+  auto            msg    = message(1000, 4);
+  auto            frames = fragment(msg, 248, 9);
+  FragReassembler reassembler(buff, sizeof(buff));
+
+  // Every fragment but the last one twice: the duplicates are reported,
+  // and don't count towards the completion.
+  for (size_t i = 0; i + 1 < frames.size(); i++) {
+    CHECK(reassembler.add(frames[i].data(), frames[i].size()) == Result::INCOMPLETE);
+    CHECK(reassembler.add(frames[i].data(), frames[i].size()) == Result::DUPLICATE);
+  }
+
+  CHECK(reassembler.add(frames.back().data(), frames.back().size()) == Result::COMPLETE);
+  CHECK(same(reassembler, msg));
+  CHECK(reassembler.get_abandoned_count() == 0);
+}
+
+static void test_loss()
+{
+  static uint8_t buff[4096];
+
+  auto            first  = message(1000, 5);
+  auto            second = message(700, 6);
+  auto            frames = fragment(first, 248, 10);
+  FragReassembler reassembler(buff, sizeof(buff));
+
+  // A lost fragment: the message never completes, and is abandoned when
+  // the fragments of the next message arrive.
+  for (size_t i = 0; i < frames.size(); i++) {
+    if (i == 2) continue;
+    CHECK(reassembler.add(frames[i].data(), frames[i].size()) == Result::INCOMPLETE);
+  }
+
+  Result res = Result::INVALID;
+  for (auto & f : fragment(second, 248, 11)) res = reassembler.add(f.data(), f.size());
+
+  CHECK(res == Result::COMPLETE);
+  CHECK(same(reassembler, second));
+  CHECK(reassembler.get_abandoned_count() == 1);
+}
+
+static void test_corruption()
+{
+  static uint8_t buff[4096];
+
+  auto            msg    = message(1000, 7);
+  auto            frames = fragment(msg, 248, 12);
+  FragReassembler reassembler(buff, sizeof(buff));
+
+  frames[1][sizeof(FragHeader) + 5] ^= 0x01;
+
+  Result res = Result::INVALID;
+  for (auto & f : frames) res = reassembler.add(f.data(), f.size());
+
+  CHECK(res == Result::CRC_ERROR);
+
+  // Inconsistent headers.
+  frames = fragment(msg, 248, 13);
+
+  Frame marker = frames[0];
+  marker[0] = 0;
+  CHECK(reassembler.add(marker.data(), marker.size()) == Result::INVALID);
+
+  Frame index = frames[0];
+  index[offsetof(FragHeader, index)] = index[offsetof(FragHeader, count)];
+  CHECK(reassembler.add(index.data(), index.size()) == Result::INVALID);
+
+  Frame shorter(frames[0].begin(), frames[0].end() - 1);
+  CHECK(reassembler.add(shorter.data(), shorter.size()) == Result::INVALID);
+
+  CHECK(reassembler.add(frames[0].data(), sizeof(FragHeader)) == Result::INVALID);
+
+  // Message larger than the reassembly buffer.
+  uint8_t         small[500];
+  FragReassembler limited(small, sizeof(small));
+
+  CHECK(limited.add(frames[0].data(), frames[0].size()) == Result::INVALID);
+}
+
+int main()
+{
+  test_vector();
+  test_sizes();
+  test_reordering();
+  test_duplicates();
+  test_loss();
+  test_corruption();
+
+  return TEST_RESULT("test_msg_frag");
+}
@@ -0,0 +1,192 @@
+// Store-and-forward ring (src/msg_store.cpp) against a list of the messages:
+// random pushes and pops, wrapping around the RTC buffer, with the oldest
+// messages evicted and counted when full. Then the corruptions of the RTC
+// memory: header CRC, record length and record CRC, and a record too large
+// for the reader. The counters are cleared by a reset, the messages are
+// kept.
+
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "global.hpp"
+
+#include "host_test.hpp"
+
+// The store in RTC memory (src/msg_store.cpp).
+extern MsgStore::Header store_hdr;
+extern uint8_t          store_data[MsgStore::SIZE];
+
+static constexpr int REC_HEADER = 4;   // MsgStore::RecordHeader
+static constexpr int MAX_LEN    = 100;
+static constexpr int STEPS      = 20000;
+
+typedef std::vector<uint8_t> Msg;
+
+static Msg random_msg(std::mt19937 & rng)
+{
+  Msg msg(1 + rng() % MAX_LEN);
+
+  for (auto & b : msg) b = rng();
+
+  return msg;
+}
+
+static int used(const std::deque<Msg> & ref)
+{
+  int total = 0;
+
+  for (auto & m : ref) total += REC_HEADER + m.size();
+
+  return total;
+}
+
+static bool peek_is(const Msg & expected)
+{
+  uint8_t buff[MAX_LEN];
+  int     len = msg_store.peek(buff, sizeof(buff));
+
+  return (len == (int) expected.size()) && (memcmp(buff, expected.data(), len) == 0);
+}
+
+// FIFO order and eviction, the ring wrapping around many times.
+static void test_ring()
+{
+  std::mt19937    rng(1);
+  std::deque<Msg> ref;
+  uint32_t        evicted = 0, forwarded = 0;
+  int             errors  = 0, max_count = 0;
+
+  CHECK(msg_store.init(true) == ESP_OK);
+
+  for (int step = 0; step < STEPS; step++) {
+    if (rng() % 3 != 0) {
+      Msg msg = random_msg(rng);
+
+      while (used(ref) + REC_HEADER + (int) msg.size() > MsgStore::SIZE) {
+        ref.pop_front();
+        evicted++;
+      }
+
+      if (msg_store.push(msg.data(), msg.size()) != ESP_OK) errors++;
+      ref.push_back(msg);
+    }
+    else if (!ref.empty()) {
+      if (!peek_is(ref.front())) errors++;
+      msg_store.pop();
+      ref.pop_front();
+      forwarded++;
+    }
+    else {
+      uint8_t buff[MAX_LEN];
+      if (msg_store.peek(buff, sizeof(buff)) != 0) errors++;
+    }
+
+    if ((msg_store.get_count() != (int) ref.size()) || (msg_store.get_evicted_count() != evicted)) errors++;
+
+    max_count = std::max(max_count, (int) ref.size());
+
+    if (errors > 0) {
+      printf("Step %d: first difference with the reference.\n", step);
+      break;
+    }
+  }
+
+  printf("%d steps, up to %d messages, %u evicted, %u forwarded.\n", STEPS, max_count, evicted, forwarded);
+
+  CHECK(errors == 0);
+  CHECK(evicted > 0);
+  CHECK(msg_store.get_forwarded_count() == forwarded);
+  CHECK(store_hdr.stored_count == evicted + forwarded + ref.size());
+
+  // Kept through a deep sleep, counters included.
+  CHECK(msg_store.init(false) == ESP_OK);
+  CHECK(msg_store.get_count() == (int) ref.size());
+  CHECK(msg_store.get_evicted_count() == evicted);
+
+  // Kept through a reset, counters cleared.
+  CHECK(msg_store.init(true) == ESP_OK);
+  CHECK(msg_store.get_count() == (int) ref.size());
+  CHECK(msg_store.get_evicted_count() == 0);
+  CHECK(msg_store.get_forwarded_count() == 0);
+  CHECK(store_hdr.stored_count == 0);
+
+  while (!ref.empty()) {
+    CHECK(peek_is(ref.front()));
+    msg_store.pop();
+    ref.pop_front();
+  }
+
+  CHECK(msg_store.is_empty());
+}
+
+// Three messages stored, from an empty store, the first record at offset 0.
+static void fill(const Msg & a, const Msg & b, const Msg & c)
+{
+  store_hdr.magic = 0;
+  CHECK(msg_store.init(true) == ESP_OK);
+  CHECK(msg_store.is_empty() && (store_hdr.head == 0));
+
+  for (auto * m : { &a, &b, &c }) CHECK(msg_store.push(m->data(), m->size()) == ESP_OK);
+}
+
+static void test_corruption()
+{
+  std::mt19937 rng(2);
+  uint8_t      buff[MAX_LEN];
+  Msg          a = random_msg(rng), b = random_msg(rng), c = random_msg(rng);
+
+  // Header CRC: the store is emptied.
+  fill(a, b, c);
+  store_hdr.count ^= 1;
+  CHECK(msg_store.init(false) == ESP_OK);
+  CHECK(msg_store.is_empty());
+
+  // Record CRC: the store is emptied.
+  fill(a, b, c);
+  store_data[REC_HEADER + a.size() + REC_HEADER] ^= 0x10;
+  CHECK(peek_is(a));
+  msg_store.pop();
+  CHECK(msg_store.peek(buff, sizeof(buff)) == -1);
+  CHECK(msg_store.is_empty());
+
+  // Record length beyond the data stored: the store is emptied.
+  fill(a, b, c);
+  store_data[0] = 0xFF;
+  store_data[1] = 0x0F;
+  CHECK(msg_store.peek(buff, sizeof(buff)) == -1);
+  CHECK(msg_store.is_empty());
+
+  // Record larger than the reader buffer: only this one is evicted.
+  Msg large(MAX_LEN, 0x55);
+
+  fill(a, large, c);
+  CHECK(peek_is(a));
+  msg_store.pop();
+  CHECK(msg_store.peek(buff, MAX_LEN - 1) == -1);
+  CHECK(msg_store.get_count() == 1);
+  CHECK(msg_store.get_evicted_count() == 1);
+  CHECK(peek_is(c));
+  msg_store.pop();
+  CHECK(msg_store.is_empty());
+
+  // The header CRC was kept up to date.
+  CHECK(msg_store.init(false) == ESP_OK);
+  CHECK(msg_store.get_evicted_count() == 1);
+}
+
+int main()
+{
+  // Without the eviction warnings.
+  esp_log_level_set("*", ESP_LOG_ERROR);
+
+  // After a power on: garbage in RTC memory.
+  memset(&store_hdr, 0xA5, sizeof(store_hdr));
+  CHECK(msg_store.init(true) == ESP_OK);
+  CHECK(msg_store.is_empty());
+
+  test_ring();
+  test_corruption();
+
+  return TEST_RESULT("test_msg_store");
+}
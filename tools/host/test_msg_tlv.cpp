@@ -0,0 +1,281 @@
+// Round trip tests of the binary message format (include/msg_tlv.hpp):
+// TLVEncoder output decoded by TLVDecoder, and compared with the frame
+// built by tools/iot_proto.py encode_tlv() for the same message (the same
+// vector is checked by tools/test_iot_proto.py).
+
+#include <cstring>
+#include <string>
+
+#include "msg_tlv.hpp"
+#include "host_test.hpp"
+
+static const uint8_t MAC[6] = { 0x24, 0x6F, 0x28, 0x0A, 0x1B, 0x2C };
+static const uint8_t IP[4]  = { 192, 168, 1, 23 };
+
+// iot_proto.encode_tlv(dict(topic="iot", name="dev1", type="STATE", seq=300,
+//   dur=1234, mac="24:6f:28:0a:1b:2c", err=0, rssi=-67, st=4, rst=2,
+//   heap=123456, other="state:HIGH", vbat=3.3, drop=2, ip="192.168.1.23"))
+static const char * VECTOR =
+  "b10103696f740204646576310305535441544504022c010502d2040606246f280a1b2c"
+  "0701000801bd0901040a01020b0340e2010c0a73746174653a484947480d024a010f01"
+  "020e04c0a80117";
+
+// Same field sequence as IoT::encode_msg().
+static size_t encode(uint8_t * buff, size_t size, bool & truncated)
+{
+  TLVEncoder enc(buff, size);
+
+  enc.str(TLV_TOPIC, "iot")
+     .str(TLV_NAME,  "dev1")
+     .str(TLV_TYPE,  "STATE")
+     .u32(TLV_SEQ,   300)
+     .u32(TLV_DUR,   1234)
+     .bytes(TLV_MAC, MAC, sizeof(MAC))
+     .u32(TLV_ERR,   0)
+     .i8(TLV_RSSI,   -67)
+     .u32(TLV_ST,    4)
+     .u32(TLV_RST,   2)
+     .u32(TLV_HEAP,  123456)
+     .str(TLV_OTHER, "state:HIGH")
+     .u32(TLV_VBAT,  330)
+     .u32(TLV_DROP,  2)
+     .bytes(TLV_IP,  IP, sizeof(IP));
+
+  truncated = enc.is_truncated();
+
+  return enc.get_length();
+}
+
+static std::string hex(const uint8_t * data, size_t len)
+{
+  std::string out;
+  char        digits[3];
+
+  for (size_t i = 0; i < len; i++) {
+    snprintf(digits, sizeof(digits), "%02x", data[i]);
+    out += digits;
+  }
+
+  return out;
+}
+
+static std::string as_str(const TLVDecoder::Field & f)
+{
+  return std::string((const char *) f.value, f.length);
+}
+
+static void test_round_trip()
+{
+  uint8_t buff[248];
+  bool    truncated;
+  size_t  len = encode(buff, sizeof(buff), truncated);
+
+  CHECK(!truncated);
+  CHECK(hex(buff, len) == VECTOR);
+
+  TLVDecoder        dec(buff, len);
+  TLVDecoder::Field f;
+  int               count = 0;
+
+  while (dec.next(f)) {
+    count++;
+    switch (f.key) {
+      case TLV_TOPIC: CHECK(as_str(f) == "iot");                     break;
+      case TLV_NAME:  CHECK(as_str(f) == "dev1");                    break;
+      case TLV_TYPE:  CHECK(as_str(f) == "STATE");                   break;
+      case TLV_SEQ:   CHECK(f.as_uint() == 300);                     break;
+      case TLV_DUR:   CHECK(f.as_uint() == 1234);                    break;
+      case TLV_MAC:   CHECK((f.length == 6) && (memcmp(f.value, MAC, 6) == 0)); break;
+      case TLV_ERR:   CHECK((f.length == 1) && (f.as_uint() == 0));  break;
+      case TLV_RSSI:  CHECK(f.as_int8() == -67);                     break;
+      case TLV_ST:    CHECK(f.as_uint() == 4);                       break;
+      case TLV_RST:   CHECK(f.as_uint() == 2);                       break;
+      case TLV_HEAP:  CHECK((f.length == 3) && (f.as_uint() == 123456)); break;
+      case TLV_OTHER: CHECK(as_str(f) == "state:HIGH");              break;
+      case TLV_VBAT:  CHECK(f.as_uint() == 330);                     break;
+      case TLV_DROP:  CHECK(f.as_uint() == 2);                       break;
+      case TLV_IP:    CHECK((f.length == 4) && (memcmp(f.value, IP, 4) == 0)); break;
+      default:        CHECK(false);
+    }
+  }
+
+  CHECK(dec.is_valid());
+  CHECK(count == 15);
+}
+
+static void test_uint_sizes()
+{
+  static const struct { uint32_t value; uint8_t length; } cases[] = {
+    { 0, 1 }, { 0xFF, 1 }, { 0x100, 2 }, { 0xFFFF, 2 }, { 0x10000, 3 }, { 0x1000000, 4 }, { UINT32_MAX, 4 }
+  };
+
+  for (auto & c : cases) {
+    uint8_t    buff[8];
+    TLVEncoder enc(buff, sizeof(buff));
+
+    enc.u32(TLV_SEQ, c.value);
+
+    TLVDecoder        dec(buff, enc.get_length());
+    TLVDecoder::Field f;
+
+    CHECK(dec.next(f));
+    CHECK(f.length == c.length);
+    CHECK(f.as_uint() == c.value);
+    CHECK(!dec.next(f) && dec.is_valid());
+  }
+}
+
+// A truncated frame is a prefix of the complete one, made of whole fields.
+static void test_truncation()
+{
+  uint8_t full[248];
+  bool    truncated;
+  size_t  full_len = encode(full, sizeof(full), truncated);
+
+  for (size_t size = 0; size < full_len; size++) {
+    uint8_t buff[248];
+    size_t  len = encode(buff, size, truncated);
+
+    CHECK(truncated);
+    CHECK(len <= size);
+    CHECK(memcmp(buff, full, len) == 0);
+
+    if (len == 0) continue;
+
+    TLVDecoder        dec(buff, len);
+    TLVDecoder::Field f;
+    size_t            decoded = 1;
+
+    while (dec.next(f)) decoded += 2 + f.length;
+
+    CHECK(dec.is_valid());
+    CHECK(decoded == len);
+  }
+
+  // A field too long for its length byte stops the encoding, even if the
+  // following fields are small enough.
+  uint8_t     buff[600];
+  std::string large(300, 'x');
+  TLVEncoder  enc(buff, sizeof(buff));
+
+  enc.str(TLV_TYPE, "STATE").str(TLV_OTHER, large.c_str()).u32(TLV_SEQ, 1);
+
+  CHECK(enc.is_truncated());
+  CHECK(enc.get_length() == 1 + 2 + 5);
+}
+
+// Batch frame, as built by IoT::batch_header() and IoT::batch_msg(): the
+// records are nested sequences of fields, without the frame marker.
+static void test_batch()
+{
+  // iot_proto.encode_batch([MSG, dict(MSG, seq=301, other="")], True)
+  static const char * BATCH_VECTOR =
+    "b10103696f740204646576310502d2040606246f280a1b2c0701000801bd0901040a0102"
+    "0b0340e20110170305535441544504022c010c0a73746174653a48494748100b03055354"
+    "41544504022d01";
+
+  uint8_t    frame[248];
+  TLVEncoder hdr(frame, sizeof(frame));
+
+  hdr.str(TLV_TOPIC, "iot")
+     .str(TLV_NAME,  "dev1")
+     .u32(TLV_DUR,   1234)
+     .bytes(TLV_MAC, MAC, sizeof(MAC))
+     .u32(TLV_ERR,   0)
+     .i8(TLV_RSSI,   -67)
+     .u32(TLV_ST,    4)
+     .u32(TLV_RST,   2)
+     .u32(TLV_HEAP,  123456);
+
+  size_t len = hdr.get_length();
+
+  static const struct { uint32_t seq; const char * other; } msgs[] = { { 300, "state:HIGH" }, { 301, nullptr } };
+
+  for (auto & m : msgs) {
+    uint8_t    rec[248];
+    TLVEncoder enc(rec, sizeof(rec), false);
+
+    enc.str(TLV_TYPE, "STATE").u32(TLV_SEQ, m.seq);
+    if (m.other != nullptr) enc.str(TLV_OTHER, m.other);
+
+    TLVEncoder app(&frame[len], sizeof(frame) - len, false);
+    app.bytes(TLV_REC, rec, enc.get_length());
+    len += app.get_length();
+  }
+
+  CHECK(hex(frame, len) == BATCH_VECTOR);
+
+  TLVDecoder        dec(frame, len);
+  TLVDecoder::Field f;
+  int               recs = 0;
+
+  while (dec.next(f)) {
+    if (f.key != TLV_REC) continue;
+
+    TLVDecoder        rec(f.value, f.length, false);
+    TLVDecoder::Field r;
+    int               fields = 0;
+
+    while (rec.next(r)) {
+      fields++;
+      if (r.key == TLV_TYPE)  CHECK(as_str(r) == "STATE");
+      if (r.key == TLV_SEQ)   CHECK(r.as_uint() == msgs[recs].seq);
+      if (r.key == TLV_OTHER) CHECK((msgs[recs].other != nullptr) && (as_str(r) == msgs[recs].other));
+    }
+
+    CHECK(rec.is_valid());
+    CHECK(fields == ((msgs[recs].other != nullptr) ? 3 : 2));
+    recs++;
+  }
+
+  CHECK(dec.is_valid());
+  CHECK(recs == 2);
+
+  // A nested sequence doesn't start with the marker, and may be empty.
+  TLVDecoder empty(frame, 0, false);
+
+  CHECK(!empty.next(f) && empty.is_valid());
+
+  TLVDecoder framed(&frame[1], 5, true);
+
+  CHECK(!framed.next(f) && !framed.is_valid());
+}
+
+static void test_malformed()
+{
+  // Unknown keys are skipped through their length.
+  const uint8_t unknown[] = { TLV_FRAME_MARKER, 0xEE, 2, 1, 2, TLV_SEQ, 1, 7 };
+
+  TLVDecoder        dec(unknown, sizeof(unknown));
+  TLVDecoder::Field f;
+
+  CHECK(dec.next(f) && (f.key == 0xEE));
+  CHECK(dec.next(f) && (f.key == TLV_SEQ) && (f.as_uint() == 7));
+  CHECK(!dec.next(f) && dec.is_valid());
+
+  // Length past the end of the frame.
+  const uint8_t overrun[] = { TLV_FRAME_MARKER, TLV_SEQ, 1, 7, TLV_TYPE, 5, 'S' };
+
+  TLVDecoder dec2(overrun, sizeof(overrun));
+
+  CHECK(dec2.next(f));
+  CHECK(!dec2.next(f) && !dec2.is_valid());
+
+  // Text frame, or no marker.
+  const uint8_t text[] = "iot;{name:dev1}";
+
+  TLVDecoder dec3(text, sizeof(text) - 1);
+
+  CHECK(!dec3.next(f) && !dec3.is_valid());
+}
+
+int main()
+{
+  test_round_trip();
+  test_uint_sizes();
+  test_truncation();
+  test_batch();
+  test_malformed();
+
+  return TEST_RESULT("test_msg_tlv");
+}
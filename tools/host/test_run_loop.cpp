@@ -0,0 +1,233 @@
+// Run loop of IoT::process() (src/iot.cpp), deep sleep disabled: process()
+// waits for the next event, up to CONFIG_IOT_RUN_LOOP_MAX_IDLE. An event
+// signalled from another thread, through notify() or notify_from_isr() (the
+// thread standing for the ISR), ends the wait at once and is accounted in the
+// wake statistics, with its latency from the notification.
+//
+// Built once with UDP, and once with ESP-NOW and the firmware update (see the
+// Makefile): there is no receive window without deep sleep, the OTA frames
+// received by the run loop must start the transfer. The ESP-NOW gateway is
+// found and heard through the host emulation (esp_host.cpp).
+//
+// The IRAM placement of notify_from_isr() and of the data it reads can't be
+// checked on the host: it is only visible in the map file of an ESP-IDF
+// build (.iram0.text and .dram0.data sections).
+
+#include <thread>
+#include <vector>
+
+#include "global.hpp"
+
+#ifdef CONFIG_IOT_OTA
+  #include "ota.hpp"
+#endif
+
+#include "esp_host.hpp"
+#include "host_test.hpp"
+
+static constexpr int NOTIFY_MS = 50;
+static constexpr int SLACK_MS  = 100;   // Host scheduling
+
+static IoT::UserResult handler(IoT::State state)
+{
+  return IoT::COMPLETED;
+}
+
+static void set_config()
+{
+  memset(&cfg, 0, sizeof(CFG));
+
+  cfg.log_level         = ESP_LOG_WARN;
+  cfg.watchdog_interval = CONFIG_IOT_WATCHDOG_INTERVAL;
+  strcpy(cfg.device_name, CONFIG_IOT_DEVICE_NAME);
+  strcpy(cfg.topic_name,  CONFIG_IOT_TOPIC_NAME);
+}
+
+#ifdef CONFIG_IOT_ENABLE_UDP
+  static int sink = -1;
+
+  // The gateway: a loopback socket receiving the messages, never read.
+  static void open_gateway()
+  {
+    sockaddr_in addr = {};
+    socklen_t   len  = sizeof(addr);
+
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    sink = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    CHECK(bind(sink, (sockaddr *) &addr, sizeof(addr)) == 0);
+    CHECK(getsockname(sink, (sockaddr *) &addr, &len) == 0);
+
+    set_config();
+
+    cfg.udp.port         = ntohs(addr.sin_port);
+    cfg.udp.max_pkt_size = CONFIG_IOT_UDP_MAX_PKT_SIZE;
+    strcpy(cfg.udp.gateway_address, CONFIG_IOT_GATEWAY_ADDRESS);
+
+    cfg.crc = esp_crc16_le(UINT16_MAX, (const uint8_t *) &cfg, sizeof(CFG) - 2);
+  }
+#else
+  // The gateway: an access point found by the scan of its channel.
+  static void open_gateway()
+  {
+    set_config();
+
+    cfg.esp_now.channel      = esp_host_gateway.channel;
+    cfg.esp_now.max_pkt_size = CONFIG_IOT_ESPNOW_MAX_PKT_SIZE;
+    strcpy(cfg.esp_now.primary_master_key,  CONFIG_IOT_ESPNOW_PMK);
+    strcpy(cfg.esp_now.local_master_key,    CONFIG_IOT_ESPNOW_LMK);
+    strcpy(cfg.esp_now.gateway_ssid_prefix, CONFIG_IOT_GATEWAY_SSID_PREFIX);
+
+    cfg.crc = esp_crc16_le(UINT16_MAX, (const uint8_t *) &cfg, sizeof(CFG) - 2);
+  }
+#endif
+
+// Duration of one process() call in msec, **notify** being called from
+// another thread NOTIFY_MS after its start, if any.
+static int64_t timed_process(void (* notify)())
+{
+  std::thread notifier;
+
+  iot.set_deep_sleep_duration(-1);
+
+  int64_t start = esp_timer_get_time();
+
+  if (notify != nullptr) {
+    notifier = std::thread([notify] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(NOTIFY_MS));
+      notify();
+    });
+  }
+
+  iot.process();
+
+  int64_t elapsed = (esp_timer_get_time() - start) / 1000;
+
+  if (notifier.joinable()) notifier.join();
+
+  return elapsed;
+}
+
+static void test_idle()
+{
+  int64_t elapsed = timed_process(nullptr);
+
+  printf("Idle: %d msec.\n", (int) elapsed);
+
+  CHECK(elapsed >= CONFIG_IOT_RUN_LOOP_MAX_IDLE);
+  CHECK(elapsed <  CONFIG_IOT_RUN_LOOP_MAX_IDLE + SLACK_MS);
+  CHECK(iot.get_wake_stats(IoT::WakeSource::APP).count == 0);
+}
+
+// The wait ends on the notification, accounted once, the event bit being
+// cleared: the next wait lasts until the idle timeout.
+static void test_notify(const char * name, void (* notify)())
+{
+  uint32_t count   = iot.get_wake_stats(IoT::WakeSource::APP).count;
+  int64_t  elapsed = timed_process(notify);
+
+  const IoT::WakeStats & stats = iot.get_wake_stats(IoT::WakeSource::APP);
+
+  printf("%s: %d msec, latency %u usec.\n", name, (int) elapsed, stats.max_us);
+
+  CHECK(elapsed >= NOTIFY_MS);
+  CHECK(elapsed <  NOTIFY_MS + SLACK_MS);
+  CHECK(stats.count == count + 1);
+  CHECK(stats.max_us < SLACK_MS * 1000);
+  CHECK(iot.get_wake_stats(IoT::WakeSource::SEND).count == 0);
+
+  CHECK(timed_process(nullptr) >= CONFIG_IOT_RUN_LOOP_MAX_IDLE);
+  CHECK(iot.get_wake_stats(IoT::WakeSource::APP).count == count + 1);
+}
+
+#ifdef CONFIG_IOT_OTA
+  // An OTA frame from the gateway, received in another thread.
+  static void receive_ota(const std::vector<uint8_t> & body)
+  {
+    std::vector<uint8_t> frame(DOWNLINK_HEADER_SIZE);
+
+    frame[2] = OTA_MARKER;
+    frame.insert(frame.end(), body.begin(), body.end());
+
+    uint16_t crc = esp_crc16_le(UINT16_MAX, &frame[2], frame.size() - 2);
+    memcpy(&frame[0], &crc, 2);
+
+    esp_host_now_receive(esp_host_gateway.bssid, frame.data(), frame.size());
+  }
+
+  // The status of the last OTA status frame sent, -1 if none.
+  static int last_status()
+  {
+    for (int i = esp_host_now_frame_count - 1; i >= 0; i--) {
+      const HostFrame & f = esp_host_now_frames[i];
+
+      if ((f.len == 2 + sizeof(Ota::StatusFrame)) && (f.data[2] == OTA_MARKER) && (f.data[3] == (uint8_t) Ota::FrameType::STATUS)) {
+        return f.data[4];
+      }
+    }
+
+    return -1;
+  }
+
+  static std::vector<uint8_t> begin_frame;
+
+  // The transfer starts with the BEGIN frame received while waiting: the
+  // wait ends on it, and the next process() call runs the transfer until it
+  // goes idle. ABORT ends it at once.
+  static void test_ota()
+  {
+    uint32_t size  = 4096;
+    uint16_t chunk = Ota::MAX_CHUNK_SIZE;
+
+    begin_frame.push_back((uint8_t) Ota::FrameType::BEGIN);
+    begin_frame.insert(begin_frame.end(), (uint8_t *) &size,  (uint8_t *) &size  + 4);
+    begin_frame.insert(begin_frame.end(), (uint8_t *) &chunk, (uint8_t *) &chunk + 2);
+    begin_frame.insert(begin_frame.end(), 32, 0x5A);
+
+    esp_host_now_frame_count = 0;
+
+    uint32_t count   = iot.get_wake_stats(IoT::WakeSource::DOWNLINK).count;
+    int64_t  elapsed = timed_process([] { receive_ota(begin_frame); });
+
+    CHECK(elapsed < NOTIFY_MS + SLACK_MS);
+    CHECK(iot.get_wake_stats(IoT::WakeSource::DOWNLINK).count == count + 1);
+
+    elapsed = timed_process(nullptr);
+
+    printf("OTA transfer: idle after %d msec.\n", (int) elapsed);
+
+    CHECK(last_status() == (int) Ota::Status::RECEIVING);
+    CHECK(elapsed >= CONFIG_IOT_OTA_IDLE_TIMEOUT);
+
+    esp_host_now_frame_count = 0;
+
+    timed_process([] { receive_ota({ (uint8_t) Ota::FrameType::ABORT }); });
+    elapsed = timed_process(nullptr);
+
+    CHECK(last_status() == (int) Ota::Status::IDLE);
+    CHECK(elapsed < CONFIG_IOT_OTA_IDLE_TIMEOUT);
+  }
+#endif
+
+int main()
+{
+  open_gateway();
+
+  esp_host_wifi_connect_ms = 0;
+
+  CHECK(iot.init(handler) == ESP_OK);
+
+  // STARTUP state and message.
+  timed_process(nullptr);
+
+  test_idle();
+  test_notify("notify",          [] { iot.notify(IoT::APP_EVENT); });
+  test_notify("notify_from_isr", [] { iot.notify_from_isr(IoT::APP_EVENT); });
+
+  #ifdef CONFIG_IOT_OTA
+    test_ota();
+  #endif
+
+  return TEST_RESULT("test_run_loop");
+}
@@ -0,0 +1,275 @@
+// Checks that sending messages doesn't allocate any memory. The send path
+// of the framework (IoT::send_msg() in src/iot.cpp, UDP::send() or
+// ESPNow::send(), the encoders and the Fragmenter) runs with malloc()
+// replaced by a counting version. The frames sent are then checked: CRC,
+// fragments reassembled, and messages decoded.
+//
+// Built once per transport and message format (see the Makefile): UDP frames
+// are received on a loopback socket, ESP-NOW frames are kept by the host
+// esp_now_send() (esp_host.cpp). There is no send callback on the host: the
+// ESP-NOW frames must fit in the send window (CONFIG_IOT_ESPNOW_SEND_WINDOW).
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "global.hpp"
+#include "msg_frag.hpp"
+#include "msg_tlv.hpp"
+
+#include "esp_host.hpp"
+#include "host_test.hpp"
+
+extern "C" {
+  void * __libc_malloc(size_t size);
+  void * __libc_calloc(size_t count, size_t size);
+  void * __libc_realloc(void * ptr, size_t size);
+  void * __libc_memalign(size_t alignment, size_t size);
+}
+
+static bool counting    = false;
+static int  alloc_count = 0;
+
+// Every allocation goes through these, including operator new and the ones
+// made by the C and C++ libraries.
+extern "C" {
+  void * malloc(size_t size) {
+    if (counting) alloc_count++;
+    return __libc_malloc(size);
+  }
+
+  void * calloc(size_t count, size_t size) {
+    if (counting) alloc_count++;
+    return __libc_calloc(count, size);
+  }
+
+  void * realloc(void * ptr, size_t size) {
+    if (counting) alloc_count++;
+    return __libc_realloc(ptr, size);
+  }
+
+  void * aligned_alloc(size_t alignment, size_t size) {
+    if (counting) alloc_count++;
+    return __libc_memalign(alignment, size);
+  }
+
+  int posix_memalign(void ** ptr, size_t alignment, size_t size) {
+    if (counting) alloc_count++;
+    return ((*ptr = __libc_memalign(alignment, size)) != nullptr) ? 0 : ENOMEM;
+  }
+}
+
+struct Expected {
+  const char * type;
+  uint32_t     seq;
+  std::string  other;
+};
+
+// Larger than a packet, but not than a TLV field.
+static const std::string LARGE = "data:" + std::string(240, 'x');
+
+// Sent in this order, the third one in fragments.
+static const std::vector<Expected> MSGS = {
+  { "STATE",    0, "state:HIGH" },
+  { "WATCHDOG", 1, ""           },
+  { "STATE",    2, LARGE        },
+  { "STATE",    3, "state:LOW"  }
+};
+
+static void send_all()
+{
+  for (auto & m : MSGS) iot.send_msg(m.type, m.other.empty() ? nullptr : m.other.c_str());
+
+  #ifdef CONFIG_IOT_ENABLE_UDP
+    // With ESP-NOW, flush() would wait for the send callbacks.
+    iot.flush();
+  #endif
+}
+
+static std::vector<std::vector<uint8_t>> received;
+
+#ifdef CONFIG_IOT_ENABLE_UDP
+  static int rx_sock = -1;
+
+  // The gateway: a loopback socket whose port is given to the UDP class.
+  static void open_gateway()
+  {
+    sockaddr_in addr = {};
+    socklen_t   len  = sizeof(addr);
+
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    rx_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    CHECK(rx_sock >= 0);
+    CHECK(bind(rx_sock, (sockaddr *) &addr, sizeof(addr)) == 0);
+    CHECK(getsockname(rx_sock, (sockaddr *) &addr, &len) == 0);
+
+    cfg.udp.port         = ntohs(addr.sin_port);
+    cfg.udp.max_pkt_size = CONFIG_IOT_UDP_MAX_PKT_SIZE;
+    strcpy(cfg.udp.gateway_address, CONFIG_IOT_GATEWAY_ADDRESS);
+
+    CHECK(udp.init() == ESP_OK);
+  }
+
+  static void receive_frames()
+  {
+    uint8_t buff[1500];
+    int     len;
+
+    while ((len = recv(rx_sock, buff, sizeof(buff), MSG_DONTWAIT)) > 0) received.emplace_back(buff, buff + len);
+  }
+#else
+  static void open_gateway()
+  {
+    cfg.esp_now.max_pkt_size = CONFIG_IOT_ESPNOW_MAX_PKT_SIZE;
+  }
+
+  static void receive_frames()
+  {
+    for (int i = 0; i < esp_host_now_frame_count; i++) {
+      received.emplace_back(esp_host_now_frames[i].data, esp_host_now_frames[i].data + esp_host_now_frames[i].len);
+    }
+  }
+#endif
+
+// Frames to messages: CRC checked and removed, fragments reassembled.
+static std::vector<std::string> reassemble()
+{
+  static uint8_t buff[2048];
+
+  std::vector<std::string> msgs;
+  FragReassembler          reassembler(buff, sizeof(buff));
+
+  for (auto & f : received) {
+    uint16_t crc;
+
+    CHECK(f.size() > 2);
+    if (f.size() <= 2) continue;
+
+    memcpy(&crc, f.data(), 2);
+    CHECK(crc == esp_crc16_le(UINT16_MAX, &f[2], f.size() - 2));
+
+    if (f[2] != FRAG_FRAME_MARKER) {
+      msgs.emplace_back((const char *) &f[2], f.size() - 2);
+    }
+    else if (reassembler.add(&f[2], f.size() - 2) == FragReassembler::Result::COMPLETE) {
+      msgs.emplace_back((const char *) reassembler.get_data(), reassembler.get_length());
+    }
+  }
+
+  return msgs;
+}
+
+// Messages to (type, seq, other) records, batched or not.
+static std::vector<Expected> decode(const std::vector<std::string> & msgs)
+{
+  std::vector<Expected> out;
+
+  for (auto & msg : msgs) {
+    #ifdef CONFIG_IOT_MSG_FORMAT_BINARY
+      TLVDecoder        dec((const uint8_t *) msg.data(), msg.size());
+      TLVDecoder::Field f;
+      Expected          single = { nullptr, UINT32_MAX, "" };
+
+      while (dec.next(f)) {
+        if (f.key == TLV_TYPE)  single.type  = (f.length == 5) ? "STATE" : "WATCHDOG";
+        if (f.key == TLV_SEQ)   single.seq   = f.as_uint();
+        if (f.key == TLV_OTHER) single.other = std::string((const char *) f.value, f.length);
+
+        if (f.key == TLV_REC) {
+          TLVDecoder        rec(f.value, f.length, false);
+          TLVDecoder::Field r;
+          Expected          m = { nullptr, UINT32_MAX, "" };
+
+          while (rec.next(r)) {
+            if (r.key == TLV_TYPE)  m.type  = (r.length == 5) ? "STATE" : "WATCHDOG";
+            if (r.key == TLV_SEQ)   m.seq   = r.as_uint();
+            if (r.key == TLV_OTHER) m.other = std::string((const char *) r.value, r.length);
+          }
+
+          CHECK(rec.is_valid());
+          out.push_back(m);
+        }
+      }
+
+      CHECK(dec.is_valid());
+      if (single.type != nullptr) out.push_back(single);
+    #else
+      // topic;{name:dev1,type:STATE,seq:0,...,state:HIGH,...} or, batched,
+      // topic;{name:dev1,...,recs:[<len>{type:STATE,seq:0,state:HIGH}...]}
+      CHECK(msg.compare(0, 15, "iot;{name:dev1,") == 0);
+
+      for (size_t pos = 0; (pos = msg.find("type:", pos)) != std::string::npos; pos++) {
+        Expected m    = { nullptr, UINT32_MAX, "" };
+        size_t   comma = msg.find(',', pos);
+        size_t   end   = msg.find('}', pos);
+
+        m.type = (msg.compare(pos + 5, 5, "STATE") == 0) ? "STATE" : "WATCHDOG";
+        m.seq  = strtoul(&msg[msg.find("seq:", pos) + 4], nullptr, 10);
+
+        for (auto & e : MSGS) {
+          if (!e.other.empty() && (msg.find(e.other, comma) < end)) m.other = e.other;
+        }
+
+        out.push_back(m);
+      }
+    #endif
+  }
+
+  return out;
+}
+
+static void test_counter()
+{
+  void * (* volatile alloc)(size_t) = malloc;
+
+  counting = true;
+  void * p = alloc(16);
+  counting = false;
+
+  free(p);
+
+  CHECK(alloc_count == 1);
+  alloc_count = 0;
+}
+
+static void test_send()
+{
+  strcpy(cfg.device_name, CONFIG_IOT_DEVICE_NAME);
+  strcpy(cfg.topic_name,  CONFIG_IOT_TOPIC_NAME);
+  cfg.log_level = ESP_LOG_WARN;
+
+  open_gateway();
+
+  counting = true;
+  send_all();
+  counting = false;
+
+  printf("Allocations while sending %d messages: %d.\n", (int) MSGS.size(), alloc_count);
+  CHECK(alloc_count == 0);
+
+  receive_frames();
+
+  auto msgs = decode(reassemble());
+
+  CHECK(msgs.size() == MSGS.size());
+
+  for (size_t i = 0; (i < msgs.size()) && (i < MSGS.size()); i++) {
+    CHECK((msgs[i].type != nullptr) && (strcmp(msgs[i].type, MSGS[i].type) == 0));
+    CHECK(msgs[i].seq   == MSGS[i].seq);
+    CHECK(msgs[i].other == MSGS[i].other);
+  }
+}
+
+int main()
+{
+  // The stdout buffer would be allocated by the first log message.
+  static char stdout_buff[BUFSIZ];
+  setvbuf(stdout, stdout_buff, _IOLBF, sizeof(stdout_buff));
+
+  test_counter();
+  test_send();
+
+  return TEST_RESULT("test_send_alloc");
+}
@@ -0,0 +1,211 @@
+// Wake scheduler (src/wake_scheduler.cpp): heap order and coalescing against
+// a sorted list, phase of the periodic deadlines, replacement, cancellation
+// and capacity, RTC memory state kept across init(), slot offsets (same
+// values as tools/collision_sim.py) and backoff bounds.
+//
+// The time is given by the test: time() is replaced, as the RTC time of the
+// device.
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "global.hpp"
+
+#include "esp_host.hpp"
+#include "host_test.hpp"
+
+static time_t fake_now = 1700000000;
+
+extern "C" time_t time(time_t * t)
+{
+  if (t != nullptr) *t = fake_now;
+  return fake_now;
+}
+
+static void setup()
+{
+  cfg.log_level = ESP_LOG_WARN;
+  CHECK(wake_scheduler.init(true));
+}
+
+// Random one-shot and periodic deadlines, collected at random times: the
+// fired ids and the next wake up time are the ones of a sorted list.
+static void test_order()
+{
+  std::mt19937            rng(1);
+  std::map<uint8_t, std::pair<time_t, uint32_t>> ref;   // id -> (time, period)
+  int                     errors = 0, fired_count = 0;
+
+  setup();
+
+  for (int step = 0; step < 20000; step++) {
+    if (rng() % 3 == 0) {
+      uint8_t  id     = WakeScheduler::APP_ID + rng() % (WakeScheduler::MAX_DEADLINES - 2);
+      uint32_t delay  = rng() % 600;
+      uint32_t period = (rng() % 2) ? 0 : 1 + rng() % 300;
+
+      if (wake_scheduler.schedule(id, "app", delay, period) != ESP_OK) errors++;
+      ref[id] = { fake_now + delay, period };
+    }
+    else if (rng() % 10 == 0) {
+      uint8_t id = WakeScheduler::APP_ID + rng() % (WakeScheduler::MAX_DEADLINES - 2);
+
+      if ((wake_scheduler.cancel(id) == ESP_OK) != (ref.erase(id) == 1)) errors++;
+    }
+
+    fake_now += rng() % 60;
+
+    time_t   limit    = fake_now + CONFIG_IOT_WAKE_COALESCE;
+    uint32_t expected = 0;
+
+    for (auto it = ref.begin(); it != ref.end();) {
+      auto & [time, period] = it->second;
+
+      if (time > limit) {
+        ++it;
+        continue;
+      }
+
+      expected |= 1UL << it->first;
+
+      if (period > 0) {
+        time += (((limit - time) / period) + 1) * period;
+        ++it;
+      }
+      else {
+        it = ref.erase(it);
+      }
+    }
+
+    uint32_t fired = wake_scheduler.collect();
+
+    if (fired != expected) errors++;
+    if (fired != wake_scheduler.get_fired()) errors++;
+
+    time_t next = 0;
+    for (auto & r : ref) next = (next == 0) ? r.second.first : std::min(next, r.second.first);
+
+    if (wake_scheduler.next_wake() != next) errors++;
+
+    fired_count += __builtin_popcount(fired);
+
+    if (errors > 0) {
+      printf("Step %d: first difference with the sorted list.\n", step);
+      break;
+    }
+  }
+
+  CHECK(errors == 0);
+  CHECK(fired_count > 1000);
+}
+
+// A periodic deadline keeps its phase, whether collected early (coalescing)
+// or late (periods missed while asleep are skipped).
+static void test_phase()
+{
+  setup();
+
+  time_t start = fake_now;
+
+  CHECK(wake_scheduler.schedule(WakeScheduler::APP_ID, "sensor", 100, 100) == ESP_OK);
+
+  fake_now = start + 100 - CONFIG_IOT_WAKE_COALESCE;
+  CHECK(wake_scheduler.collect() == (1UL << WakeScheduler::APP_ID));
+  CHECK(wake_scheduler.next_wake() == start + 200);
+
+  fake_now = start + 200 - CONFIG_IOT_WAKE_COALESCE - 1;
+  CHECK(wake_scheduler.collect() == 0);
+
+  fake_now = start + 450;
+  CHECK(wake_scheduler.collect() == (1UL << WakeScheduler::APP_ID));
+  CHECK(wake_scheduler.next_wake() == start + 500);
+  CHECK(wake_scheduler.has_fired(WakeScheduler::APP_ID));
+  CHECK(!wake_scheduler.has_fired(WakeScheduler::WATCHDOG_ID));
+}
+
+static void test_capacity()
+{
+  setup();
+
+  CHECK(wake_scheduler.schedule(WakeScheduler::MAX_ID + 1, "bad", 10) == ESP_ERR_INVALID_ARG);
+
+  for (int i = 0; i < WakeScheduler::MAX_DEADLINES; i++) {
+    CHECK(wake_scheduler.schedule(WakeScheduler::APP_ID + i, "app", 100 + i) == ESP_OK);
+  }
+
+  CHECK(wake_scheduler.schedule(WakeScheduler::WATCHDOG_ID, "watchdog", 10) == ESP_ERR_NO_MEM);
+
+  // Same id: replaced, no room needed.
+  CHECK(wake_scheduler.schedule(WakeScheduler::APP_ID + 3, "app", 5) == ESP_OK);
+  CHECK(wake_scheduler.next_wake() == fake_now + 5);
+
+  CHECK(wake_scheduler.cancel(WakeScheduler::APP_ID + 3) == ESP_OK);
+  CHECK(wake_scheduler.cancel(WakeScheduler::APP_ID + 3) == ESP_ERR_NOT_FOUND);
+  CHECK(!wake_scheduler.is_scheduled(WakeScheduler::APP_ID + 3));
+  CHECK(wake_scheduler.next_wake() == fake_now + 100);
+}
+
+// After a deep sleep, the deadlines are found in RTC memory.
+static void test_deep_sleep()
+{
+  setup();
+
+  CHECK(wake_scheduler.schedule(WakeScheduler::RETRY_ID, "retry", 30) == ESP_OK);
+
+  fake_now += 30;
+
+  CHECK(!wake_scheduler.init(false));
+  CHECK(wake_scheduler.get_fired() == 0);
+  CHECK(wake_scheduler.collect() == (1UL << WakeScheduler::RETRY_ID));
+
+  CHECK(wake_scheduler.init(true));
+  CHECK(wake_scheduler.next_wake() == 0);
+}
+
+// Host MAC address 24:6f:28:0a:1b:2c (esp_host.cpp), values given by
+// fnv1a_slot() of tools/collision_sim.py.
+static void test_slot_offset()
+{
+  CHECK(WakeScheduler::slot_offset(WakeScheduler::WATCHDOG_ID, 86400) == 43991);
+  CHECK(WakeScheduler::slot_offset(WakeScheduler::APP_ID,      600)   == 429);
+  CHECK(WakeScheduler::slot_offset(5,                          3600)  == 3496);
+  CHECK(WakeScheduler::slot_offset(5,                          0)     == 0);
+}
+
+// Every delay is within [base, min(3 * last, cap)], and reaches the cap.
+static void test_backoff()
+{
+  const uint32_t BASE = 300000, CAP = 2400000;
+
+  uint32_t last = 0, prev, max = 0;
+  int      errors = 0;
+
+  for (int i = 0; i < 10000; i++) {
+    prev = last;
+
+    uint32_t delay = WakeScheduler::backoff(last, BASE, CAP);
+
+    if ((delay != last) || (delay < BASE) || (delay > std::min(std::max(prev, BASE) * 3, CAP))) errors++;
+    max = std::max(max, delay);
+  }
+
+  CHECK(errors == 0);
+  CHECK(max > CAP * 9 / 10);
+
+  last = 0;
+  CHECK(WakeScheduler::backoff(last, CAP * 2, CAP) == CAP);
+}
+
+int main()
+{
+  test_order();
+  test_phase();
+  test_capacity();
+  test_deep_sleep();
+  test_slot_offset();
+  test_backoff();
+
+  return TEST_RESULT("test_wake_scheduler");
+}
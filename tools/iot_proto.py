@@ -0,0 +1,326 @@
+#
+# Host side implementation of the ESP32 Simple IoT Framework wire format.
+#
+# - Transport frame (UDP::send(), ESPNow::send()): [ack seq (u16)] crc (u16) payload
+#   The ack sequence number is present only with CONFIG_IOT_UDP_ACK.
+# - Downlink command frame (include/downlink.hpp): crc (u16) marker command
+# - Firmware update frames (include/ota.hpp): same layout as a downlink frame
+#   towards the device, a status payload from the device.
+# - Payload (IoT::send_msg()): text frame (include/msg_encoder.hpp), binary TLV
+#   frame (include/msg_tlv.hpp), batch of records (CONFIG_IOT_MSG_BATCHING) or
+#   fragment (include/msg_frag.hpp).
+#
+# The encoders produce the same bytes as the device, such that a simulated
+# fleet exercises the same decoding paths as real hardware.
+
+import struct
+
+TLV_FRAME_MARKER  = 0xB1
+FRAG_FRAME_MARKER = 0xF5
+DOWNLINK_MARKER   = 0xDC
+DOWNLINK_MAX_SIZE = 247
+OTA_MARKER        = 0xA5
+OTA_BEGIN, OTA_DATA, OTA_ABORT, OTA_STATUS = 0x01, 0x02, 0x03, 0x80
+OTA_STATUS_FRAME  = struct.Struct("<BBB4sHIH")
+OTA_STATUSES      = ["RECEIVING", "COMPLETE", "HASH_ERROR", "REJECTED", "FLASH_ERROR", "IDLE"]
+FRAG_HEADER       = struct.Struct("<BHBBHH")
+
+TLV_KEYS = ["", "topic", "name", "type", "seq", "dur", "mac", "err", "rssi", "st",
+            "rst", "heap", "other", "vbat", "ip", "drop", "rec"]
+TLV_STR  = {"topic", "name", "type", "other"}
+
+
+def esp_crc16_le(data, crc=0xFFFF):
+  """Same result as esp_crc16_le() from ESP-IDF (reflected CCITT polynomial,
+  with the initial value and the result inverted)."""
+  crc = ~crc & 0xFFFF
+  for b in data:
+    crc ^= b
+    for _ in range(8):
+      crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+  return ~crc & 0xFFFF
+
+
+def frag_crc16(data):
+  """Same result as frag_crc16() (src/msg_frag.cpp)."""
+  crc = 0xFFFF
+  for b in data:
+    crc ^= b
+    for _ in range(8):
+      crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+  return crc
+
+
+# ----- Transport frame -----
+
+def build_frame(payload, ack_seq=None):
+  frame = struct.pack("<H", esp_crc16_le(payload)) + payload
+  if ack_seq is not None:
+    frame = struct.pack("<H", ack_seq & 0xFFFF) + frame
+  return frame
+
+
+def parse_frame(frame, ack=False):
+  """Returns (ack_seq, payload, crc_ok). ack_seq is None without acks."""
+  seq = None
+  if ack:
+    if len(frame) < 2:
+      return None, b"", False
+    seq, frame = struct.unpack_from("<H", frame)[0], frame[2:]
+  if len(frame) < 2:
+    return seq, b"", False
+  crc, payload = struct.unpack_from("<H", frame)[0], frame[2:]
+  return seq, payload, esp_crc16_le(payload) == crc
+
+
+def _downlink(marker, data):
+  body = bytes([marker]) + data
+  return struct.pack("<H", esp_crc16_le(body)) + body
+
+
+def check_downlink(frame, marker):
+  """Same checks as downlink_check() (src/downlink.cpp). Returns the frame
+  content following the marker, or None."""
+  if not 3 < len(frame) <= 3 + DOWNLINK_MAX_SIZE or frame[2] != marker:
+    return None
+  if struct.unpack_from("<H", frame)[0] != esp_crc16_le(frame[2:]):
+    return None
+  return frame[3:]
+
+
+def build_downlink(command):
+  """Command frame accepted by downlink_push() (src/downlink.cpp)."""
+  if not 1 <= len(command) <= DOWNLINK_MAX_SIZE:
+    raise ValueError(f"command length must be between 1 and {DOWNLINK_MAX_SIZE}")
+  return _downlink(DOWNLINK_MARKER, command)
+
+
+# ----- Firmware update -----
+
+def build_ota_begin(image_size, chunk_size, sha256):
+  return _downlink(OTA_MARKER, struct.pack("<BIH", OTA_BEGIN, image_size, chunk_size) + sha256)
+
+
+def build_ota_data(index, chunk):
+  return _downlink(OTA_MARKER, struct.pack("<BH", OTA_DATA, index) + chunk)
+
+
+def build_ota_abort():
+  return _downlink(OTA_MARKER, bytes([OTA_ABORT]))
+
+
+def build_ota_status(status, image_id, base, bitmap, received):
+  """Status payload, as sent by Ota::send_status()."""
+  return OTA_STATUS_FRAME.pack(OTA_MARKER, OTA_STATUS, OTA_STATUSES.index(status), image_id, base, bitmap, received)
+
+
+def parse_ota_status(payload):
+  """Returns a dict, or None if the payload is not an OTA status."""
+  if len(payload) != OTA_STATUS_FRAME.size or payload[0] != OTA_MARKER or payload[1] != OTA_STATUS:
+    return None
+  _, _, status, image_id, base, bitmap, received = OTA_STATUS_FRAME.unpack(payload)
+  if status >= len(OTA_STATUSES):
+    return None
+  return dict(status=OTA_STATUSES[status], image_id=image_id, base=base, bitmap=bitmap, received=received)
+
+
+# ----- Text format -----
+
+def encode_text(msg):
+  """msg: dict with topic, name, type, seq, dur, mac, err, rssi, st, rst, heap
+  and optionally other, vbat, drop, ip. Same field order as IoT::send_msg()."""
+  out = f"{msg['topic']};{{name:{msg['name']},type:{msg['type']},seq:{msg['seq']}," \
+        f"dur:{msg['dur']},mac:\"{msg['mac']}\",err:{msg['err']},rssi:{msg['rssi']}," \
+        f"st:{msg['st']},rst:{msg['rst']},heap:{msg['heap']}"
+  if msg.get("other"): out += "," + msg["other"]
+  if "vbat" in msg:    out += f",vbat:{msg['vbat']:.2f}"
+  if "drop" in msg:    out += f",drop:{msg['drop']}"
+  if "ip" in msg:      out += f",ip:\"{msg['ip']}\""
+  return (out + "}").encode()
+
+
+def _parse_fields(body, pos, end, out):
+  while pos < end:
+    colon = body.index(b":", pos)
+    key = body[pos:colon].decode()
+    pos = colon + 1
+    if key == "recs":
+      pos += 1                           # '['
+      out["recs"] = []
+      while body[pos:pos + 1] != b"]":
+        start = pos
+        while body[pos:pos + 1].isdigit():
+          pos += 1
+        rec_len = int(body[start:pos])
+        rec = {}
+        _parse_fields(body, pos + 1, pos + rec_len - 1, rec)
+        out["recs"].append(rec)
+        pos += rec_len
+      pos += 1                           # ']'
+    elif body[pos:pos + 1] == b'"':
+      close = body.index(b'"', pos + 1)
+      out[key] = body[pos + 1:close].decode()
+      pos = close + 1
+    else:
+      comma = body.find(b",", pos, end)
+      comma = end if comma < 0 else comma
+      value = body[pos:comma].decode()
+      out[key] = int(value) if value.lstrip("-").isdigit() else value
+      pos = comma
+    pos += 1                             # ','
+  return out
+
+
+def decode_text(payload):
+  topic, _, body = payload.partition(b";")
+  if not body.startswith(b"{") or not body.endswith(b"}"):
+    raise ValueError("malformed text frame")
+  return _parse_fields(body, 1, len(body) - 1, {"topic": topic.decode()})
+
+
+# ----- Binary (TLV) format -----
+
+def _tlv(fields):
+  """Concatenation of the (key, value) fields. Like TLVEncoder, the encoding
+  stops at the first field too long: the frame ends with complete fields."""
+  out = b""
+  for key, value in fields:
+    if len(value) > 255:
+      break
+    out += bytes([TLV_KEYS.index(key), len(value)]) + value
+  return out
+
+
+def _u32(value):
+  out = bytearray()
+  while True:
+    out.append(value & 0xFF)
+    value >>= 8
+    if value == 0:
+      return bytes(out)
+
+
+def _mac(mac):
+  return bytes(int(b, 16) for b in mac.split(":"))
+
+
+def encode_tlv(msg):
+  """Same field order as IoT::send_msg() with CONFIG_IOT_MSG_FORMAT_BINARY."""
+  fields = [("topic", msg["topic"].encode()), ("name", msg["name"].encode()), ("type", msg["type"].encode()),
+            ("seq", _u32(msg["seq"])), ("dur", _u32(msg["dur"])), ("mac", _mac(msg["mac"])),
+            ("err", _u32(msg["err"])), ("rssi", struct.pack("b", msg["rssi"])),
+            ("st", _u32(msg["st"])), ("rst", _u32(msg["rst"])), ("heap", _u32(msg["heap"]))]
+  if msg.get("other"): fields.append(("other", msg["other"].encode()))
+  if "vbat" in msg:    fields.append(("vbat", _u32(int(msg["vbat"] * 100 + 0.5))))
+  if "drop" in msg:    fields.append(("drop", _u32(msg["drop"])))
+  if "ip" in msg:      fields.append(("ip", bytes(int(b) for b in msg["ip"].split("."))))
+  return bytes([TLV_FRAME_MARKER]) + _tlv(fields)
+
+
+def _decode_tlv_fields(data, pos, out):
+  while pos < len(data):
+    if pos + 2 > len(data) or pos + 2 + data[pos + 1] > len(data):
+      raise ValueError("malformed TLV frame")
+    key_id, length = data[pos], data[pos + 1]
+    value = data[pos + 2:pos + 2 + length]
+    pos += 2 + length
+    if key_id >= len(TLV_KEYS) or key_id == 0:
+      continue                           # Unknown keys are skipped
+    key = TLV_KEYS[key_id]
+    if key == "rec":
+      out.setdefault("recs", []).append(_decode_tlv_fields(value, 0, {}))
+    elif key in TLV_STR:
+      out[key] = value.decode()
+    elif key == "mac":
+      out[key] = ":".join(f"{b:02x}" for b in value)
+    elif key == "ip":
+      out[key] = ".".join(str(b) for b in value)
+    elif key == "rssi":
+      out[key] = struct.unpack("b", value[:1])[0]
+    elif key == "vbat":
+      out[key] = int.from_bytes(value, "little") / 100.0
+    else:
+      out[key] = int.from_bytes(value, "little")
+  return out
+
+
+def decode_tlv(payload):
+  if not payload or payload[0] != TLV_FRAME_MARKER:
+    raise ValueError("not a TLV frame")
+  return _decode_tlv_fields(payload, 1, {})
+
+
+# ----- Batching -----
+
+def encode_batch(msgs, binary):
+  """Same layout as IoT::batch_header() and IoT::batch_msg(). The common
+  fields are taken from the first message."""
+  head = msgs[0]
+  if binary:
+    fields = [("topic", head["topic"].encode()), ("name", head["name"].encode()),
+              ("dur", _u32(head["dur"])), ("mac", _mac(head["mac"])),
+              ("err", _u32(head["err"])), ("rssi", struct.pack("b", head["rssi"])),
+              ("st", _u32(head["st"])), ("rst", _u32(head["rst"])), ("heap", _u32(head["heap"]))]
+    for msg in msgs:
+      rec = [("type", msg["type"].encode()), ("seq", _u32(msg["seq"]))]
+      if msg.get("other"): rec.append(("other", msg["other"].encode()))
+      fields.append(("rec", _tlv(rec)))
+    return bytes([TLV_FRAME_MARKER]) + _tlv(fields)
+
+  out = f"{head['topic']};{{name:{head['name']},dur:{head['dur']},mac:\"{head['mac']}\"," \
+        f"err:{head['err']},rssi:{head['rssi']},st:{head['st']},rst:{head['rst']}," \
+        f"heap:{head['heap']},recs:["
+  for msg in msgs:
+    rec = f"{{type:{msg['type']},seq:{msg['seq']}" + ("," + msg["other"] if msg.get("other") else "") + "}"
+    out += f"{len(rec)}{rec}"
+  return (out + "]}").encode()
+
+
+# ----- Fragmentation -----
+
+def fragment(payload, max_frame_size, msg_id):
+  """Same split as the Fragmenter class (src/msg_frag.cpp)."""
+  max_chunk = max_frame_size - FRAG_HEADER.size
+  count = -(-len(payload) // max_chunk)
+  chunk = -(-len(payload) // count)
+  crc   = frag_crc16(payload)
+  return [FRAG_HEADER.pack(FRAG_FRAME_MARKER, msg_id & 0xFFFF, i, count, len(payload), crc) +
+          payload[i * chunk:(i + 1) * chunk] for i in range(count)]
+
+
+class Reassembler:
+  """Equivalent to the FragReassembler class, for one device."""
+
+  def __init__(self):
+    self.key, self.parts, self.abandoned = None, {}, 0
+
+  def add(self, frame):
+    """Returns the complete message, or None."""
+    marker, msg_id, index, count, total_len, crc = FRAG_HEADER.unpack_from(frame)
+    if marker != FRAG_FRAME_MARKER or count == 0 or index >= count:
+      raise ValueError("invalid fragment")
+    key = (msg_id, count, total_len, crc)
+    if key != self.key:
+      if self.key is not None:
+        self.abandoned += 1
+      self.key, self.parts = key, {}
+    self.parts[index] = frame[FRAG_HEADER.size:]
+    if len(self.parts) < count:
+      return None
+    msg, self.key = b"".join(self.parts[i] for i in range(count)), None
+    if len(msg) != total_len or frag_crc16(msg) != crc:
+      raise ValueError("fragmented message CRC error")
+    return msg
+
+
+# ----- Any payload -----
+
+def decode_payload(payload):
+  """Decode a complete (reassembled) payload, text or TLV."""
+  if payload[:1] == bytes([TLV_FRAME_MARKER]):
+    return decode_tlv(payload)
+  return decode_text(payload)
+
+
+def is_fragment(payload):
+  return payload[:1] == bytes([FRAG_FRAME_MARKER]) and len(payload) > FRAG_HEADER.size
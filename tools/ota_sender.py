@@ -0,0 +1,579 @@
+#!/usr/bin/env python3
+#
+# Gateway side of the ESP-NOW firmware update (CONFIG_IOT_OTA, see
+# include/ota.hpp), and a simulator of a transfer over a lossy link.
+#
+#   send:     send a firmware image as UDP datagrams to a gateway bridge that
+#             forwards them to the device through ESP-NOW, and forwards back
+#             the device uplink frames (CRC + payload).
+#   simulate: run a transfer in simulated time against a model of the device
+#             (src/ota.cpp: frame ring, flash erase and write times, status
+#             after a window or ACK_DELAY_MS, idle timeout, deep sleep and
+#             resume), over a link with frame loss:
+#
+#     tools/ota_sender.py simulate --size 1000000 --loss 0.05 --interrupt 20
+#     tools/ota_sender.py simulate --loss 0.2 --interrupt 10 --power-loss
+#
+# The gateway sends the BEGIN frame when it receives an uplink from the
+# device, then the missing chunks of the window [base, base + window), and
+# sends them again if no status is received within --status-timeout msec.
+# After --retries timeouts in a row, it waits for the next device uplink (the
+# device is asleep): a device with a pending transfer reports its status as
+# soon as it wakes up.
+#
+# The simulate report (JSON) gives the transfer time, the goodput and the
+# count of frames sent again, such that window and chunk sizes can be
+# compared for a given loss rate. "completed" is set once the device has
+# verified the image, "confirmed" once the gateway has received the COMPLETE
+# status (not sent again by the device, which restarts on the new firmware).
+
+import argparse
+import copy
+import hashlib
+import heapq
+import json
+import random
+import socket
+import struct
+import sys
+import time
+from collections import deque
+
+import iot_proto
+from gateway_emulator import framework_version
+
+REPORT_SCHEMA = 1
+
+# Device constants, see include/ota.hpp
+MAX_CHUNK_SIZE = 240
+MAX_CHUNKS     = 8192
+RING_SIZE      = 16
+ACK_DELAY_MS   = 50
+
+
+class OtaSender:
+  """Gateway side: windowed selective repeat. Every method returns the list
+  of frames to be sent."""
+
+  def __init__(self, image, chunk_size, window, retries=3):
+    if not 16 <= chunk_size <= MAX_CHUNK_SIZE or chunk_size % 16:
+      raise ValueError(f"chunk size must be a multiple of 16, up to {MAX_CHUNK_SIZE}")
+    self.image       = image
+    self.chunk_size  = chunk_size
+    self.window      = window
+    self.retries     = retries
+    self.sha256      = hashlib.sha256(image).digest()
+    self.chunk_count = (len(image) + chunk_size - 1) // chunk_size
+    if self.chunk_count > MAX_CHUNKS:
+      raise ValueError(f"image too large: {self.chunk_count} chunks, {MAX_CHUNKS} max")
+    self.state       = "BEGIN"    # BEGIN, SENDING, WAITING, DONE, FAILED
+    self.error       = None
+    self.timeouts    = 0
+    self.stats       = dict(begin_frames=0, data_frames=0, statuses=0, timeouts=0, restarts=0)
+    self._restart()
+
+  def _restart(self):
+    self.acked     = bytearray(self.chunk_count)
+    self.sent_seq  = [-1] * self.chunk_count  # Send order of the last copy of every chunk
+    self.seq       = 0
+    self.acked_seq = -1                       # Latest copy known to be received
+    self.base      = 0
+
+  def begin_frame(self):
+    self.stats["begin_frames"] += 1
+    return iot_proto.build_ota_begin(len(self.image), self.chunk_size, self.sha256)
+
+  def chunk_frame(self, index):
+    self.stats["data_frames"] += 1
+    self.sent_seq[index] = self.seq
+    self.seq += 1
+    offset = index * self.chunk_size
+    return iot_proto.build_ota_data(index, self.image[offset:offset + self.chunk_size])
+
+  def window_frames(self, in_flight=False):
+    """Missing chunks of the window. Unless **in_flight**, a chunk sent after
+    the latest one received may still be on its way, and is not sent again."""
+    end = min(self.base + self.window, self.chunk_count)
+    return [self.chunk_frame(i) for i in range(self.base, end)
+            if not self.acked[i] and (in_flight or self.sent_seq[i] < self.acked_seq or self.sent_seq[i] < 0)]
+
+  def _ack(self, index):
+    if not self.acked[index]:
+      self.acked[index] = 1
+      self.acked_seq    = max(self.acked_seq, self.sent_seq[index])
+
+  @property
+  def done(self):
+    return self.state in ("DONE", "FAILED")
+
+  def on_uplink(self):
+    """Any other uplink from the device: it is awake and listening."""
+    if self.state in ("BEGIN", "WAITING"):
+      self.timeouts = 0
+      return [self.begin_frame()]
+    return []
+
+  def on_status(self, status):
+    self.stats["statuses"] += 1
+    self.timeouts = 0
+    name = status["status"]
+
+    if status["image_id"] != self.sha256[:4] and name != "IDLE":
+      # Another transfer pending on the device: BEGIN restarts it.
+      return [self.begin_frame()]
+
+    if name == "RECEIVING":
+      # Resume after a deep sleep: the frames in flight have been lost.
+      resume    = self.state != "SENDING"
+      self.base = status["base"]
+      for i in range(min(self.base, self.chunk_count)):
+        self._ack(i)
+      for i in range(32):
+        if status["bitmap"] & (1 << i) and self.base + i < self.chunk_count:
+          self._ack(self.base + i)
+      self.state = "SENDING"
+      return self.window_frames(in_flight=resume)
+
+    if name == "COMPLETE":
+      self.state = "DONE"
+    elif name in ("HASH_ERROR", "IDLE"):
+      self.stats["restarts"] += 1
+      self._restart()
+      self.state = "BEGIN"
+      return [self.begin_frame()]
+    else:
+      self.state = "FAILED"
+      self.error = name
+    return []
+
+  def on_timeout(self):
+    self.stats["timeouts"] += 1
+    self.timeouts += 1
+    if self.state == "WAITING" or self.done:
+      return []
+    if self.timeouts > self.retries:
+      self.state = "WAITING"
+      return []
+    return [self.begin_frame()] if self.state == "BEGIN" else self.window_frames(in_flight=True)
+
+
+class OtaReceiver:
+  """Model of the device side, following src/ota.cpp. The flash behaves as
+  a NOR flash: erased to 0xFF, written bits can only be cleared. Returns the
+  status payloads sent and the processing time (msec)."""
+
+  def __init__(self, partition_size, window, write_ms, erase_ms):
+    self.flash        = bytearray(b"\x00") * partition_size
+    self.window       = window
+    self.write_ms     = write_ms
+    self.erase_ms     = erase_ms
+    self.state        = None      # RTC memory copy
+    self.nvs          = None      # NVS copy
+    self.dirty        = False
+    self.since_status = 0
+    self.completed    = False
+    self.verified     = False
+
+  def is_active(self):
+    return self.state is not None
+
+  def is_received(self, index):
+    return self.state["bitmap"][index >> 3] & (1 << (index & 7))
+
+  def save(self, persist):
+    if persist:
+      self.nvs   = copy.deepcopy(self.state)
+      self.dirty = False
+
+  def reset(self):
+    self.state = None
+    self.dirty = True
+
+  def status(self, name, image_id=None):
+    base = bitmap = received = 0
+    if self.is_active():
+      st, base, received = self.state, self.state["base"], self.state["received"]
+      for i in range(32):
+        if base + i < st["chunk_count"] and self.is_received(base + i):
+          bitmap |= 1 << i
+      image_id = image_id or st["sha256"]
+    self.since_status = 0
+    return iot_proto.build_ota_status(name, (image_id or bytes(4))[:4], base, bitmap, received)
+
+  def begin(self, body):
+    if len(body) != 1 + 4 + 2 + 32:
+      return [self.status("REJECTED")], 0
+    image_size, chunk_size = struct.unpack_from("<IH", body, 1)
+    sha256 = body[7:]
+    st     = self.state
+
+    if st and st["image_size"] == image_size and st["chunk_size"] == chunk_size and st["sha256"] == sha256:
+      return [self.status("RECEIVING")], 0
+
+    chunk_count = (image_size + chunk_size - 1) // chunk_size if chunk_size else 0
+    if (not chunk_size or chunk_size > MAX_CHUNK_SIZE or chunk_size % 16 or not image_size or
+        image_size > len(self.flash) or chunk_count > MAX_CHUNKS):
+      return [self.status("REJECTED", sha256)], 0
+
+    self.reset()
+    erased = (image_size + 4095) & ~4095
+    self.flash[:erased] = b"\xff" * erased
+    self.state = dict(sha256=sha256, image_size=image_size, chunk_size=chunk_size, chunk_count=chunk_count,
+                      received=0, base=0, bitmap=bytearray(MAX_CHUNKS // 8))
+    self.save(True)
+    return [self.status("RECEIVING")], erased // 4096 * self.erase_ms
+
+  def write_chunk(self, body):
+    if len(body) < 4:
+      return [], 0
+    self.since_status += 1
+    if not self.is_active():
+      return [], 0
+    st    = self.state
+    index = struct.unpack_from("<H", body, 1)[0]
+    if index >= st["chunk_count"]:
+      return [], 0
+    offset = index * st["chunk_size"]
+    size   = min(st["chunk_size"], st["image_size"] - offset)
+    if len(body) - 3 != size or self.is_received(index):
+      return [], 0
+
+    for i, b in enumerate(body[3:]):
+      self.flash[offset + i] &= b
+    st["bitmap"][index >> 3] |= 1 << (index & 7)
+    st["received"] += 1
+    self.dirty = True
+    while st["base"] < st["chunk_count"] and self.is_received(st["base"]):
+      st["base"] += 1
+
+    if st["received"] == st["chunk_count"]:
+      statuses, dt = self.finish()
+      return statuses, self.write_ms + dt
+    return [], self.write_ms
+
+  def finish(self):
+    st = self.state
+    dt = st["image_size"] / 1024 * 0.1
+    if hashlib.sha256(bytes(self.flash[:st["image_size"]])).digest() != st["sha256"]:
+      statuses = [self.status("HASH_ERROR")]
+      self.reset()
+      self.save(True)
+      return statuses, dt
+    statuses = [self.status("COMPLETE")]
+    self.reset()
+    self.save(True)
+    self.completed = self.verified = True
+    return statuses, dt
+
+  def handle(self, body):
+    kind = body[0]
+    if kind == iot_proto.OTA_BEGIN:
+      return self.begin(body)
+    if kind == iot_proto.OTA_DATA:
+      return self.write_chunk(body)
+    if kind == iot_proto.OTA_ABORT:
+      if self.is_active():
+        self.reset()
+        self.save(True)
+      return [self.status("IDLE")], 0
+    return [], 0
+
+  def prepare_for_deep_sleep(self):
+    self.save(self.dirty)
+    self.since_status = 0
+
+  def power_loss(self):
+    """Reset: the RTC memory copy is lost, the NVS copy is loaded."""
+    self.state        = copy.deepcopy(self.nvs)
+    self.dirty        = False
+    self.since_status = 0
+
+
+class Simulation:
+  """Discrete event simulation, times in msec. One shared channel: every
+  frame waits for the previous one to be on air."""
+
+  def __init__(self, args, image):
+    self.args     = args
+    self.now      = 0.0
+    self.events   = []
+    self.seq      = 0
+    self.air_free = 0.0
+    self.rng      = random.Random(args.seed)
+    self.sender   = OtaSender(image, args.chunk_size, args.window, args.retries)
+    self.device   = OtaReceiver(args.partition_size, args.window, args.write_ms, args.erase_ms)
+    self.gw_queue = deque()
+    self.gw_busy  = False
+    self.gw_gen   = 0
+    self.ring     = deque()
+    self.awake    = False
+    self.busy     = False
+    self.dev_gen  = 0
+    self.stats    = dict(frames_lost=0, lost_asleep=0, ring_drops=0, statuses_sent=0,
+                         wakeups=0, sleeps=0, interruptions=0)
+
+  def at(self, t, fn, *args):
+    self.seq += 1
+    heapq.heappush(self.events, (t, self.seq, fn, args))
+
+  def transmit(self, frame, deliver):
+    start         = max(self.now, self.air_free)
+    end           = start + self.args.overhead + len(frame) * 8 / self.args.rate
+    self.air_free = end
+    if self.rng.random() < self.args.loss:
+      self.stats["frames_lost"] += 1
+    else:
+      self.at(end, deliver, frame)
+    return end
+
+  # ----- Gateway -----
+
+  def gw_send(self, frames):
+    if frames:
+      self.gw_queue = deque(frames)
+      self.gw_gen  += 1
+      self.gw_pump()
+
+  def gw_pump(self):
+    if self.gw_busy:
+      return
+    if not self.gw_queue:
+      self.gw_gen += 1
+      self.at(self.now + self.args.status_timeout, self.gw_timeout, self.gw_gen)
+      return
+    self.gw_busy = True
+    self.at(self.transmit(self.gw_queue.popleft(), self.dev_receive), self.gw_sent)
+
+  def gw_sent(self):
+    self.gw_busy = False
+    self.gw_pump()
+
+  def gw_timeout(self, gen):
+    if gen == self.gw_gen:
+      self.gw_send(self.sender.on_timeout())
+
+  def gw_receive(self, payload):
+    status = iot_proto.parse_ota_status(payload)
+    self.gw_send(self.sender.on_status(status) if status else self.sender.on_uplink())
+
+  # ----- Device -----
+
+  def dev_uplink(self, payload):
+    self.stats["statuses_sent"] += payload[:1] == bytes([iot_proto.OTA_MARKER])
+    self.transmit(payload, self.gw_receive)
+
+  def dev_wake(self):
+    self.stats["wakeups"] += 1
+    self.awake = True
+    self.dev_uplink(self.device.status("RECEIVING") if self.device.is_active() else b"uplink")
+    self.dev_idle()
+
+  def dev_sleep(self, power_loss=False):
+    self.stats["sleeps"] += 1
+    self.device.prepare_for_deep_sleep()
+    if power_loss:
+      self.device.power_loss()
+    self.awake    = False
+    self.busy     = False
+    self.dev_gen += 1
+    self.ring.clear()
+    self.at(self.now + self.args.sleep, self.dev_wake)
+
+  def dev_receive(self, frame):
+    if not self.awake:
+      self.stats["lost_asleep"] += 1
+      return
+    body = iot_proto.check_downlink(frame, iot_proto.OTA_MARKER)
+    if body is None:
+      return
+    if len(self.ring) >= RING_SIZE:
+      self.stats["ring_drops"] += 1
+      return
+    self.ring.append(body)
+    self.dev_gen += 1
+    self.dev_pump()
+
+  def dev_pump(self):
+    if self.busy or not self.ring:
+      return
+    statuses, dt = self.device.handle(self.ring.popleft())
+    self.busy    = True
+    self.at(self.now + dt, self.dev_handled, statuses)
+
+  def dev_handled(self, statuses):
+    self.busy = False
+    for status in statuses:
+      self.dev_uplink(status)
+    if self.device.completed:
+      self.awake = False
+      return
+    if self.device.since_status >= self.args.window:
+      self.dev_uplink(self.device.status("RECEIVING" if self.device.is_active() else "IDLE"))
+    if self.ring:
+      self.dev_pump()
+    else:
+      self.dev_idle()
+
+  def dev_idle(self):
+    gen = self.dev_gen
+    if self.device.since_status > 0:
+      self.at(self.now + ACK_DELAY_MS, self.dev_ack_delay, gen)
+    listen = self.args.idle_timeout if self.device.is_active() else self.args.downlink_window
+    self.at(self.now + listen, self.dev_idle_timeout, gen)
+
+  def dev_ack_delay(self, gen):
+    if gen == self.dev_gen and self.awake and not self.busy and self.device.since_status > 0:
+      self.dev_uplink(self.device.status("RECEIVING" if self.device.is_active() else "IDLE"))
+
+  def dev_idle_timeout(self, gen):
+    if gen == self.dev_gen and self.awake and not self.busy:
+      self.dev_sleep()
+
+  def interrupt(self):
+    if self.awake and not self.device.completed:
+      self.stats["interruptions"] += 1
+      self.dev_sleep(self.args.power_loss)
+    self.at(self.now + self.args.interrupt * 1000, self.interrupt)
+
+  def run(self):
+    self.at(0, self.dev_wake)
+    if self.args.interrupt:
+      self.at(self.args.interrupt * 1000, self.interrupt)
+    limit = self.args.max_time * 1000
+    while self.events and not self.sender.done:
+      t, _, fn, args = heapq.heappop(self.events)
+      if t > limit:
+        break
+      self.now = t
+      fn(*args)
+    return self.now
+
+
+def simulate(args):
+  rng   = random.Random(args.seed)
+  image = bytes(rng.getrandbits(8) for _ in range(args.size))
+  sim   = Simulation(args, image)
+  t     = sim.run()
+  chunk = sim.sender.chunk_count
+  sent  = sim.sender.stats["data_frames"]
+
+  return dict(
+    schema    = REPORT_SCHEMA,
+    version   = framework_version(),
+    mode      = "simulate",
+    params    = {k: v for k, v in vars(args).items() if k not in ("func", "report")},
+    completed = sim.device.verified,
+    confirmed = sim.sender.state == "DONE",
+    error     = sim.sender.error,
+    time_sec  = round(t / 1000, 3),
+    goodput_kBps   = round(args.size / t, 3) if t else 0,
+    chunks         = chunk,
+    retransmitted  = max(0, sent - chunk),
+    efficiency     = round(chunk / sent, 4) if sent else 0,
+    gateway   = sim.sender.stats,
+    device    = sim.stats,
+  )
+
+
+def send(args):
+  with open(args.image, "rb") as f:
+    image = f.read()
+
+  sender = OtaSender(image, args.chunk_size, args.window, args.retries)
+  sock   = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+  sock.bind(("0.0.0.0", args.local_port))
+  dest   = (args.address, args.port)
+  start  = time.monotonic()
+  frames = []
+
+  print(f"Sending {len(image)} bytes in {sender.chunk_count} chunks to {dest[0]}:{dest[1]}. "
+        f"Waiting for the device...", file=sys.stderr)
+
+  while not sender.done and time.monotonic() - start < args.timeout:
+    for frame in frames:
+      sock.sendto(frame, dest)
+      time.sleep(args.pace / 1000)
+
+    deadline = time.monotonic() + args.status_timeout / 1000
+    frames   = None
+    while frames is None:
+      sock.settimeout(max(0.001, deadline - time.monotonic()))
+      try:
+        data, _ = sock.recvfrom(2048)
+      except socket.timeout:
+        frames = sender.on_timeout()
+        break
+      _, payload, crc_ok = iot_proto.parse_frame(data)
+      if not crc_ok:
+        continue
+      status = iot_proto.parse_ota_status(payload)
+      frames = sender.on_status(status) if status else sender.on_uplink()
+      if status and args.verbose:
+        print(f"{status['status']} base {status['base']} received {status['received']}", file=sys.stderr)
+
+  elapsed = time.monotonic() - start
+  return dict(
+    schema    = REPORT_SCHEMA,
+    version   = framework_version(),
+    mode      = "send",
+    params    = {k: v for k, v in vars(args).items() if k not in ("func", "report")},
+    completed = sender.state == "DONE",
+    error     = sender.error or (None if sender.done else "timeout"),
+    time_sec  = round(elapsed, 3),
+    chunks    = sender.chunk_count,
+    gateway   = sender.stats,
+  )
+
+
+def main():
+  parser = argparse.ArgumentParser(description="Firmware update sender for the ESP32 Simple IoT Framework")
+  parser.add_argument("--report",         help="JSON report file (default: stdout)")
+  parser.add_argument("--chunk-size",     type=int,   default=MAX_CHUNK_SIZE)
+  parser.add_argument("--window",         type=int,   default=8,   help="CONFIG_IOT_OTA_WINDOW")
+  parser.add_argument("--status-timeout", type=float, default=300, help="window sent again after (msec)")
+  parser.add_argument("--retries",        type=int,   default=3,   help="timeouts before waiting for the device")
+  sub = parser.add_subparsers(dest="command", required=True)
+
+  snd = sub.add_parser("send", help="send an image to a gateway bridge")
+  snd.add_argument("image")
+  snd.add_argument("--address",    default="127.0.0.1")
+  snd.add_argument("--port",       type=int,   default=3334)
+  snd.add_argument("--local-port", type=int,   default=3335)
+  snd.add_argument("--pace",       type=float, default=3,   help="delay between frames (msec)")
+  snd.add_argument("--timeout",    type=float, default=600, help="give up after (sec)")
+  snd.add_argument("--verbose",    action="store_true")
+  snd.set_defaults(func=send)
+
+  sim = sub.add_parser("simulate", help="simulated transfer over a lossy link")
+  sim.add_argument("--size",            type=int,   default=500000,  help="image size (bytes)")
+  sim.add_argument("--partition-size",  type=int,   default=0x180000)
+  sim.add_argument("--loss",            type=float, default=0.05,    help="frame loss probability, both directions")
+  sim.add_argument("--rate",            type=float, default=1000,    help="link rate (kbit/s)")
+  sim.add_argument("--overhead",        type=float, default=0.2,     help="per frame airtime overhead (msec)")
+  sim.add_argument("--write-ms",        type=float, default=1.0,     help="flash write time per chunk (msec)")
+  sim.add_argument("--erase-ms",        type=float, default=45,      help="flash erase time per 4 KB sector (msec)")
+  sim.add_argument("--idle-timeout",    type=float, default=2000,    help="CONFIG_IOT_OTA_IDLE_TIMEOUT (msec)")
+  sim.add_argument("--downlink-window", type=float, default=50,      help="CONFIG_IOT_DOWNLINK_WINDOW (msec)")
+  sim.add_argument("--sleep",           type=float, default=5000,    help="deep sleep duration (msec)")
+  sim.add_argument("--interrupt",       type=float, default=0,       help="put the device to sleep every (sec)")
+  sim.add_argument("--power-loss",      action="store_true",         help="interruptions are resets (NVS state only)")
+  sim.add_argument("--max-time",        type=float, default=3600,    help="simulated time limit (sec)")
+  sim.add_argument("--seed",            type=int,   default=1)
+  sim.set_defaults(func=simulate)
+
+  args = parser.parse_args()
+  if not 1 <= args.window <= RING_SIZE:
+    parser.error(f"window must be between 1 and {RING_SIZE}")
+
+  report = args.func(args)
+  out    = json.dumps(report, indent=2)
+  if args.report:
+    with open(args.report, "w") as f:
+      f.write(out + "\n")
+  else:
+    print(out)
+  return 0 if report["completed"] else 1
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+#
+# Tests of the host side wire format (iot_proto.py). The binary vector is
+# the one checked against the C++ TLVEncoder by tools/host/test_msg_tlv.cpp,
+# such that both implementations produce the same bytes.
+#
+#     python3 -m unittest discover -s tools -p 'test_*.py'
+
+import random
+import unittest
+
+import iot_proto
+
+MSG = dict(topic="iot", name="dev1", type="STATE", seq=300, dur=1234, mac="24:6f:28:0a:1b:2c",
+           err=0, rssi=-67, st=4, rst=2, heap=123456, other="state:HIGH", vbat=3.3, drop=2,
+           ip="192.168.1.23")
+
+TLV_VECTOR = bytes.fromhex(
+  "b10103696f740204646576310305535441544504022c010502d2040606246f280a1b2c"
+  "0701000801bd0901040a01020b0340e2010c0a73746174653a484947480d024a010f01"
+  "020e04c0a80117")
+
+
+class TestTLV(unittest.TestCase):
+
+  def test_vector(self):
+    self.assertEqual(iot_proto.encode_tlv(MSG), TLV_VECTOR)
+
+  def test_round_trip(self):
+    self.assertEqual(iot_proto.decode_tlv(iot_proto.encode_tlv(MSG)), MSG)
+    self.assertEqual(iot_proto.decode_payload(TLV_VECTOR), MSG)
+
+  def test_optional_fields(self):
+    msg = {k: v for k, v in MSG.items() if k not in ("other", "vbat", "drop", "ip")}
+    self.assertEqual(iot_proto.decode_tlv(iot_proto.encode_tlv(msg)), msg)
+
+  def test_uint_sizes(self):
+    for value in (0, 0xFF, 0x100, 0xFFFF, 0x10000, 0x1000000, 0xFFFFFFFF):
+      msg = dict(MSG, seq=value, heap=value)
+      self.assertEqual(iot_proto.decode_tlv(iot_proto.encode_tlv(msg))["seq"], value)
+
+  def test_field_too_long(self):
+    # Like TLVEncoder, the encoding stops at the field: the fields that
+    # follow it are not sent either.
+    out = iot_proto.decode_tlv(iot_proto.encode_tlv(dict(MSG, other="x" * 300)))
+    self.assertNotIn("other", out)
+    self.assertNotIn("vbat", out)
+    self.assertEqual(out["heap"], MSG["heap"])
+
+  def test_unknown_key(self):
+    frame = TLV_VECTOR + bytes([0xEE, 2, 1, 2])
+    self.assertEqual(iot_proto.decode_tlv(frame), MSG)
+
+  def test_malformed(self):
+    with self.assertRaises(ValueError):
+      iot_proto.decode_tlv(TLV_VECTOR[:-1])
+    with self.assertRaises(ValueError):
+      iot_proto.decode_tlv(b"iot;{name:dev1}")
+
+
+class TestText(unittest.TestCase):
+
+  def test_round_trip(self):
+    # The application field is decoded as its own key, the voltage as text.
+    expected = {k: v for k, v in MSG.items() if k not in ("other", "vbat")}
+    expected.update(state="HIGH", vbat="3.30")
+    self.assertEqual(iot_proto.decode_text(iot_proto.encode_text(MSG)), expected)
+
+  def test_vbat_rounding(self):
+    # Same rounding as printf, on the binary value (see MsgEncoder::fixed2()).
+    for vbat, text in ((3.295, "3.29"), (2.675, "2.67"), (0.125, "0.12"), (3.3, "3.30")):
+      self.assertEqual(iot_proto.decode_text(iot_proto.encode_text(dict(MSG, vbat=vbat)))["vbat"], text)
+
+
+class TestBatch(unittest.TestCase):
+
+  MSGS = [dict(MSG, seq=300), dict(MSG, seq=301, type="WATCHDOG", other=""), dict(MSG, seq=302, other="n:7")]
+
+  # Also checked against the C++ encoder by tools/host/test_msg_tlv.cpp.
+  BATCH_VECTOR = bytes.fromhex(
+    "b10103696f740204646576310502d2040606246f280a1b2c0701000801bd0901040a0102"
+    "0b0340e20110170305535441544504022c010c0a73746174653a48494748100b03055354"
+    "41544504022d01")
+
+  def test_binary_vector(self):
+    self.assertEqual(iot_proto.encode_batch([MSG, dict(MSG, seq=301, other="")], True), self.BATCH_VECTOR)
+
+  def test_binary(self):
+    out = iot_proto.decode_payload(iot_proto.encode_batch(self.MSGS, True))
+    self.assertEqual(out["name"], "dev1")
+    self.assertEqual([r["seq"] for r in out["recs"]], [300, 301, 302])
+    self.assertEqual(out["recs"][1], dict(type="WATCHDOG", seq=301))
+    self.assertEqual(out["recs"][2]["other"], "n:7")
+
+  def test_text(self):
+    out = iot_proto.decode_payload(iot_proto.encode_batch(self.MSGS, False))
+    self.assertEqual(out["heap"], MSG["heap"])
+    self.assertEqual([r["seq"] for r in out["recs"]], [300, 301, 302])
+    self.assertEqual(out["recs"][2]["n"], 7)
+
+
+
+class TestFragment(unittest.TestCase):
+  """Reassembler, with losses, reordering and duplicates. The same split is
+  checked against the C++ Fragmenter by tools/host/test_msg_frag.cpp."""
+
+  def setUp(self):
+    self.rng = random.Random(1)
+    self.msg = bytes(self.rng.randrange(256) for _ in range(3000))
+
+  def test_vector(self):
+    self.assertEqual([f.hex() for f in iot_proto.fragment(bytes(range(40)), 25, 7)],
+                     ["f5070000032800baf7000102030405060708090a0b0c0d",
+                      "f5070001032800baf70e0f101112131415161718191a1b",
+                      "f5070002032800baf71c1d1e1f2021222324252627"])
+
+  def test_in_order(self):
+    for size in (1, 239, 240, 241, 1000, 3000):
+      frags = iot_proto.fragment(self.msg[:size], 248, size)
+      self.assertTrue(all(len(f) <= 248 for f in frags))
+      self.assertTrue(all(iot_proto.is_fragment(f) for f in frags))
+      r = iot_proto.Reassembler()
+      out = [r.add(f) for f in frags]
+      self.assertEqual(out[-1], self.msg[:size])
+      self.assertTrue(all(o is None for o in out[:-1]))
+
+  def test_reordering(self):
+    for msg_id in range(50):
+      frags = iot_proto.fragment(self.msg, 248, msg_id)
+      self.rng.shuffle(frags)
+      r = iot_proto.Reassembler()
+      out = [m for m in (r.add(f) for f in frags) if m is not None]
+      self.assertEqual(out, [self.msg])
+
+  def test_duplicates(self):
+    frags = iot_proto.fragment(self.msg, 248, 3)
+    r = iot_proto.Reassembler()
+    for f in frags[:-1]:
+      self.assertIsNone(r.add(f))
+      self.assertIsNone(r.add(f))
+    self.assertEqual(r.add(frags[-1]), self.msg)
+    self.assertEqual(r.abandoned, 0)
+
+  def test_loss(self):
+    # The message missing a fragment is abandoned by the next one.
+    frags = iot_proto.fragment(self.msg, 248, 4)
+    r = iot_proto.Reassembler()
+    for f in frags[:2] + frags[3:]:
+      self.assertIsNone(r.add(f))
+    out = [r.add(f) for f in iot_proto.fragment(self.msg[:700], 248, 5)]
+    self.assertEqual(out[-1], self.msg[:700])
+    self.assertEqual(r.abandoned, 1)
+
+  def test_corruption(self):
+    frags = [bytearray(f) for f in iot_proto.fragment(self.msg, 248, 6)]
+    frags[1][iot_proto.FRAG_HEADER.size + 5] ^= 1
+    r = iot_proto.Reassembler()
+    with self.assertRaises(ValueError):
+      for f in frags:
+        r.add(bytes(f))
+    with self.assertRaises(ValueError):
+      r.add(b"\x00" + bytes(frags[0][1:]))
+
+
+if __name__ == "__main__":
+  unittest.main()
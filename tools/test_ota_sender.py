@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+#
+# Tests of the firmware update gateway (ota_sender.py): the selective repeat
+# of OtaSender, the device model OtaReceiver (following src/ota.cpp), and
+# complete transfers simulated over a lossy link, interrupted by deep sleeps
+# and power losses.
+#
+#     python3 -m unittest discover -s tools -p 'test_*.py'
+
+import argparse
+import random
+import struct
+import unittest
+
+import iot_proto
+import ota_sender
+
+
+def sim_args(**kw):
+  """The simulate command defaults (see ota_sender.main())."""
+  args = dict(chunk_size=240, window=8, status_timeout=300, retries=3, size=20000, partition_size=0x180000,
+              loss=0.0, rate=1000, overhead=0.2, write_ms=1.0, erase_ms=45, idle_timeout=2000,
+              downlink_window=50, sleep=5000, interrupt=0, power_loss=False, max_time=600, seed=1)
+  args.update(kw)
+  return argparse.Namespace(**args)
+
+
+def body(frame):
+  out = iot_proto.check_downlink(frame, iot_proto.OTA_MARKER)
+  assert out is not None
+  return out
+
+
+def chunk_index(frame):
+  b = body(frame)
+  assert b[0] == iot_proto.OTA_DATA
+  return struct.unpack_from("<H", b, 1)[0]
+
+
+def status(name, image_id, base=0, bitmap=0, received=0):
+  return iot_proto.parse_ota_status(iot_proto.build_ota_status(name, image_id, base, bitmap, received))
+
+
+class TestSender(unittest.TestCase):
+
+  def setUp(self):
+    self.image  = bytes(random.Random(1).getrandbits(8) for _ in range(240 * 20 + 100))
+    self.sender = ota_sender.OtaSender(self.image, 240, 8)
+    self.id     = self.sender.sha256[:4]
+
+  def test_chunk_size(self):
+    for size in (0, 8, 100, 256):
+      with self.assertRaises(ValueError):
+        ota_sender.OtaSender(self.image, size, 8)
+
+  def test_begin(self):
+    frames = self.sender.on_uplink()
+    self.assertEqual(len(frames), 1)
+    self.assertEqual(body(frames[0]), bytes([iot_proto.OTA_BEGIN]) + struct.pack("<IH", len(self.image), 240) +
+                     self.sender.sha256)
+
+  def test_selective_repeat(self):
+    self.sender.on_uplink()
+    frames = self.sender.on_status(status("RECEIVING", self.id))
+    self.assertEqual([chunk_index(f) for f in frames], list(range(8)))
+
+    # Chunks 0 and 3 lost: only those are sent again, with the new ones.
+    frames = self.sender.on_status(status("RECEIVING", self.id, 0, 0b11110110, 6))
+    self.assertEqual([chunk_index(f) for f in frames], [0, 3])
+
+    # Chunk 3, sent again after chunk 7, may still be on its way.
+    frames = self.sender.on_status(status("RECEIVING", self.id, 3, 0b11110, 7))
+    self.assertEqual([chunk_index(f) for f in frames], [8, 9, 10])
+
+    # Chunk 8 received, sent after chunk 3: chunk 3 is lost again.
+    frames = self.sender.on_status(status("RECEIVING", self.id, 3, 0b111110, 8))
+    self.assertEqual([chunk_index(f) for f in frames], [3])
+
+  def test_last_window(self):
+    self.sender.on_uplink()
+    frames = self.sender.on_status(status("RECEIVING", self.id, 16, 0))
+    self.assertEqual([chunk_index(f) for f in frames], [16, 17, 18, 19, 20])
+    self.assertEqual(len(body(frames[-1])) - 3, 100)
+
+  def test_timeouts(self):
+    self.sender.on_uplink()
+    self.sender.on_status(status("RECEIVING", self.id))
+    for _ in range(3):
+      self.assertEqual([chunk_index(f) for f in self.sender.on_timeout()], list(range(8)))
+    self.assertEqual(self.sender.on_timeout(), [])
+    self.assertEqual(self.sender.state, "WAITING")
+
+    # The device wakes up and reports where it is.
+    frames = self.sender.on_status(status("RECEIVING", self.id, 2, 0b1))
+    self.assertEqual([chunk_index(f) for f in frames], [3, 4, 5, 6, 7, 8, 9])
+
+  def test_other_image(self):
+    self.sender.on_uplink()
+    frames = self.sender.on_status(status("RECEIVING", b"\x01\x02\x03\x04", 5))
+    self.assertEqual(body(frames[0])[0], iot_proto.OTA_BEGIN)
+
+  def test_end(self):
+    self.sender.on_uplink()
+    self.assertEqual(body(self.sender.on_status(status("HASH_ERROR", self.id))[0])[0], iot_proto.OTA_BEGIN)
+    self.assertEqual(self.sender.stats["restarts"], 1)
+    self.assertEqual(self.sender.on_status(status("COMPLETE", self.id)), [])
+    self.assertEqual(self.sender.state, "DONE")
+
+    sender = ota_sender.OtaSender(self.image, 240, 8)
+    sender.on_status(status("REJECTED", self.id))
+    self.assertEqual((sender.state, sender.error), ("FAILED", "REJECTED"))
+
+
+class TestReceiver(unittest.TestCase):
+
+  def setUp(self):
+    self.image    = bytes(random.Random(2).getrandbits(8) for _ in range(160 * 10 + 32))
+    self.sender   = ota_sender.OtaSender(self.image, 160, 8)
+    self.device   = ota_sender.OtaReceiver(0x10000, 8, 1.0, 45)
+    self.chunks   = [body(self.sender.chunk_frame(i)) for i in range(self.sender.chunk_count)]
+
+  def begin(self):
+    statuses, _ = self.device.handle(body(self.sender.begin_frame()))
+    return iot_proto.parse_ota_status(statuses[0])
+
+  def test_any_order(self):
+    self.assertEqual(self.begin()["status"], "RECEIVING")
+    order = list(range(len(self.chunks)))
+    random.Random(3).shuffle(order)
+    for n, i in enumerate(order):
+      statuses, _ = self.device.handle(self.chunks[i])
+      self.device.handle(self.chunks[i])
+      if n < len(order) - 1:
+        self.assertEqual(statuses, [])
+    self.assertEqual(iot_proto.parse_ota_status(statuses[0])["status"], "COMPLETE")
+    self.assertEqual(bytes(self.device.flash[:len(self.image)]), self.image)
+
+  def test_status(self):
+    self.begin()
+    for i in (0, 1, 3, 5):
+      self.device.handle(self.chunks[i])
+    st = iot_proto.parse_ota_status(self.device.status("RECEIVING"))
+    self.assertEqual((st["base"], st["bitmap"], st["received"]), (2, 0b1010, 4))
+    self.assertEqual(st["image_id"], self.sender.sha256[:4])
+
+  def test_resume(self):
+    # Saved in NVS before deep sleep: a power loss only loses what was
+    # received since.
+    self.begin()
+    for i in range(4):
+      self.device.handle(self.chunks[i])
+    self.device.prepare_for_deep_sleep()
+    self.device.handle(self.chunks[4])
+    self.device.power_loss()
+    self.assertEqual(self.begin()["base"], 4)
+
+  def test_hash_error(self):
+    self.begin()
+    bad = bytearray(self.chunks[2])
+    bad[10] ^= 1
+    for i, c in enumerate(self.chunks):
+      statuses, _ = self.device.handle(bytes(bad) if i == 2 else c)
+    self.assertEqual(iot_proto.parse_ota_status(statuses[0])["status"], "HASH_ERROR")
+    self.assertFalse(self.device.is_active())
+
+  def test_rejected(self):
+    for image_size, chunk_size in ((0x20000, 160), (1000, 100), (1000, 0)):
+      frame = iot_proto.build_ota_begin(image_size, chunk_size, bytes(32))
+      statuses, _ = self.device.handle(body(frame))
+      self.assertEqual(iot_proto.parse_ota_status(statuses[0])["status"], "REJECTED")
+
+
+class TestSimulation(unittest.TestCase):
+
+  def run_sim(self, **kw):
+    args  = sim_args(**kw)
+    image = bytes(random.Random(args.seed).getrandbits(8) for _ in range(args.size))
+    sim   = ota_sender.Simulation(args, image)
+    sim.run()
+    self.assertTrue(sim.device.verified, kw)
+    self.assertEqual(bytes(sim.device.flash[:args.size]), image)
+    # The COMPLETE status is not sent again: when lost, the gateway is left
+    # waiting for the device, restarted on the new firmware.
+    self.assertIn(sim.sender.state, ("DONE", "WAITING"), kw)
+    return sim
+
+  def test_no_loss(self):
+    sim = self.run_sim()
+    self.assertEqual(sim.sender.state, "DONE")
+    self.assertEqual(sim.sender.stats["data_frames"], sim.sender.chunk_count)
+
+  def test_loss(self):
+    for loss in (0.05, 0.2):
+      for window in (1, 8, 16):
+        self.run_sim(loss=loss, window=window, seed=int(loss * 100) + window)
+
+  def test_deep_sleep(self):
+    sim = self.run_sim(size=100000, loss=0.1, interrupt=7)
+    self.assertGreater(sim.stats["interruptions"], 0)
+
+  def test_power_loss(self):
+    sim = self.run_sim(size=100000, loss=0.2, interrupt=10, power_loss=True)
+    self.assertGreater(sim.stats["interruptions"], 0)
+
+  def test_report(self):
+    report = ota_sender.simulate(sim_args(loss=0.1))
+    self.assertTrue(report["completed"] and report["confirmed"])
+    self.assertEqual(report["chunks"], 84)
+    self.assertGreater(report["retransmitted"], 0)
+
+
+if __name__ == "__main__":
+  unittest.main()
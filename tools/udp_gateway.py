@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+#
+# Loopback stand-in for the ESP32 gateway, UDP transport.
+#
+# Receives the frames sent by UDP::send(), verifies their CRC and, when
+# started with --ack, acknowledges them as expected by the UDP delivery
+# verification protocol (CONFIG_IOT_UDP_ACK, see include/udp.hpp).
+#
+# The "client" command sends frames the way the device does (sequence
+# number, CRC, retransmissions with the RFC 6298 timeout) such that the
+# protocol can be exercised and measured on a Linux host:
+#
+#     tools/udp_gateway.py server --ack --loss 0.1 --delay 5
+#     tools/udp_gateway.py client --count 1000
+#
+# Loss and delay are simulated by the server, on both directions.
+#
+# With --downlink, the server answers every frame delivered with a downlink
+# command frame (CONFIG_IOT_DOWNLINK, see include/downlink.hpp), sent after
+# the ack such that it reaches the device during its receive window.
+
+import argparse
+import random
+import socket
+import struct
+import sys
+import time
+
+from iot_proto import build_downlink, esp_crc16_le, parse_frame
+
+
+def server(args):
+  sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+  sock.bind((args.address, args.port))
+  print(f"Listening on {args.address}:{args.port} (ack: {'on' if args.ack else 'off'}, "
+        f"loss: {args.loss}, delay: {args.delay} msec)")
+
+  last_seq  = {}
+  stats     = dict(received=0, delivered=0, duplicates=0, crc_errors=0, dropped=0, acks=0, commands=0)
+  command   = build_downlink(args.downlink.encode()) if args.downlink else None
+  pending   = []  # (time, data, addr) acks and commands delayed
+  sock.settimeout(0.001)
+
+  try:
+    while True:
+      now = time.monotonic()
+      while pending and pending[0][0] <= now:
+        _, data, addr = pending.pop(0)
+        sock.sendto(data, addr)
+        if data is not command:
+          stats["acks"] += 1
+
+      try:
+        frame, addr = sock.recvfrom(2048)
+      except socket.timeout:
+        continue
+
+      stats["received"] += 1
+      if random.random() < args.loss:
+        stats["dropped"] += 1
+        continue
+
+      seq, payload, ok = parse_frame(frame, args.ack)
+      if not ok:
+        stats["crc_errors"] += 1
+        continue
+
+      if args.ack:
+        if random.random() >= args.loss:
+          pending.append((time.monotonic() + args.delay / 1000.0, frame[:4], addr))
+        if last_seq.get(addr[0]) == seq:
+          stats["duplicates"] += 1
+          continue
+        last_seq[addr[0]] = seq
+
+      stats["delivered"] += 1
+      if command is not None:
+        pending.append((time.monotonic() + args.delay / 1000.0, command, addr))
+        stats["commands"] += 1
+      if args.verbose:
+        print(f"{addr[0]}:{addr[1]} seq={seq} {payload!r}")
+  except KeyboardInterrupt:
+    print()
+    for key, value in stats.items():
+      print(f"{key:>12}: {value}")
+
+
+class RTOEstimator:
+  """Same computation as UDP::get_rto_ms() and UDP::update_rtt()."""
+
+  def __init__(self, min_rto, max_rto):
+    self.min_rto, self.max_rto = min_rto, max_rto
+    self.srtt = self.rttvar = 0
+
+  def rto_ms(self):
+    if self.srtt == 0:
+      return self.max_rto
+    rto = (self.srtt + max(1000, 4 * self.rttvar) + 999) // 1000
+    return min(max(rto, self.min_rto), self.max_rto)
+
+  def update(self, rtt):
+    if self.srtt == 0:
+      self.srtt, self.rttvar = max(rtt, 1), rtt // 2
+    else:
+      self.rttvar = self.rttvar - self.rttvar // 4 + abs(self.srtt - rtt) // 4
+      self.srtt   = max(self.srtt - self.srtt // 8 + rtt // 8, 1)
+
+
+def client(args):
+  sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+  dest = (args.address, args.port)
+  est  = RTOEstimator(args.min_rto, args.max_rto)
+
+  sent = retransmits = lost = 0
+  rtts = []
+  start = time.monotonic()
+
+  for seq in range(args.count):
+    payload = f"test;{{name:host,type:ACK,seq:{seq}}}".encode()
+    frame   = struct.pack("<HH", seq & 0xFFFF, esp_crc16_le(payload)) + payload
+    rto     = est.rto_ms()
+
+    for attempt in range(args.retries + 1):
+      if attempt > 0:
+        retransmits += 1
+        rto = min(rto * 2, args.max_rto)
+      t0 = time.monotonic()
+      sock.sendto(frame, dest)
+      sent += 1
+      deadline = t0 + rto / 1000.0
+      acked = False
+      while not acked:
+        remaining = deadline - time.monotonic()
+        if remaining <= 0:
+          break
+        sock.settimeout(remaining)
+        try:
+          ack = sock.recv(16)
+        except socket.timeout:
+          break
+        acked = ack == frame[:4]
+      if acked:
+        if attempt == 0:
+          rtt = int((time.monotonic() - t0) * 1000000)
+          est.update(rtt)
+          rtts.append(rtt)
+        break
+    else:
+      lost += 1
+
+  elapsed = time.monotonic() - start
+  rtts.sort()
+  print(f"    frames: {args.count} in {elapsed:.2f} sec")
+  print(f"  datagrams: {sent}")
+  print(f"retransmits: {retransmits}")
+  print(f"       lost: {lost}")
+  if rtts:
+    print(f"   RTT usec: min {rtts[0]}, median {rtts[len(rtts) // 2]}, "
+          f"p99 {rtts[min(len(rtts) - 1, len(rtts) * 99 // 100)]}, max {rtts[-1]}")
+  print(f" final RTO: {est.rto_ms()} msec")
+
+
+def main():
+  parser = argparse.ArgumentParser(description="Loopback UDP gateway for the ESP32 Simple IoT Framework")
+  parser.add_argument("--address", default="127.0.0.1")
+  parser.add_argument("--port",    type=int, default=3333)
+  sub = parser.add_subparsers(dest="command", required=True)
+
+  srv = sub.add_parser("server", help="receive and acknowledge frames")
+  srv.add_argument("--ack",     action="store_true", help="acknowledge frames (CONFIG_IOT_UDP_ACK)")
+  srv.add_argument("--loss",    type=float, default=0.0, help="probability of losing a frame or an ack")
+  srv.add_argument("--delay",   type=float, default=0.0, help="ack delay in msec")
+  srv.add_argument("--downlink", help="downlink command sent in answer to every frame delivered")
+  srv.add_argument("--verbose", action="store_true")
+
+  cli = sub.add_parser("client", help="send frames the way the device does, with acks")
+  cli.add_argument("--count",   type=int, default=100)
+  cli.add_argument("--retries", type=int, default=3,    help="CONFIG_IOT_UDP_ACK_RETRIES")
+  cli.add_argument("--min-rto", type=int, default=20,   help="CONFIG_IOT_UDP_ACK_MIN_RTO")
+  cli.add_argument("--max-rto", type=int, default=1000, help="CONFIG_IOT_UDP_ACK_MAX_RTO")
+
+  args = parser.parse_args()
+  server(args) if args.command == "server" else client(args)
+
+
+if __name__ == "__main__":
+  sys.exit(main())